@@ -0,0 +1,236 @@
+#include "AnalysisPipeline.h"
+#include "MappedImage.h"
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	double secondsBetween(Clock::time_point start, Clock::time_point end)
+	{
+		return std::chrono::duration<double>(end - start).count();
+	}
+
+	// Sums the statistics of the workers of one stage
+	AnalysisPipeline::StageStatistics merge(const char* stage, const std::vector<AnalysisPipeline::StageStatistics>& workers)
+	{
+		AnalysisPipeline::StageStatistics total;
+		total.stage = stage;
+		total.workers = static_cast<int>(workers.size());
+		for (const AnalysisPipeline::StageStatistics& worker : workers)
+		{
+			total.items += worker.items;
+			total.busySeconds += worker.busySeconds;
+			total.starvedSeconds += worker.starvedSeconds;
+			total.blockedSeconds += worker.blockedSeconds;
+		}
+		return total;
+	}
+}
+
+AnalysisPipeline::AnalysisPipeline(const Config& config, AnalysisFactory factory, Analyzer analyzer, Writer writer,
+	Decoder decoder) :
+	config{ config }, factory{ std::move(factory) }, analyzer{ std::move(analyzer) }, writer{ std::move(writer) },
+	decoder{ decoder ? std::move(decoder) : Decoder(&AnalysisPipeline::decodeGrayscale) }
+{
+	if (this->config.analysisWorkers < 1)
+		this->config.analysisWorkers = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	if (this->config.decodeWorkers < 1 || this->config.outputWorkers < 1)
+		throw std::invalid_argument("AnalysisPipeline: every stage needs at least one worker.");
+	if (!this->factory || !this->analyzer || !this->writer)
+		throw std::invalid_argument("AnalysisPipeline: factory, analyzer and writer are required.");
+}
+
+/**
+ * @brief Reads a file as a grayscale image of its own depth, 8 or 16 bits.
+ *
+ * @param path Image file.
+ * @return Mapped or decoded image.
+ */
+cv::Mat AnalysisPipeline::decodeGrayscale(const std::string& path)
+{
+	cv::Mat image = MappedImage::load(path);
+	if (image.empty())
+		throw std::runtime_error("cannot decode " + path);
+	return image;
+}
+
+/**
+ * @brief Runs the three stages until every source completed.
+ *
+ * The last decode worker to finish closes the analysis queue and the last analysis worker closes
+ * the output queue, so each stage stops once its input is drained.
+ *
+ * @param sources Sources handed to the decoder.
+ * @param completion Called once per item after it was written or failed; must not throw.
+ */
+void AnalysisPipeline::run(const std::vector<std::string>& sources, const Completion& completion)
+{
+	const int decodeWorkers = config.decodeWorkers;
+	const int analysisWorkers = config.analysisWorkers;
+	const int outputWorkers = config.outputWorkers;
+
+	Queue analysisQueue(config.queueCapacity ? config.queueCapacity : 2 * static_cast<size_t>(analysisWorkers));
+	Queue outputQueue(config.queueCapacity ? config.queueCapacity : 2 * static_cast<size_t>(outputWorkers));
+
+	std::vector<StageStatistics> decodeStatistics(decodeWorkers);
+	std::vector<StageStatistics> analysisStatistics(analysisWorkers);
+	std::vector<StageStatistics> outputStatistics(outputWorkers);
+
+	std::atomic<size_t> next{ 0 };
+	std::atomic<int> decoding{ decodeWorkers };
+	std::atomic<int> analysing{ analysisWorkers };
+
+	std::vector<std::thread> threads;
+	threads.reserve(decodeWorkers + analysisWorkers + outputWorkers);
+
+	for (int i = 0; i < outputWorkers; i++)
+	{
+		threads.emplace_back([&, i]
+		{
+			outputWorker(outputQueue, completion, outputStatistics[i]);
+		});
+	}
+	for (int i = 0; i < analysisWorkers; i++)
+	{
+		threads.emplace_back([&, i]
+		{
+			analysisWorker(analysisQueue, outputQueue, analysisStatistics[i]);
+			if (--analysing == 0)
+				outputQueue.close();
+		});
+	}
+	for (int i = 0; i < decodeWorkers; i++)
+	{
+		threads.emplace_back([&, i]
+		{
+			decodeWorker(sources, next, analysisQueue, decodeStatistics[i]);
+			if (--decoding == 0)
+				analysisQueue.close();
+		});
+	}
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	stages.clear();
+	stages.push_back(merge("decode", decodeStatistics));
+	stages.push_back(merge("analysis", analysisStatistics));
+	stages.push_back(merge("output", outputStatistics));
+}
+
+/**
+ * @brief Decodes sources until none is left.
+ */
+void AnalysisPipeline::decodeWorker(const std::vector<std::string>& sources, std::atomic<size_t>& next, Queue& output,
+	StageStatistics& statistics)
+{
+	for (size_t i = next++; i < sources.size(); i = next++)
+	{
+		Clock::time_point start = Clock::now();
+
+		std::unique_ptr<Item> item(new Item());
+		item->index = i;
+		item->source = sources[i];
+		try
+		{
+			item->image = decoder(item->source);
+			if (item->image.empty())
+				throw std::runtime_error("cannot decode " + item->source);
+			item->pixels = static_cast<int64_t>(item->image.total());
+		}
+		catch (const std::exception& e)
+		{
+			item->error = e.what();
+			item->image.release();
+		}
+
+		Clock::time_point decoded = Clock::now();
+		output.push(item);
+		statistics.items++;
+		statistics.busySeconds += secondsBetween(start, decoded);
+		statistics.blockedSeconds += secondsBetween(decoded, Clock::now());
+	}
+}
+
+/**
+ * @brief Analyses images until the input queue is closed and drained.
+ *
+ * The analysis object is created on the first image and kept; after a failure it is recreated,
+ * since its state is unknown.
+ */
+void AnalysisPipeline::analysisWorker(Queue& input, Queue& output, StageStatistics& statistics)
+{
+	std::unique_ptr<StructureTensorAnalysis> analysis;
+	std::unique_ptr<Item> item;
+
+	for (;;)
+	{
+		Clock::time_point start = Clock::now();
+		if (!input.pop(item))
+			break;
+		Clock::time_point popped = Clock::now();
+
+		if (item->error.empty())
+		{
+			try
+			{
+				if (!analysis)
+					analysis = factory();
+				analyzer(*analysis, *item);
+			}
+			catch (const std::exception& e)
+			{
+				item->error = e.what();
+				item->outputs.clear();
+				analysis.reset();
+			}
+		}
+		item->image.release();
+
+		Clock::time_point analysed = Clock::now();
+		output.push(item);
+		statistics.items++;
+		statistics.starvedSeconds += secondsBetween(start, popped);
+		statistics.busySeconds += secondsBetween(popped, analysed);
+		statistics.blockedSeconds += secondsBetween(analysed, Clock::now());
+	}
+}
+
+/**
+ * @brief Writes results until the input queue is closed and drained.
+ */
+void AnalysisPipeline::outputWorker(Queue& input, const Completion& completion, StageStatistics& statistics)
+{
+	std::unique_ptr<Item> item;
+
+	for (;;)
+	{
+		Clock::time_point start = Clock::now();
+		if (!input.pop(item))
+			break;
+		Clock::time_point popped = Clock::now();
+
+		if (item->error.empty())
+		{
+			try
+			{
+				writer(*item);
+			}
+			catch (const std::exception& e)
+			{
+				item->error = e.what();
+			}
+		}
+		if (completion)
+			completion(*item);
+		item.reset();
+
+		statistics.items++;
+		statistics.starvedSeconds += secondsBetween(start, popped);
+		statistics.busySeconds += secondsBetween(popped, Clock::now());
+	}
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "BoundedQueue.h"
+#include "StructureTensorAnalysis.h"
+
+/**
+ * @class AnalysisPipeline
+ * @brief Decode, analysis and output stages connected by bounded lock-free queues.
+ *
+ * Every stage runs its own worker threads. Decode workers take the next source, decode it and
+ * push the image to the analysis queue; analysis workers run their own StructureTensorAnalysis
+ * (created once per worker, so buffers are reused from image to image) and push the results to
+ * the output queue; output workers write them. When a queue is full its producers wait, so
+ * memory stays bounded by the queue capacities whatever the number of sources.
+ *
+ * An item that fails in a stage keeps flowing with its error set: the later stages skip it and
+ * the completion callback still sees it exactly once.
+ */
+class AnalysisPipeline
+{
+public:
+    /**
+     * @brief One source on its way through the stages.
+     */
+    struct Item
+    {
+        size_t index = 0;                                       // Position in the source list
+        std::string source;
+        cv::Mat image;                                          // Released once analysed
+        std::vector<std::pair<std::string, cv::Mat>> outputs;   // Named maps produced by the analyzer
+        int64_t pixels = 0;
+        std::string error;                                      // Empty unless a stage failed
+    };
+
+    using Decoder = std::function<cv::Mat(const std::string& source)>;
+    using AnalysisFactory = std::function<std::unique_ptr<StructureTensorAnalysis>()>;
+    using Analyzer = std::function<void(StructureTensorAnalysis& analysis, Item& item)>;
+    using Writer = std::function<void(const Item& item)>;
+    using Completion = std::function<void(const Item& item)>;
+
+    /**
+     * @brief Worker counts and queue capacities.
+     */
+    struct Config
+    {
+        int decodeWorkers = 2;
+        int analysisWorkers = 0;    // 0 = hardware concurrency
+        int outputWorkers = 1;
+        size_t queueCapacity = 0;   // Per queue; 0 = two items per consumer
+    };
+
+    /**
+     * @brief Activity of one stage over a run.
+     */
+    struct StageStatistics
+    {
+        const char* stage = "";
+        int workers = 0;
+        int64_t items = 0;
+        double busySeconds = 0;     // Summed over the workers
+        double starvedSeconds = 0;  // Waiting for input
+        double blockedSeconds = 0;  // Waiting for room in the next queue
+    };
+
+    /**
+     * @brief Sets up the stages; no thread runs until run().
+     * @param config Worker counts and queue capacities.
+     * @param factory Creates the analysis object of an analysis worker.
+     * @param analyzer Fills item.outputs from item.image; may throw.
+     * @param writer Writes item.outputs; may throw.
+     * @param decoder Decodes a source; may throw. Defaults to decodeGrayscale().
+     */
+    AnalysisPipeline(const Config& config, AnalysisFactory factory, Analyzer analyzer, Writer writer,
+        Decoder decoder = Decoder());
+
+    /**
+     * @brief Pushes every source through the stages and waits until the last one completed.
+     * @param sources Sources handed to the decoder.
+     * @param completion Called once per item, on an output worker, after it was written or failed.
+     */
+    void run(const std::vector<std::string>& sources, const Completion& completion = Completion());
+
+    /**
+     * @brief Statistics of the last run, one entry per stage in pipeline order.
+     */
+    const std::vector<StageStatistics>& statistics() const { return stages; }
+
+    /**
+     * @brief Reads a file as a grayscale image of its own depth with MappedImage::load(), so
+     * uncompressed TIFFs are views of the mapped file.
+     * @throws std::runtime_error when it cannot be read.
+     */
+    static cv::Mat decodeGrayscale(const std::string& path);
+
+private:
+    using Queue = BoundedQueue<std::unique_ptr<Item>>;
+
+    Config config;
+    AnalysisFactory factory;
+    Analyzer analyzer;
+    Writer writer;
+    Decoder decoder;
+    std::vector<StageStatistics> stages;
+
+    void decodeWorker(const std::vector<std::string>& sources, std::atomic<size_t>& next, Queue& output,
+        StageStatistics& statistics);
+    void analysisWorker(Queue& input, Queue& output, StageStatistics& statistics);
+    void outputWorker(Queue& input, const Completion& completion, StageStatistics& statistics);
+};
@@ -0,0 +1,227 @@
+#include "ArenaAllocator.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	// Alignment of every matrix, that of cv::fastMalloc
+	constexpr size_t arenaAlignment = 64;
+
+	size_t alignUp(size_t bytes)
+	{
+		return (bytes + arenaAlignment - 1) & ~(arenaAlignment - 1);
+	}
+}
+
+/**
+ * @brief Creates an empty arena.
+ *
+ * @param chunkBytes Size of the chunks requested from the system.
+ */
+ArenaAllocator::ArenaAllocator(size_t chunkBytes) :
+	defaultChunkBytes{ alignUp(std::max<size_t>(chunkBytes, arenaAlignment)) }
+{
+}
+
+ArenaAllocator::~ArenaAllocator()
+{
+	for (const std::unique_ptr<Chunk>& chunk : chunks)
+	{
+		cv::fastFree(chunk->memory);
+	}
+}
+
+/**
+ * @brief Allocates a matrix, or wraps user data, the way cv::Mat's standard allocator does.
+ *
+ * Steps are computed as continuous unless user data with explicit steps is given. The owning
+ * chunk is kept in UMatData::userdata for deallocate().
+ */
+cv::UMatData* ArenaAllocator::allocate(int dims, const int* sizes, int type, void* data0, size_t* step,
+	cv::AccessFlag, cv::UMatUsageFlags) const
+{
+	size_t total = CV_ELEM_SIZE(type);
+	for (int i = dims - 1; i >= 0; i--)
+	{
+		if (step)
+		{
+			if (data0 && step[i] != CV_AUTOSTEP)
+			{
+				CV_Assert(total <= step[i]);
+				total = step[i];
+			}
+			else
+			{
+				step[i] = total;
+			}
+		}
+		total *= sizes[i];
+	}
+
+	cv::UMatData* u = new cv::UMatData(this);
+	u->size = total;
+	if (data0)
+	{
+		u->data = u->origdata = static_cast<uchar*>(data0);
+		u->flags |= cv::UMatData::USER_ALLOCATED;
+		return u;
+	}
+
+	const size_t bytes = alignUp(std::max<size_t>(total, 1));
+	std::lock_guard<std::mutex> lock(mutex);
+	Chunk* chunk = chunkFor(bytes);
+	u->data = u->origdata = chunk->memory + chunk->offset;
+	u->userdata = chunk;
+	chunk->offset += bytes;
+	chunk->used += bytes;
+	chunk->live++;
+	allocationCount++;
+	return u;
+}
+
+bool ArenaAllocator::allocate(cv::UMatData* data, cv::AccessFlag, cv::UMatUsageFlags) const
+{
+	return data != nullptr;
+}
+
+/**
+ * @brief Releases a matrix; its chunk is rewound when it was the last one carved from it.
+ */
+void ArenaAllocator::deallocate(cv::UMatData* u) const
+{
+	if (!u)
+		return;
+	CV_Assert(u->urefcount == 0 && u->refcount == 0);
+
+	if (!(u->flags & cv::UMatData::USER_ALLOCATED))
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Chunk* chunk = static_cast<Chunk*>(u->userdata);
+		chunk->used -= alignUp(std::max<size_t>(u->size, 1));
+		if (--chunk->live == 0)
+		{
+			chunk->offset = 0;
+			chunk->used = 0;
+		}
+	}
+	u->origdata = nullptr;
+	delete u;
+}
+
+// Prefers the current chunk, then any drained chunk large enough, and only then asks the system
+ArenaAllocator::Chunk* ArenaAllocator::chunkFor(size_t bytes) const
+{
+	if (current && current->size - current->offset >= bytes)
+		return current;
+
+	for (const std::unique_ptr<Chunk>& chunk : chunks)
+	{
+		if (chunk->live == 0 && chunk->size >= bytes)
+		{
+			current = chunk.get();
+			return current;
+		}
+	}
+
+	std::unique_ptr<Chunk> chunk(new Chunk());
+	chunk->size = std::max(defaultChunkBytes, bytes);
+	chunk->memory = static_cast<uint8_t*>(cv::fastMalloc(chunk->size));
+	chunkCount++;
+	chunks.push_back(std::move(chunk));
+
+	// Requests larger than a chunk get one of their own and leave the current chunk in place
+	if (bytes <= defaultChunkBytes || !current)
+		current = chunks.back().get();
+	return chunks.back().get();
+}
+
+/**
+ * @brief Allocates chunks until at least bytes are free in drained chunks and touches their pages.
+ *
+ * @param bytes Free space to guarantee.
+ */
+void ArenaAllocator::reserve(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t available = 0;
+	for (const std::unique_ptr<Chunk>& chunk : chunks)
+	{
+		if (chunk->live == 0)
+			available += chunk->size;
+	}
+	while (available < bytes)
+	{
+		std::unique_ptr<Chunk> chunk(new Chunk());
+		chunk->size = defaultChunkBytes;
+		chunk->memory = static_cast<uint8_t*>(cv::fastMalloc(chunk->size));
+		std::memset(chunk->memory, 0, chunk->size);
+		available += chunk->size;
+		chunkCount++;
+		chunks.push_back(std::move(chunk));
+	}
+}
+
+void ArenaAllocator::trim()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto drained = std::stable_partition(chunks.begin(), chunks.end(),
+		[](const std::unique_ptr<Chunk>& chunk) { return chunk->live > 0; });
+	for (auto it = drained; it != chunks.end(); ++it)
+	{
+		if (it->get() == current)
+			current = nullptr;
+		cv::fastFree((*it)->memory);
+	}
+	chunks.erase(drained, chunks.end());
+}
+
+size_t ArenaAllocator::reservedBytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t bytes = 0;
+	for (const std::unique_ptr<Chunk>& chunk : chunks)
+	{
+		bytes += chunk->size;
+	}
+	return bytes;
+}
+
+size_t ArenaAllocator::usedBytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t bytes = 0;
+	for (const std::unique_ptr<Chunk>& chunk : chunks)
+	{
+		bytes += chunk->used;
+	}
+	return bytes;
+}
+
+int64_t ArenaAllocator::allocations() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return allocationCount;
+}
+
+int64_t ArenaAllocator::chunkAllocations() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return chunkCount;
+}
+
+/**
+ * @brief Makes a matrix allocate from the given allocator on its next create().
+ *
+ * Mat::create() keeps the data when the size and type match, whatever allocator it came from, so
+ * data of another allocator is released first.
+ *
+ * @param m Matrix to redirect.
+ * @param allocator Allocator to use, null for the default one.
+ */
+void ArenaAllocator::use(cv::Mat& m, cv::MatAllocator* allocator)
+{
+	if (m.allocator == allocator)
+		return;
+	m.release();
+	m.allocator = allocator;
+}
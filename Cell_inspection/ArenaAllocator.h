@@ -0,0 +1,93 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @class ArenaAllocator
+ * @brief cv::MatAllocator that carves matrices out of large preallocated chunks.
+ *
+ * Allocations bump an offset in the current chunk under a single short lock instead of going
+ * through the global heap, and a chunk is rewound as a whole once every matrix carved from it
+ * has been released, so the intermediates of one frame reuse the pages of the previous one
+ * instead of faulting in fresh ones. Chunks are only returned to the system by trim() or the
+ * destructor. A request larger than the chunk size gets a chunk of its own.
+ *
+ * Install it on the matrices to allocate before they are created, e.g. with use(), or on a whole
+ * analysis with BasicStructureTensorAnalysis::setArena(). The arena must outlive every matrix
+ * allocated from it; one arena can be shared by several analyses and threads.
+ */
+class ArenaAllocator : public cv::MatAllocator
+{
+public:
+    /**
+     * @brief Creates an empty arena; nothing is allocated before the first matrix or reserve().
+     * @param chunkBytes Size of the chunks requested from the system.
+     */
+    explicit ArenaAllocator(size_t chunkBytes = size_t(64) << 20);
+
+    /**
+     * @brief Frees every chunk. No matrix allocated from the arena may be alive.
+     */
+    ~ArenaAllocator() override;
+
+    ArenaAllocator(const ArenaAllocator&) = delete;
+    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+        cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+    /**
+     * @brief Allocates chunks until at least bytes are free and touches their pages, so that the
+     * first frame does not pay for page faults either.
+     */
+    void reserve(size_t bytes);
+
+    /**
+     * @brief Returns the chunks that hold no matrix to the system.
+     */
+    void trim();
+
+    size_t chunkBytes() const { return defaultChunkBytes; }
+
+    // Bytes of all chunks
+    size_t reservedBytes() const;
+
+    // Bytes of the matrices currently allocated, including alignment padding
+    size_t usedBytes() const;
+
+    // Matrices allocated so far, and chunks requested from the system to hold them
+    int64_t allocations() const;
+    int64_t chunkAllocations() const;
+
+    /**
+     * @brief Makes m allocate from allocator (the default one when null) on its next create(),
+     * releasing its data when it was allocated elsewhere.
+     */
+    static void use(cv::Mat& m, cv::MatAllocator* allocator);
+
+private:
+    struct Chunk
+    {
+        uint8_t* memory = nullptr;
+        size_t size = 0;
+        size_t offset = 0;      // Start of the free space
+        size_t used = 0;        // Bytes of the live matrices
+        int live = 0;           // Live matrices; the chunk is rewound when it drops to 0
+    };
+
+    size_t defaultChunkBytes;
+    mutable std::mutex mutex;
+    mutable std::vector<std::unique_ptr<Chunk>> chunks;
+    mutable Chunk* current = nullptr;
+    mutable int64_t allocationCount = 0;
+    mutable int64_t chunkCount = 0;
+
+    // Chunk with room for bytes: the current one, a drained one, or a new one. Called under the lock.
+    Chunk* chunkFor(size_t bytes) const;
+};
@@ -0,0 +1,285 @@
+#include "BatchOptions.h"
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+	std::string lowercase(std::string text)
+	{
+		std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return text;
+	}
+
+	std::vector<std::string> splitList(const std::string& text)
+	{
+		std::vector<std::string> items;
+		std::stringstream stream(text);
+		std::string item;
+		while (std::getline(stream, item, ','))
+		{
+			if (!item.empty())
+				items.push_back(item);
+		}
+		return items;
+	}
+
+	int parseInteger(const std::string& text, const std::string& option, int minimum)
+	{
+		size_t used = 0;
+		int value = 0;
+		try
+		{
+			value = std::stoi(text, &used);
+		}
+		catch (const std::exception&)
+		{
+			used = 0;
+		}
+		if (used != text.size() || value < minimum)
+			throw std::invalid_argument(option + " expects an integer of at least " + std::to_string(minimum) + ", got '" + text + "'.");
+		return value;
+	}
+
+	// WIDTHxHEIGHT[:BITS] of raw frames
+	void parseRawFormat(const std::string& text, BatchOptions& options)
+	{
+		const size_t x = text.find('x');
+		const size_t colon = text.find(':');
+		if (x == std::string::npos || (colon != std::string::npos && colon < x))
+			throw std::invalid_argument("--raw expects WIDTHxHEIGHT[:BITS], got '" + text + "'.");
+
+		const std::string height = colon == std::string::npos ? text.substr(x + 1) : text.substr(x + 1, colon - x - 1);
+		options.rawSize = cv::Size(parseInteger(text.substr(0, x), "--raw", 1), parseInteger(height, "--raw", 1));
+		const int bits = colon == std::string::npos ? 8 : parseInteger(text.substr(colon + 1), "--raw", 8);
+		if (bits != 8 && bits != 16)
+			throw std::invalid_argument("--raw supports 8 and 16 bits, got " + std::to_string(bits) + ".");
+		options.rawDepth = bits == 8 ? CV_8U : CV_16U;
+	}
+
+	StructureTensorAnalysis::GRADIENT_METHOD parseMethod(const std::string& text)
+	{
+		typedef StructureTensorAnalysis::GRADIENT_METHOD METHOD;
+		const METHOD methods[] = { METHOD::CUBIC_SPLINE, METHOD::FINITE_DIFFERENCE, METHOD::FOURIER,
+			METHOD::RIESZ, METHOD::GAUSSIAN, METHOD::HESSIAN };
+
+		std::string name = lowercase(text);
+		for (METHOD method : methods)
+		{
+			if (name == lowercase(StructureTensorAnalysis::methodName(method)))
+				return method;
+		}
+		throw std::invalid_argument("Unknown gradient method '" + text + "'.");
+	}
+
+	int parseOutputs(const std::string& text)
+	{
+		int outputs = 0;
+		for (const std::string& item : splitList(lowercase(text)))
+		{
+			if (item == "energy")
+				outputs |= StructureTensorAnalysis::OUTPUT_ENERGY;
+			else if (item == "orientation")
+				outputs |= StructureTensorAnalysis::OUTPUT_ORIENTATION;
+			else if (item == "coherency")
+				outputs |= StructureTensorAnalysis::OUTPUT_COHERENCY;
+			else if (item == "gradients")
+				outputs |= StructureTensorAnalysis::OUTPUT_GRADIENTS;
+			else if (item == "tensor")
+				outputs |= StructureTensorAnalysis::OUTPUT_TENSOR;
+			else if (item == "all")
+				outputs |= StructureTensorAnalysis::OUTPUT_ALL;
+			else
+				throw std::invalid_argument("Unknown output '" + item + "'.");
+		}
+		if (outputs == 0)
+			throw std::invalid_argument("--outputs needs at least one output.");
+		return outputs;
+	}
+}
+
+/**
+ * @brief Parses the command line.
+ *
+ * Options take their value as the next argument; every other argument is an input.
+ *
+ * @param argc Argument count.
+ * @param argv Arguments.
+ * @return Parsed options.
+ */
+BatchOptions BatchOptions::parse(int argc, char** argv)
+{
+	BatchOptions options;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		auto value = [&]() -> std::string
+		{
+			if (i + 1 >= argc)
+				throw std::invalid_argument(argument + " expects a value.");
+			return argv[++i];
+		};
+
+		if (argument == "-h" || argument == "--help")
+		{
+			options.help = true;
+		}
+		else if (argument == "-o" || argument == "--output-dir")
+		{
+			options.outputDir = value();
+		}
+		else if (argument == "-m" || argument == "--method")
+		{
+			options.gradientMethod = parseMethod(value());
+		}
+		else if (argument == "-w" || argument == "--window")
+		{
+			options.windowSizes.clear();
+			for (const std::string& item : splitList(value()))
+			{
+				options.windowSizes.push_back(parseInteger(item, argument, 1));
+			}
+			if (options.windowSizes.empty())
+				throw std::invalid_argument(argument + " needs at least one window size.");
+		}
+		else if (argument == "--window-method")
+		{
+			std::string name = lowercase(value());
+			if (name == "gaussian")
+				options.windowMethod = WINDOW_METHOD::GAUSSIAN;
+			else if (name == "recursive")
+				options.windowMethod = WINDOW_METHOD::RECURSIVE;
+			else
+				throw std::invalid_argument("Unknown window method '" + name + "'.");
+		}
+		else if (argument == "--storage")
+		{
+			std::string name = lowercase(value());
+			if (name == "full" || name == "float32")
+				options.storage = ReducedPrecision::STORAGE::FULL;
+			else if (name == "float16")
+				options.storage = ReducedPrecision::STORAGE::FLOAT16;
+			else if (name == "int16")
+				options.storage = ReducedPrecision::STORAGE::INT16;
+			else
+				throw std::invalid_argument("Unknown storage '" + name + "'.");
+		}
+		else if (argument == "--tile")
+		{
+			options.tileSize = parseInteger(value(), argument, 0);
+		}
+		else if (argument == "--raw")
+		{
+			parseRawFormat(value(), options);
+		}
+		else if (argument == "--raw-header")
+		{
+			options.rawHeader = parseInteger(value(), argument, 0);
+		}
+		else if (argument == "--outputs")
+		{
+			options.outputs = parseOutputs(value());
+		}
+		else if (argument == "--format")
+		{
+			options.format = lowercase(value());
+			if (options.format != "tiff" && options.format != "png" && options.format != "field")
+				throw std::invalid_argument("Unknown format '" + options.format + "'.");
+		}
+		else if (argument == "--field-encoding")
+		{
+			std::string name = lowercase(value());
+			if (name == "float32")
+				options.fieldEncoding = TensorFieldFile::ENCODING::FLOAT32;
+			else if (name == "float16")
+				options.fieldEncoding = TensorFieldFile::ENCODING::FLOAT16;
+			else if (name == "quant16")
+				options.fieldEncoding = TensorFieldFile::ENCODING::QUANT16;
+			else
+				throw std::invalid_argument("Unknown field encoding '" + name + "'.");
+		}
+		else if (argument == "-j" || argument == "--workers")
+		{
+			options.workers = parseInteger(value(), argument, 0);
+		}
+		else if (argument == "--decode-threads")
+		{
+			options.decodeThreads = parseInteger(value(), argument, 1);
+		}
+		else if (argument == "--encode-threads")
+		{
+			options.encodeThreads = parseInteger(value(), argument, 1);
+		}
+		else if (argument == "--queue")
+		{
+			options.queueCapacity = parseInteger(value(), argument, 1);
+		}
+		else if (argument == "-r" || argument == "--recursive")
+		{
+			options.recursive = true;
+		}
+		else if (argument == "-q" || argument == "--quiet")
+		{
+			options.quiet = true;
+		}
+		else if (argument.size() > 1 && argument[0] == '-')
+		{
+			throw std::invalid_argument("Unknown option '" + argument + "'.");
+		}
+		else
+		{
+			options.inputs.push_back(argument);
+		}
+	}
+
+	if (options.inputs.empty() && !options.help)
+		throw std::invalid_argument("No input given.");
+	return options;
+}
+
+/**
+ * @brief Usage text.
+ *
+ * @param program Name of the executable.
+ * @return Text listing every option.
+ */
+std::string BatchOptions::usage(const std::string& program)
+{
+	return "Usage: " + program + " [options] <file|directory|glob>...\n"
+		"\n"
+		"Structure tensor analysis of grayscale images, without any window.\n"
+		"\n"
+		"Options:\n"
+		"  -o, --output-dir DIR     Output directory (default: .)\n"
+		"  -m, --method NAME        cubic_spline, finite_difference, fourier (default), riesz,\n"
+		"                           gaussian or hessian\n"
+		"  -w, --window LIST        Comma-separated window sizes (default: 2)\n"
+		"      --window-method NAME gaussian (default) or recursive\n"
+		"      --storage NAME       Precision of the intermediates: full (default), float16, int16\n"
+		"      --tile N             Analyze images in tiles of at most N x N pixels, which bounds\n"
+		"                           the memory of large slides (default: 0, whole images)\n"
+		"      --raw WxH[:BITS]     Geometry of .raw inputs: frames of W x H pixels of\n"
+		"                           8 (default) or 16 bits in the byte order of the machine\n"
+		"      --raw-header N       Bytes to skip at the start of every .raw input (default: 0)\n"
+		"      --outputs LIST       Comma-separated energy, orientation, coherency, gradients,\n"
+		"                           tensor (Ixx, Iyy, Ixy) or all (all but tensor; default: energy)\n"
+		"      --format NAME        tiff: float32 maps (default), png: 16-bit scaled maps,\n"
+		"                           field: every map of an image in one memory-mappable .stf file\n"
+		"      --field-encoding E   float32 (default), float16 or quant16 for --format field\n"
+		"  -j, --workers N          Analysis threads (default: hardware concurrency)\n"
+		"      --decode-threads N   Decode threads (default: 2)\n"
+		"      --encode-threads N   Encode threads (default: 1)\n"
+		"      --queue N            Images waiting between two stages (default: two per consumer)\n"
+		"  -r, --recursive          Descend into subdirectories of directory inputs\n"
+		"  -q, --quiet              Only report errors, no per-image lines or stage statistics\n"
+		"  -h, --help               Show this text\n"
+		"\n"
+		"Inputs are read as grayscale at their own depth, 8 or 16 bits. TIFF pages and .raw frames\n"
+		"are memory-mapped and uncompressed ones analyzed in place, without decoding.\n"
+		"\n"
+		"Outputs are written as <output-dir>/<relative path>/<name>_<output>[_w<window>].<ext>;\n"
+		"the window suffix is added when several window sizes are given. With --format field the\n"
+		"maps of an image are the channels of <output-dir>/<relative path>/<name>.stf.\n";
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "StructureTensorAnalysis.h"
+#include "TensorFieldFile.h"
+
+/**
+ * @struct BatchOptions
+ * @brief Command-line configuration of a headless batch run.
+ */
+struct BatchOptions
+{
+    using GRADIENT_METHOD = StructureTensorAnalysis::GRADIENT_METHOD;
+    using WINDOW_METHOD = StructureTensorAnalysis::WINDOW_METHOD;
+
+    std::vector<std::string> inputs;        // Files, directories or file-name globs (* and ?)
+    std::string outputDir = ".";
+    GRADIENT_METHOD gradientMethod = GRADIENT_METHOD::FOURIER;
+    WINDOW_METHOD windowMethod = WINDOW_METHOD::GAUSSIAN;
+    ReducedPrecision::STORAGE storage = ReducedPrecision::STORAGE::FULL;  // Precision of the intermediates
+    int tileSize = 0;                       // Processing tile size, 0 = whole images
+    cv::Size rawSize;                       // Size of .raw frames, empty when none are expected
+    int rawDepth = CV_8U;                   // CV_8U or CV_16U
+    int rawHeader = 0;                      // Bytes before the pixels of a .raw frame
+    std::vector<int> windowSizes = { 2 };
+    int outputs = StructureTensorAnalysis::OUTPUT_ENERGY;
+    std::string format = "tiff";            // tiff: float32 maps, png: 16-bit scaled maps, field: one TensorFieldFile
+    TensorFieldFile::ENCODING fieldEncoding = TensorFieldFile::ENCODING::FLOAT32;
+    int workers = 0;                        // Analysis threads, 0 = hardware concurrency
+    int decodeThreads = 2;
+    int encodeThreads = 1;
+    int queueCapacity = 0;                  // Images per stage queue, 0 = two per consumer
+    bool recursive = false;                 // Descend into subdirectories of directory inputs
+    bool quiet = false;
+    bool help = false;
+
+    /**
+     * @brief Parses the command line.
+     * @throws std::invalid_argument with a message for the user when an argument is not valid.
+     */
+    static BatchOptions parse(int argc, char** argv);
+
+    /**
+     * @brief Usage text.
+     */
+    static std::string usage(const std::string& program);
+};
@@ -0,0 +1,393 @@
+#include "BatchProcessor.h"
+#include "MappedImage.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <opencv2/imgcodecs.hpp>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	const char* const imageExtensions[] = { ".bmp", ".dib", ".jpg", ".jpeg", ".jpe", ".jp2", ".png", ".webp",
+		".pbm", ".pgm", ".ppm", ".pnm", ".tif", ".tiff", ".exr", ".hdr", ".pic", ".raw" };
+
+	bool isImageFile(const fs::path& path)
+	{
+		std::string extension = path.extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(),
+			[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return std::find(std::begin(imageExtensions), std::end(imageExtensions), extension) != std::end(imageExtensions);
+	}
+
+	// Regular files below root (or directly in it), optionally filtered by a file-name pattern
+	void listFiles(const fs::path& root, bool recursive, const std::string& pattern, std::vector<BatchProcessor::Input>& inputs)
+	{
+		auto add = [&](const fs::directory_entry& entry)
+		{
+			if (!entry.is_regular_file())
+				return;
+			const fs::path& path = entry.path();
+			if (pattern.empty() ? !isImageFile(path) : !BatchProcessor::matchesGlob(path.filename().string(), pattern))
+				return;
+			BatchProcessor::Input input;
+			input.path = path;
+			input.relative = path.lexically_relative(root).replace_extension();
+			inputs.push_back(input);
+		};
+
+		if (recursive)
+		{
+			for (const fs::directory_entry& entry : fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied))
+				add(entry);
+		}
+		else
+		{
+			for (const fs::directory_entry& entry : fs::directory_iterator(root))
+				add(entry);
+		}
+	}
+
+	std::string outputName(int output)
+	{
+		switch (output)
+		{
+		case StructureTensorAnalysis::OUTPUT_ENERGY: return "energy";
+		case StructureTensorAnalysis::OUTPUT_ORIENTATION: return "orientation";
+		case StructureTensorAnalysis::OUTPUT_COHERENCY: return "coherency";
+		default: return "gradients";
+		}
+	}
+}
+
+BatchProcessor::BatchProcessor(const BatchOptions& options) :
+	options{ options }
+{
+	if (this->options.workers < 1)
+		this->options.workers = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+/**
+ * @brief Matches a file name against a pattern where * matches any run of characters and ? one character.
+ *
+ * @param name File name.
+ * @param pattern Pattern.
+ * @return True when the whole name matches.
+ */
+bool BatchProcessor::matchesGlob(const std::string& name, const std::string& pattern)
+{
+	// Greedy matching that backtracks to the last star only
+	size_t n = 0, p = 0, star = std::string::npos, resume = 0;
+	while (n < name.size())
+	{
+		if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n]))
+		{
+			n++;
+			p++;
+		}
+		else if (p < pattern.size() && pattern[p] == '*')
+		{
+			star = p++;
+			resume = n;
+		}
+		else if (star != std::string::npos)
+		{
+			p = star + 1;
+			n = ++resume;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	while (p < pattern.size() && pattern[p] == '*')
+		p++;
+	return p == pattern.size();
+}
+
+/**
+ * @brief Expands the input arguments.
+ *
+ * A file is taken as it is and its outputs are named after its file name. A directory contributes
+ * the image files in it (and below it when recursive), named by their path relative to the
+ * directory. A glob may only have wildcards in its file-name part; it contributes the matching
+ * files of its directory, whatever their extension.
+ *
+ * @param patterns Files, directories and globs.
+ * @param recursive Descend into subdirectories of directories and globs.
+ * @return Inputs sorted by path, each file once.
+ */
+std::vector<BatchProcessor::Input> BatchProcessor::collectInputs(const std::vector<std::string>& patterns, bool recursive)
+{
+	std::vector<Input> inputs;
+
+	for (const std::string& pattern : patterns)
+	{
+		size_t before = inputs.size();
+		fs::path path(pattern);
+
+		if (pattern.find_first_of("*?") != std::string::npos)
+		{
+			fs::path directory = path.parent_path();
+			if (directory.string().find_first_of("*?") != std::string::npos)
+				throw std::invalid_argument("Wildcards are only supported in the file name: '" + pattern + "'.");
+			if (directory.empty())
+				directory = ".";
+			if (fs::is_directory(directory))
+				listFiles(directory, recursive, path.filename().string(), inputs);
+		}
+		else if (fs::is_directory(path))
+		{
+			listFiles(path, recursive, std::string(), inputs);
+		}
+		else if (fs::is_regular_file(path))
+		{
+			Input input;
+			input.path = path;
+			input.relative = path.filename().replace_extension();
+			inputs.push_back(input);
+		}
+
+		if (inputs.size() == before)
+			throw std::invalid_argument("No input found for '" + pattern + "'.");
+	}
+
+	std::sort(inputs.begin(), inputs.end(), [](const Input& a, const Input& b) { return a.path < b.path; });
+	inputs.erase(std::unique(inputs.begin(), inputs.end(), [](const Input& a, const Input& b) { return a.path == b.path; }),
+		inputs.end());
+	return inputs;
+}
+
+/**
+ * @brief Processes every input through the decode, analysis and encode stages.
+ *
+ * @return Totals of the run.
+ */
+BatchProcessor::Summary BatchProcessor::run()
+{
+	std::vector<Input> inputs = collectInputs(options.inputs, options.recursive);
+	auto start = std::chrono::steady_clock::now();
+
+	summary = Summary();
+	completed = 0;
+
+	std::vector<std::string> sources;
+	sources.reserve(inputs.size());
+	for (const Input& input : inputs)
+		sources.push_back(input.path.string());
+
+	AnalysisPipeline::Config config;
+	config.decodeWorkers = options.decodeThreads;
+	config.analysisWorkers = options.workers;
+	config.outputWorkers = options.encodeThreads;
+	config.queueCapacity = static_cast<size_t>(options.queueCapacity);
+
+	AnalysisPipeline pipeline(config,
+		[this] { return createAnalysis(); },
+		[this](StructureTensorAnalysis& analysis, AnalysisPipeline::Item& item) { item.outputs = analyze(analysis, item.image); },
+		[this, &inputs](const AnalysisPipeline::Item& item) { write(inputs[item.index], item.outputs); },
+		[this](const std::string& source) { return decode(source); });
+	pipeline.run(sources, [this, &inputs](const AnalysisPipeline::Item& item)
+	{
+		complete(inputs[item.index], item.pixels, item.error);
+	});
+
+	summary.images = static_cast<int>(inputs.size());
+	summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	summary.stages = pipeline.statistics();
+	return summary;
+}
+
+/**
+ * @brief Reads one input at its own depth. A .raw frame is mapped with the --raw geometry; any other
+ * file goes through AnalysisPipeline::decodeGrayscale, which maps TIFFs.
+ *
+ * @param path Input file.
+ * @return Image, a view of the mapped file when it is stored uncompressed.
+ */
+cv::Mat BatchProcessor::decode(const std::string& path) const
+{
+	std::string extension = fs::path(path).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(),
+		[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	if (extension != ".raw")
+		return AnalysisPipeline::decodeGrayscale(path);
+
+	if (options.rawSize.empty())
+		throw std::runtime_error("--raw is needed to read " + path);
+	return MappedImage::raw(path, options.rawSize, options.rawDepth, static_cast<size_t>(options.rawHeader)).image();
+}
+
+/**
+ * @brief Creates the analysis object of one analysis worker, with the configured method and outputs.
+ *
+ * With several window sizes the gradients are requested as well, so that the first window pass
+ * stores them for the others.
+ */
+std::unique_ptr<StructureTensorAnalysis> BatchProcessor::createAnalysis() const
+{
+	auto analysis = std::make_unique<StructureTensorAnalysis>();
+	analysis->setGradientandWindowSize(options.gradientMethod, options.windowSizes.front());
+	analysis->setWindowMethod(options.windowMethod);
+	analysis->setStorage(options.storage);
+	analysis->setTileSize(options.tileSize);
+	int outputs = options.outputs;
+	if (options.windowSizes.size() > 1)
+		outputs |= StructureTensorAnalysis::OUTPUT_GRADIENTS;
+	analysis->setOutputs(outputs);
+	return analysis;
+}
+
+/**
+ * @brief Analyses one image at every window size.
+ *
+ * The maps are written into fresh buffers bound to the analysis, because the encode of this window
+ * size or image is still pending when the analysis computes the next one. Gradients are cloned.
+ *
+ * @param analysis Analysis object owned by the calling worker.
+ * @param image Grayscale image.
+ * @return Named maps to write, in a stable order.
+ */
+BatchProcessor::Outputs BatchProcessor::analyze(StructureTensorAnalysis& analysis, const cv::Mat& image) const
+{
+	Outputs outputs;
+	bool severalWindows = options.windowSizes.size() > 1;
+
+	for (size_t k = 0; k < options.windowSizes.size(); k++)
+	{
+		int window = options.windowSizes[k];
+
+		StructureTensorAnalysis::OutputBuffers buffers;
+		std::pair<int, cv::Mat*> maps[] = {
+			{ StructureTensorAnalysis::OUTPUT_ENERGY, &buffers.energy },
+			{ StructureTensorAnalysis::OUTPUT_ORIENTATION, &buffers.orientation },
+			{ StructureTensorAnalysis::OUTPUT_COHERENCY, &buffers.coherency },
+			{ StructureTensorAnalysis::OUTPUT_TENSOR, &buffers.ixx },
+			{ StructureTensorAnalysis::OUTPUT_TENSOR, &buffers.iyy },
+			{ StructureTensorAnalysis::OUTPUT_TENSOR, &buffers.ixy } };
+		for (const std::pair<int, cv::Mat*>& map : maps)
+		{
+			if (options.outputs & map.first)
+				map.second->create(image.size(), CV_32F);
+		}
+		analysis.setOutputBuffers(buffers);
+
+		analysis.setWindowSize(window);
+		if (k == 0)
+			analysis.process(image);
+
+		std::string suffix = severalWindows ? "_w" + std::to_string(window) : std::string();
+		const int tensorOutputs[] = { StructureTensorAnalysis::OUTPUT_ENERGY, StructureTensorAnalysis::OUTPUT_ORIENTATION,
+			StructureTensorAnalysis::OUTPUT_COHERENCY };
+		for (int output : tensorOutputs)
+		{
+			if (!(options.outputs & output))
+				continue;
+			cv::Mat map = output == StructureTensorAnalysis::OUTPUT_ENERGY ? analysis.getEnegry()
+				: output == StructureTensorAnalysis::OUTPUT_ORIENTATION ? analysis.getOrientation()
+				: analysis.getCoherency();
+			outputs.emplace_back(outputName(output) + suffix, map);
+		}
+
+		if (options.outputs & StructureTensorAnalysis::OUTPUT_TENSOR)
+		{
+			outputs.emplace_back("ixx" + suffix, analysis.getTensorXX());
+			outputs.emplace_back("iyy" + suffix, analysis.getTensorYY());
+			outputs.emplace_back("ixy" + suffix, analysis.getTensorXY());
+		}
+
+		// Gradients only depend on the window size for HESSIAN
+		bool windowDependent = options.gradientMethod == StructureTensorAnalysis::GRADIENT_METHOD::HESSIAN;
+		if ((options.outputs & StructureTensorAnalysis::OUTPUT_GRADIENTS) && (k == 0 || windowDependent))
+		{
+			std::string gradientSuffix = windowDependent ? suffix : std::string();
+			outputs.emplace_back("gradx" + gradientSuffix, analysis.getGradX().clone());
+			outputs.emplace_back("grady" + gradientSuffix, analysis.getGradY().clone());
+		}
+	}
+	analysis.clearOutputBuffers();
+	return outputs;
+}
+
+/**
+ * @brief Converts a map to the pixel type of the output format.
+ *
+ * TIFF keeps the float32 values. PNG stores 16 bits: orientation is scaled from [0, pi) and
+ * coherency from [0, 1] to the full range, the other maps are min-max scaled per image.
+ *
+ * @param name Output name, possibly with a window suffix.
+ * @param map Float map.
+ * @return Image ready for cv::imwrite.
+ */
+cv::Mat BatchProcessor::encode(const std::string& name, const cv::Mat& map) const
+{
+	if (options.format == "tiff")
+		return map;
+
+	cv::Mat encoded;
+	if (name.compare(0, 11, "orientation") == 0)
+		map.convertTo(encoded, CV_16U, 65535.0 / CV_PI);
+	else if (name.compare(0, 9, "coherency") == 0)
+		map.convertTo(encoded, CV_16U, 65535.0);
+	else
+		cv::normalize(map, encoded, 0, 65535, cv::NORM_MINMAX, CV_16U);
+	return encoded;
+}
+
+/**
+ * @brief Writes the maps of one image as <output-dir>/<relative>_<name>.<ext>, or as the channels
+ * of <output-dir>/<relative>.stf.
+ *
+ * @throws std::runtime_error when a file cannot be written.
+ */
+void BatchProcessor::write(const Input& input, const Outputs& outputs) const
+{
+	fs::path base = fs::path(options.outputDir) / input.relative;
+	if (base.has_parent_path())
+		fs::create_directories(base.parent_path());
+
+	if (options.format == "field")
+	{
+		std::vector<TensorFieldFile::Channel> channels;
+		for (const auto& output : outputs)
+			channels.push_back({ output.first, output.second });
+		TensorFieldFile::write(base.string() + ".stf", channels, options.fieldEncoding);
+		return;
+	}
+
+	const std::string extension = options.format == "tiff" ? ".tif" : ".png";
+	for (const auto& output : outputs)
+	{
+		std::string path = base.string() + "_" + output.first + extension;
+		if (!cv::imwrite(path, encode(output.first, output.second)))
+			throw std::runtime_error("cannot write " + path);
+	}
+}
+
+/**
+ * @brief Records the end of one image and reports it. Called by the encode workers.
+ *
+ * @param input Finished input.
+ * @param pixels Pixels of the decoded image, 0 when decoding failed.
+ * @param error Empty on success.
+ */
+void BatchProcessor::complete(const Input& input, int64_t pixels, const std::string& error)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	completed++;
+	if (error.empty())
+	{
+		summary.pixels += pixels;
+		if (!options.quiet)
+			std::cout << "[" << completed << "] " << input.path.string() << std::endl;
+	}
+	else
+	{
+		summary.failed++;
+		std::cerr << "[" << completed << "] " << input.path.string() << ": " << error << std::endl;
+	}
+}
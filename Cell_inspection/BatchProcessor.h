@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "AnalysisPipeline.h"
+#include "BatchOptions.h"
+#include "StructureTensorAnalysis.h"
+
+/**
+ * @class BatchProcessor
+ * @brief Headless batch analysis of many images with overlapped decode, compute and encode.
+ *
+ * The inputs go through an AnalysisPipeline: images are decoded, analysed and encoded by
+ * separate worker threads, so that disk and codec time hides behind the analysis, and the
+ * bounded queues between the stages bound memory no matter how many inputs are given. Each
+ * analysis worker reuses its analysis object (and therefore its buffers) from image to image;
+ * with several window sizes the gradients of an image are computed once.
+ *
+ * A failing image is reported and counted; it does not stop the batch.
+ */
+class BatchProcessor
+{
+public:
+    /**
+     * @brief One input file and the path of its outputs relative to the output directory.
+     */
+    struct Input
+    {
+        std::filesystem::path path;
+        std::filesystem::path relative;     // Without extension
+    };
+
+    /**
+     * @brief Totals of a batch run.
+     */
+    struct Summary
+    {
+        int images = 0;
+        int failed = 0;
+        int64_t pixels = 0;
+        double seconds = 0;
+        std::vector<AnalysisPipeline::StageStatistics> stages;
+
+        double megapixelsPerSecond() const { return seconds > 0 ? pixels / seconds * 1e-6 : 0.0; }
+    };
+
+    explicit BatchProcessor(const BatchOptions& options);
+
+    /**
+     * @brief Processes every input and waits for all outputs to be written.
+     */
+    Summary run();
+
+    /**
+     * @brief Expands files, directories and file-name globs (* and ?) into a sorted list of inputs.
+     * @throws std::invalid_argument when an argument matches nothing.
+     */
+    static std::vector<Input> collectInputs(const std::vector<std::string>& patterns, bool recursive);
+
+    /**
+     * @brief Matches a file name against a pattern where * and ? are wildcards.
+     */
+    static bool matchesGlob(const std::string& name, const std::string& pattern);
+
+private:
+    using Outputs = std::vector<std::pair<std::string, cv::Mat>>;
+
+    BatchOptions options;
+
+    std::mutex mutex;       // Guards the summary and the console
+    int completed = 0;
+    Summary summary;
+
+    cv::Mat decode(const std::string& path) const;
+    std::unique_ptr<StructureTensorAnalysis> createAnalysis() const;
+    Outputs analyze(StructureTensorAnalysis& analysis, const cv::Mat& image) const;
+    void write(const Input& input, const Outputs& outputs) const;
+    void complete(const Input& input, int64_t pixels, const std::string& error);
+    cv::Mat encode(const std::string& name, const cv::Mat& map) const;
+};
@@ -0,0 +1,191 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+/**
+ * @class BoundedQueue
+ * @brief Fixed-capacity lock-free multi-producer multi-consumer queue.
+ *
+ * Each cell carries a sequence number that tells producers and consumers whether it is free or
+ * full for their lap around the ring (D. Vyukov's bounded MPMC queue), so tryPush() and tryPop()
+ * take no lock and touch one shared counter each. A full queue makes push() wait, which is the
+ * backpressure that keeps a fast stage from running ahead of a slow one.
+ *
+ * The blocking push() and pop() spin briefly, then yield, then sleep, so idle stages do not burn a
+ * core. close() marks the end of the stream: pop() returns false once the queue is closed and
+ * drained. Values must only be pushed before close() is called.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    /**
+     * @brief Creates an empty queue.
+     * @param capacity Number of cells, rounded up to a power of two (at least 2).
+     */
+    explicit BoundedQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    size_t capacity() const { return mask + 1; }
+
+    /**
+     * @brief Moves value into the queue unless it is full.
+     * @return False when the queue is full; value is left untouched.
+     */
+    bool tryPush(T& value)
+    {
+        size_t position = enqueuePosition.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t lap = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+            if (lap == 0)
+            {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    cell.value = std::move(value);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (lap < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Moves the oldest value out of the queue unless it is empty.
+     * @return False when the queue is empty.
+     */
+    bool tryPop(T& value)
+    {
+        size_t position = dequeuePosition.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t lap = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+            if (lap == 0)
+            {
+                if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(cell.value);
+                    cell.value = T();
+                    cell.sequence.store(position + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (lap < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = dequeuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Moves value into the queue, waiting while it is full.
+     * @throws std::logic_error when the queue has been closed.
+     */
+    void push(T& value)
+    {
+        Backoff backoff;
+        while (!tryPush(value))
+        {
+            if (isClosed())
+                throw std::logic_error("BoundedQueue::push: the queue is closed.");
+            backoff.wait();
+        }
+    }
+
+    /**
+     * @brief Moves the oldest value out of the queue, waiting while it is empty and open.
+     * @return False when the queue is closed and every value has been popped.
+     */
+    bool pop(T& value)
+    {
+        Backoff backoff;
+        while (!tryPop(value))
+        {
+            // Everything pushed before close() is visible once closed is, so one more attempt decides
+            if (isClosed())
+                return tryPop(value);
+            backoff.wait();
+        }
+        return true;
+    }
+
+    /**
+     * @brief Ends the stream; consumers drain what is left and then stop.
+     */
+    void close() { closed.store(true, std::memory_order_release); }
+
+    bool isClosed() const { return closed.load(std::memory_order_acquire); }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    /**
+     * @brief Waiting policy of the blocking calls: spin, then yield, then sleep.
+     */
+    class Backoff
+    {
+    public:
+        void wait()
+        {
+            if (attempts < 64)
+            {
+                attempts++;
+            }
+            else if (attempts < 128)
+            {
+                attempts++;
+                std::this_thread::yield();
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+
+    private:
+        int attempts = 0;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask = 0;
+    // Separate cache lines so that producers and consumers do not invalidate each other's counter
+    alignas(64) std::atomic<size_t> enqueuePosition{ 0 };
+    alignas(64) std::atomic<size_t> dequeuePosition{ 0 };
+    alignas(64) std::atomic<bool> closed{ false };
+};
@@ -1,33 +1,51 @@
-#include <cstdio>
-#include <vector>
-#include <opencv2/core.hpp>
-#include <opencv2/imgcodecs.hpp>
-#include <opencv2/highgui.hpp>
-#include <opencv2/imgproc.hpp>
-#include "StructureTensorAnalysis.h"
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include "BatchOptions.h"
+#include "BatchProcessor.h"
 
-int main(int, char**) {
+// Headless batch driver: analyses every input image and writes the requested maps, without any window.
+// Exit status: 0 when every image was written, 1 when some failed, 2 on invalid arguments.
+int main(int argc, char** argv) {
 
-	std::string Path = "C:\\Users\\Sepehr\\Desktop\\Maryam_malekpour.jpg";
+	const std::string program = argc > 0 ? argv[0] : "CellInspection";
 
-	cv::Mat img = cv::imread(Path, cv::IMREAD_GRAYSCALE);
-	if (img.empty()) {
-		std::cerr << "Error: Could not open or find the image!" << std::endl;
+	BatchOptions options;
+	try {
+		options = BatchOptions::parse(argc, argv);
+	}
+	catch (const std::invalid_argument& e) {
+		std::cerr << "Error: " << e.what() << "\n\n" << BatchOptions::usage(program);
+		return 2;
 	}
 
-	std::shared_ptr<StructureTensorAnalysis> structureTensorAnalysis = std::make_shared<StructureTensorAnalysis>(img, StructureTensorAnalysis::GRADIENT_METHOD::FOURIER, 2);
-
-	cv::Mat Energy = structureTensorAnalysis->getEnegry();
-
-
-	cv::imshow("Energy", Energy);
-
-	// Wait for a key press indefinitely or for a specified delay (0 means infinite wait)
-	cv::waitKey(0);
-
-	// Destroy the window (optional)
-	cv::destroyAllWindows();
-
-	
+	if (options.help) {
+		std::cout << BatchOptions::usage(program);
+		return 0;
+	}
 
-}
\ No newline at end of file
+	try {
+		BatchProcessor processor(options);
+		BatchProcessor::Summary summary = processor.run();
+
+		std::cout << summary.images - summary.failed << " of " << summary.images << " images in "
+			<< summary.seconds << " s (" << summary.megapixelsPerSecond() << " MP/s)" << std::endl;
+
+		// Busy time close to workers x run time marks the bottleneck stage; blocked time marks its producers
+		if (!options.quiet) {
+			for (const AnalysisPipeline::StageStatistics& stage : summary.stages) {
+				std::cout << "  " << stage.stage << ": " << stage.workers << " workers, busy " << stage.busySeconds
+					<< " s, starved " << stage.starvedSeconds << " s, blocked " << stage.blockedSeconds << " s" << std::endl;
+			}
+		}
+		return summary.failed ? 1 : 0;
+	}
+	catch (const std::invalid_argument& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 2;
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+}
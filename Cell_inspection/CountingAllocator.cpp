@@ -0,0 +1,94 @@
+#include "CountingAllocator.h"
+#include <mutex>
+
+namespace
+{
+	thread_local size_t threadBytes = 0;
+	thread_local size_t threadCount = 0;
+}
+
+/**
+ * @brief Creates an allocator with empty global counters.
+ *
+ * @param countGlobally Also count into allocatedBytes() and allocations().
+ * @param base Allocator that does the work; OpenCV's standard allocator when null.
+ */
+CountingAllocator::CountingAllocator(bool countGlobally, cv::MatAllocator* base) :
+	base{ base ? base : cv::Mat::getStdAllocator() },
+	baseCounts{ dynamic_cast<const CountingAllocator*>(this->base) != nullptr },
+	global{ countGlobally }
+{
+}
+
+/**
+ * @brief Allocates through the base and counts the buffer unless it wraps user data.
+ */
+cv::UMatData* CountingAllocator::allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+	cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const
+{
+	cv::UMatData* u = base->allocate(dims, sizes, type, data, step, flags, usageFlags);
+	if (u && !data)
+	{
+		if (!baseCounts)
+		{
+			threadBytes += u->size;
+			threadCount++;
+		}
+		if (global)
+		{
+			bytes += u->size;
+			count++;
+		}
+	}
+	return u;
+}
+
+bool CountingAllocator::allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const
+{
+	return base->allocate(data, accessFlags, usageFlags);
+}
+
+void CountingAllocator::deallocate(cv::UMatData* data) const
+{
+	base->deallocate(data);
+}
+
+/**
+ * @brief Wraps cv::Mat's default allocator in a counting allocator unless it already is one.
+ *
+ * Only the first call has an effect.
+ */
+void CountingAllocator::installDefault()
+{
+	static std::once_flag installed;
+	std::call_once(installed, []
+	{
+		cv::MatAllocator* current = cv::Mat::getDefaultAllocator();
+		if (dynamic_cast<CountingAllocator*>(current))
+			return;
+
+		// Never destroyed: buffers released during static destruction may still reach it
+		static CountingAllocator* allocator = new CountingAllocator(false, current);
+		cv::Mat::setDefaultAllocator(allocator);
+	});
+}
+
+/**
+ * @brief Bytes of cv::Mat buffers allocated by the calling thread through any counting allocator.
+ *
+ * @return Running total since the thread started.
+ */
+size_t CountingAllocator::threadAllocatedBytes()
+{
+	return threadBytes;
+}
+
+/**
+ * @brief Number of cv::Mat buffers allocated by the calling thread through any counting allocator.
+ *
+ * @return Running total since the thread started.
+ */
+size_t CountingAllocator::threadAllocations()
+{
+	return threadCount;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <atomic>
+#include <cstddef>
+
+/**
+ * @class CountingAllocator
+ * @brief cv::MatAllocator that forwards to another allocator and counts what cv::Mat allocates.
+ *
+ * Installed with cv::Mat::setDefaultAllocator() it sees every buffer allocated by cv::Mat::create,
+ * including the temporaries inside OpenCV functions. Allocations outside cv::Mat (std::vector
+ * etc.) and user data wrapped by a cv::Mat are not counted.
+ *
+ * Every allocation is added to the counters of the allocating thread, which are shared by all
+ * counting allocators and read with threadAllocatedBytes() and threadAllocations(); wrapping one
+ * counting allocator in another does not count a buffer twice. Optionally an allocator also keeps
+ * global counters of everything it allocated on any thread; they are atomics shared by all threads,
+ * so they are off unless asked for.
+ */
+class CountingAllocator : public cv::MatAllocator
+{
+public:
+    /**
+     * @brief Creates an allocator with empty global counters.
+     * @param countGlobally Also count into allocatedBytes() and allocations().
+     * @param base Allocator that does the work; OpenCV's standard allocator when null.
+     */
+    explicit CountingAllocator(bool countGlobally = false, cv::MatAllocator* base = nullptr);
+
+    CountingAllocator(const CountingAllocator&) = delete;
+    CountingAllocator& operator=(const CountingAllocator&) = delete;
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+        cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+    /**
+     * @brief Makes sure cv::Mat's default allocator counts, wrapping the current default in a
+     * counting allocator unless it already is one. Only the first call has an effect; the wrapper
+     * is never destroyed.
+     */
+    static void installDefault();
+
+    // Bytes and buffers allocated by the calling thread through any counting allocator
+    static size_t threadAllocatedBytes();
+    static size_t threadAllocations();
+
+    // Bytes and buffers allocated by this allocator since construction; 0 unless counting globally
+    size_t allocatedBytes() const { return bytes; }
+    size_t allocations() const { return count; }
+
+    bool countsGlobally() const { return global; }
+
+private:
+    cv::MatAllocator* base;
+    bool baseCounts;            // The base counts the thread's allocations itself
+    bool global;
+    mutable std::atomic<size_t> bytes{ 0 };
+    mutable std::atomic<size_t> count{ 0 };
+};
@@ -1,4 +1,5 @@
 #include "GradientCalculator.h"
+#include <limits>
 
 /**
  * @brief Computes image gradients using the finite difference method.
@@ -10,157 +11,236 @@
  * @param gradX Output gradient in the X direction.
  * @param gradY Output gradient in the Y direction.
  */
-void GradientCalculator::computeFiniteDifferenceGradient(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY)
+template <typename T>
+void BasicGradientCalculator<T>::computeFiniteDifferenceGradient(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY)
 {
-	cv::Mat kernelX = (cv::Mat_<float>(1, 3) << -1, 0, 1);
-	cv::Mat kernelY = (cv::Mat_<float>(3, 1) << -1, 0, 1);
+	static const cv::Mat kernelX = (cv::Mat_<float>(1, 3) << -1, 0, 1);
+	static const cv::Mat kernelY = (cv::Mat_<float>(3, 1) << -1, 0, 1);
 
-	cv::filter2D(grayImage, gradX, CV_32F, kernelX);
-	cv::filter2D(grayImage, gradY, CV_32F, kernelY);
+	cv::filter2D(grayImage, gradX, Precision<T>::depth, kernelX);
+	cv::filter2D(grayImage, gradY, Precision<T>::depth, kernelY);
 }
 
 /**
  * @brief Computes image gradients using Gaussian smoothing followed by Sobel operators.
  *
  * This method applies a Gaussian blur to reduce noise before computing gradients using the Sobel operator.
+ * The blur runs on the image converted to T, as GaussianStencil does, so the fused path of the
+ * analysis gives the same gradients up to rounding.
  *
  * @param grayImage Input grayscale image.
  * @param gradX Output gradient in the X direction.
  * @param gradY Output gradient in the Y direction.
+ * @param workspace Optional scratch buffers.
  */
-void GradientCalculator::computeGaussianGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY)
+template <typename T>
+void BasicGradientCalculator<T>::computeGaussianGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY, Workspace* workspace)
 {
-	cv::Mat smoothed;
+	cv::Mat local;
+	cv::Mat& smoothed = workspace ? workspace->smoothed : local;
 	int kernel_size = 5;
 	double sigma = 2.0;
-	cv::GaussianBlur(grayImage, smoothed, cv::Size(kernel_size, kernel_size), sigma, sigma);
-	cv::Sobel(smoothed, gradX, CV_32F, 1, 0, 3);
-	cv::Sobel(smoothed, gradY, CV_32F, 0, 1, 3);
+	grayImage.convertTo(smoothed, Precision<T>::depth);
+	cv::GaussianBlur(smoothed, smoothed, cv::Size(kernel_size, kernel_size), sigma, sigma);
+	cv::Sobel(smoothed, gradX, Precision<T>::depth, 1, 0, 3);
+	cv::Sobel(smoothed, gradY, Precision<T>::depth, 0, 1, 3);
 }
 
 /**
  * @brief Computes image gradients using cubic spline interpolation.
  *
  * This method fits cubic splines along rows and columns to estimate the gradients.
+ * Since the knots are uniform, the spline coefficients follow from a fixed recursive
+ * prefilter and the derivative at the knots from a fixed FIR filter, so both directions are
+ * computed by one separable filter applied to all rows or columns at once. The X direction
+ * is handled by filtering the transposed image. The samples and the recursions are in T, so the
+ * float instance reads and writes half the bytes of the double one.
  *
  * @param grayImage Input grayscale image.
  * @param gradX Output gradient in the X direction.
  * @param gradY Output gradient in the Y direction.
+ * @param pool Optional thread pool.
+ * @param workspace Optional scratch buffers.
  */
-void GradientCalculator::cubicSplineInterpolation(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY)
+template <typename T>
+void BasicGradientCalculator<T>::cubicSplineInterpolation(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY, ThreadPool* pool,
+	Workspace* workspace)
 {
-	int rows = grayImage.rows;
-	int cols = grayImage.cols;
+	Workspace local;
+	Workspace& buffers = workspace ? *workspace : local;
+	cv::Mat& samples = buffers.samples;
+	cv::Mat& transposed = buffers.transposed;
+	cv::Mat& transposedGrad = buffers.transposedGrad;
 
-	gradX = cv::Mat::zeros(rows, cols, CV_64F);
-	gradY = cv::Mat::zeros(rows, cols, CV_64F);
+	grayImage.convertTo(samples, Precision<T>::depth);
 
-	for (size_t i = 0; i < rows; i++)
+	splineDerivativeAlongColumns(samples, gradY, pool);
+
+	cv::transpose(samples, transposed);
+	splineDerivativeAlongColumns(transposed, transposedGrad, pool);
+	cv::transpose(transposedGrad, gradX);
+}
+
+/**
+ * @brief Derivative at the knots of the cubic spline interpolating every column.
+ *
+ * The B-spline coefficients are obtained with the causal/anti-causal recursive filter of pole
+ * z = sqrt(3) - 2 using mirror-symmetric boundaries; the derivative at knot k is then
+ * (c[k + 1] - c[k - 1]) / 2. The recursions run down the rows and are vectorized across the
+ * columns of a block, and blocks of columns are independent. The causal initialization sums
+ * z^k terms until they drop below the precision of T.
+ *
+ * @param src Input samples (Precision<T>::depth).
+ * @param dst Output derivative (Precision<T>::depth).
+ * @param pool Optional thread pool.
+ */
+template <typename T>
+void BasicGradientCalculator<T>::splineDerivativeAlongColumns(const cv::Mat& src, cv::Mat& dst, ThreadPool* pool)
+{
+	const int rows = src.rows;
+	const int cols = src.cols;
+	const T z = static_cast<T>(std::sqrt(3.0) - 2.0);
+	const int blockCols = 256;
+	const int blocks = (cols + blockCols - 1) / blockCols;
+
+	dst.create(rows, cols, Precision<T>::depth);
+	if (rows < 2)
 	{
-		std::vector<double> x(cols), values(cols);
-		for (size_t j = 0; j < cols; j++)
-		{
-			x[j] = j;
-			values[j] = static_cast<double>(grayImage.at<uchar>(i, j));
-		}
+		dst.setTo(cv::Scalar(0));
+		return;
+	}
+
+	// Terms of the causal initialization sum until z^k drops below the precision of T
+	const int horizon = static_cast<int>(std::ceil(std::log(std::numeric_limits<T>::epsilon()) / std::log(std::abs(z))));
 
-		auto spline = boost::math::interpolators::cardinal_cubic_b_spline<double>(values.begin(), values.end(), 0.0, 1.0);
+	ThreadPool::forEach(pool, 0, blocks, [&](int block)
+	{
+		const int j0 = block * blockCols;
+		const int n = std::min(blockCols, cols - j0);
+		std::vector<T> previous(n), current(n);
 
-		for (size_t j = 0; j < cols; j++)
+		// Causal initialization: c+[0] = sum_k z^|k| s[mirror(k)]
+		T* c = dst.ptr<T>(0) + j0;
+		if (rows <= horizon)
 		{
-			gradX.at<double>(i, j) = spline.prime(j);
+			// Exact sum over one mirror period
+			const T zn = static_cast<T>(std::pow(z, rows - 1));
+			const T scale = T(1) / (T(1) - zn * zn);
+			const T* first = src.ptr<T>(0) + j0;
+			const T* last = src.ptr<T>(rows - 1) + j0;
+			for (int j = 0; j < n; j++)
+			{
+				c[j] = first[j] + zn * last[j];
+			}
+			T zk = z;
+			T z2n = zn * zn / z;
+			for (int k = 1; k < rows - 1; k++)
+			{
+				const T* s = src.ptr<T>(k) + j0;
+				for (int j = 0; j < n; j++)
+				{
+					c[j] += (zk + z2n) * s[j];
+				}
+				zk *= z;
+				z2n /= z;
+			}
+			for (int j = 0; j < n; j++)
+			{
+				c[j] *= scale;
+			}
+		}
+		else
+		{
+			const T* s = src.ptr<T>(0) + j0;
+			for (int j = 0; j < n; j++)
+			{
+				c[j] = s[j];
+			}
+			T zk = z;
+			for (int k = 1; k < horizon; k++)
+			{
+				s = src.ptr<T>(k) + j0;
+				for (int j = 0; j < n; j++)
+				{
+					c[j] += zk * s[j];
+				}
+				zk *= z;
+			}
 		}
-	}
 
-	for (size_t j = 0; j < cols; j++)
-	{
-		std::vector<double> y(rows), values(rows);
-		for (size_t i = 0; i < rows; i++)
+		// Causal pass: c+[k] = s[k] + z c+[k - 1]
+		for (int k = 1; k < rows; k++)
 		{
-			y[i] = i;
-			values[i] = static_cast<double>(grayImage.at<uchar>(i, j));
+			const T* s = src.ptr<T>(k) + j0;
+			const T* up = dst.ptr<T>(k - 1) + j0;
+			T* out = dst.ptr<T>(k) + j0;
+			for (int j = 0; j < n; j++)
+			{
+				out[j] = s[j] + z * up[j];
+			}
 		}
 
-		auto spline = boost::math::interpolators::cardinal_cubic_b_spline<double>(values.begin(), values.end(), 0.0, 1.0);
-		for (size_t i = 0; i < rows; i++)
+		// Anti-causal pass: c-[k] = z (c-[k + 1] - c+[k]), with the gain 6 of the prefilter folded in
 		{
-			gradY.at<double>(i, j) = spline.prime(i);
+			T* last = dst.ptr<T>(rows - 1) + j0;
+			const T* beforeLast = dst.ptr<T>(rows - 2) + j0;
+			const T init = z / (z * z - T(1));
+			for (int j = 0; j < n; j++)
+			{
+				last[j] = init * (last[j] + z * beforeLast[j]);
+			}
+		}
+		for (int k = rows - 2; k >= 0; k--)
+		{
+			const T* down = dst.ptr<T>(k + 1) + j0;
+			T* out = dst.ptr<T>(k) + j0;
+			for (int j = 0; j < n; j++)
+			{
+				out[j] = z * (down[j] - out[j]);
+			}
 		}
-	}
-}
 
-/**
- * @brief Computes the frequency grid required for Fourier-based gradient computation.
- *
- * @param size Size of the grid (assumed to be the image dimension).
- * @return A frequency grid matrix.
- */
-cv::Mat GradientCalculator::computeFrequencyGrid(int size)
-{
-	cv::Mat freq(size, 1, CV_32F);
-	for (size_t i = 0; i < size; i++)
-	{
-		freq.at<float>(i, 0) = (i < size / 2) ? float(i) / size : float(i - size) / size;
-	}
-	return freq;
+		// Derivative at the knots: 6 * (c[k + 1] - c[k - 1]) / 2, mirrored at both ends
+		const T* first = dst.ptr<T>(0) + j0;
+		for (int j = 0; j < n; j++)
+		{
+			previous[j] = first[j];
+		}
+		for (int k = 0; k < rows - 1; k++)
+		{
+			T* out = dst.ptr<T>(k) + j0;
+			const T* down = dst.ptr<T>(k + 1) + j0;
+			const T* up = (k > 0) ? previous.data() : down;
+			for (int j = 0; j < n; j++)
+			{
+				current[j] = out[j];
+				out[j] = T(3) * (down[j] - up[j]);
+			}
+			std::swap(previous, current);
+		}
+		std::fill(dst.ptr<T>(rows - 1) + j0, dst.ptr<T>(rows - 1) + j0 + n, T(0));
+	});
 }
 
 /**
  * @brief Computes image gradients using Fourier Transform techniques.
  *
- * This method computes gradients in the frequency domain using the Discrete Fourier Transform (DFT).
+ * This method computes gradients in the frequency domain using the Discrete Fourier Transform (DFT):
+ * the spectrum is multiplied by i * 2 * pi * f in each direction. See SpectralGradient.
  *
  * @param grayImage Input grayscale image.
  * @param gradX Output gradient in the X direction.
  * @param gradY Output gradient in the Y direction.
+ * @param pool Optional thread pool.
+ * @param workspace Optional scratch buffers.
  */
-void GradientCalculator::computeFourierGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY)
+template <typename T>
+void BasicGradientCalculator<T>::computeFourierGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY, ThreadPool* pool,
+	Workspace* workspace)
 {
-	// Convert input image to floating point
-	cv::Mat floatImage;
-	grayImage.convertTo(floatImage, CV_32F);
-
-	// Perform DFT
-	cv::Mat planes[] = { floatImage, cv::Mat::zeros(floatImage.size(), CV_32F) };
-	cv::Mat complexImage;
-	cv::merge(planes, 2, complexImage);
-	cv::dft(complexImage, complexImage, cv::DFT_COMPLEX_OUTPUT);
-
-	// Compute frequency grid
-	cv::Mat freqX = computeFrequencyGrid(grayImage.cols);
-	cv::Mat freqY = computeFrequencyGrid(grayImage.rows);
-
-	// Compute gradient in X direction
-	cv::Mat planesX[2];
-	cv::split(complexImage, planesX);
-	cv::Mat realPartX = planesX[0];
-	cv::Mat imagPartX = planesX[1];
-
-	cv::Mat freqXexpanded;
-	cv::repeat(freqX.t(), grayImage.rows, 1, freqXexpanded);
-
-	cv::Mat realGradX = -2 * CV_PI * freqXexpanded.mul(imagPartX);
-	cv::Mat imagGradX = 2 * CV_PI * freqXexpanded.mul(realPartX);
-
-	cv::Mat complexGradX;
-	cv::merge(std::vector<cv::Mat>{realGradX, imagGradX}, complexGradX);
-	cv::idft(complexGradX, gradX, cv::DFT_REAL_OUTPUT);
-
-	// Compute gradient in Y direction
-	cv::Mat planesY[2];
-	cv::split(complexImage, planesY);
-	cv::Mat realPartY = planesY[0];
-	cv::Mat imagPartY = planesY[1];
-
-	cv::Mat freqYexpanded;
-	cv::repeat(freqY, 1, grayImage.cols, freqYexpanded);
-
-	cv::Mat realGradY = -2 * CV_PI * freqYexpanded.mul(imagPartY);
-	cv::Mat imagGradY = 2 * CV_PI * freqYexpanded.mul(realPartY);
-
-	cv::Mat complexGradY;
-	cv::merge(std::vector<cv::Mat>{realGradY, imagGradY}, complexGradY);
-	cv::idft(complexGradY, gradY, cv::DFT_REAL_OUTPUT);
+	BasicSpectralGradient<T> local;
+	BasicSpectralGradient<T>& engine = workspace ? workspace->spectral : local;
+	engine.compute(grayImage, BasicSpectralGradient<T>::KIND::FOURIER, gradX, gradY, pool);
 }
 
 /**
@@ -172,77 +252,44 @@ void GradientCalculator::computeFourierGradients(const cv::Mat& grayImage, cv::M
  * @param windowSize Size of the Gaussian kernel for smoothing.
  * @param gradX Output second-order derivative in the X direction.
  * @param gradY Output second-order derivative in the Y direction.
+ * @param workspace Optional scratch buffers.
  */
-void GradientCalculator::computeSecondOrderDerivatives(const cv::Mat& grayImage, int windowSize, cv::Mat& gradX, cv::Mat& gradY)
+template <typename T>
+void BasicGradientCalculator<T>::computeSecondOrderDerivatives(const cv::Mat& grayImage, int windowSize, cv::Mat& gradX, cv::Mat& gradY,
+	Workspace* workspace)
 {
-	cv::Mat grayFloat;
-	grayImage.convertTo(grayFloat, CV_32F);
+	Workspace local;
+	Workspace& buffers = workspace ? *workspace : local;
+	cv::Mat& samples = buffers.samples;
+	cv::Mat& blurred = buffers.smoothed;
+
+	grayImage.convertTo(samples, Precision<T>::depth);
 
-	cv::Mat blurred;
-	cv::GaussianBlur(grayFloat, blurred, cv::Size(0, 0), windowSize);
+	cv::GaussianBlur(samples, blurred, cv::Size(0, 0), windowSize);
 
-	cv::Sobel(blurred, gradX, CV_32F, 0, 2, 3);
-	cv::Sobel(blurred, gradY, CV_32F, 2, 0, 3);
+	cv::Sobel(blurred, gradX, Precision<T>::depth, 0, 2, 3);
+	cv::Sobel(blurred, gradY, Precision<T>::depth, 2, 0, 3);
 }
 
-void GradientCalculator::computeRieszGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY)
+/**
+ * @brief Computes image gradients using the Riesz Transform.
+ *
+ * The spectrum is multiplied by i * f / |f| in each direction. See SpectralGradient.
+ *
+ * @param grayImage Input grayscale image.
+ * @param gradX Output gradient in the X direction.
+ * @param gradY Output gradient in the Y direction.
+ * @param pool Optional thread pool.
+ * @param workspace Optional scratch buffers.
+ */
+template <typename T>
+void BasicGradientCalculator<T>::computeRieszGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY, ThreadPool* pool,
+	Workspace* workspace)
 {
-	cv::Mat floatImage;
-	grayImage.convertTo(floatImage, CV_32F);
-
-	cv::Mat planes[] = { floatImage, cv::Mat::zeros(floatImage.size(), CV_32F) };
-	cv::Mat complexImage;
-
-	cv::merge(planes, 2, complexImage);
-
-	cv::dft(complexImage, complexImage, cv::DFT_COMPLEX_OUTPUT);
-
-	int rows = grayImage.rows;
-	int cols = grayImage.cols;
-
-	cv::Mat freqX(rows, cols, CV_32F);
-	cv::Mat freqY(rows, cols, CV_32F);
-
-	for (size_t i = 0; i < rows; i++)
-	{
-		float fy = (i < rows / 2) ? float(i) / rows : float(i - rows) / rows;
-		for (size_t j = 0; j < cols; j++)
-		{
-			float fx = (j < cols / 2) ? float(j) / cols : float(j - cols) / cols;
-			freqX.at<float>(i, j) = fx;
-			freqY.at<float>(i, j) = fy;
-		}
-	}
-
-	cv::Mat denominator;
-	cv::sqrt(freqX.mul(freqX) + freqY.mul(freqY) + 1e-5, denominator);
-
-	cv::Mat rieszXreal = cv::Mat::zeros(rows, cols, CV_32F);
-	cv::Mat rieszXimag = freqX / denominator;
-	cv::Mat rieszYreal = cv::Mat::zeros(rows, cols, CV_32F);
-	cv::Mat rieszYimag = freqY / denominator;
-
-	cv::Mat planesDFT[2];
-	cv::split(complexImage, planesDFT);
-	cv::Mat realPart = planesDFT[0];
-	cv::Mat imagPart = planesDFT[1];
-
-	cv::Mat realGradX = -rieszXimag.mul(imagPart);
-	cv::Mat imagGradX = rieszXimag.mul(realPart);
-	cv::Mat realGradY = -rieszYimag.mul(imagPart);
-	cv::Mat imagGradY = rieszYimag.mul(realPart);
-
-	cv::Mat complexGradX, complexGradY;
-	cv::merge(std::vector<cv::Mat>{realGradX, imagGradX}, complexGradX);
-	cv::merge(std::vector<cv::Mat>{realGradY, imagGradY}, complexGradY);
-
-	cv::idft(complexGradX, gradX, cv::DFT_REAL_OUTPUT);
-	cv::idft(complexGradY, gradY, cv::DFT_REAL_OUTPUT);
-
-
-
-
-
-
-
+	BasicSpectralGradient<T> local;
+	BasicSpectralGradient<T>& engine = workspace ? workspace->spectral : local;
+	engine.compute(grayImage, BasicSpectralGradient<T>::KIND::RIESZ, gradX, gradY, pool);
 }
+
+template class BasicGradientCalculator<float>;
+template class BasicGradientCalculator<double>;
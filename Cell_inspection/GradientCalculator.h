@@ -1,12 +1,13 @@
 #pragma once
 #include <iostream>
 #include <opencv2/opencv.hpp>
-#include <random> 
-#include <boost/random.hpp>
-#include <boost/math/interpolators/cardinal_cubic_b_spline.hpp>
+#include "ArenaAllocator.h"
+#include "Precision.h"
+#include "SpectralGradient.h"
+#include "ThreadPool.h"
 
 /**
- * @class GradientCalculator
+ * @class BasicGradientCalculator
  * @brief Provides various methods for computing image gradients using different techniques.
  *
  * This class implements multiple approaches to compute image gradients, including:
@@ -18,11 +19,37 @@
  * - Hessian-based Second Order Derivatives
  *
  * The methods take a grayscale image as input and output two gradient matrices (X and Y directions).
+ * Every method produces gradients of the precision T (see Precision), whatever the input depth;
+ * GradientCalculator is the float instance.
  */
-class GradientCalculator
+template <typename T>
+class BasicGradientCalculator
 {
 public:
 
+    /**
+     * @brief Scratch buffers kept between calls so that repeated gradients of same-sized images
+     * do not allocate. Passing no workspace uses temporaries.
+     */
+    struct Workspace
+    {
+        cv::Mat smoothed;
+        cv::Mat samples;        // Input converted to T
+        cv::Mat transposed;
+        cv::Mat transposedGrad;
+        BasicSpectralGradient<T> spectral;
+
+        // Allocates the buffers from allocator (the default one when null) from now on
+        void setAllocator(cv::MatAllocator* allocator)
+        {
+            for (cv::Mat* m : { &smoothed, &samples, &transposed, &transposedGrad })
+            {
+                ArenaAllocator::use(*m, allocator);
+            }
+            spectral.setAllocator(allocator);
+        }
+    };
+
     /**
      * @brief Computes image gradients using the finite difference method.
      * @param grayImage Input grayscale image.
@@ -36,32 +63,42 @@ public:
      * @param grayImage Input grayscale image.
      * @param gradX Output gradient in the X direction.
      * @param gradY Output gradient in the Y direction.
+     * @param workspace Optional scratch buffers.
      */
-    static void computeGaussianGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY);
+    static void computeGaussianGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY, Workspace* workspace = nullptr);
 
     /**
      * @brief Computes image gradients using cubic spline interpolation.
      * @param grayImage Input grayscale image.
      * @param gradX Output gradient in the X direction.
      * @param gradY Output gradient in the Y direction.
+     * @param pool Optional thread pool the column blocks are distributed over.
+     * @param workspace Optional scratch buffers.
      */
-    static void cubicSplineInterpolation(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY);
+    static void cubicSplineInterpolation(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY, ThreadPool* pool = nullptr,
+        Workspace* workspace = nullptr);
 
     /**
      * @brief Computes image gradients using Fourier Transform techniques.
      * @param grayImage Input grayscale image.
      * @param gradX Output gradient in the X direction.
      * @param gradY Output gradient in the Y direction.
+     * @param pool Optional thread pool the spectrum rows are distributed over.
+     * @param workspace Optional scratch buffers; the outputs alias its spectral buffers.
      */
-    static void computeFourierGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY);
+    static void computeFourierGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY, ThreadPool* pool = nullptr,
+        Workspace* workspace = nullptr);
 
     /**
      * @brief Computes image gradients using the Riesz Transform.
      * @param grayImage Input grayscale image.
      * @param gradX Output gradient in the X direction.
      * @param gradY Output gradient in the Y direction.
+     * @param pool Optional thread pool the spectrum rows are distributed over.
+     * @param workspace Optional scratch buffers; the outputs alias its spectral buffers.
      */
-    static void computeRieszGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY);
+    static void computeRieszGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY, ThreadPool* pool = nullptr,
+        Workspace* workspace = nullptr);
 
     /**
      * @brief Computes second-order derivatives using Hessian-based methods.
@@ -69,15 +106,20 @@ public:
      * @param windowSize Size of the local window used for computation.
      * @param gradX Output second-order derivative in the X direction.
      * @param gradY Output second-order derivative in the Y direction.
+     * @param workspace Optional scratch buffers.
      */
-    static void computeSecondOrderDerivatives(const cv::Mat& grayImage, int windowSize, cv::Mat& gradX, cv::Mat& gradY);
+    static void computeSecondOrderDerivatives(const cv::Mat& grayImage, int windowSize, cv::Mat& gradX, cv::Mat& gradY,
+        Workspace* workspace = nullptr);
 
 private:
 
     /**
-     * @brief Computes a frequency grid matrix used for Fourier-based gradient computation.
-     * @param size Size of the grid (assumed to be the image dimension).
-     * @return A frequency grid matrix.
+     * @brief Derivative along the rows direction of the cubic spline interpolating each column.
+     * @param src Input samples (Precision<T>::depth).
+     * @param dst Output derivative (Precision<T>::depth), same size as src.
+     * @param pool Optional thread pool the column blocks are distributed over.
      */
-    static cv::Mat computeFrequencyGrid(int size);
+    static void splineDerivativeAlongColumns(const cv::Mat& src, cv::Mat& dst, ThreadPool* pool);
 };
+
+using GradientCalculator = BasicGradientCalculator<float>;
@@ -0,0 +1,123 @@
+#include "GradientStencil.h"
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+
+/**
+ * @brief Starts reading an image with an empty ring.
+ *
+ * @param image Single-channel image of any depth.
+ * @param pad Padding columns on each side.
+ * @param slots Rows of the ring.
+ */
+template <typename T>
+void StencilRows<T>::reset(const cv::Mat& image, int pad, int slots)
+{
+	CV_Assert(image.channels() == 1 && pad >= 0 && slots > 0);
+
+	source = image;
+	padding = pad;
+	ring.create(slots, image.cols + 2 * pad, Precision<T>::depth);
+	cached.assign(slots, -1);
+}
+
+/**
+ * @brief Converts an image row into its slot, unless it is already there, and fills the padding.
+ *
+ * @param index Image row, inside the image.
+ * @return Pointer to column 0 of the converted row.
+ */
+template <typename T>
+const T* StencilRows<T>::row(int index)
+{
+	const int slot = index % ring.rows;
+	T* values = ring.ptr<T>(slot) + padding;
+	if (cached[slot] == index)
+		return values;
+
+	const int cols = source.cols;
+	cv::Mat converted(1, cols, Precision<T>::depth, values);
+	source.row(index).convertTo(converted, Precision<T>::depth);
+	for (int k = 1; k <= padding; k++)
+	{
+		values[-k] = values[cv::borderInterpolate(-k, cols, cv::BORDER_REFLECT_101)];
+		values[cols - 1 + k] = values[cv::borderInterpolate(cols - 1 + k, cols, cv::BORDER_REFLECT_101)];
+	}
+	cached[slot] = index;
+	return values;
+}
+
+/**
+ * @brief Starts reading an image: the five source rows of the blur are converted without padding,
+ * since the vertical pass runs first.
+ *
+ * @param image Single-channel image of any depth.
+ */
+template <typename T>
+void GaussianStencil<T>::reset(const cv::Mat& image)
+{
+	source.reset(image, 0, kernelSize);
+
+	cv::Mat kernel = cv::getGaussianKernel(kernelSize, sigma, Precision<T>::depth);
+	for (int k = 0; k <= kernelSize / 2; k++)
+	{
+		weights[k] = kernel.at<T>(kernelSize / 2 + k, 0);
+	}
+
+	vertical.create(1, image.cols + 4, Precision<T>::depth);
+	smoothed.create(3, image.cols + 2, Precision<T>::depth);
+	std::fill(cached, cached + 3, -1);
+}
+
+/**
+ * @brief Smoothed image row, computed into the ring when it is not there yet.
+ *
+ * The vertical pass reads five converted rows, the horizontal one the reflected vertical row;
+ * one padding column is then reflected for the Sobel operators.
+ *
+ * @param index Image row, inside the image.
+ * @return Pointer to column 0 of the smoothed row.
+ */
+template <typename T>
+const T* GaussianStencil<T>::smoothedRow(int index)
+{
+	const int slot = index % 3;
+	T* dst = smoothed.ptr<T>(slot) + 1;
+	if (cached[slot] == index)
+		return dst;
+
+	const int cols = source.cols();
+	const T* r0 = source.row(source.reflect(index - 2));
+	const T* r1 = source.row(source.reflect(index - 1));
+	const T* r2 = source.row(index);
+	const T* r3 = source.row(source.reflect(index + 1));
+	const T* r4 = source.row(source.reflect(index + 2));
+	const T w0 = weights[0];
+	const T w1 = weights[1];
+	const T w2 = weights[2];
+
+	T* v = vertical.ptr<T>() + 2;
+	for (int j = 0; j < cols; j++)
+	{
+		v[j] = w0 * r2[j] + w1 * (r1[j] + r3[j]) + w2 * (r0[j] + r4[j]);
+	}
+	for (int k = 1; k <= 2; k++)
+	{
+		v[-k] = v[cv::borderInterpolate(-k, cols, cv::BORDER_REFLECT_101)];
+		v[cols - 1 + k] = v[cv::borderInterpolate(cols - 1 + k, cols, cv::BORDER_REFLECT_101)];
+	}
+
+	for (int j = 0; j < cols; j++)
+	{
+		dst[j] = w0 * v[j] + w1 * (v[j - 1] + v[j + 1]) + w2 * (v[j - 2] + v[j + 2]);
+	}
+	dst[-1] = dst[cv::borderInterpolate(-1, cols, cv::BORDER_REFLECT_101)];
+	dst[cols] = dst[cv::borderInterpolate(cols, cols, cv::BORDER_REFLECT_101)];
+
+	cached[slot] = index;
+	return dst;
+}
+
+template class StencilRows<float>;
+template class StencilRows<double>;
+template class GaussianStencil<float>;
+template class GaussianStencil<double>;
@@ -0,0 +1,180 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <vector>
+#include "ArenaAllocator.h"
+#include "Precision.h"
+
+// Gradient functors evaluated inside the product loop of the structure tensor kernel.
+//
+// A stencil produces the gradient of one pixel of a prepared row:
+//
+//     stencil.prepare(row);           // once per gradient row, rows in increasing order
+//     stencil(j, gx, gy);             // for every column j, inlined into the caller's loop
+//
+// BasicStructureTensorKernel::pushRow() and the analysis are templates over the stencil type,
+// so for the stencil methods the gradient, the three products and the stores of one pixel are a
+// single loop body the compiler can vectorize, and no gradient image is ever written. The
+// image rows a stencil reads are converted to T once, as they are first needed.
+
+/**
+ * @class StencilRows
+ * @brief Ring of image rows converted to T, with reflected padding columns on both sides.
+ *
+ * Rows are cached by index in slot index % slots, so a stencil reading at most `slots`
+ * consecutive rows at a time converts every image row once when it walks down the image.
+ */
+template <typename T>
+class StencilRows
+{
+public:
+    /**
+     * @brief Starts reading an image; cached rows are invalidated, buffers are kept when they fit.
+     * @param image Single-channel image of any depth.
+     * @param pad Columns of BORDER_REFLECT_101 padding on each side.
+     * @param slots Rows of the ring.
+     */
+    void reset(const cv::Mat& image, int pad, int slots);
+
+    /**
+     * @brief Pointer to column 0 of image row index; columns -pad .. cols + pad - 1 are valid.
+     */
+    const T* row(int index);
+
+    /**
+     * @brief Image row of index under BORDER_REFLECT_101.
+     */
+    int reflect(int index) const { return cv::borderInterpolate(index, source.rows, cv::BORDER_REFLECT_101); }
+
+    int rows() const { return source.rows; }
+    int cols() const { return source.cols; }
+
+    void setAllocator(cv::MatAllocator* allocator) { ArenaAllocator::use(ring, allocator); }
+
+private:
+    cv::Mat source;
+    cv::Mat ring;               // slots x (cols + 2 * pad)
+    std::vector<int> cached;    // Image row held by each slot, -1 when none
+    int padding = 0;
+};
+
+/**
+ * @class GradientRows
+ * @brief Stencil over gradients that already exist, such as the output of a whole-image method.
+ */
+template <typename T>
+class GradientRows
+{
+public:
+    GradientRows(const T* gx, const T* gy) : x{ gx }, y{ gy } {}
+
+    void operator()(int j, T& gx, T& gy) const
+    {
+        gx = x[j];
+        gy = y[j];
+    }
+
+private:
+    const T* x;
+    const T* y;
+};
+
+/**
+ * @class FiniteDifferenceStencil
+ * @brief Central differences [-1, 0, 1] in both directions, as cv::filter2D computes them with
+ * BORDER_REFLECT_101 borders. Same values as BasicGradientCalculator::computeFiniteDifferenceGradient.
+ */
+template <typename T>
+class FiniteDifferenceStencil
+{
+public:
+    /**
+     * @brief Starts reading an image; must be called before the first prepare() of every image.
+     */
+    void reset(const cv::Mat& image) { source.reset(image, 1, 3); }
+
+    /**
+     * @brief Allocates the row ring from allocator (the default one when null) from now on.
+     */
+    void setAllocator(cv::MatAllocator* allocator) { source.setAllocator(allocator); }
+
+    /**
+     * @brief Selects the gradient row.
+     */
+    void prepare(int row)
+    {
+        above = source.row(source.reflect(row - 1));
+        centre = source.row(row);
+        below = source.row(source.reflect(row + 1));
+    }
+
+    void operator()(int j, T& gx, T& gy) const
+    {
+        gx = centre[j + 1] - centre[j - 1];
+        gy = below[j] - above[j];
+    }
+
+private:
+    StencilRows<T> source;
+    const T* above = nullptr;
+    const T* centre = nullptr;
+    const T* below = nullptr;
+};
+
+/**
+ * @class GaussianStencil
+ * @brief 5x5 Gaussian of sigma 2 followed by the 3x3 Sobel operators, both with BORDER_REFLECT_101
+ * borders. Same values as BasicGradientCalculator::computeGaussianGradients, up to rounding.
+ *
+ * The blur is separable and runs once per image row, into a ring of three smoothed rows; the
+ * Sobel operators are evaluated per pixel on that ring.
+ */
+template <typename T>
+class GaussianStencil
+{
+public:
+    static constexpr int kernelSize = 5;
+    static constexpr double sigma = 2.0;
+
+    /**
+     * @brief Starts reading an image; must be called before the first prepare() of every image.
+     */
+    void reset(const cv::Mat& image);
+
+    /**
+     * @brief Allocates the rings from allocator (the default one when null) from now on.
+     */
+    void setAllocator(cv::MatAllocator* allocator)
+    {
+        source.setAllocator(allocator);
+        ArenaAllocator::use(vertical, allocator);
+        ArenaAllocator::use(smoothed, allocator);
+    }
+
+    /**
+     * @brief Selects the gradient row, smoothing the rows it needs that are not in the ring yet.
+     */
+    void prepare(int row)
+    {
+        above = smoothedRow(source.reflect(row - 1));
+        centre = smoothedRow(row);
+        below = smoothedRow(source.reflect(row + 1));
+    }
+
+    void operator()(int j, T& gx, T& gy) const
+    {
+        gx = (above[j + 1] - above[j - 1]) + 2 * (centre[j + 1] - centre[j - 1]) + (below[j + 1] - below[j - 1]);
+        gy = (below[j - 1] + 2 * below[j] + below[j + 1]) - (above[j - 1] + 2 * above[j] + above[j + 1]);
+    }
+
+private:
+    StencilRows<T> source;
+    T weights[kernelSize / 2 + 1] = {};     // Half kernel, weights[0] is the centre tap
+    cv::Mat vertical;                       // Vertically smoothed row with 2 padding columns per side
+    cv::Mat smoothed;                       // Ring of 3 smoothed rows with 1 padding column per side
+    int cached[3] = { -1, -1, -1 };
+    const T* above = nullptr;
+    const T* centre = nullptr;
+    const T* below = nullptr;
+
+    const T* smoothedRow(int index);
+};
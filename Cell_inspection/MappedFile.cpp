@@ -0,0 +1,169 @@
+#include "MappedFile.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// Allocator of the views: their UMatData holds a reference to the mapping, dropped with the
+	// last header. Matrices created through a view's allocator get the standard allocator's memory.
+	class MappingAllocator : public cv::MatAllocator
+	{
+	public:
+		cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+			cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override
+		{
+			return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+		}
+
+		bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override
+		{
+			return cv::Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+		}
+
+		void deallocate(cv::UMatData* u) const override
+		{
+			if (!u)
+				return;
+			delete static_cast<std::shared_ptr<const MappedFile>*>(u->userdata);
+			delete u;
+		}
+	};
+
+	// Never destroyed, so that views released during static destruction still find it
+	MappingAllocator& mappingAllocator()
+	{
+		static MappingAllocator* allocator = new MappingAllocator();
+		return *allocator;
+	}
+}
+
+/**
+ * @brief Opens and maps a file read-only.
+ *
+ * @param path File to map.
+ */
+MappedFile::MappedFile(const std::string& path) :
+	filePath{ path }
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("MappedFile: cannot open " + path);
+	fileHandle = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		close();
+		throw std::runtime_error("MappedFile: cannot read the size of " + path);
+	}
+	length = static_cast<size_t>(fileSize.QuadPart);
+	if (length == 0)
+		return;
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		close();
+		throw std::runtime_error("MappedFile: cannot map " + path);
+	}
+	mappingHandle = mapping;
+
+	bytes = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!bytes)
+	{
+		close();
+		throw std::runtime_error("MappedFile: cannot map " + path);
+	}
+#else
+	descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor < 0)
+		throw std::runtime_error("MappedFile: cannot open " + path);
+
+	struct stat status;
+	if (::fstat(descriptor, &status) != 0)
+	{
+		close();
+		throw std::runtime_error("MappedFile: cannot read the size of " + path);
+	}
+	length = static_cast<size_t>(status.st_size);
+	if (length == 0)
+		return;
+
+	void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, descriptor, 0);
+	if (mapped == MAP_FAILED)
+	{
+		close();
+		throw std::runtime_error("MappedFile: cannot map " + path);
+	}
+	bytes = static_cast<const uint8_t*>(mapped);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+/**
+ * @brief Releases the view, the mapping and the file, whichever exist.
+ */
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (bytes)
+		UnmapViewOfFile(bytes);
+	if (mappingHandle)
+		CloseHandle(mappingHandle);
+	if (fileHandle)
+		CloseHandle(fileHandle);
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+#else
+	if (bytes)
+		::munmap(const_cast<uint8_t*>(bytes), length);
+	if (descriptor >= 0)
+		::close(descriptor);
+	descriptor = -1;
+#endif
+	bytes = nullptr;
+}
+
+/**
+ * @brief Header over mapped bytes whose UMatData holds a reference to the mapping.
+ *
+ * @param file Mapping to view.
+ * @param offset File offset of the first element.
+ * @param rows Rows of the view.
+ * @param cols Columns of the view.
+ * @param type Type of the elements.
+ * @param step Bytes between rows, cv::Mat::AUTO_STEP for rows without padding.
+ */
+cv::Mat MappedFile::view(const std::shared_ptr<const MappedFile>& file, uint64_t offset, int rows, int cols,
+	int type, size_t step)
+{
+	uint8_t* data = const_cast<uint8_t*>(file->data() + offset);
+	cv::Mat pixels(rows, cols, type, data, step);
+
+	cv::UMatData* u = new cv::UMatData(&mappingAllocator());
+	u->data = u->origdata = data;
+	u->size = pixels.step[0] * rows;
+	u->refcount = 1;
+	u->flags |= cv::UMatData::USER_ALLOCATED;
+	u->userdata = new std::shared_ptr<const MappedFile>(file);
+	pixels.u = u;
+	pixels.allocator = &mappingAllocator();
+	return pixels;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * @class MappedFile
+ * @brief Read-only memory mapping of a whole file.
+ *
+ * Pages are loaded by the operating system on first access and shared with its file cache, so
+ * re-reading a file that was read recently costs no I/O and no copy. Uses mmap on POSIX systems
+ * and file mappings on Windows.
+ *
+ * view() hands out cv::Mat headers over the mapping that hold a reference to it, so they stay
+ * valid after every other owner of the MappedFile is gone.
+ */
+class MappedFile
+{
+public:
+    /**
+     * @brief Maps a file.
+     * @throws std::runtime_error when the file cannot be opened or mapped.
+     */
+    explicit MappedFile(const std::string& path);
+
+    /**
+     * @brief Unmaps the file; pointers into it become invalid.
+     */
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * @brief First byte of the file, null for an empty file. The pages are read-only.
+     */
+    const uint8_t* data() const { return bytes; }
+
+    size_t size() const { return length; }
+
+    const std::string& path() const { return filePath; }
+
+    /**
+     * @brief Read-only header over mapped bytes whose data keeps the mapping alive until the last
+     * header sharing it is released.
+     * @param file Mapping to view.
+     * @param offset File offset of the first element.
+     * @param rows Rows of the view.
+     * @param cols Columns of the view.
+     * @param type Type of the elements.
+     * @param step Bytes between rows, cv::Mat::AUTO_STEP for rows without padding.
+     */
+    static cv::Mat view(const std::shared_ptr<const MappedFile>& file, uint64_t offset, int rows, int cols,
+        int type, size_t step = cv::Mat::AUTO_STEP);
+
+private:
+    std::string filePath;
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#else
+    int descriptor = -1;
+#endif
+
+    void close();
+};
@@ -0,0 +1,517 @@
+#include "MappedImage.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <opencv2/imgcodecs.hpp>
+
+namespace
+{
+	bool bigEndianMachine()
+	{
+		const uint16_t probe = 1;
+		uint8_t first;
+		std::memcpy(&first, &probe, 1);
+		return first == 0;
+	}
+
+	// Bounds-checked reads of the TIFF structures in the byte order of the file
+	class TiffReader
+	{
+	public:
+		TiffReader(const MappedFile& file) : file{ file } {}
+
+		bool bigEndian = false;
+
+		uint16_t u16(uint64_t at) const
+		{
+			const uint8_t* p = bytes(at, 2);
+			return bigEndian ? static_cast<uint16_t>(p[0] << 8 | p[1]) : static_cast<uint16_t>(p[1] << 8 | p[0]);
+		}
+
+		uint32_t u32(uint64_t at) const
+		{
+			const uint8_t* p = bytes(at, 4);
+			return bigEndian ? uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3]
+				: uint32_t(p[3]) << 24 | uint32_t(p[2]) << 16 | uint32_t(p[1]) << 8 | p[0];
+		}
+
+		const uint8_t* bytes(uint64_t at, uint64_t count) const
+		{
+			if (at > file.size() || count > file.size() - at)
+				throw std::runtime_error("MappedImage: " + file.path() + " is truncated.");
+			return file.data() + at;
+		}
+
+		// Values of an IFD entry of type BYTE, SHORT or LONG, inline or at their offset
+		std::vector<uint64_t> values(uint64_t entry) const
+		{
+			const uint16_t type = u16(entry + 2);
+			const uint32_t count = u32(entry + 4);
+			const int size = type == 1 ? 1 : type == 3 ? 2 : type == 4 ? 4 : 0;
+			if (size == 0)
+				return std::vector<uint64_t>();
+
+			uint64_t at = entry + 8;
+			if (uint64_t(count) * size > 4)
+				at = u32(entry + 8);
+			bytes(at, uint64_t(count) * size);
+
+			std::vector<uint64_t> result(count);
+			for (uint32_t k = 0; k < count; k++)
+			{
+				const uint64_t item = at + uint64_t(k) * size;
+				result[k] = size == 1 ? *bytes(item, 1) : size == 2 ? u16(item) : u32(item);
+			}
+			return result;
+		}
+
+	private:
+		const MappedFile& file;
+	};
+
+	// PackBits runs: a count n >= 0 copies n + 1 bytes, -127 <= n <= -1 repeats the next byte 1 - n times
+	void unpackBits(const uint8_t* src, size_t srcBytes, uint8_t* dst, size_t dstBytes)
+	{
+		size_t in = 0;
+		size_t out = 0;
+		while (in < srcBytes && out < dstBytes)
+		{
+			const int n = static_cast<int8_t>(src[in++]);
+			if (n >= 0)
+			{
+				const size_t count = std::min<size_t>(n + 1, std::min(dstBytes - out, srcBytes - in));
+				std::memcpy(dst + out, src + in, count);
+				in += count;
+				out += count;
+			}
+			else if (n != -128 && in < srcBytes)
+			{
+				const size_t count = std::min<size_t>(1 - n, dstBytes - out);
+				std::memset(dst + out, src[in++], count);
+				out += count;
+			}
+		}
+	}
+
+	// TIFF LZW: codes of 9 to 12 bits, most significant bit first, with the early change of width
+	void unpackLzw(const uint8_t* src, size_t srcBytes, uint8_t* dst, size_t dstBytes)
+	{
+		constexpr int clearCode = 256;
+		constexpr int endCode = 257;
+		constexpr int tableSize = 4096;
+
+		std::vector<uint16_t> prefix(tableSize);
+		std::vector<uint8_t> suffix(tableSize);
+		std::vector<uint8_t> first(tableSize);
+		std::vector<uint16_t> length(tableSize);
+		for (int code = 0; code < 256; code++)
+		{
+			suffix[code] = first[code] = static_cast<uint8_t>(code);
+			length[code] = 1;
+		}
+
+		uint64_t bitPosition = 0;
+		const uint64_t bitCount = uint64_t(srcBytes) * 8;
+		int width = 9;
+		int next = 258;
+		int previous = -1;
+		size_t out = 0;
+
+		// Writes a string backwards from its last byte; strings that do not fit are cut
+		auto emit = [&](int code)
+		{
+			const size_t size = length[code];
+			for (size_t k = size; k-- > 0; )
+			{
+				if (out + k < dstBytes)
+					dst[out + k] = suffix[code];
+				code = prefix[code];
+			}
+			out += size;
+		};
+
+		while (out < dstBytes && bitPosition + width <= bitCount)
+		{
+			int code = 0;
+			for (int b = 0; b < width; b++, bitPosition++)
+			{
+				code = code << 1 | ((src[bitPosition >> 3] >> (7 - (bitPosition & 7))) & 1);
+			}
+
+			if (code == endCode)
+				break;
+			if (code == clearCode)
+			{
+				width = 9;
+				next = 258;
+				previous = -1;
+				continue;
+			}
+			if (previous < 0)
+			{
+				if (code >= 256)
+					throw std::runtime_error("MappedImage: invalid LZW data.");
+				emit(code);
+				previous = code;
+				continue;
+			}
+			if (code > next || (code == next && next >= tableSize))
+				throw std::runtime_error("MappedImage: invalid LZW data.");
+
+			if (next < tableSize)
+			{
+				// The new entry is the previous string plus the first byte of this one, which for
+				// code == next is the first byte of the previous string
+				prefix[next] = static_cast<uint16_t>(previous);
+				first[next] = first[previous];
+				suffix[next] = code < next ? first[code] : first[previous];
+				length[next] = static_cast<uint16_t>(length[previous] + 1);
+				next++;
+			}
+			emit(code);
+			previous = code;
+
+			if (next >= (1 << width) - 1 && width < 12)
+				width++;
+		}
+	}
+}
+
+/**
+ * @brief Maps a raw frame as a single block, which is a view of the whole frame.
+ *
+ * @param path Frame file.
+ * @param size Frame size in pixels.
+ * @param depth CV_8U or CV_16U.
+ * @param headerBytes Bytes before the first pixel.
+ */
+MappedImage MappedImage::raw(const std::string& path, cv::Size size, int depth, size_t headerBytes)
+{
+	if (depth != CV_8U && depth != CV_16U)
+		throw std::invalid_argument("MappedImage: raw frames must be 8 or 16 bits.");
+	if (size.width <= 0 || size.height <= 0)
+		throw std::invalid_argument("MappedImage: raw frame size must be positive.");
+
+	MappedImage image;
+	image.file = std::make_shared<MappedFile>(path);
+	image.imageSize = size;
+	image.imageDepth = depth;
+
+	Block block;
+	block.area = cv::Rect(cv::Point(0, 0), size);
+	block.storedRows = size.height;
+	block.storedCols = size.width;
+	block.offset = headerBytes;
+	block.bytes = uint64_t(size.area()) * CV_ELEM_SIZE(depth);
+	if (headerBytes > image.file->size() || block.bytes > image.file->size() - headerBytes)
+		throw std::runtime_error("MappedImage: " + path + " is smaller than a frame of the given size.");
+	image.blockList.push_back(block);
+	return image;
+}
+
+/**
+ * @brief Maps a TIFF and reads the layout of its first page.
+ *
+ * Strips or tiles, compression, predictor and sample format are taken from the first IFD; the
+ * pixels are not touched. Uncompressed strips that follow each other in the file are merged into
+ * a single block, so that the page is one view.
+ *
+ * @param path TIFF file.
+ */
+MappedImage MappedImage::tiff(const std::string& path)
+{
+	MappedImage image;
+	image.file = std::make_shared<MappedFile>(path);
+	image.decodedPage = std::make_shared<DecodedPage>();
+	const MappedFile& file = *image.file;
+
+	auto invalid = [&](const std::string& reason)
+	{
+		return std::runtime_error("MappedImage: cannot map " + path + " (" + reason + ").");
+	};
+
+	TiffReader reader(file);
+	const uint8_t* signature = reader.bytes(0, 4);
+	if (signature[0] == 'I' && signature[1] == 'I')
+		reader.bigEndian = false;
+	else if (signature[0] == 'M' && signature[1] == 'M')
+		reader.bigEndian = true;
+	else
+		throw invalid("not a TIFF");
+	if (reader.u16(2) != 42)
+		throw invalid(reader.u16(2) == 43 ? "BigTIFF is not supported" : "not a TIFF");
+
+	const uint64_t ifd = reader.u32(4);
+	const int entries = reader.u16(ifd);
+	std::map<int, std::vector<uint64_t>> tags;
+	for (int e = 0; e < entries; e++)
+	{
+		const uint64_t entry = ifd + 2 + 12 * uint64_t(e);
+		tags[reader.u16(entry)] = reader.values(entry);
+	}
+	auto tag = [&](int id, uint64_t fallback) -> uint64_t
+	{
+		auto it = tags.find(id);
+		return it == tags.end() || it->second.empty() ? fallback : it->second[0];
+	};
+
+	const uint64_t width = tag(256, 0);
+	const uint64_t height = tag(257, 0);
+	const uint64_t bits = tag(258, 1);
+	const uint64_t compression = tag(259, 1);
+	const uint64_t samples = tag(277, 1);
+	const uint64_t predictor = tag(317, 1);
+	const uint64_t format = tag(339, 1);
+	if (width == 0 || height == 0 || width > INT32_MAX || height > INT32_MAX)
+		throw invalid("invalid image size");
+	if (samples != 1)
+		throw invalid("only single-channel images are supported");
+	if (bits != 8 && bits != 16)
+		throw invalid("only 8 and 16 bits per sample are supported");
+	if (format != 1 && format != 2)
+		throw invalid("only integer samples are supported");
+
+	image.imageSize = cv::Size(static_cast<int>(width), static_cast<int>(height));
+	image.imageDepth = bits == 8 ? (format == 1 ? CV_8U : CV_8S) : (format == 1 ? CV_16U : CV_16S);
+	image.compression = compression == 1 ? COMPRESSION::NONE : compression == 5 ? COMPRESSION::LZW
+		: compression == 32773 ? COMPRESSION::PACKBITS : COMPRESSION::OTHER;
+	image.swapBytes = bits == 16 && reader.bigEndian != bigEndianMachine();
+	image.predictor = predictor == 2;
+	if (predictor != 1 && predictor != 2 && image.compression != COMPRESSION::OTHER)
+		throw invalid("unsupported predictor");
+
+	const bool tiled = tags.count(322) != 0;
+	const int blockCols = static_cast<int>(tiled ? tag(322, 0) : width);
+	const int blockRows = static_cast<int>(tiled ? tag(323, 0) : std::min(tag(278, height), height));
+	if (blockCols <= 0 || blockRows <= 0)
+		throw invalid("invalid strip or tile size");
+	const std::vector<uint64_t>& offsets = tags[tiled ? 324 : 273];
+	const std::vector<uint64_t>& counts = tags[tiled ? 325 : 279];
+
+	const int across = static_cast<int>((width + blockCols - 1) / blockCols);
+	const int down = static_cast<int>((height + blockRows - 1) / blockRows);
+	if (offsets.size() < size_t(across) * down || counts.size() < offsets.size())
+		throw invalid("missing strip or tile offsets");
+
+	const size_t elemSize = bits / 8;
+	for (int by = 0; by < down; by++)
+	{
+		for (int bx = 0; bx < across; bx++)
+		{
+			Block block;
+			block.area = cv::Rect(bx * blockCols, by * blockRows, blockCols, blockRows) & cv::Rect(cv::Point(0, 0), image.imageSize);
+			block.storedRows = tiled ? blockRows : block.area.height;
+			block.storedCols = blockCols;
+			block.offset = offsets[image.blockList.size()];
+			block.bytes = counts[image.blockList.size()];
+			if (image.compression == COMPRESSION::NONE)
+				block.bytes = std::max<uint64_t>(block.bytes, uint64_t(block.storedRows) * block.storedCols * elemSize);
+			reader.bytes(block.offset, block.bytes);
+			image.blockList.push_back(block);
+		}
+	}
+
+	// Strips stored back to back, which is how most writers lay out uncompressed pages
+	if (!tiled && image.isMapped(0))
+	{
+		const uint64_t rowBytes = width * elemSize;
+		const uint64_t start = image.blockList[0].offset;
+		bool consecutive = true;
+		for (const Block& block : image.blockList)
+		{
+			consecutive = consecutive && block.offset == start + uint64_t(block.area.y) * rowBytes;
+		}
+		if (consecutive && image.blockList.size() > 1)
+		{
+			Block page;
+			page.area = cv::Rect(cv::Point(0, 0), image.imageSize);
+			page.storedRows = image.imageSize.height;
+			page.storedCols = image.imageSize.width;
+			page.offset = start;
+			page.bytes = height * rowBytes;
+			image.blockList.assign(1, page);
+		}
+	}
+	return image;
+}
+
+bool MappedImage::isTiff(const std::string& path)
+{
+	std::string name = path;
+	std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	auto endsWith = [&](const std::string& suffix)
+	{
+		return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+	};
+	return endsWith(".tif") || endsWith(".tiff");
+}
+
+/**
+ * @brief Reads an image at its own depth, mapped when it is a TIFF that tiff() accepts.
+ *
+ * @param path Image file.
+ */
+cv::Mat MappedImage::load(const std::string& path)
+{
+	if (isTiff(path))
+	{
+		try
+		{
+			return tiff(path).image();
+		}
+		catch (const std::runtime_error&)
+		{
+			// Layouts that are not mapped, and unreadable files, are left to cv::imread
+		}
+	}
+	return cv::imread(path, cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH);
+}
+
+std::vector<cv::Rect> MappedImage::blocks() const
+{
+	std::vector<cv::Rect> areas;
+	areas.reserve(blockList.size());
+	for (const Block& block : blockList)
+	{
+		areas.push_back(block.area);
+	}
+	return areas;
+}
+
+bool MappedImage::isMapped(int index) const
+{
+	CV_Assert(index >= 0 && index < static_cast<int>(blockList.size()));
+	if (compression != COMPRESSION::NONE || swapBytes)
+		return false;
+
+	// The mapping starts on a page boundary, so a view's samples are aligned to their size when
+	// its offset and row stride are; other blocks are copied by decode()
+	const Block& b = blockList[index];
+	const size_t elemSize = CV_ELEM_SIZE(imageDepth);
+	return b.offset % elemSize == 0 && rowStride(b) % elemSize == 0;
+}
+
+/**
+ * @brief Pixels of a block: a view, a decoded buffer, or the block's part of the decoded page.
+ *
+ * @param index Block in file order.
+ */
+cv::Mat MappedImage::block(int index) const
+{
+	CV_Assert(index >= 0 && index < static_cast<int>(blockList.size()));
+	const Block& b = blockList[index];
+	const cv::Rect area(0, 0, b.area.width, b.area.height);
+
+	if (isMapped(index))
+		return MappedFile::view(file, b.offset, b.area.height, b.area.width, imageDepth, rowStride(b));
+	if (compression == COMPRESSION::OTHER)
+		return decodePage()(b.area);
+	return decode(b)(area);
+}
+
+/**
+ * @brief Pixels of a rectangle, viewed in place when a single mapped block holds it.
+ *
+ * @param roi Rectangle inside the image.
+ */
+cv::Mat MappedImage::read(const cv::Rect& roi) const
+{
+	if ((roi & cv::Rect(cv::Point(0, 0), imageSize)) != roi || roi.area() == 0)
+		throw std::invalid_argument("MappedImage: the rectangle must be a non-empty part of the image.");
+	if (compression == COMPRESSION::OTHER)
+		return decodePage()(roi);
+
+	for (size_t k = 0; k < blockList.size(); k++)
+	{
+		if ((blockList[k].area & roi) == roi && isMapped(static_cast<int>(k)))
+			return block(static_cast<int>(k))(roi - blockList[k].area.tl());
+	}
+
+	cv::Mat pixels(roi.size(), imageDepth);
+	for (size_t k = 0; k < blockList.size(); k++)
+	{
+		const cv::Rect overlap = blockList[k].area & roi;
+		if (overlap.area() > 0)
+			block(static_cast<int>(k))(overlap - blockList[k].area.tl()).copyTo(pixels(overlap - roi.tl()));
+	}
+	return pixels;
+}
+
+/**
+ * @brief Decompresses a block, then swaps the bytes of foreign 16-bit samples and integrates the
+ * horizontal differences of the predictor, row by row.
+ *
+ * @param block Block to decode.
+ * @return storedRows x storedCols pixels.
+ */
+cv::Mat MappedImage::decode(const Block& block) const
+{
+	cv::Mat pixels(block.storedRows, block.storedCols, imageDepth, cv::Scalar(0));
+	const uint8_t* src = file->data() + block.offset;
+	const size_t srcBytes = static_cast<size_t>(block.bytes);
+	const size_t dstBytes = pixels.total() * pixels.elemSize();
+
+	switch (compression)
+	{
+	case COMPRESSION::NONE:
+		std::memcpy(pixels.data, src, dstBytes);
+		break;
+	case COMPRESSION::PACKBITS:
+		unpackBits(src, srcBytes, pixels.data, dstBytes);
+		break;
+	case COMPRESSION::LZW:
+		unpackLzw(src, srcBytes, pixels.data, dstBytes);
+		break;
+	default:
+		throw std::logic_error("MappedImage: compression is decoded by page.");
+	}
+
+	const bool wide = pixels.elemSize() == 2;
+	for (int i = 0; i < pixels.rows; i++)
+	{
+		if (wide)
+		{
+			uint16_t* row = pixels.ptr<uint16_t>(i);
+			if (swapBytes)
+			{
+				for (int j = 0; j < pixels.cols; j++)
+				{
+					row[j] = static_cast<uint16_t>(row[j] << 8 | row[j] >> 8);
+				}
+			}
+			if (predictor)
+			{
+				for (int j = 1; j < pixels.cols; j++)
+				{
+					row[j] = static_cast<uint16_t>(row[j] + row[j - 1]);
+				}
+			}
+		}
+		else if (predictor)
+		{
+			uint8_t* row = pixels.ptr<uint8_t>(i);
+			for (int j = 1; j < pixels.cols; j++)
+			{
+				row[j] = static_cast<uint8_t>(row[j] + row[j - 1]);
+			}
+		}
+	}
+	return pixels;
+}
+
+/**
+ * @brief Decodes the page with cv::imread at its own depth on the first call and keeps it.
+ */
+cv::Mat MappedImage::decodePage() const
+{
+	std::lock_guard<std::mutex> lock(decodedPage->mutex);
+	if (decodedPage->image.empty())
+	{
+		decodedPage->image = cv::imread(file->path(), cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH);
+		if (decodedPage->image.empty())
+			throw std::runtime_error("MappedImage: cannot decode " + file->path());
+	}
+	return decodedPage->image;
+}
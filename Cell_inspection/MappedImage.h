@@ -0,0 +1,144 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+
+/**
+ * @class MappedImage
+ * @brief Grayscale image of 8 or 16 bits read in place from a memory-mapped raw frame or TIFF.
+ *
+ * A raw frame is a block of pixels after an optional header, rows without padding. A TIFF is read
+ * from its first page, stored in strips or tiles of one sample per pixel. Both are mapped with
+ * MappedFile and parsed without decoding any pixel: blocks (strips or tiles) that are stored
+ * uncompressed in the byte order of the machine, with samples aligned to their size, are handed
+ * out as cv::Mat views of the mapping, and consecutive uncompressed strips make the whole page one
+ * such view. Other blocks are decoded on demand into a fresh buffer each time they are read:
+ * PackBits and LZW (with or without the horizontal predictor) here, any other compression by
+ * decoding the whole page with cv::imread on the first read and keeping it.
+ *
+ * Views share ownership of the mapping, so they stay valid after the MappedImage is gone; they are
+ * read-only. Copies of a MappedImage share the mapping.
+ */
+class MappedImage
+{
+public:
+    /**
+     * @brief Maps a raw frame.
+     * @param path Frame file.
+     * @param size Frame size in pixels.
+     * @param depth CV_8U or CV_16U; 16-bit pixels are in the byte order of the machine.
+     * @param headerBytes Bytes before the first pixel.
+     * @throws std::invalid_argument for another depth or an empty size.
+     * @throws std::runtime_error when the file cannot be mapped or is too small.
+     */
+    static MappedImage raw(const std::string& path, cv::Size size, int depth, size_t headerBytes = 0);
+
+    /**
+     * @brief Maps a TIFF and parses the layout of its first page.
+     * @throws std::runtime_error when the file cannot be mapped, is not a classic TIFF, or its first
+     * page is not a single-channel image of 8 or 16 bits per sample.
+     */
+    static MappedImage tiff(const std::string& path);
+
+    /**
+     * @brief True when the file name ends with .tif or .tiff, in any case.
+     */
+    static bool isTiff(const std::string& path);
+
+    /**
+     * @brief Reads a grayscale image at its own depth: a TIFF through tiff(), so an uncompressed
+     * page is a view of the mapping, and any other file, or a TIFF that tiff() cannot map such as
+     * a colour one, with cv::imread.
+     * @return The image, empty when the file cannot be read.
+     */
+    static cv::Mat load(const std::string& path);
+
+    cv::Size size() const { return imageSize; }
+
+    /**
+     * @brief CV_8U or CV_16U, or CV_8S or CV_16S for signed TIFF samples.
+     */
+    int depth() const { return imageDepth; }
+
+    /**
+     * @brief Image area of every block (strip or tile, cropped to the image), in file order.
+     */
+    std::vector<cv::Rect> blocks() const;
+
+    /**
+     * @brief True when block index is a view of the mapping, false when it is decoded on read:
+     * compressed, in the other byte order, or with samples not aligned to their size.
+     */
+    bool isMapped(int index) const;
+
+    /**
+     * @brief True when the whole image is a single view of the mapping.
+     */
+    bool isContiguous() const { return blockList.size() == 1 && isMapped(0); }
+
+    /**
+     * @brief Pixels of one block, a view of the mapping or a decoded copy.
+     */
+    cv::Mat block(int index) const;
+
+    /**
+     * @brief Pixels of a rectangle of the image: a view when it lies in one mapped block, and
+     * otherwise a buffer assembled from the blocks it touches, which are decoded as needed.
+     * @throws std::invalid_argument when the rectangle is not inside the image.
+     */
+    cv::Mat read(const cv::Rect& roi) const;
+
+    /**
+     * @brief The whole image; a view of the mapping when isContiguous().
+     */
+    cv::Mat image() const { return read(cv::Rect(cv::Point(0, 0), imageSize)); }
+
+private:
+    enum class COMPRESSION {
+        NONE,
+        LZW,
+        PACKBITS,
+        OTHER       // Decoded with cv::imread
+    };
+
+    // One strip or tile as stored
+    struct Block
+    {
+        cv::Rect area;              // Pixels of the image it holds
+        int storedRows = 0;         // Rows and columns as stored; tiles at the edges are padded
+        int storedCols = 0;
+        uint64_t offset = 0;
+        uint64_t bytes = 0;
+    };
+
+    std::shared_ptr<const MappedFile> file;
+    cv::Size imageSize;
+    int imageDepth = CV_8U;
+    COMPRESSION compression = COMPRESSION::NONE;
+    bool swapBytes = false;         // 16-bit samples in the other byte order
+    bool predictor = false;         // Horizontal differencing
+    std::vector<Block> blockList;
+
+    // Page decoded by cv::imread, shared by the copies
+    struct DecodedPage
+    {
+        std::mutex mutex;
+        cv::Mat image;
+    };
+    std::shared_ptr<DecodedPage> decodedPage;
+
+    MappedImage() {}
+
+    // Bytes between the stored rows of a block
+    size_t rowStride(const Block& block) const { return size_t(block.storedCols) * CV_ELEM_SIZE(imageDepth); }
+
+    // Decompresses a block into a rows x cols buffer and undoes the byte order and predictor
+    cv::Mat decode(const Block& block) const;
+
+    // Whole page decoded by cv::imread, for the compressions that are not decoded here
+    cv::Mat decodePage() const;
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @class ObjectPool
+ * @brief Free list of heavyweight objects (analyses, workspaces) shared by concurrent tasks.
+ *
+ * A task takes an object, uses it and gives it back, so the pool holds as many objects as tasks
+ * ever ran at the same time, at most the worker count plus the calling thread, however many tasks
+ * there are. Objects keep their buffers between tasks, so tasks of the same size reuse them.
+ */
+template <typename T>
+class ObjectPool
+{
+public:
+    /**
+     * @brief A free object, or a default-constructed one when every object is in use.
+     */
+    std::unique_ptr<T> take()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (free.empty())
+            return std::unique_ptr<T>(new T());
+        std::unique_ptr<T> object = std::move(free.back());
+        free.pop_back();
+        return object;
+    }
+
+    /**
+     * @brief Returns an object taken with take().
+     */
+    void give(std::unique_ptr<T> object)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        free.push_back(std::move(object));
+    }
+
+    /**
+     * @brief Destroys the free objects.
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        free.clear();
+    }
+
+    /**
+     * @brief Calls f on every free object.
+     */
+    template <class F>
+    void forEach(F f) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const std::unique_ptr<T>& object : free)
+        {
+            f(*object);
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<T>> free;
+    mutable std::mutex mutex;
+};
@@ -0,0 +1,32 @@
+#pragma once
+#include <opencv2/core.hpp>
+
+/**
+ * @struct Precision
+ * @brief Working precision of the analysis: the type of every gradient, tensor and output value.
+ *
+ * The gradient calculators, the structure tensor kernel and the analysis are templates over
+ * the value type T, instantiated for float and double. A precision is chosen once, by the type
+ * of the analysis, and holds end to end: every gradient method produces depth values, the
+ * window and the eigen-analysis run in T and the output maps have that depth.
+ *
+ * float is the default (StructureTensorAnalysis, GradientCalculator...): it halves the memory
+ * traffic of every stage, which bounds the throughput of the whole pipeline. double is meant
+ * for reference results and for inputs whose dynamic range float cannot hold.
+ */
+template <typename T>
+struct Precision;
+
+template <>
+struct Precision<float>
+{
+    static constexpr int depth = CV_32F;
+    static const char* name() { return "float"; }
+};
+
+template <>
+struct Precision<double>
+{
+    static constexpr int depth = CV_64F;
+    static const char* name() { return "double"; }
+};
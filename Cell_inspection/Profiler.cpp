@@ -0,0 +1,175 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <fstream>
+
+#ifdef CELL_INSPECTION_PROFILING
+#include "CountingAllocator.h"
+#endif
+
+/**
+ * @brief Starts the trace clock and, in profiling builds, installs the counting allocator.
+ */
+Profiler::Profiler() :
+	epoch{ Clock::now() }
+{
+#ifdef CELL_INSPECTION_PROFILING
+	CountingAllocator::installDefault();
+#endif
+}
+
+/**
+ * @brief Copies the statistics and trace events; the copy has its own lock.
+ */
+Profiler::Profiler(const Profiler& other)
+{
+	*this = other;
+}
+
+Profiler& Profiler::operator=(const Profiler& other)
+{
+	if (this == &other)
+		return *this;
+
+	std::lock(mutex, other.mutex);
+	std::lock_guard<std::mutex> lock(mutex, std::adopt_lock);
+	std::lock_guard<std::mutex> otherLock(other.mutex, std::adopt_lock);
+	epoch = other.epoch;
+	stages = other.stages;
+	events = other.events;
+	threads = other.threads;
+	traceEnabled = other.traceEnabled;
+	droppedEvents = other.droppedEvents;
+	return *this;
+}
+
+/**
+ * @brief Adds one interval to the statistics of its stage and method, and to the trace.
+ *
+ * @param stage Stage name.
+ * @param method Gradient method name.
+ * @param start Start of the interval.
+ * @param end End of the interval.
+ * @param bytes Bytes allocated during the interval.
+ * @param pixels Pixels processed during the interval.
+ */
+void Profiler::record(const char* stage, const char* method, Clock::time_point start, Clock::time_point end,
+	size_t bytes, int64_t pixels)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto found = std::find_if(stages.begin(), stages.end(), [&](const StageStatistics& s)
+	{
+		return s.stage == stage && s.method == method;
+	});
+	if (found == stages.end())
+	{
+		stages.emplace_back();
+		found = stages.end() - 1;
+		found->stage = stage;
+		found->method = method;
+	}
+	found->calls++;
+	found->seconds += std::chrono::duration<double>(end - start).count();
+	found->bytesAllocated += bytes;
+	found->pixels += pixels;
+
+	if (!traceEnabled)
+		return;
+	if (events.size() >= maxTraceEvents)
+	{
+		droppedEvents++;
+		return;
+	}
+
+	std::thread::id id = std::this_thread::get_id();
+	auto thread = std::find(threads.begin(), threads.end(), id);
+	if (thread == threads.end())
+		thread = threads.insert(threads.end(), id);
+
+	TraceEvent event;
+	event.stage = stage;
+	event.method = method;
+	event.thread = static_cast<int>(thread - threads.begin());
+	event.start = std::chrono::duration_cast<std::chrono::microseconds>(start - epoch).count();
+	event.duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	event.pixels = pixels;
+	event.bytes = bytes;
+	events.push_back(event);
+}
+
+/**
+ * @brief Copy of the aggregated statistics.
+ *
+ * @return One entry per stage and method.
+ */
+std::vector<Profiler::StageStatistics> Profiler::statistics() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stages;
+}
+
+/**
+ * @brief Clears statistics and trace events and restarts the trace clock.
+ */
+void Profiler::reset()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	stages.clear();
+	events.clear();
+	droppedEvents = 0;
+	epoch = Clock::now();
+}
+
+/**
+ * @brief Enables or disables the trace; events already recorded are kept.
+ *
+ * @param enabled True to keep every interval as a trace event.
+ */
+void Profiler::setTraceEnabled(bool enabled)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	traceEnabled = enabled;
+}
+
+/**
+ * @brief Writes the trace as complete ("X") events, one track per thread.
+ *
+ * Stage and method names are identifiers, so they are written without escaping.
+ *
+ * @param path Output file.
+ * @return False when the file cannot be written.
+ */
+bool Profiler::writeChromeTrace(const std::string& path) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::ofstream file(path);
+	if (!file.is_open())
+		return false;
+
+	file << "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":" << droppedEvents << "},\"traceEvents\":[";
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		const TraceEvent& e = events[i];
+		file << (i ? ",\n" : "\n")
+			<< "{\"name\":\"" << e.stage << "\",\"cat\":\"" << e.method << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+			<< ",\"ts\":" << e.start << ",\"dur\":" << e.duration
+			<< ",\"args\":{\"pixels\":" << e.pixels << ",\"bytes\":" << e.bytes << "}}";
+	}
+	file << "\n]}\n";
+	return static_cast<bool>(file);
+}
+
+/**
+ * @brief Bytes of cv::Mat buffers allocated by the calling thread.
+ *
+ * @return Running total; 0 when profiling is compiled out.
+ */
+size_t Profiler::threadAllocatedBytes()
+{
+#ifdef CELL_INSPECTION_PROFILING
+	return CountingAllocator::threadAllocatedBytes();
+#else
+	return 0;
+#endif
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @class Profiler
+ * @brief Per-stage timing, allocation and throughput statistics of the analysis hot path.
+ *
+ * The hot path is instrumented with CELL_PROFILE_SCOPE and blocks guarded by
+ * CELL_INSPECTION_PROFILING. Without that definition (the default) the instrumentation compiles
+ * to nothing and the statistics stay empty; the class itself is always available so that code
+ * reading the report builds either way.
+ *
+ * Statistics are aggregated per stage and gradient method. Optionally every recorded interval is
+ * also kept as a trace event and can be written as a Chrome trace (chrome://tracing, Perfetto).
+ *
+ * Allocated bytes are those of cv::Mat buffers allocated by the recording thread while the
+ * stage ran. To see them, profiling builds wrap OpenCV's default allocator in a CountingAllocator
+ * when the first profiler is created, unless it already counts; buffers allocated by OpenCV's
+ * internal worker threads are not attributed to any stage.
+ */
+class Profiler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief True when the instrumentation is compiled in.
+     */
+#ifdef CELL_INSPECTION_PROFILING
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    /**
+     * @brief Aggregated statistics of one stage and gradient method.
+     */
+    struct StageStatistics
+    {
+        std::string stage;
+        std::string method;
+        int64_t calls = 0;
+        double seconds = 0;         // Summed wall time over all threads
+        size_t bytesAllocated = 0;
+        int64_t pixels = 0;
+
+        /**
+         * @brief Pixel throughput of the stage per second of its own wall time.
+         */
+        double megapixelsPerSecond() const { return seconds > 0 ? pixels / seconds * 1e-6 : 0.0; }
+    };
+
+    Profiler();
+    Profiler(const Profiler& other);
+    Profiler& operator=(const Profiler& other);
+
+    /**
+     * @brief Adds one interval of a stage. Thread-safe.
+     * @param stage Stage name (a string literal).
+     * @param method Gradient method name (a string literal).
+     * @param start Start of the interval.
+     * @param end End of the interval.
+     * @param bytes Bytes allocated during the interval.
+     * @param pixels Pixels processed during the interval.
+     */
+    void record(const char* stage, const char* method, Clock::time_point start, Clock::time_point end,
+        size_t bytes, int64_t pixels);
+
+    /**
+     * @brief Copy of the aggregated statistics, in the order the stages were first seen.
+     */
+    std::vector<StageStatistics> statistics() const;
+
+    /**
+     * @brief Clears statistics and trace events.
+     */
+    void reset();
+
+    /**
+     * @brief Keeps every interval as a trace event (at most maxTraceEvents of them).
+     */
+    void setTraceEnabled(bool enabled);
+
+    /**
+     * @brief Writes the trace events in the Chrome trace-event JSON format.
+     * @return False when the file cannot be written.
+     */
+    bool writeChromeTrace(const std::string& path) const;
+
+    /**
+     * @brief Bytes of cv::Mat buffers the calling thread has allocated so far; 0 without profiling.
+     */
+    static size_t threadAllocatedBytes();
+
+    /**
+     * @brief Upper bound on the trace events kept, so that a long run cannot exhaust memory.
+     */
+    static const size_t maxTraceEvents = 1 << 20;
+
+    /**
+     * @brief Records the lifetime of a scope as one interval of a stage.
+     */
+    class Scope
+    {
+    public:
+        Scope(Profiler& profiler, const char* stage, const char* method, int64_t pixels) :
+            profiler(profiler), stage(stage), method(method), pixels(pixels),
+            bytes(threadAllocatedBytes()), start(Clock::now()) {}
+
+        ~Scope()
+        {
+            profiler.record(stage, method, start, Clock::now(), threadAllocatedBytes() - bytes, pixels);
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Profiler& profiler;
+        const char* stage;
+        const char* method;
+        int64_t pixels;
+        size_t bytes;
+        Clock::time_point start;
+    };
+
+private:
+    struct TraceEvent
+    {
+        const char* stage;
+        const char* method;
+        int thread;
+        int64_t start;      // Microseconds since the profiler epoch
+        int64_t duration;
+        int64_t pixels;
+        size_t bytes;
+    };
+
+    mutable std::mutex mutex;
+    Clock::time_point epoch;
+    std::vector<StageStatistics> stages;
+    std::vector<TraceEvent> events;
+    std::vector<std::thread::id> threads;   // Trace thread numbers
+    bool traceEnabled = false;
+    size_t droppedEvents = 0;
+};
+
+#define CELL_PROFILE_CONCAT_(a, b) a##b
+#define CELL_PROFILE_CONCAT(a, b) CELL_PROFILE_CONCAT_(a, b)
+
+#ifdef CELL_INSPECTION_PROFILING
+#define CELL_PROFILE_SCOPE(profiler, stage, method, pixels) \
+    Profiler::Scope CELL_PROFILE_CONCAT(profileScope, __LINE__)(profiler, stage, method, pixels)
+#else
+#define CELL_PROFILE_SCOPE(profiler, stage, method, pixels) ((void)0)
+#endif
@@ -0,0 +1,265 @@
+#include "RecursiveGaussian.h"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <complex>
+#include <stdexcept>
+
+/**
+ * @brief Computes the feedback coefficients and the boundary matrix of a standard deviation.
+ *
+ * The poles d_k of the sigma = 2 filter are raised to 1 / q, with q solved by Newton's method so
+ * that the variance of the forward-backward impulse response, 2 * sum d / (d - 1)^2, is sigma^2.
+ *
+ * @param sigma Standard deviation in pixels.
+ */
+RecursiveGaussian::RecursiveGaussian(double sigma) :
+	filterSigma{ sigma }
+{
+	if (sigma < minSigma)
+		throw std::invalid_argument("RecursiveGaussian: sigma is below the accuracy range of the filter.");
+
+	typedef std::complex<double> Complex;
+	const Complex poles[3] = { Complex(1.41650, 1.00829), Complex(1.41650, -1.00829), Complex(1.86543, 0.0) };
+
+	auto variance = [&poles](double q)
+	{
+		Complex sum = 0.0;
+		for (const Complex& pole : poles)
+		{
+			Complex d = std::pow(pole, 1.0 / q);
+			sum += d / ((d - 1.0) * (d - 1.0));
+		}
+		return 2.0 * sum.real();
+	};
+
+	double q = sigma / 2;
+	for (int iteration = 0; iteration < 20; iteration++)
+	{
+		double h = 1e-6 * q;
+		double slope = (variance(q + h) - variance(q - h)) / (2 * h);
+		double step = (variance(q) - sigma * sigma) / slope;
+		q -= step;
+		if (std::abs(step) < 1e-12 * q)
+			break;
+	}
+
+	// (1 - p1 z^-1)(1 - p2 z^-1)(1 - p3 z^-1) = 1 - a1 z^-1 - a2 z^-2 - a3 z^-3 with p = 1 / d
+	Complex p[3];
+	for (int k = 0; k < 3; k++)
+	{
+		p[k] = 1.0 / std::pow(poles[k], 1.0 / q);
+	}
+	feedback[0] = (p[0] + p[1] + p[2]).real();
+	feedback[1] = -(p[0] * p[1] + p[0] * p[2] + p[1] * p[2]).real();
+	feedback[2] = (p[0] * p[1] * p[2]).real();
+	gain = 1.0 - feedback[0] - feedback[1] - feedback[2];
+
+	// Triggs and Sdika, "Boundary conditions for Young-van Vliet recursive filtering", 2006
+	const double a1 = feedback[0];
+	const double a2 = feedback[1];
+	const double a3 = feedback[2];
+	const double k = 1.0 / ((1 + a1 - a2 + a3) * (1 - a1 - a2 - a3) * (1 + a2 + (a1 - a3) * a3));
+	boundary[0][0] = k * (-a3 * a1 + 1 - a3 * a3 - a2);
+	boundary[0][1] = k * (a3 + a1) * (a2 + a3 * a1);
+	boundary[0][2] = k * a3 * (a1 + a3 * a2);
+	boundary[1][0] = k * (a1 + a3 * a2);
+	boundary[1][1] = -k * (a2 - 1) * (a2 + a3 * a1);
+	boundary[1][2] = -k * (a3 * a1 + a3 * a3 + a2 - 1) * a3;
+	boundary[2][0] = k * (a3 * a1 + a2 + a1 * a1 - a2 * a2);
+	boundary[2][1] = k * (a1 * a2 + a3 * a2 * a2 - a1 * a3 * a3 - a3 * a3 * a3 - a3 * a2 + a3);
+	boundary[2][2] = k * a3 * (a1 + a3 * a2);
+}
+
+/**
+ * @brief Smooths an image: every row, then every strip of columns.
+ *
+ * @param src Input CV_32F or CV_64F image.
+ * @param dst Output image; may be src.
+ * @param pool Optional thread pool.
+ */
+void RecursiveGaussian::apply(const cv::Mat& src, cv::Mat& dst, ThreadPool* pool)
+{
+	if (src.type() != CV_32FC1 && src.type() != CV_64FC1)
+		throw std::invalid_argument("RecursiveGaussian: only single-channel CV_32F or CV_64F images are supported.");
+	if (src.rows < 3 || src.cols < 3)
+		throw std::invalid_argument("RecursiveGaussian: image must be at least 3 x 3.");
+
+	if (src.depth() == CV_64F)
+		filter<double>(src, dst, pool);
+	else
+		filter<float>(src, dst, pool);
+}
+
+/**
+ * @brief Row passes then column passes over an image of value type T.
+ *
+ * @param src Input image.
+ * @param dst Output image; may be src.
+ * @param pool Optional thread pool.
+ */
+template <typename T>
+void RecursiveGaussian::filter(const cv::Mat& src, cv::Mat& dst, ThreadPool* pool)
+{
+	const int rows = src.rows;
+	const int cols = src.cols;
+	dst.create(rows, cols, src.type());
+
+	ThreadPool::forEach(pool, 0, rows, [&](int row)
+	{
+		filterRow(src.ptr<T>(row), dst.ptr<T>(row), cols);
+	});
+
+	state.resize(3 * static_cast<size_t>(cols));
+	lastRow.assign(dst.ptr<T>(rows - 1), dst.ptr<T>(rows - 1) + cols);
+
+	const int blockCols = 256;
+	const int blocks = (cols + blockCols - 1) / blockCols;
+	ThreadPool::forEach(pool, 0, blocks, [&](int block)
+	{
+		int begin = block * blockCols;
+		filterColumns<T>(dst, begin, std::min(cols, begin + blockCols));
+	});
+}
+
+/**
+ * @brief Causal then anti-causal pass over one row.
+ *
+ * The causal pass starts from the steady state of the replicated first value. The anti-causal
+ * pass starts from the Triggs-Sdika values of y[n - 1], y[n] and y[n + 1], which are exact for
+ * a replicated last value.
+ *
+ * @param src Input row.
+ * @param dst Output row; may be src.
+ * @param n Row length, at least 3.
+ */
+template <typename T>
+void RecursiveGaussian::filterRow(const T* src, T* dst, int n) const
+{
+	const double b = gain;
+	const double a1 = feedback[0];
+	const double a2 = feedback[1];
+	const double a3 = feedback[2];
+	const double first = src[0];
+	const double last = src[n - 1];
+
+	double w1 = first, w2 = first, w3 = first;
+	for (int i = 0; i < n; i++)
+	{
+		double w = b * src[i] + a1 * w1 + a2 * w2 + a3 * w3;
+		dst[i] = static_cast<T>(w);
+		w3 = w2;
+		w2 = w1;
+		w1 = w;
+	}
+
+	double d0 = w1 - last, d1 = w2 - last, d2 = w3 - last;
+	double y1 = b * (boundary[0][0] * d0 + boundary[0][1] * d1 + boundary[0][2] * d2) + last;
+	double y2 = b * (boundary[1][0] * d0 + boundary[1][1] * d1 + boundary[1][2] * d2) + last;
+	double y3 = b * (boundary[2][0] * d0 + boundary[2][1] * d1 + boundary[2][2] * d2) + last;
+	dst[n - 1] = static_cast<T>(y1);
+	for (int i = n - 2; i >= 0; i--)
+	{
+		double y = b * dst[i] + a1 * y1 + a2 * y2 + a3 * y3;
+		dst[i] = static_cast<T>(y);
+		y3 = y2;
+		y2 = y1;
+		y1 = y;
+	}
+}
+
+/**
+ * @brief Causal then anti-causal pass down a strip of columns.
+ *
+ * The passes walk whole rows of the strip so that memory is read contiguously; the three
+ * previous outputs of every column are kept in the state rows.
+ *
+ * @param dst Image filtered in place.
+ * @param colBegin First column of the strip.
+ * @param colEnd One past the last column of the strip.
+ */
+template <typename T>
+void RecursiveGaussian::filterColumns(cv::Mat& dst, int colBegin, int colEnd)
+{
+	const int rows = dst.rows;
+	const int cols = dst.cols;
+	const int n = colEnd - colBegin;
+	const double b = gain;
+	const double a1 = feedback[0];
+	const double a2 = feedback[1];
+	const double a3 = feedback[2];
+
+	double* s1 = state.data() + colBegin;
+	double* s2 = s1 + cols;
+	double* s3 = s2 + cols;
+	const double* last = lastRow.data() + colBegin;
+
+	const T* top = dst.ptr<T>(0) + colBegin;
+	for (int j = 0; j < n; j++)
+	{
+		s1[j] = s2[j] = s3[j] = top[j];
+	}
+
+	for (int i = 0; i < rows; i++)
+	{
+		T* row = dst.ptr<T>(i) + colBegin;
+		for (int j = 0; j < n; j++)
+		{
+			double w = b * row[j] + a1 * s1[j] + a2 * s2[j] + a3 * s3[j];
+			row[j] = static_cast<T>(w);
+			s3[j] = s2[j];
+			s2[j] = s1[j];
+			s1[j] = w;
+		}
+	}
+
+	T* bottom = dst.ptr<T>(rows - 1) + colBegin;
+	for (int j = 0; j < n; j++)
+	{
+		double d0 = s1[j] - last[j], d1 = s2[j] - last[j], d2 = s3[j] - last[j];
+		s1[j] = b * (boundary[0][0] * d0 + boundary[0][1] * d1 + boundary[0][2] * d2) + last[j];
+		s2[j] = b * (boundary[1][0] * d0 + boundary[1][1] * d1 + boundary[1][2] * d2) + last[j];
+		s3[j] = b * (boundary[2][0] * d0 + boundary[2][1] * d1 + boundary[2][2] * d2) + last[j];
+		bottom[j] = static_cast<T>(s1[j]);
+	}
+
+	for (int i = rows - 2; i >= 0; i--)
+	{
+		T* row = dst.ptr<T>(i) + colBegin;
+		for (int j = 0; j < n; j++)
+		{
+			double y = b * row[j] + a1 * s1[j] + a2 * s2[j] + a3 * s3[j];
+			row[j] = static_cast<T>(y);
+			s3[j] = s2[j];
+			s2[j] = s1[j];
+			s1[j] = y;
+		}
+	}
+}
+
+/**
+ * @brief Gaussian smoothing with the recursive filter where it is accurate.
+ *
+ * @param src Input CV_32F or CV_64F image.
+ * @param dst Output image; may be src.
+ * @param sigma Standard deviation in pixels.
+ * @param engine Filter reused between calls.
+ * @param pool Optional thread pool.
+ */
+void RecursiveGaussian::blur(const cv::Mat& src, cv::Mat& dst, double sigma, RecursiveGaussian& engine, ThreadPool* pool)
+{
+	if (sigma < minSigma || src.rows < 3 || src.cols < 3)
+	{
+		cv::GaussianBlur(src, dst, cv::Size(0, 0), sigma);
+		return;
+	}
+
+	if (engine.sigma() != sigma)
+	{
+		RecursiveGaussian rebuilt(sigma);
+		engine.filterSigma = rebuilt.filterSigma;
+		engine.gain = rebuilt.gain;
+		std::copy_n(rebuilt.feedback, 3, engine.feedback);
+		std::copy_n(&rebuilt.boundary[0][0], 9, &engine.boundary[0][0]);
+	}
+	engine.apply(src, dst, pool);
+}
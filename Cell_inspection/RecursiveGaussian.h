@@ -0,0 +1,89 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <vector>
+#include "ThreadPool.h"
+
+/**
+ * @class RecursiveGaussian
+ * @brief Gaussian smoothing with a third-order recursive (IIR) filter whose cost does not depend on sigma.
+ *
+ * Each direction is filtered by a causal and an anti-causal pass of the van Vliet, Young and
+ * Verbeek filter (poles 1.41650 +- 1.00829i and 1.86543, scaled so that the variance of the
+ * impulse response is exactly sigma^2). Borders are replicated, with the exact Triggs and Sdika
+ * initialisation of the anti-causal pass, and the recursions run in double precision.
+ *
+ * Accuracy against the kernel of cv::GaussianBlur, measured on the 1-D impulse response h
+ * against the sampled Gaussian g:
+ *
+ *     sigma >= 2:  sum |h - g| <= 0.029,  max |h - g| <= 2.1 % of the peak of g
+ *     sigma >= 4:  sum |h - g| <= 0.022,  max |h - g| <= 1.2 % of the peak of g
+ *     sigma >= 8:  sum |h - g| <= 0.021,  max |h - g| <= 1.1 % of the peak of g
+ *
+ * The first figure bounds the error of a 1-D pass on an input bounded by |x| <= M by 0.029 M,
+ * and the separable 2-D filter by twice that. The DC gain is exactly one. Below minSigma the
+ * approximation degrades quickly and blur() uses cv::GaussianBlur instead, which is cheap there.
+ */
+class RecursiveGaussian
+{
+public:
+
+    /**
+     * @brief Smallest sigma the recursive filter is used for.
+     */
+    static constexpr double minSigma = 2.0;
+
+    RecursiveGaussian() {};
+
+    /**
+     * @brief Computes the filter coefficients of a standard deviation.
+     * @param sigma Standard deviation in pixels, at least minSigma.
+     */
+    explicit RecursiveGaussian(double sigma);
+
+    /**
+     * @brief Standard deviation the filter was built for.
+     */
+    double sigma() const { return filterSigma; }
+
+    /**
+     * @brief Smooths a single-channel CV_32F or CV_64F image; src and dst may be the same.
+     * @param src Input image, at least 3 x 3.
+     * @param dst Output image.
+     * @param pool Optional thread pool the rows and column strips are distributed over.
+     */
+    void apply(const cv::Mat& src, cv::Mat& dst, ThreadPool* pool = nullptr);
+
+    /**
+     * @brief Smooths with the recursive filter when sigma >= minSigma and the image is at least
+     * 3 x 3, and with cv::GaussianBlur otherwise.
+     * @param engine Filter reused between calls; rebuilt when sigma changes.
+     */
+    static void blur(const cv::Mat& src, cv::Mat& dst, double sigma, RecursiveGaussian& engine, ThreadPool* pool = nullptr);
+
+private:
+    double filterSigma = 0;
+    double gain = 1;            // B, input gain of each pass
+    double feedback[3] = {};    // y[n] = B x[n] + a1 y[n - 1] + a2 y[n - 2] + a3 y[n - 3]
+    double boundary[3][3] = {}; // Triggs-Sdika matrix for the anti-causal initialisation
+
+    std::vector<double> state;      // Recursion state of the vertical passes, 3 rows of cols values
+    std::vector<double> lastRow;    // Input row rows - 1, kept for the anti-causal initialisation
+
+    /**
+     * @brief Filters one row in place, reading it from src.
+     */
+    template <typename T>
+    void filterRow(const T* src, T* dst, int n) const;
+
+    /**
+     * @brief Filters the columns [colBegin, colEnd) of dst in place.
+     */
+    template <typename T>
+    void filterColumns(cv::Mat& dst, int colBegin, int colEnd);
+
+    /**
+     * @brief apply() for images of value type T.
+     */
+    template <typename T>
+    void filter(const cv::Mat& src, cv::Mat& dst, ThreadPool* pool);
+};
@@ -0,0 +1,107 @@
+#include "ReducedPrecision.h"
+#include <cmath>
+#include <cstring>
+
+template <typename T>
+int ReducedPrecision::depth(STORAGE storage)
+{
+	switch (storage)
+	{
+	case STORAGE::FLOAT16: return CV_16F;
+	case STORAGE::INT16: return CV_16S;
+	default: return Precision<T>::depth;
+	}
+}
+
+const char* ReducedPrecision::name(STORAGE storage)
+{
+	switch (storage)
+	{
+	case STORAGE::FULL: return "FULL";
+	case STORAGE::FLOAT16: return "FLOAT16";
+	case STORAGE::INT16: return "INT16";
+	}
+	return "UNKNOWN";
+}
+
+/**
+ * @brief Encodes n values; the conversions are OpenCV's vectorized convertTo on row headers.
+ *
+ * @param src Values.
+ * @param n Number of values.
+ * @param storage Encoding.
+ * @param dst Destination of n values of depth<T>(storage).
+ * @return Scale to decode with.
+ */
+template <typename T>
+T ReducedPrecision::encodeRow(const T* src, int n, STORAGE storage, void* dst)
+{
+	const cv::Mat values(1, n, Precision<T>::depth, const_cast<T*>(src));
+	cv::Mat stored(1, n, depth<T>(storage), dst);
+
+	switch (storage)
+	{
+	case STORAGE::FULL:
+		std::memcpy(dst, src, sizeof(T) * n);
+		return 1;
+
+	case STORAGE::FLOAT16:
+	{
+		// Power of two that brings the peak to [2^14, 2^15), which scales every value exactly
+		double peak = cv::norm(values, cv::NORM_INF);
+		if (!(peak > 0))
+		{
+			stored.setTo(0);
+			return 0;
+		}
+		int exponent = 0;
+		std::frexp(peak, &exponent);
+		const double scale = std::ldexp(1.0, exponent - 15);
+		values.convertTo(stored, CV_16F, 1.0 / scale);
+		return static_cast<T>(scale);
+	}
+
+	case STORAGE::INT16:
+	{
+		double peak = cv::norm(values, cv::NORM_INF);
+		if (!(peak > 0))
+		{
+			stored.setTo(0);
+			return 0;
+		}
+		values.convertTo(stored, CV_16S, 32767.0 / peak);
+		return static_cast<T>(peak / 32767.0);
+	}
+	}
+	return 1;
+}
+
+/**
+ * @brief Decodes n values.
+ *
+ * @param src Values of depth<T>(storage).
+ * @param n Number of values.
+ * @param storage Encoding.
+ * @param scale Scale returned by encodeRow().
+ * @param dst Destination of n values.
+ */
+template <typename T>
+void ReducedPrecision::decodeRow(const void* src, int n, STORAGE storage, T scale, T* dst)
+{
+	if (storage == STORAGE::FULL)
+	{
+		std::memcpy(dst, src, sizeof(T) * n);
+		return;
+	}
+
+	const cv::Mat stored(1, n, depth<T>(storage), const_cast<void*>(src));
+	cv::Mat values(1, n, Precision<T>::depth, dst);
+	stored.convertTo(values, Precision<T>::depth, scale);
+}
+
+template int ReducedPrecision::depth<float>(STORAGE);
+template int ReducedPrecision::depth<double>(STORAGE);
+template float ReducedPrecision::encodeRow<float>(const float*, int, STORAGE, void*);
+template double ReducedPrecision::encodeRow<double>(const double*, int, STORAGE, void*);
+template void ReducedPrecision::decodeRow<float>(const void*, int, STORAGE, float, float*);
+template void ReducedPrecision::decodeRow<double>(const void*, int, STORAGE, double, double*);
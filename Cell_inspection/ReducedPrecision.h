@@ -0,0 +1,66 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include "Precision.h"
+
+/**
+ * @class ReducedPrecision
+ * @brief Row encodings of the reduced-precision storage mode.
+ *
+ * Intermediates (gradients, horizontally smoothed tensor components) can be stored in 16 bits
+ * instead of the working precision T (see Precision), which halves the memory they take in
+ * float, and quarters it in double, along with the bandwidth of every pass that reads them
+ * back. All arithmetic stays in T: rows are decoded before they are accumulated.
+ *
+ * - FULL: the values themselves, in T.
+ * - FLOAT16: IEEE half floats h with value = scale * h, one power-of-two scale per row that puts
+ *   max |value| of the row in [2^14, 2^15), so squared 8- or 16-bit gradients do not overflow
+ *   the half range (65504). The scaling is exact, so the relative error is at most 2^-11 per value
+ *   down to 2^-28 of the row peak, and the absolute error below that at most 2^-39 of it.
+ * - INT16: block floating point, one scale per row of values with
+ *   value = scale * q and scale = max |value| / 32767, so the absolute error of a value is at
+ *   most max |value of its row| / 65534.
+ */
+class ReducedPrecision
+{
+public:
+    // Storage of the intermediates
+    enum class STORAGE {
+        FULL,
+        FLOAT16,
+        INT16
+    };
+
+    /**
+     * @brief OpenCV depth of the stored values: Precision<T>::depth, CV_16F or CV_16S.
+     */
+    template <typename T>
+    static int depth(STORAGE storage);
+
+    /**
+     * @brief Name of a storage, as used in reports.
+     */
+    static const char* name(STORAGE storage);
+
+    /**
+     * @brief Encodes n values.
+     * @param src Values.
+     * @param n Number of values.
+     * @param storage Encoding.
+     * @param dst Destination of n values of depth<T>(storage).
+     * @return Scale to decode with: the row scale for FLOAT16 and INT16 (0 for a row of zeros), 1
+     * for FULL.
+     */
+    template <typename T>
+    static T encodeRow(const T* src, int n, STORAGE storage, void* dst);
+
+    /**
+     * @brief Decodes n values.
+     * @param src Values of depth<T>(storage).
+     * @param n Number of values.
+     * @param storage Encoding.
+     * @param scale Scale returned by encodeRow().
+     * @param dst Destination of n values.
+     */
+    template <typename T>
+    static void decodeRow(const void* src, int n, STORAGE storage, T scale, T* dst);
+};
@@ -0,0 +1,219 @@
+#include "SpectralGradient.h"
+#include <map>
+#include <mutex>
+#include <tuple>
+
+/**
+ * @brief Returns the cached multipliers of a padded size, building them on first use.
+ *
+ * Frequencies follow the convention of the original grids: f = k / n for k <= n / 2 and
+ * (k - n) / n otherwise, so for an odd padded size the highest bin of each half is positive
+ * and the spectrum stays Hermitian. The Nyquist entries of the odd multipliers are zeroed because the
+ * half spectrum cannot hold a non-Hermitian value there.
+ *
+ * @param rows Padded number of rows.
+ * @param cols Padded number of columns.
+ * @param kind Spectral multiplier.
+ * @return Shared, immutable plan.
+ */
+template <typename T>
+std::shared_ptr<const typename BasicSpectralGradient<T>::Plan> BasicSpectralGradient<T>::getPlan(int rows, int cols, KIND kind)
+{
+	typedef std::tuple<int, int, KIND> Key;
+	static std::mutex mutex;
+	static std::map<Key, std::shared_ptr<const Plan>> cache;
+	const size_t maxPlans = 16;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	Key key(rows, cols, kind);
+	auto found = cache.find(key);
+	if (found != cache.end())
+		return found->second;
+
+	auto frequency = [](int k, int n) { return (2 * k <= n) ? T(k) / n : T(k - n) / n; };
+	const T scale = (kind == KIND::FOURIER) ? static_cast<T>(2 * CV_PI) : T(1);
+
+	auto built = std::make_shared<Plan>();
+	built->rows = rows;
+	built->cols = cols;
+	built->kind = kind;
+
+	built->freqX.resize(cols / 2 + 1);
+	for (int k = 0; k <= cols / 2; k++)
+	{
+		bool nyquist = (cols % 2 == 0) && (k == cols / 2);
+		built->freqX[k] = nyquist ? T(0) : scale * frequency(k, cols);
+	}
+
+	built->freqY.resize(rows);
+	for (int k = 0; k < rows; k++)
+	{
+		bool nyquist = (rows % 2 == 0) && (k == rows / 2);
+		built->freqY[k] = nyquist ? T(0) : scale * frequency(k, rows);
+	}
+
+	if (kind == KIND::RIESZ)
+	{
+		built->rieszScale.create(rows, cols / 2 + 1, Precision<T>::depth);
+		for (int ky = 0; ky < rows; ky++)
+		{
+			T fy = frequency(ky, rows);
+			T* dst = built->rieszScale.template ptr<T>(ky);
+			for (int kx = 0; kx <= cols / 2; kx++)
+			{
+				T fx = frequency(kx, cols);
+				dst[kx] = T(1) / std::sqrt(fx * fx + fy * fy + T(1e-5));
+			}
+		}
+	}
+
+	if (cache.size() >= maxPlans)
+		cache.clear();
+	cache[key] = built;
+	return built;
+}
+
+/**
+ * @brief Computes the gradients of an image with a real-to-complex DFT.
+ *
+ * The image is padded by reflection to the optimal DFT size, transformed into the CCS half
+ * spectrum, multiplied once to obtain both derivative spectra and transformed back with
+ * scaled, real-output inverse DFTs. The outputs are the top-left image-sized views of the
+ * padded results.
+ *
+ * @param grayImage Input grayscale image.
+ * @param kind Spectral multiplier to apply.
+ * @param gradX Output gradient in the X direction.
+ * @param gradY Output gradient in the Y direction.
+ * @param pool Optional thread pool.
+ */
+template <typename T>
+void BasicSpectralGradient<T>::compute(const cv::Mat& grayImage, KIND kind, cv::Mat& gradX, cv::Mat& gradY, ThreadPool* pool)
+{
+	const int rows = cv::getOptimalDFTSize(grayImage.rows);
+	const int cols = cv::getOptimalDFTSize(grayImage.cols);
+
+	if (!plan || plan->rows != rows || plan->cols != cols || plan->kind != kind)
+		plan = getPlan(rows, cols, kind);
+
+	// Convert into the top-left corner of the padded buffer and reflect into the padding
+	padded.create(rows, cols, Precision<T>::depth);
+	grayImage.convertTo(padded(cv::Rect(0, 0, grayImage.cols, grayImage.rows)), Precision<T>::depth);
+	for (int i = 0; i < grayImage.rows; i++)
+	{
+		T* row = padded.ptr<T>(i);
+		for (int j = grayImage.cols; j < cols; j++)
+		{
+			row[j] = row[cv::borderInterpolate(j, grayImage.cols, cv::BORDER_REFLECT_101)];
+		}
+	}
+	for (int i = grayImage.rows; i < rows; i++)
+	{
+		padded.row(cv::borderInterpolate(i, grayImage.rows, cv::BORDER_REFLECT_101)).copyTo(padded.row(i));
+	}
+
+	cv::dft(padded, spectrum);
+
+	spectrumX.create(rows, cols, Precision<T>::depth);
+	spectrumY.create(rows, cols, Precision<T>::depth);
+
+	ThreadPool::forEach(pool, 0, rows, [this](int row) { multiplyRow(row); });
+
+	multiplyPackedColumn(0, 0);
+	if (cols % 2 == 0)
+		multiplyPackedColumn(cols - 1, cols / 2);
+
+	cv::dft(spectrumX, fullGradX, cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT | cv::DFT_SCALE);
+	cv::dft(spectrumY, fullGradY, cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT | cv::DFT_SCALE);
+
+	cv::Rect roi(0, 0, grayImage.cols, grayImage.rows);
+	gradX = fullGradX(roi);
+	gradY = fullGradY(roi);
+}
+
+/**
+ * @brief Multiplies one row of the pair columns by i * mx and i * my.
+ *
+ * In CCS, columns 2k - 1 and 2k hold the real and imaginary part of Y(row, k) for
+ * k = 1 .. (cols - 1) / 2, so i * m * (re + i im) = (-m im) + i (m re).
+ *
+ * @param row Spectrum row (ky).
+ */
+template <typename T>
+void BasicSpectralGradient<T>::multiplyRow(int row)
+{
+	const int pairs = (plan->cols - 1) / 2;
+	const T* src = spectrum.ptr<T>(row);
+	T* dstX = spectrumX.ptr<T>(row);
+	T* dstY = spectrumY.ptr<T>(row);
+	const T* fx = plan->freqX.data();
+	const T fy = plan->freqY[row];
+
+	if (plan->kind == KIND::FOURIER)
+	{
+		for (int k = 1; k <= pairs; k++)
+		{
+			T re = src[2 * k - 1];
+			T im = src[2 * k];
+			dstX[2 * k - 1] = -fx[k] * im;
+			dstX[2 * k] = fx[k] * re;
+			dstY[2 * k - 1] = -fy * im;
+			dstY[2 * k] = fy * re;
+		}
+	}
+	else
+	{
+		const T* scale = plan->rieszScale.template ptr<T>(row);
+		for (int k = 1; k <= pairs; k++)
+		{
+			T re = src[2 * k - 1];
+			T im = src[2 * k];
+			T mx = fx[k] * scale[k];
+			T my = fy * scale[k];
+			dstX[2 * k - 1] = -mx * im;
+			dstX[2 * k] = mx * re;
+			dstY[2 * k - 1] = -my * im;
+			dstY[2 * k] = my * re;
+		}
+	}
+}
+
+/**
+ * @brief Multiplies a packed CCS column by the derivative multipliers.
+ *
+ * Column 0 (kx = 0) and, for an even width, the last column (kx = cols / 2) hold the
+ * Hermitian column spectrum Y(., kx) in packed form: row 0 is Re Y(0), rows 2t - 1 and 2t are
+ * Re/Im Y(t) and for an even height the last row is Re Y(rows / 2). The X multiplier is zero
+ * on both columns, and the Y multiplier is zero at ky = 0 and at the Nyquist row.
+ *
+ * @param column CCS column index.
+ * @param kx Horizontal frequency index of that column.
+ */
+template <typename T>
+void BasicSpectralGradient<T>::multiplyPackedColumn(int column, int kx)
+{
+	const int rows = plan->rows;
+
+	for (int i = 0; i < rows; i++)
+	{
+		spectrumX.at<T>(i, column) = T(0);
+	}
+
+	spectrumY.at<T>(0, column) = T(0);
+	for (int t = 1; 2 * t < rows; t++)
+	{
+		T my = plan->freqY[t];
+		if (plan->kind == KIND::RIESZ)
+			my *= plan->rieszScale.template at<T>(t, kx);
+
+		T re = spectrum.at<T>(2 * t - 1, column);
+		T im = spectrum.at<T>(2 * t, column);
+		spectrumY.at<T>(2 * t - 1, column) = -my * im;
+		spectrumY.at<T>(2 * t, column) = my * re;
+	}
+	if (rows % 2 == 0)
+		spectrumY.at<T>(rows - 1, column) = T(0);
+}
+
+template class BasicSpectralGradient<float>;
+template class BasicSpectralGradient<double>;
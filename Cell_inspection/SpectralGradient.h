@@ -0,0 +1,95 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <memory>
+#include <vector>
+#include "ArenaAllocator.h"
+#include "Precision.h"
+#include "ThreadPool.h"
+
+/**
+ * @class BasicSpectralGradient
+ * @brief Real-to-complex FFT engine for the FOURIER and RIESZ gradients, in precision T.
+ *
+ * The image is padded to an optimal DFT size and transformed once with a real-input DFT into
+ * OpenCV's packed half spectrum (CCS). Both derivative spectra are produced in a single pass
+ * over that half spectrum and brought back with real-output inverse DFTs.
+ *
+ * Frequency multipliers are cached per padded size and shared by every engine. An engine owns
+ * its work buffers and reuses them as long as the image size does not change, so a single
+ * engine must not be used by several threads at once.
+ */
+template <typename T>
+class BasicSpectralGradient
+{
+public:
+
+    /**
+     * @brief Spectral multiplier applied to the image spectrum.
+     */
+    enum class KIND {
+        FOURIER,    // i * 2 * pi * f, the exact derivative of the band-limited image
+        RIESZ       // i * f / |f|, the Riesz transform
+    };
+
+    /**
+     * @brief Computes the gradients of an image.
+     * @param grayImage Input grayscale image.
+     * @param kind Spectral multiplier to apply.
+     * @param gradX Output gradient in the X direction (Precision<T>::depth). Aliases the engine's buffers.
+     * @param gradY Output gradient in the Y direction (Precision<T>::depth). Aliases the engine's buffers.
+     * @param pool Optional thread pool the spectrum rows are distributed over.
+     */
+    void compute(const cv::Mat& grayImage, KIND kind, cv::Mat& gradX, cv::Mat& gradY, ThreadPool* pool = nullptr);
+
+    /**
+     * @brief Allocates the work buffers from allocator (the default one when null) from now on.
+     */
+    void setAllocator(cv::MatAllocator* allocator)
+    {
+        for (cv::Mat* m : { &padded, &spectrum, &spectrumX, &spectrumY, &fullGradX, &fullGradY })
+        {
+            ArenaAllocator::use(*m, allocator);
+        }
+    }
+
+private:
+
+    /**
+     * @brief Frequency multipliers for one padded size.
+     */
+    struct Plan
+    {
+        int rows = 0;
+        int cols = 0;
+        KIND kind = KIND::FOURIER;
+        std::vector<T> freqX;   // Multiplier of columns 0..cols/2, zero at DC and Nyquist
+        std::vector<T> freqY;   // Multiplier of rows 0..rows-1, zero at DC and Nyquist
+        cv::Mat rieszScale;         // rows x (cols/2 + 1) values of 1 / |f| for RIESZ
+    };
+
+    std::shared_ptr<const Plan> plan;
+
+    cv::Mat padded;
+    cv::Mat spectrum;
+    cv::Mat spectrumX;
+    cv::Mat spectrumY;
+    cv::Mat fullGradX;
+    cv::Mat fullGradY;
+
+    /**
+     * @brief Returns the cached plan of a padded size, building it on first use.
+     */
+    static std::shared_ptr<const Plan> getPlan(int rows, int cols, KIND kind);
+
+    /**
+     * @brief Applies the multipliers to one row of the pair columns (kx = 1 .. (cols - 1) / 2).
+     */
+    void multiplyRow(int row);
+
+    /**
+     * @brief Applies the Y multiplier to a packed CCS column (kx = 0 or the Nyquist column).
+     */
+    void multiplyPackedColumn(int column, int kx);
+};
+
+using SpectralGradient = BasicSpectralGradient<float>;
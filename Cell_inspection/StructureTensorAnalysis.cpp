@@ -1,16 +1,171 @@
 #include "StructureTensorAnalysis.h"
 
-// Constructor: Initializes the object with an image, gradient method, and window size, then computes parameters
-StructureTensorAnalysis::StructureTensorAnalysis(cv::Mat Image, GRADIENT_METHOD GradientMethod, int WindowSize) :
-	image{ Image }, gradientMethod{ GradientMethod }, windowSize{ WindowSize }
+namespace
 {
-	computeParameters();
+	// Splits [0, length) into parts of at most size values, as equal as possible: bounds[k] to
+	// bounds[k + 1] for k < parts. No part is shorter than size / 2 unless length is.
+	std::vector<int> tileBounds(int length, int size)
+	{
+		const int parts = std::max(1, (length + size - 1) / size);
+		std::vector<int> bounds(parts + 1);
+		for (int k = 0; k <= parts; k++)
+		{
+			bounds[k] = static_cast<int>(static_cast<int64_t>(length) * k / parts);
+		}
+		return bounds;
+	}
+
+	// Weights of part k over [bounds[k] - blend, bounds[k + 1] + blend), without the blend zones at
+	// the ends of the axis: 1 inside, raised-cosine ramps over the 2 * blend values centred on each
+	// inner bound, which sum to 1 with the ramps of the neighbouring part
+	template <typename T>
+	std::vector<T> fadeWeights(const std::vector<int>& bounds, int k, int blend)
+	{
+		const int parts = static_cast<int>(bounds.size()) - 1;
+		const bool fadeIn = k > 0;
+		const bool fadeOut = k + 1 < parts;
+		const int first = fadeIn ? bounds[k] - blend : bounds[k];
+		const int last = fadeOut ? bounds[k + 1] + blend : bounds[k + 1];
+
+		std::vector<T> weights(last - first, T(1));
+		for (int i = 0; i < 2 * blend; i++)
+		{
+			const T up = static_cast<T>(0.5 - 0.5 * std::cos(CV_PI * (i + 0.5) / (2 * blend)));
+			if (fadeIn)
+				weights[i] = up;
+			if (fadeOut)
+				weights[weights.size() - 2 * blend + i] = 1 - up;
+		}
+		return weights;
+	}
+
+	// Window of the fused stencil pass over a band: the sampled Gaussian ring of the band's kernel
+	template <typename T>
+	struct RingWindow
+	{
+		BasicStructureTensorKernel<T>& kernel;
+		const typename BasicStructureTensorKernel<T>::RowTarget& target;
+
+		template <class Stencil>
+		void push(const Stencil& stencil, int row, T* gx, T* gy)
+		{
+			kernel.pushRow(stencil, target, gx, gy);
+		}
+	};
+
+	// Window of the fused stencil pass over the whole frame: the products are written to the
+	// tensor images, which the recursive filter smooths afterwards
+	template <typename T>
+	struct FrameWindow
+	{
+		cv::Mat& xx;
+		cv::Mat& yy;
+		cv::Mat& xy;
+
+		template <class Stencil>
+		void push(const Stencil& stencil, int row, T* gx, T* gy)
+		{
+			T* pxx = xx.ptr<T>(row);
+			T* pyy = yy.ptr<T>(row);
+			T* pxy = xy.ptr<T>(row);
+			const int cols = xx.cols;
+			if (gx && gy)
+			{
+				for (int j = 0; j < cols; j++)
+				{
+					T x, y;
+					stencil(j, x, y);
+					gx[j] = x;
+					gy[j] = y;
+					pxx[j] = x * x;
+					pyy[j] = y * y;
+					pxy[j] = x * y;
+				}
+			}
+			else
+			{
+				for (int j = 0; j < cols; j++)
+				{
+					T x, y;
+					stencil(j, x, y);
+					pxx[j] = x * x;
+					pyy[j] = y * y;
+					pxy[j] = x * y;
+				}
+			}
+		}
+	};
+}
+
+// Constructor: Initializes the object with an image, gradient method, window size and the wanted
+// outputs; the outputs are computed when first requested. The image header is shared, not copied.
+template <typename T>
+BasicStructureTensorAnalysis<T>::BasicStructureTensorAnalysis(const cv::Mat& Image, GRADIENT_METHOD GradientMethod, int WindowSize, int Threads,
+	int Outputs) :
+	image{ Image }, gradientMethod{ GradientMethod }, windowSize{ WindowSize }, requestedOutputs{ Outputs }
+{
+	setThreadCount(Threads);
+}
+
+// Session constructor: prepares kernels and outputs for frames of the given size without computing
+template <typename T>
+BasicStructureTensorAnalysis<T>::BasicStructureTensorAnalysis(cv::Size FrameSize, GRADIENT_METHOD GradientMethod, int WindowSize, int Threads,
+	int Outputs) :
+	gradientMethod{ GradientMethod }, windowSize{ WindowSize }, requestedOutputs{ Outputs }
+{
+	setThreadCount(Threads);
+	prepare(FrameSize);
 }
 
-// Reads an image from the given path and converts it to grayscale
-cv::Mat StructureTensorAnalysis::read_image(const std::string& Path)
+// Analyzes the next frame of a stream with the buffers of the previous one
+template <typename T>
+void BasicStructureTensorAnalysis<T>::process(const cv::Mat& Frame)
 {
-	cv::Mat img = cv::imread(Path, cv::IMREAD_GRAYSCALE);
+	image = Frame;
+	computedOutputs = 0;
+	retainGradients = false;
+	ensureOutputs(requestedOutputs);
+}
+
+// Binds caller-owned output buffers. The outputs are released first, so that an output that still
+// aliases a previous binding is reallocated instead of overwriting the caller's memory.
+template <typename T>
+void BasicStructureTensorAnalysis<T>::setOutputBuffers(const OutputBuffers& Buffers)
+{
+	for (const cv::Mat* buffer : { &Buffers.energy, &Buffers.orientation, &Buffers.coherency, &Buffers.ixx, &Buffers.iyy, &Buffers.ixy })
+	{
+		if (!buffer->empty() && (buffer->type() != Precision<T>::depth || buffer->dims != 2))
+			throw std::invalid_argument("Output buffers must be single-channel 2D images of the working precision.");
+	}
+
+	outputBuffers = Buffers;
+	for (cv::Mat* m : { &Energy, &Orientation, &Coherency, &Ixx, &Iyy, &Ixy })
+	{
+		m->release();
+	}
+	computedOutputs &= OUTPUT_GRADIENTS;
+}
+
+// Computes the outputs that are missing, together with the other requested outputs that are
+// missing, so that one pass serves every getter of the same configuration. Once the window size
+// has been changed on its own the gradients are kept as well, so that further changes reuse them.
+template <typename T>
+void BasicStructureTensorAnalysis<T>::ensureOutputs(int outputs)
+{
+	if ((computedOutputs & outputs) == outputs || image.empty())
+		return;
+
+	int pass = outputs | requestedOutputs;
+	if (retainGradients)
+		pass |= OUTPUT_GRADIENTS;
+	computeParameters(pass & ~computedOutputs);
+}
+
+// Reads an image from the given path as grayscale, keeping 16-bit pixels
+template <typename T>
+cv::Mat BasicStructureTensorAnalysis<T>::read_image(const std::string& Path)
+{
+	cv::Mat img = MappedImage::load(Path);
 	if (img.empty()) {
 		std::cerr << "Error: Could not open or find the image!" << std::endl;
 	}
@@ -18,36 +173,36 @@ cv::Mat StructureTensorAnalysis::read_image(const std::string& Path)
 }
 
 // Computes image gradients based on the selected gradient method
-void StructureTensorAnalysis::computeGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY,
-	StructureTensorAnalysis::GRADIENT_METHOD gradientMethod,
-	int windowSize)
+template <typename T>
+void BasicStructureTensorAnalysis<T>::computeGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY,
+	GRADIENT_METHOD gradientMethod, int windowSize, Workspace& workspace, ThreadPool* pool)
 {
-	gradX = cv::Mat::zeros(grayImage.size(), CV_32F);
-	gradY = cv::Mat::zeros(grayImage.size(), CV_32F);
+	typedef BasicGradientCalculator<T> Gradients;
+
 	switch (gradientMethod)
 	{
-	case StructureTensorAnalysis::GRADIENT_METHOD::FINITE_DIFFERENCE:
-		GradientCalculator::computeFiniteDifferenceGradient(grayImage, gradX, gradY);
+	case GRADIENT_METHOD::FINITE_DIFFERENCE:
+		Gradients::computeFiniteDifferenceGradient(grayImage, gradX, gradY);
 		break;
 
-	case StructureTensorAnalysis::GRADIENT_METHOD::GAUSSIAN:
-		GradientCalculator::computeGaussianGradients(grayImage, gradX, gradY);
+	case GRADIENT_METHOD::GAUSSIAN:
+		Gradients::computeGaussianGradients(grayImage, gradX, gradY, &workspace);
 		break;
 
-	case StructureTensorAnalysis::GRADIENT_METHOD::CUBIC_SPLINE:
-		GradientCalculator::cubicSplineInterpolation(grayImage, gradX, gradY);
+	case GRADIENT_METHOD::CUBIC_SPLINE:
+		Gradients::cubicSplineInterpolation(grayImage, gradX, gradY, pool, &workspace);
 		break;
 
-	case StructureTensorAnalysis::GRADIENT_METHOD::FOURIER:
-		GradientCalculator::computeFourierGradients(grayImage, gradX, gradY);
+	case GRADIENT_METHOD::FOURIER:
+		Gradients::computeFourierGradients(grayImage, gradX, gradY, pool, &workspace);
 		break;
 
-	case StructureTensorAnalysis::GRADIENT_METHOD::RIESZ:
-		GradientCalculator::computeRieszGradients(grayImage, gradX, gradY);
+	case GRADIENT_METHOD::RIESZ:
+		Gradients::computeRieszGradients(grayImage, gradX, gradY, pool, &workspace);
 		break;
 
-	case StructureTensorAnalysis::GRADIENT_METHOD::HESSIAN:
-		GradientCalculator::computeSecondOrderDerivatives(grayImage, windowSize, gradX, gradY);
+	case GRADIENT_METHOD::HESSIAN:
+		Gradients::computeSecondOrderDerivatives(grayImage, windowSize, gradX, gradY, &workspace);
 		break;
 
 	default:
@@ -58,74 +213,1105 @@ void StructureTensorAnalysis::computeGradients(const cv::Mat& grayImage, cv::Mat
 
 }
 
-// Computes the structural tensor components from the gradients
-void StructureTensorAnalysis::computeStructuralTensor(const cv::Mat& gradX, const cv::Mat& gradY, int windowSize,
-	cv::Mat& Ixx, cv::Mat& Iyy, cv::Mat& Ixy)
+// Name of a gradient method, as used in profiles and reports
+const char* StructureTensorTypes::methodName(GRADIENT_METHOD gradientMethod)
+{
+	switch (gradientMethod)
+	{
+	case GRADIENT_METHOD::CUBIC_SPLINE: return "CUBIC_SPLINE";
+	case GRADIENT_METHOD::FINITE_DIFFERENCE: return "FINITE_DIFFERENCE";
+	case GRADIENT_METHOD::FOURIER: return "FOURIER";
+	case GRADIENT_METHOD::RIESZ: return "RIESZ";
+	case GRADIENT_METHOD::GAUSSIAN: return "GAUSSIAN";
+	case GRADIENT_METHOD::HESSIAN: return "HESSIAN";
+	}
+	return "UNKNOWN";
+}
+
+// Halo rows a band of gradients needs so that its inner rows match a full-frame computation
+int StructureTensorTypes::gradientHalo(GRADIENT_METHOD gradientMethod, int windowSize)
+{
+	switch (gradientMethod)
+	{
+	case GRADIENT_METHOD::FINITE_DIFFERENCE:
+		return 1;
+
+	case GRADIENT_METHOD::GAUSSIAN:
+		return 2 + 1; // 5x5 Gaussian followed by a 3x3 Sobel
+
+	case GRADIENT_METHOD::HESSIAN:
+		return StructureTensorKernel::gaussianRadius(windowSize) + 1;
+
+	default:
+		return -1;
+	}
+}
+
+// The spline recursions decay as |z|^k with z = sqrt(3) - 2, below double precision after 28
+// rows, so a margin of 32 makes spline tiles exact to the precision of T and they need no fade.
+// The spectral derivatives have kernels that decay slowly (as 1 / d for FOURIER), so each FFT sees
+// 64 pixels of context and the 32 next to the tile are cross-faded with the neighbouring tile,
+// which hides the remaining seam. Larger values trade tile overhead for accuracy.
+int StructureTensorTypes::tileMargin(GRADIENT_METHOD gradientMethod)
 {
-	cv::Mat gradXSquare, gradYSquare, gradXYSquare;
+	switch (gradientMethod)
+	{
+	case GRADIENT_METHOD::CUBIC_SPLINE:
+		return 32;
 
-	cv::multiply(gradX, gradX, gradXSquare);
-	cv::multiply(gradY, gradY, gradYSquare);
-	cv::multiply(gradX, gradY, gradXYSquare);
+	case GRADIENT_METHOD::FOURIER:
+	case GRADIENT_METHOD::RIESZ:
+		return 64;
 
+	default:
+		return 0;
+	}
+}
 
-	cv::GaussianBlur(gradXSquare, Ixx, cv::Size(0, 0), windowSize, windowSize);
-	cv::GaussianBlur(gradXSquare, Iyy, cv::Size(0, 0), windowSize, windowSize);
-	cv::GaussianBlur(gradXYSquare, Ixy, cv::Size(0, 0), windowSize, windowSize);
+int StructureTensorTypes::tileBlend(GRADIENT_METHOD gradientMethod)
+{
+	return (gradientMethod == GRADIENT_METHOD::FOURIER || gradientMethod == GRADIENT_METHOD::RIESZ) ? 32 : 0;
 }
 
-// Computes the energy from structure tensor components
-cv::Mat StructureTensorAnalysis::computeEnergy(const cv::Mat& Ixx, const cv::Mat& Iyy)
+// Feeds gradient rows to the band's kernel, converting them to T when the method produced another depth
+// or decoding them when they are stored gradients in reduced precision.
+// When profiling, the time of the pushes is split into the window stage and the eigen stage the kernel measured.
+template <typename T>
+void BasicStructureTensorAnalysis<T>::pushGradientRows(BandWorkspace& band, const cv::Mat& gradX, const cv::Mat& gradY,
+	int first, int last, const typename Kernel::RowTarget& target, bool stored)
 {
-	return Ixx + Iyy;
+	const bool decode = stored && storage != ReducedPrecision::STORAGE::FULL;
+
+#ifdef CELL_INSPECTION_PROFILING
+	Profiler::Clock::time_point start = Profiler::Clock::now();
+	size_t bytes = Profiler::threadAllocatedBytes();
+#endif
+
+	for (int i = first; i < last; i++)
+	{
+		if (decode)
+		{
+			band.rowX.create(1, gradX.cols, Precision<T>::depth);
+			band.rowY.create(1, gradY.cols, Precision<T>::depth);
+			ReducedPrecision::decodeRow(gradX.ptr(i), gradX.cols, storage, gradientScaleX[i], band.rowX.template ptr<T>());
+			ReducedPrecision::decodeRow(gradY.ptr(i), gradY.cols, storage, gradientScaleY[i], band.rowY.template ptr<T>());
+			band.kernel.pushRow(band.rowX.template ptr<T>(), band.rowY.template ptr<T>(), target);
+		}
+		else if (gradX.depth() == Precision<T>::depth && gradY.depth() == Precision<T>::depth)
+		{
+			band.kernel.pushRow(gradX.ptr<T>(i), gradY.ptr<T>(i), target);
+		}
+		else
+		{
+			gradX.row(i).convertTo(band.rowX, Precision<T>::depth);
+			gradY.row(i).convertTo(band.rowY, Precision<T>::depth);
+			band.kernel.pushRow(band.rowX.template ptr<T>(), band.rowY.template ptr<T>(), target);
+		}
+	}
+
+#ifdef CELL_INSPECTION_PROFILING
+	recordWindow(band, start, bytes, static_cast<int64_t>(last - first) * gradX.cols);
+#endif
 }
 
-// Computes the orientation of the structure tensor
-cv::Mat StructureTensorAnalysis::computeOrientation(const cv::Mat& Ixx, const cv::Mat& Iyy, const cv::Mat Ixy)
+#ifdef CELL_INSPECTION_PROFILING
+// Records a pass of a band through its kernel as the window stage and the eigen stage the kernel measured
+template <typename T>
+void BasicStructureTensorAnalysis<T>::recordWindow(BandWorkspace& band, Profiler::Clock::time_point start, size_t bytes,
+	int64_t pixels)
 {
-	cv::Mat theta;
-	cv::phase(2 * Ixy, Ixx - Iyy, theta, false);
-	return 0.5 * theta;
+	Profiler::Clock::time_point end = Profiler::Clock::now();
+	Profiler::Clock::duration eigen = band.kernel.takeEigenTime();
+	profiler.record("window", methodName(gradientMethod), start, end - eigen, Profiler::threadAllocatedBytes() - bytes, pixels);
+	profiler.record("eigen", methodName(gradientMethod), end - eigen, end, 0, pixels);
 }
+#endif
 
-// Computes the coherency measure of the structure tensor
-cv::Mat StructureTensorAnalysis::computeCoherency(const cv::Mat& Ixx,
-	const cv::Mat& Iyy,
-	const cv::Mat Ixy)
+// Streams one band of output rows through its kernel. The kernel needs gradient rows up to its
+// window radius beyond the band; those are computed in chunks that carry the stencil halo, and
+// only the rows inside the band are stored in gradX/gradY so that bands never write the same row.
+// The halo'd window of a chunk is shifted inside the image rather than clipped, so every chunk
+// has the same height and the band's gradient buffers are reused instead of reallocated.
+// When no tensor output is wanted the kernel is skipped and only the band's own gradient rows are computed.
+template <typename T>
+void BasicStructureTensorAnalysis<T>::computeBand(BandWorkspace& band, int halo, int outputs, const typename Kernel::RowTarget& target)
 {
-	cv::Mat coherency;
-	cv::Mat lambda1, lambda2;
-	cv::Mat square1, square2;
-	cv::Mat root1, root2;
+	Kernel& kernel = band.kernel;
+	const bool tensor = (outputs & windowedOutputs) != 0;
+	const bool storeGradients = (outputs & OUTPUT_GRADIENTS) != 0;
+
+	int inputBegin = band.rowBegin;
+	int inputEnd = band.rowEnd;
+	if (tensor)
+	{
+		kernel.begin(band.rowBegin, band.rowEnd);
+		inputBegin = kernel.inputBegin();
+		inputEnd = kernel.inputEnd();
+	}
 
-	cv::multiply(Ixx - Iyy, Ixx - Iyy, square1);
-	cv::multiply(Ixy, Ixy, square2);
+	if (halo < 0)
+	{
+		if (tensor)
+			pushGradientRows(band, gradX, gradY, inputBegin, inputEnd, target, true);
+		return;
+	}
+
+	// The stencil methods evaluate their gradients inside the kernel's product loop and read the
+	// image rows around the band directly, so they need no chunks
+	if (hasStencil(gradientMethod))
+	{
+#ifdef CELL_INSPECTION_PROFILING
+		Profiler::Clock::time_point start = Profiler::Clock::now();
+		size_t bytes = Profiler::threadAllocatedBytes();
+#endif
+		RingWindow<T> window{ kernel, target };
+		streamFused(band, tensor ? &window : nullptr, inputBegin, inputEnd, outputs);
+#ifdef CELL_INSPECTION_PROFILING
+		recordWindow(band, start, bytes, static_cast<int64_t>(inputEnd - inputBegin) * image.cols);
+#endif
+		return;
+	}
+
+	const int chunkRows = gradientChunkRows(halo);
+	const int rows = image.rows;
+	const int windowRows = std::min(rows, chunkRows + 2 * halo);
+
+	for (int chunkBegin = inputBegin; chunkBegin < inputEnd; chunkBegin += chunkRows)
+	{
+		int chunkEnd = std::min(inputEnd, chunkBegin + chunkRows);
+		int windowBegin = std::min(std::max(0, chunkBegin - halo), rows - windowRows);
 
-	cv::sqrt(square1 + 4 * square2, root1);
-	cv::sqrt(square1 + 4 * square2, root2);
+		{
+			CELL_PROFILE_SCOPE(profiler, "gradient", methodName(gradientMethod), static_cast<int64_t>(windowRows) * image.cols);
+			computeGradients(image.rowRange(windowBegin, windowBegin + windowRows), band.chunkX, band.chunkY,
+				gradientMethod, windowSize, band.gradient, threadPool.get());
+		}
 
-	lambda1 = (Ixx + Iyy + root1);
-	lambda2 = (Ixx + Iyy - root2);
+		cv::Mat innerX = band.chunkX.rowRange(chunkBegin - windowBegin, chunkEnd - windowBegin);
+		cv::Mat innerY = band.chunkY.rowRange(chunkBegin - windowBegin, chunkEnd - windowBegin);
 
-	cv::divide(lambda1 - lambda2, lambda1 + lambda2 + 1e-5, coherency);
+		int storeBegin = std::max(chunkBegin, band.rowBegin);
+		int storeEnd = std::min(chunkEnd, band.rowEnd);
+		if (storeGradients && storeBegin < storeEnd)
+		{
+			storeGradientRows(innerX.rowRange(storeBegin - chunkBegin, storeEnd - chunkBegin),
+				innerY.rowRange(storeBegin - chunkBegin, storeEnd - chunkBegin), storeBegin, nullptr);
+		}
 
-	return coherency;
+		if (tensor)
+			pushGradientRows(band, innerX, innerY, 0, chunkEnd - chunkBegin, target);
+	}
+}
+
+// Dispatches a fused pass to the stencil of the method; every stencil, precision and window
+// combination is a separate instantiation of streamStencil
+template <typename T>
+template <class Window>
+void BasicStructureTensorAnalysis<T>::streamFused(BandWorkspace& band, Window* window, int first, int last, int outputs)
+{
+	switch (gradientMethod)
+	{
+	case GRADIENT_METHOD::FINITE_DIFFERENCE:
+		streamStencil(band, band.finiteDifference, window, first, last, outputs);
+		break;
+
+	case GRADIENT_METHOD::GAUSSIAN:
+		streamStencil(band, band.gaussian, window, first, last, outputs);
+		break;
+
+	default:
+		throw std::logic_error("Gradient method has no stencil.");
+	}
 }
 
-// Computes all necessary parameters for the structure tensor analysis
-void StructureTensorAnalysis::computeParameters()
+// Fused pass of a stencil method: every gradient row is evaluated by the stencil inside the loop
+// that forms the products for the window, reading the image rows directly, so the stencil halo
+// costs no recomputation and no gradient image is written unless the gradients are wanted.
+// Those are written straight into gradX/gradY, or into the band's row buffers and encoded when
+// the storage is reduced.
+template <typename T>
+template <class Stencil, class Window>
+void BasicStructureTensorAnalysis<T>::streamStencil(BandWorkspace& band, Stencil& stencil, Window* window,
+	int first, int last, int outputs)
 {
-	computeGradients(image, gradX, gradY, gradientMethod, windowSize);
-	computeStructuralTensor(gradX, gradY, windowSize, Ixx, Iyy, Ixy);
-	Energy = computeEnergy(Ixx, Iyy);
-	Orientation = computeOrientation(Ixx, Iyy, Ixy);
-	Coherency = computeCoherency(Ixx, Iyy, Ixy);
+	const bool storeGradients = (outputs & OUTPUT_GRADIENTS) != 0;
+	const bool reduced = storage != ReducedPrecision::STORAGE::FULL;
+	const int cols = image.cols;
+	if (!window && !storeGradients)
+		return;
+
+	if (storeGradients && reduced)
+	{
+		band.rowX.create(1, cols, Precision<T>::depth);
+		band.rowY.create(1, cols, Precision<T>::depth);
+	}
+
+	stencil.reset(image);
+	for (int i = first; i < last; i++)
+	{
+		stencil.prepare(i);
+
+		T* gx = nullptr;
+		T* gy = nullptr;
+		const bool store = storeGradients && i >= band.rowBegin && i < band.rowEnd;
+		if (store)
+		{
+			gx = reduced ? band.rowX.template ptr<T>() : gradX.ptr<T>(i);
+			gy = reduced ? band.rowY.template ptr<T>() : gradY.ptr<T>(i);
+		}
+
+		if (window)
+		{
+			window->push(stencil, i, gx, gy);
+		}
+		else if (store)
+		{
+			for (int j = 0; j < cols; j++)
+			{
+				stencil(j, gx[j], gy[j]);
+			}
+		}
+
+		if (store && reduced)
+		{
+			gradientScaleX[i] = ReducedPrecision::encodeRow(gx, cols, storage, gradX.ptr(i));
+			gradientScaleY[i] = ReducedPrecision::encodeRow(gy, cols, storage, gradY.ptr(i));
+		}
+	}
 }
 
-// Sets the gradient computation method and window size, then recalculates parameters
-void StructureTensorAnalysis::setGradientandWindowSize(GRADIENT_METHOD GradientMethod, int WindowSize)
+// Splits the rows into bands, one kernel each, and allocates the requested outputs. Nothing is done when the
+// frame size, method, window size and thread count are those of the previous call, which is what
+// lets a stream of same-sized frames run without reallocating.
+template <typename T>
+void BasicStructureTensorAnalysis<T>::prepare(cv::Size size)
 {
+	int threads = threadPool ? threadPool->size() : 1;
+	if (!bands.empty() && size == preparedSize && gradientMethod == preparedMethod &&
+		windowSize == preparedWindowSize && threads == preparedThreads && windowMethod == preparedWindowMethod &&
+		storage == preparedStorage)
+		return;
+
+	CELL_PROFILE_SCOPE(profiler, "prepare", methodName(gradientMethod), static_cast<int64_t>(size.area()));
+
+	const int rows = size.height;
+	const int cols = size.width;
+	int halo = gradientHalo(gradientMethod, windowSize);
+
+	// Every band recomputes its window and stencil halo, so keep bands several halos tall. The
+	// recursive window works on the whole frame and needs no kernel; its bands only split the fused
+	// stencil pass, which has no window halo.
+	int bandCount = 1;
+	if (threads > 1)
+	{
+		int radius = usesRecursiveWindow() ? 0 : Kernel::gaussianRadius(windowSize);
+		int minBandRows = std::max(64, 4 * (radius + std::max(halo, 0)));
+		bandCount = std::max(1, std::min(2 * threads, rows / minBandRows));
+	}
+
+	bands.clear();
+	bands.resize(bandCount);
+	for (int b = 0; b < bandCount; b++)
+	{
+		bands[b].rowBegin = static_cast<int>(static_cast<int64_t>(rows) * b / bandCount);
+		bands[b].rowEnd = static_cast<int>(static_cast<int64_t>(rows) * (b + 1) / bandCount);
+		if (!usesRecursiveWindow())
+			bands[b].kernel = Kernel(rows, cols, windowSize, storage, arena.get());
+		for (cv::Mat* m : { &bands[b].chunkX, &bands[b].chunkY, &bands[b].rowX, &bands[b].rowY })
+		{
+			ArenaAllocator::use(*m, arena.get());
+		}
+		bands[b].gradient.setAllocator(arena.get());
+		bands[b].finiteDifference.setAllocator(arena.get());
+		bands[b].gaussian.setAllocator(arena.get());
+	}
+
+	// Drop gradients that may alias the buffers of a previous whole-image method, unless they are
+	// still valid because only the window size or thread count changed
+	if (!(computedOutputs & OUTPUT_GRADIENTS))
+	{
+		gradX.release();
+		gradY.release();
+	}
+
+	preparedSize = size;
+	preparedMethod = gradientMethod;
+	preparedWindowSize = windowSize;
+	preparedThreads = threads;
+	preparedWindowMethod = windowMethod;
+	preparedStorage = storage;
+
+	allocateOutputs(size, requestedOutputs);
+}
+
+// Allocates the buffers of the given outputs. Whole-image methods hand their gradients over
+// directly, so gradient buffers are only allocated for the stencil methods, or when the gradients
+// are stored in reduced precision.
+template <typename T>
+void BasicStructureTensorAnalysis<T>::allocateOutputs(cv::Size size, int outputs)
+{
+	// A bound buffer becomes the output, provided it fits the frame
+	auto allocate = [&](cv::Mat& output, const cv::Mat& buffer)
+	{
+		if (buffer.empty())
+			output.create(size, Precision<T>::depth);
+		else if (buffer.size() == size)
+			output = buffer;
+		else
+			throw std::invalid_argument("Output buffer size does not match the frame size.");
+	};
+
+	if (outputs & OUTPUT_ENERGY)
+		allocate(Energy, outputBuffers.energy);
+	if (outputs & OUTPUT_ORIENTATION)
+		allocate(Orientation, outputBuffers.orientation);
+	if (outputs & OUTPUT_COHERENCY)
+		allocate(Coherency, outputBuffers.coherency);
+	if (outputs & OUTPUT_TENSOR)
+	{
+		allocate(Ixx, outputBuffers.ixx);
+		allocate(Iyy, outputBuffers.iyy);
+		allocate(Ixy, outputBuffers.ixy);
+	}
+	const bool reduced = storage != ReducedPrecision::STORAGE::FULL;
+	if ((outputs & OUTPUT_GRADIENTS) && (gradientHalo(gradientMethod, windowSize) >= 0 || reduced))
+	{
+		gradX.create(size, ReducedPrecision::depth<T>(storage));
+		gradY.create(size, ReducedPrecision::depth<T>(storage));
+		if (reduced)
+		{
+			gradientScaleX.resize(size.height);
+			gradientScaleY.resize(size.height);
+		}
+	}
+}
+
+// Computes the given outputs of the structure tensor analysis; the others are left untouched.
+// Gradients are streamed through the fused kernel, which forms the products, applies the Gaussian
+// window and runs the eigen-analysis row by row, so Ixx, Iyy and Ixy never exist as full-frame
+// images. With a thread pool the output rows are split into bands that each run the whole
+// pipeline on a worker; every output row sees exactly the same inputs as in the serial path.
+template <typename T>
+void BasicStructureTensorAnalysis<T>::computeParameters(int outputs)
+{
+	CELL_PROFILE_SCOPE(profiler, "frame", methodName(gradientMethod), static_cast<int64_t>(image.total()));
+	if (regionTileSize > 0 || tileSize > 0)
+	{
+		std::vector<cv::Rect> runs = processingTiles(image.size());
+		if (!(runs.size() == 1 && runs[0].size() == image.size()))
+		{
+			computeRegions(runs, outputs);
+			computedOutputs |= outputs;
+			return;
+		}
+	}
+	prepare(image.size());
+	allocateOutputs(image.size(), outputs);
+
+	// Outputs that are not computed get no row pointer, so the kernel skips their eigen-analysis
+	typename Kernel::RowTarget target = [this, outputs](int row)
+	{
+		typename Kernel::RowOutput out;
+		if (outputs & OUTPUT_ENERGY)
+			out.energy = Energy.ptr<T>(row);
+		if (outputs & OUTPUT_ORIENTATION)
+			out.orientation = Orientation.ptr<T>(row);
+		if (outputs & OUTPUT_COHERENCY)
+			out.coherency = Coherency.ptr<T>(row);
+		if (outputs & OUTPUT_TENSOR)
+		{
+			out.ixx = Ixx.ptr<T>(row);
+			out.iyy = Iyy.ptr<T>(row);
+			out.ixy = Ixy.ptr<T>(row);
+		}
+		return out;
+	};
+
+	// Whole-image methods produce every gradient before the pass, so those come for free and are
+	// reused by later passes over the same image. Gradients kept from an earlier pass are streamed
+	// from gradX/gradY the same way instead of being recomputed in chunks. The recursive window
+	// needs whole-frame gradients as well, except for the stencil methods, whose gradients are
+	// evaluated while the products are formed.
+	const bool recursive = usesRecursiveWindow();
+	const bool cachedGradients = (computedOutputs & OUTPUT_GRADIENTS) != 0;
+	const bool fusedFrame = recursive && !cachedGradients && hasStencil(gradientMethod);
+	int halo = (cachedGradients || recursive) ? -1 : gradientHalo(gradientMethod, windowSize);
+	if (halo < 0 && !cachedGradients && !fusedFrame)
+	{
+		CELL_PROFILE_SCOPE(profiler, "gradient", methodName(gradientMethod), static_cast<int64_t>(image.total()));
+		if (storage == ReducedPrecision::STORAGE::FULL)
+		{
+			computeGradients(image, gradX, gradY, gradientMethod, windowSize, frameWorkspace, threadPool.get());
+		}
+		else
+		{
+			cv::Mat fullX, fullY;
+			computeGradients(image, fullX, fullY, gradientMethod, windowSize, frameWorkspace, threadPool.get());
+			allocateOutputs(image.size(), OUTPUT_GRADIENTS);
+			storeGradientRows(fullX, fullY, 0, threadPool.get());
+		}
+		outputs |= OUTPUT_GRADIENTS;
+	}
+
+	if (recursive)
+	{
+		computeRecursive(outputs, fusedFrame, target);
+	}
+	else if (bands.size() == 1)
+	{
+		computeBand(bands[0], halo, outputs, target);
+	}
+	else
+	{
+		threadPool->parallelFor(0, static_cast<int>(bands.size()), [&](int band)
+		{
+			computeBand(bands[band], halo, outputs, target);
+		});
+	}
+
+	computedOutputs |= outputs;
+}
+
+// Whole-frame path of the recursive window: the products are formed into three tensor images,
+// each is smoothed by the recursive Gaussian, whose cost per pixel does not depend on the
+// window size, and the eigen-analysis runs row by row on the result. Stencil methods form the
+// products (and store the gradients, when wanted) in a fused pass over the bands.
+template <typename T>
+void BasicStructureTensorAnalysis<T>::computeRecursive(int outputs, bool fused, const typename Kernel::RowTarget& target)
+{
+	const bool tensor = (outputs & windowedOutputs) != 0;
+	const int rows = image.rows;
+	const int cols = image.cols;
+
+	if (fused)
+	{
+		CELL_PROFILE_SCOPE(profiler, "window", methodName(gradientMethod), static_cast<int64_t>(image.total()));
+		if (tensor)
+		{
+			tensorXX.create(rows, cols, Precision<T>::depth);
+			tensorYY.create(rows, cols, Precision<T>::depth);
+			tensorXY.create(rows, cols, Precision<T>::depth);
+		}
+		ThreadPool::forEach(bands.size() > 1 ? threadPool.get() : nullptr, 0, static_cast<int>(bands.size()), [&](int b)
+		{
+			FrameWindow<T> window{ tensorXX, tensorYY, tensorXY };
+			streamFused(bands[b], tensor ? &window : nullptr, bands[b].rowBegin, bands[b].rowEnd, outputs);
+		});
+	}
+	if (!tensor)
+		return;
+
+	if (!fused)
+		formTensor();
+
+	{
+		CELL_PROFILE_SCOPE(profiler, "window", methodName(gradientMethod), static_cast<int64_t>(image.total()));
+		RecursiveGaussian::blur(tensorXX, tensorXX, windowSize, recursiveGaussian, threadPool.get());
+		RecursiveGaussian::blur(tensorYY, tensorYY, windowSize, recursiveGaussian, threadPool.get());
+		RecursiveGaussian::blur(tensorXY, tensorXY, windowSize, recursiveGaussian, threadPool.get());
+	}
+
+	CELL_PROFILE_SCOPE(profiler, "eigen", methodName(gradientMethod), static_cast<int64_t>(image.total()));
+	ThreadPool::forEach(threadPool.get(), 0, rows, [&](int row)
+	{
+		const T* xx = tensorXX.ptr<T>(row);
+		const T* yy = tensorYY.ptr<T>(row);
+		const T* xy = tensorXY.ptr<T>(row);
+		const typename Kernel::RowOutput out = target(row);
+		if (out.ixx)
+			std::copy(xx, xx + cols, out.ixx);
+		if (out.iyy)
+			std::copy(yy, yy + cols, out.iyy);
+		if (out.ixy)
+			std::copy(xy, xy + cols, out.ixy);
+		Kernel::eigenRow(xx, yy, xy, cols, out);
+	});
+}
+
+// Region path: every run is analyzed by a nested analysis of the same configuration on the run and
+// its halo, and the run part of its outputs is copied into the frame outputs, which are 0 elsewhere.
+// The nested analyses share the thread pool, whose parallelFor can be nested, so one large run still
+// uses every worker. The whole-image methods compute their gradients once for the frame and hand
+// each run its part, so only the window and the eigen-analysis are restricted. The other methods
+// compute their gradients in each run, with its halo, even when gradients are kept: the kept ones
+// are only valid inside the runs, and changing the regions drops them.
+template <typename T>
+void BasicStructureTensorAnalysis<T>::computeRegions(const std::vector<cv::Rect>& runs, int outputs)
+{
+	const cv::Size size = image.size();
+	const cv::Rect frame(cv::Point(), size);
+	const bool wholeImageGradients = gradientHalo(gradientMethod, windowSize) < 0;
+	const bool tileGradients = !wholeImageGradients && (outputs & OUTPUT_GRADIENTS);
+
+	allocateOutputs(size, outputs & ~OUTPUT_GRADIENTS);
+	if (regionTileSize > 0)
+	{
+		for (cv::Mat* m : { &Energy, &Orientation, &Coherency, &Ixx, &Iyy, &Ixy })
+		{
+			if (!m->empty())
+				m->setTo(0);
+		}
+	}
+
+	cv::Mat fullX, fullY;
+	if (wholeImageGradients)
+	{
+		if (computedOutputs & OUTPUT_GRADIENTS)
+		{
+			fullX = decodeGradients(gradX, gradientScaleX);
+			fullY = decodeGradients(gradY, gradientScaleY);
+		}
+		else
+		{
+			CELL_PROFILE_SCOPE(profiler, "gradient", methodName(gradientMethod), static_cast<int64_t>(image.total()));
+			if (tileSize > 0)
+				computeTiledGradients(fullX, fullY);
+			else
+				computeGradients(image, fullX, fullY, gradientMethod, windowSize, frameWorkspace, threadPool.get());
+		}
+	}
+	else if (tileGradients)
+	{
+		fullX = cv::Mat::zeros(size, Precision<T>::depth);
+		fullY = cv::Mat::zeros(size, Precision<T>::depth);
+	}
+
+	const int halo = regionHalo();
+	const int windowed = outputs & windowedOutputs;
+	// The runs of a whole-image method only add the window stages to the frame gradients
+	const int count = (wholeImageGradients && !windowed) ? 0 : static_cast<int>(runs.size());
+
+	ThreadPool::forEach(threadPool.get(), 0, count, [&](int r)
+	{
+		const cv::Rect run = runs[r];
+		const cv::Rect context = cv::Rect(run.x - halo, run.y - halo, run.width + 2 * halo, run.height + 2 * halo) & frame;
+		const cv::Rect inner = run - context.tl();
+
+		std::unique_ptr<BasicStructureTensorAnalysis> analysis = regionAnalyses.take();
+		BasicStructureTensorAnalysis& tile = *analysis;
+		tile.setArena(arena);
+		tile.gradientMethod = gradientMethod;
+		tile.windowSize = windowSize;
+		tile.windowMethod = windowMethod;
+		tile.storage = storage;
+		tile.threadPool = threadPool;
+		tile.requestedOutputs = windowed | (tileGradients ? OUTPUT_GRADIENTS : 0);
+		tile.image = image(context);
+		tile.computedOutputs = 0;
+		tile.retainGradients = false;
+
+		if (wholeImageGradients)
+		{
+			if (storage == ReducedPrecision::STORAGE::FULL)
+			{
+				tile.gradX = fullX(context);
+				tile.gradY = fullY(context);
+			}
+			else
+			{
+				tile.allocateOutputs(context.size(), OUTPUT_GRADIENTS);
+				tile.storeGradientRows(fullX(context), fullY(context), 0, nullptr);
+			}
+			tile.computedOutputs = OUTPUT_GRADIENTS;
+		}
+		tile.ensureOutputs(tile.requestedOutputs);
+
+		if (outputs & OUTPUT_ENERGY)
+			tile.Energy(inner).copyTo(Energy(run));
+		if (outputs & OUTPUT_ORIENTATION)
+			tile.Orientation(inner).copyTo(Orientation(run));
+		if (outputs & OUTPUT_COHERENCY)
+			tile.Coherency(inner).copyTo(Coherency(run));
+		if (outputs & OUTPUT_TENSOR)
+		{
+			tile.Ixx(inner).copyTo(Ixx(run));
+			tile.Iyy(inner).copyTo(Iyy(run));
+			tile.Ixy(inner).copyTo(Ixy(run));
+		}
+		if (tileGradients)
+		{
+			tile.getGradX()(inner).copyTo(fullX(run));
+			tile.getGradY()(inner).copyTo(fullY(run));
+		}
+		regionAnalyses.give(std::move(analysis));
+	});
+
+	if ((outputs & OUTPUT_GRADIENTS) && !(computedOutputs & OUTPUT_GRADIENTS))
+	{
+		if (storage == ReducedPrecision::STORAGE::FULL)
+		{
+			gradX = fullX;
+			gradY = fullY;
+		}
+		else
+		{
+			gradX.create(size, ReducedPrecision::depth<T>(storage));
+			gradY.create(size, ReducedPrecision::depth<T>(storage));
+			gradientScaleX.resize(size.height);
+			gradientScaleY.resize(size.height);
+			storeGradientRows(fullX, fullY, 0, threadPool.get());
+		}
+	}
+}
+
+// Overlap-add of tile gradients: tile (ty, tx) computes the gradients of its part of the frame
+// plus tileBlend() pixels on each inner side, from a context of tileMargin() more pixels, and adds
+// them with the product of a row and a column weight. The weights fade in and out over the blend
+// zones with raised-cosine ramps that sum to 1 with the neighbour's, so the result is a
+// partition-of-unity mix with no visible seam. Tiles of one colour (row and column parity) do not
+// overlap, so the colours run one after the other and the tiles of each in parallel, each on a
+// workspace of the pool; only the workers' spectra exist at a time, never one of the frame.
+template <typename T>
+void BasicStructureTensorAnalysis<T>::computeTiledGradients(cv::Mat& x, cv::Mat& y)
+{
+	const cv::Size size = image.size();
+	const cv::Rect frame(cv::Point(), size);
+	const std::vector<int> rowBounds = tileBounds(size.height, tileSize);
+	const std::vector<int> colBounds = tileBounds(size.width, tileSize);
+	const int tilesY = static_cast<int>(rowBounds.size()) - 1;
+	const int tilesX = static_cast<int>(colBounds.size()) - 1;
+
+	// The two ramps of a tile must not overlap
+	int blend = tileBlend(gradientMethod);
+	for (const std::vector<int>* bounds : { &rowBounds, &colBounds })
+	{
+		if (bounds->size() > 2)
+		{
+			for (size_t k = 0; k + 1 < bounds->size(); k++)
+			{
+				blend = std::min(blend, ((*bounds)[k + 1] - (*bounds)[k]) / 2);
+			}
+		}
+	}
+	const int margin = std::max(tileMargin(gradientMethod), blend);
+
+	x = cv::Mat::zeros(size, Precision<T>::depth);
+	y = cv::Mat::zeros(size, Precision<T>::depth);
+
+	const int colours = blend > 0 ? 4 : 1;
+	for (int colour = 0; colour < colours; colour++)
+	{
+		std::vector<cv::Point> tiles;
+		for (int ty = 0; ty < tilesY; ty++)
+		{
+			for (int tx = 0; tx < tilesX; tx++)
+			{
+				if (colours == 1 || (ty % 2) * 2 + tx % 2 == colour)
+					tiles.push_back(cv::Point(tx, ty));
+			}
+		}
+
+		ThreadPool::forEach(threadPool.get(), 0, static_cast<int>(tiles.size()), [&](int t)
+		{
+			const int tx = tiles[t].x;
+			const int ty = tiles[t].y;
+			const std::vector<T> rowWeights = fadeWeights<T>(rowBounds, ty, blend);
+			const std::vector<T> colWeights = fadeWeights<T>(colBounds, tx, blend);
+			const int x0 = tx > 0 ? colBounds[tx] - blend : 0;
+			const int y0 = ty > 0 ? rowBounds[ty] - blend : 0;
+			const cv::Rect faded(x0, y0, static_cast<int>(colWeights.size()), static_cast<int>(rowWeights.size()));
+			const cv::Rect context = cv::Rect(faded.x - margin, faded.y - margin, faded.width + 2 * margin,
+				faded.height + 2 * margin) & frame;
+
+			std::unique_ptr<Workspace> workspace = tileWorkspaces.take();
+			workspace->setAllocator(arena.get());
+			cv::Mat gx, gy;
+			computeGradients(image(context), gx, gy, gradientMethod, windowSize, *workspace, nullptr);
+
+			for (int i = 0; i < faded.height; i++)
+			{
+				const T* sx = gx.ptr<T>(faded.y - context.y + i) + (faded.x - context.x);
+				const T* sy = gy.ptr<T>(faded.y - context.y + i) + (faded.x - context.x);
+				T* dx = x.ptr<T>(faded.y + i) + faded.x;
+				T* dy = y.ptr<T>(faded.y + i) + faded.x;
+				const T wy = rowWeights[i];
+				for (int j = 0; j < faded.width; j++)
+				{
+					const T w = wy * colWeights[j];
+					dx[j] += w * sx[j];
+					dy[j] += w * sy[j];
+				}
+			}
+			tileWorkspaces.give(std::move(workspace));
+		});
+	}
+}
+
+// Forms the products of the whole frame from the stored gradients, decoded or converted to T first
+template <typename T>
+void BasicStructureTensorAnalysis<T>::formTensor()
+{
+	const cv::Mat* gx = &gradX;
+	const cv::Mat* gy = &gradY;
+	if (storage != ReducedPrecision::STORAGE::FULL)
+	{
+		decodeGradients(gradX, gradientScaleX, decodedGradX);
+		decodeGradients(gradY, gradientScaleY, decodedGradY);
+		gx = &decodedGradX;
+		gy = &decodedGradY;
+	}
+	else if (gradX.depth() != Precision<T>::depth || gradY.depth() != Precision<T>::depth)
+	{
+		gradX.convertTo(decodedGradX, Precision<T>::depth);
+		gradY.convertTo(decodedGradY, Precision<T>::depth);
+		gx = &decodedGradX;
+		gy = &decodedGradY;
+	}
+
+	const int rows = gx->rows;
+	const int cols = gx->cols;
+
+	{
+		CELL_PROFILE_SCOPE(profiler, "window", methodName(gradientMethod), static_cast<int64_t>(gx->total()));
+		tensorXX.create(rows, cols, Precision<T>::depth);
+		tensorYY.create(rows, cols, Precision<T>::depth);
+		tensorXY.create(rows, cols, Precision<T>::depth);
+
+		ThreadPool::forEach(threadPool.get(), 0, rows, [&](int row)
+		{
+			const T* x = gx->ptr<T>(row);
+			const T* y = gy->ptr<T>(row);
+			T* xx = tensorXX.ptr<T>(row);
+			T* yy = tensorYY.ptr<T>(row);
+			T* xy = tensorXY.ptr<T>(row);
+			for (int j = 0; j < cols; j++)
+			{
+				xx[j] = x[j] * x[j];
+				yy[j] = y[j] * y[j];
+				xy[j] = x[j] * y[j];
+			}
+		});
+
+	}
+}
+
+// Selects the window backend; the gradients stay valid, only the window and eigen stages run again
+template <typename T>
+void BasicStructureTensorAnalysis<T>::setWindowMethod(WINDOW_METHOD WindowMethod)
+{
+	if (WindowMethod == windowMethod)
+		return;
+
+	windowMethod = WindowMethod;
+	computedOutputs &= OUTPUT_GRADIENTS;
+}
+
+// Creates a private pool for band-parallel execution, or drops it for serial execution
+template <typename T>
+void BasicStructureTensorAnalysis<T>::setThreadCount(int Threads, bool Pinned)
+{
+	threadPool = (Threads > 1) ? std::make_shared<ThreadPool>(Threads, Pinned) : nullptr;
+}
+
+// Moves the intermediates to another allocator: the kernels, band buffers and pooled objects are
+// dropped while the previous arena is still alive and rebuilt from the new one on the next computation
+template <typename T>
+void BasicStructureTensorAnalysis<T>::setArena(std::shared_ptr<ArenaAllocator> Arena)
+{
+	if (Arena == arena)
+		return;
+
+	bands.clear();
+	regionAnalyses.clear();
+	tileWorkspaces.clear();
+	for (cv::Mat* m : { &tensorXX, &tensorYY, &tensorXY, &decodedGradX, &decodedGradY })
+	{
+		ArenaAllocator::use(*m, Arena.get());
+	}
+	arena = std::move(Arena);
+}
+
+// Restricts the analysis to the tiles with nonzero mask pixels; the outputs are recomputed on their next use
+template <typename T>
+void BasicStructureTensorAnalysis<T>::setMask(const cv::Mat& Mask, int TileSize)
+{
+	if (Mask.empty() || Mask.type() != CV_8UC1)
+		throw std::invalid_argument("Mask must be a non-empty CV_8UC1 image.");
+	if (TileSize < 1)
+		throw std::invalid_argument("Tile size must be positive.");
+
+	regionMask = Mask.clone();
+	regionRects.clear();
+	regionTileSize = TileSize;
+	computedOutputs = 0;
+}
+
+// Restricts the analysis to the tiles that intersect one of the rectangles
+template <typename T>
+void BasicStructureTensorAnalysis<T>::setRegions(const std::vector<cv::Rect>& Regions, int TileSize)
+{
+	if (TileSize < 1)
+		throw std::invalid_argument("Tile size must be positive.");
+
+	regionMask.release();
+	regionRects = Regions;
+	regionTileSize = TileSize;
+	computedOutputs = 0;
+}
+
+template <typename T>
+void BasicStructureTensorAnalysis<T>::clearRegions()
+{
+	regionMask.release();
+	regionRects.clear();
+	regionTileSize = 0;
+	regionAnalyses.clear();
+	computedOutputs = 0;
+}
+
+// Walks the tile grid row by row: foreground tiles that touch are merged into horizontal runs, and
+// a run continues the one of the previous tile row that spans the same columns, so that a
+// rectangular blob of foreground becomes a single run with a single halo
+template <typename T>
+std::vector<cv::Rect> BasicStructureTensorAnalysis<T>::activeRegions(cv::Size size) const
+{
+	const cv::Rect frame(cv::Point(), size);
+	if (regionTileSize <= 0 || frame.empty())
+		return { frame };
+
+	auto foreground = [&](const cv::Rect& tile)
+	{
+		if (regionMask.empty())
+		{
+			return std::any_of(regionRects.begin(), regionRects.end(), [&](const cv::Rect& r) { return !(r & tile).empty(); });
+		}
+
+		// Mask pixels that cover the tile once the mask is stretched over the frame
+		const int64_t mw = regionMask.cols;
+		const int64_t mh = regionMask.rows;
+		int x0 = static_cast<int>(tile.x * mw / size.width);
+		int y0 = static_cast<int>(tile.y * mh / size.height);
+		int x1 = static_cast<int>((tile.br().x * mw + size.width - 1) / size.width);
+		int y1 = static_cast<int>((tile.br().y * mh + size.height - 1) / size.height);
+		return cv::countNonZero(regionMask(cv::Rect(x0, y0, std::max(x1 - x0, 1), std::max(y1 - y0, 1)))) > 0;
+	};
+
+	const int tileSize = regionTileSize;
+	std::vector<cv::Rect> runs;
+	std::vector<cv::Rect> open; // Runs that reach the previous tile row
+	for (int y = 0; y < size.height; y += tileSize)
+	{
+		std::vector<cv::Rect> row;
+		for (int x = 0; x < size.width; x += tileSize)
+		{
+			cv::Rect tile = cv::Rect(x, y, tileSize, tileSize) & frame;
+			if (!foreground(tile))
+				continue;
+			if (!row.empty() && row.back().br().x == tile.x)
+				row.back().width += tile.width;
+			else
+				row.push_back(tile);
+		}
+
+		std::vector<cv::Rect> next;
+		for (const cv::Rect& run : row)
+		{
+			auto above = std::find_if(open.begin(), open.end(), [&](const cv::Rect& r) { return r.x == run.x && r.width == run.width; });
+			if (above != open.end())
+			{
+				next.push_back(cv::Rect(above->x, above->y, above->width, above->height + run.height));
+				open.erase(above);
+			}
+			else
+			{
+				next.push_back(run);
+			}
+		}
+		runs.insert(runs.end(), open.begin(), open.end());
+		open = next;
+	}
+	runs.insert(runs.end(), open.begin(), open.end());
+	return runs;
+}
+
+// Sets the processing tile size, 0 for whole frames; the outputs are recomputed on their next use
+template <typename T>
+void BasicStructureTensorAnalysis<T>::setTileSize(int TileSize)
+{
+	if (TileSize < 0)
+		throw std::invalid_argument("Tile size must not be negative.");
+
+	tileSize = TileSize;
+	computedOutputs = 0;
+}
+
+template <typename T>
+std::vector<cv::Rect> BasicStructureTensorAnalysis<T>::processingTiles(cv::Size size) const
+{
+	std::vector<cv::Rect> runs = activeRegions(size);
+	if (tileSize <= 0)
+		return runs;
+
+	std::vector<cv::Rect> tiles;
+	for (const cv::Rect& run : runs)
+	{
+		const std::vector<int> rows = tileBounds(run.height, tileSize);
+		const std::vector<int> cols = tileBounds(run.width, tileSize);
+		for (size_t i = 0; i + 1 < rows.size(); i++)
+		{
+			for (size_t j = 0; j + 1 < cols.size(); j++)
+			{
+				tiles.push_back(cv::Rect(run.x + cols[j], run.y + rows[i], cols[j + 1] - cols[j], rows[i + 1] - rows[i]));
+			}
+		}
+	}
+	return tiles;
+}
+
+// Sets the gradient computation method and window size; the outputs are recomputed on their next use.
+// The gradients only depend on the window size for HESSIAN, so for the other methods a window
+// change keeps them: the first pass after it stores them and every later one reuses them. The
+// products are not cached: they are formed on the fly from the two gradient rows, which is cheaper
+// than reading three cached product images back.
+template <typename T>
+void BasicStructureTensorAnalysis<T>::setGradientandWindowSize(GRADIENT_METHOD GradientMethod, int WindowSize)
+{
+	bool gradientsChange = GradientMethod != gradientMethod ||
+		(GradientMethod == GRADIENT_METHOD::HESSIAN && WindowSize != windowSize);
+	bool windowChange = WindowSize != windowSize;
+
 	gradientMethod = GradientMethod;
 	windowSize = WindowSize;
-	computeParameters();
+
+	if (gradientsChange)
+	{
+		computedOutputs = 0;
+	}
+	else if (windowChange)
+	{
+		computedOutputs &= OUTPUT_GRADIENTS;
+		retainGradients = true;
+	}
 }
+
+// Selects the precision of the stored intermediates; the stored gradients change format, so
+// everything is recomputed on next use
+template <typename T>
+void BasicStructureTensorAnalysis<T>::setStorage(ReducedPrecision::STORAGE Storage)
+{
+	if (Storage == storage)
+		return;
+
+	storage = Storage;
+	computedOutputs = 0;
+	gradX.release();
+	gradY.release();
+}
+
+// Stores gradient rows of any depth as rows of gradX/gradY: copied for FLOAT32, encoded row by row
+// otherwise. Bands store disjoint rows, so they call this concurrently without a pool.
+template <typename T>
+void BasicStructureTensorAnalysis<T>::storeGradientRows(const cv::Mat& x, const cv::Mat& y, int first, ThreadPool* pool)
+{
+	if (storage == ReducedPrecision::STORAGE::FULL)
+	{
+		x.copyTo(gradX.rowRange(first, first + x.rows));
+		y.copyTo(gradY.rowRange(first, first + y.rows));
+		return;
+	}
+
+	cv::Mat valuesX = x;
+	cv::Mat valuesY = y;
+	if (x.depth() != Precision<T>::depth)
+		x.convertTo(valuesX, Precision<T>::depth);
+	if (y.depth() != Precision<T>::depth)
+		y.convertTo(valuesY, Precision<T>::depth);
+
+	ThreadPool::forEach(pool, 0, x.rows, [&](int i)
+	{
+		gradientScaleX[first + i] = ReducedPrecision::encodeRow(valuesX.ptr<T>(i), x.cols, storage, gradX.ptr(first + i));
+		gradientScaleY[first + i] = ReducedPrecision::encodeRow(valuesY.ptr<T>(i), y.cols, storage, gradY.ptr(first + i));
+	});
+}
+
+// Float32 version of stored gradients; the stored matrix itself when nothing needs decoding
+template <typename T>
+cv::Mat BasicStructureTensorAnalysis<T>::decodeGradients(const cv::Mat& stored, const std::vector<T>& scales) const
+{
+	if (storage == ReducedPrecision::STORAGE::FULL || stored.empty())
+		return stored;
+
+	cv::Mat values;
+	decodeGradients(stored, scales, values);
+	return values;
+}
+
+// Decodes reduced-precision gradients into values, which keeps its buffer and allocator when the size matches
+template <typename T>
+void BasicStructureTensorAnalysis<T>::decodeGradients(const cv::Mat& stored, const std::vector<T>& scales, cv::Mat& values) const
+{
+	values.create(stored.size(), Precision<T>::depth);
+	ThreadPool::forEach(threadPool.get(), 0, stored.rows, [&](int i)
+	{
+		ReducedPrecision::decodeRow(stored.ptr(i), stored.cols, storage, scales[i], values.ptr<T>(i));
+	});
+}
+
+// Bytes held by intermediates; gradients that alias a gradient method's workspace are counted too
+template <typename T>
+size_t BasicStructureTensorAnalysis<T>::intermediateBytes() const
+{
+	size_t bytes = 0;
+	for (const cv::Mat* m : { &gradX, &gradY, &tensorXX, &tensorYY, &tensorXY, &decodedGradX, &decodedGradY })
+	{
+		bytes += m->total() * m->elemSize();
+	}
+	for (const BandWorkspace& band : bands)
+	{
+		bytes += band.kernel.ringBytes();
+	}
+	regionAnalyses.forEach([&](const BasicStructureTensorAnalysis& analysis) { bytes += analysis.intermediateBytes(); });
+	return bytes;
+}
+
+// Runs the analysis twice, with FLOAT32 and with the given storage, and measures the output errors.
+// Orientation errors are taken modulo pi and only where the reference is coherent enough for the
+// orientation to be defined.
+template <typename T>
+typename BasicStructureTensorAnalysis<T>::PrecisionReport BasicStructureTensorAnalysis<T>::comparePrecision(const cv::Mat& Image,
+	GRADIENT_METHOD GradientMethod, int WindowSize, ReducedPrecision::STORAGE Storage, int Threads)
+{
+	BasicStructureTensorAnalysis reference(Image, GradientMethod, WindowSize, Threads, OUTPUT_ALL);
+	BasicStructureTensorAnalysis reduced(Image, GradientMethod, WindowSize, Threads, OUTPUT_ALL);
+	reduced.setStorage(Storage);
+
+	cv::Mat referenceEnergy = reference.getEnegry();
+	cv::Mat referenceOrientation = reference.getOrientation();
+	cv::Mat referenceCoherency = reference.getCoherency();
+
+	PrecisionReport report;
+	report.storage = Storage;
+
+	double peak = 0;
+	cv::Mat difference;
+	cv::minMaxLoc(referenceEnergy, nullptr, &peak);
+	cv::absdiff(reduced.getEnegry(), referenceEnergy, difference);
+	cv::minMaxLoc(difference, nullptr, &report.energyMaxError);
+	report.energyMeanError = cv::mean(difference)[0];
+	if (peak > 0)
+	{
+		report.energyMaxError /= peak;
+		report.energyMeanError /= peak;
+	}
+
+	cv::absdiff(reduced.getCoherency(), referenceCoherency, difference);
+	cv::minMaxLoc(difference, nullptr, &report.coherencyMaxError);
+	report.coherencyMeanError = cv::mean(difference)[0];
+
+	cv::absdiff(reduced.getOrientation(), referenceOrientation, difference);
+	cv::Mat wrapped = CV_PI - difference;
+	cv::min(difference, wrapped, difference);
+	cv::Mat coherent = referenceCoherency >= 0.1;
+	if (cv::countNonZero(coherent) > 0)
+	{
+		cv::minMaxLoc(difference, nullptr, &report.orientationMaxError, nullptr, nullptr, coherent);
+		report.orientationMeanError = cv::mean(difference, coherent)[0];
+	}
+
+	report.referenceBytes = reference.intermediateBytes();
+	report.reducedBytes = reduced.intermediateBytes();
+	return report;
+}
+
+template class BasicStructureTensorAnalysis<float>;
+template class BasicStructureTensorAnalysis<double>;
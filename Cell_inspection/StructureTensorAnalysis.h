@@ -6,12 +6,23 @@
 #include <iostream>
 #include <filesystem>
 #include <fstream>
+#include <memory>
 #include <stdexcept>
 #include "spline.h"
+#include "ArenaAllocator.h"
 #include "GradientCalculator.h"
+#include "GradientStencil.h"
+#include "MappedImage.h"
+#include "ObjectPool.h"
+#include "Precision.h"
+#include "Profiler.h"
+#include "RecursiveGaussian.h"
+#include "ReducedPrecision.h"
+#include "StructureTensorKernel.h"
+#include "ThreadPool.h"
 
-// Class for performing structure tensor analysis on images
-class StructureTensorAnalysis
+// Options and precision-independent helpers shared by every precision of the analysis
+class StructureTensorTypes
 {
 
 public:
@@ -25,24 +36,238 @@ public:
         HESSIAN
     };
 
-    // Constructors
-    StructureTensorAnalysis() {};
-    StructureTensorAnalysis(cv::Mat Image, GRADIENT_METHOD GradientMethod, int WindowSize = 2);
+    // Outputs that can be requested, combined with |
+    enum OUTPUT {
+        OUTPUT_ENERGY = 1,
+        OUTPUT_ORIENTATION = 2,
+        OUTPUT_COHERENCY = 4,
+        OUTPUT_GRADIENTS = 8,
+        OUTPUT_ALL = OUTPUT_ENERGY | OUTPUT_ORIENTATION | OUTPUT_COHERENCY | OUTPUT_GRADIENTS,
+        OUTPUT_TENSOR = 16  // Smoothed Ixx, Iyy and Ixy; three extra maps, so not part of OUTPUT_ALL
+    };
+
+    // Window applied to the gradient products
+    enum class WINDOW_METHOD {
+        GAUSSIAN,   // Sampled Gaussian kernel, cost grows linearly with the window size
+        RECURSIVE   // Recursive Gaussian, constant cost per pixel; accuracy bound in RecursiveGaussian.h
+    };
+
+    // Name of a gradient method, as used in profiles and reports
+    static const char* methodName(GRADIENT_METHOD gradientMethod);
+
+    // Rows of halo a band of rows needs around itself for the gradient stencil, -1 for methods
+    // that have to see the whole image (CUBIC_SPLINE, FOURIER, RIESZ)
+    static int gradientHalo(GRADIENT_METHOD gradientMethod, int windowSize);
+
+    // Rows of gradients computed per halo'd chunk; long enough for the halo recomputation to stay
+    // a small fraction of the work
+    static int gradientChunkRows(int halo) { return std::max(64, 8 * halo); }
+
+    // Context on each side of a tile of gradients of a whole-image method (CUBIC_SPLINE, FOURIER,
+    // RIESZ), and the part of it, next to the tile, over which adjacent tiles are cross-faded; both
+    // 0 for the other methods, whose tiles are exact with their gradientHalo()
+    static int tileMargin(GRADIENT_METHOD gradientMethod);
+    static int tileBlend(GRADIENT_METHOD gradientMethod);
+
+    // True for the methods whose gradients are evaluated by a stencil inside the product loop
+    // (FINITE_DIFFERENCE, GAUSSIAN; see GradientStencil.h) instead of being computed beforehand
+    static bool hasStencil(GRADIENT_METHOD gradientMethod)
+    {
+        return gradientMethod == GRADIENT_METHOD::FINITE_DIFFERENCE || gradientMethod == GRADIENT_METHOD::GAUSSIAN;
+    }
+};
+
+// Class for performing structure tensor analysis on images. Every value, from the gradients to
+// the output maps, has the type T (float or double, see Precision); StructureTensorAnalysis is the
+// float analysis, the fast default, and BasicStructureTensorAnalysis<double> the reference one.
+template <typename T>
+class BasicStructureTensorAnalysis : public StructureTensorTypes
+{
+
+public:
+    using Kernel = BasicStructureTensorKernel<T>;
+    using Workspace = typename BasicGradientCalculator<T>::Workspace;
+
+    // Constructors. Nothing is computed here: every output is computed by the first getter that
+    // needs it, together with the other requested outputs, and memoized until the image, method
+    // or window size changes.
+    BasicStructureTensorAnalysis() {};
+    // The image is borrowed, not copied: it may be a ROI of a larger image and must stay unchanged
+    // until the outputs have been computed.
+    BasicStructureTensorAnalysis(const cv::Mat& Image, GRADIENT_METHOD GradientMethod, int WindowSize = 2, int Threads = 1,
+        int Outputs = OUTPUT_ALL);
+
+    // Session constructor: configures the analysis for frames of one size and preallocates the
+    // kernels and the requested output buffers; frames are then fed with process()
+    BasicStructureTensorAnalysis(cv::Size FrameSize, GRADIENT_METHOD GradientMethod, int WindowSize = 2, int Threads = 1,
+        int Outputs = OUTPUT_ALL);
+
+    // Analyze the next frame and compute the requested outputs, reusing every buffer of the previous
+    // frame when the size is unchanged. The frame is referenced, not copied, and the getters then
+    // alias buffers that the next call overwrites; clone them to keep results across frames.
+    void process(const cv::Mat& Frame);
 
-    // Function to read an image from a given file path
+    // Same for a frame in memory the caller owns, e.g. an acquisition buffer: Step is the distance
+    // between rows in bytes. The memory is read in place and must stay valid until the outputs have
+    // been computed.
+    void process(const void* Data, cv::Size Size, int Type, size_t Step = cv::Mat::AUTO_STEP)
+    {
+        process(cv::Mat(Size, Type, const_cast<void*>(Data), Step));
+    }
+
+    // Caller-owned destinations of the windowed outputs. Every non-empty buffer must have the frame
+    // size and depth Precision<T>::depth, and may be a view into a larger buffer, such as a ROI of
+    // a mosaic or a cv::Mat over a mapped file: the analysis writes its rows straight into it instead
+    // of into buffers of its own, and the getters return it. The analysis keeps a header of every
+    // buffer until they are replaced, which shares ownership of a cv::Mat that owns its data and
+    // borrows external memory, so that memory must outlive the binding. Gradients are not bindable:
+    // the whole-image methods hand over their own buffers.
+    struct OutputBuffers
+    {
+        cv::Mat energy;
+        cv::Mat orientation;
+        cv::Mat coherency;
+        cv::Mat ixx, iyy, ixy;
+    };
+
+    // Bind the output buffers (empty ones are allocated by the analysis as usual); the windowed
+    // outputs are recomputed into them on their next use, the gradients are kept
+    void setOutputBuffers(const OutputBuffers& Buffers);
+
+    // Write the outputs into buffers of the analysis again
+    void clearOutputBuffers() { setOutputBuffers(OutputBuffers()); }
+
+    // Analyze the next frame straight into the given buffers, e.g. the frame's tile of a mosaic
+    void process(const cv::Mat& Frame, const OutputBuffers& Buffers)
+    {
+        setOutputBuffers(Buffers);
+        process(Frame);
+    }
+
+    // Declare which outputs (OUTPUT flags) are wanted. Outputs that are not requested are neither
+    // allocated nor computed unless their getter is called, and the gradients are only kept when
+    // OUTPUT_GRADIENTS is set.
+    void setOutputs(int Outputs) { requestedOutputs = Outputs; }
+    int getOutputs() const { return requestedOutputs; }
+
+    // Read a grayscale image at its own depth (8 or 16 bits); uncompressed TIFFs are mapped, not
+    // decoded (see MappedImage)
     cv::Mat read_image(const std::string& Path);
 
-    // Set the gradient computation method and window size
+    // Set the gradient computation method and window size; outputs are recomputed on their next use.
+    // When only the window size changes (and the method is not HESSIAN, whose gradients depend on
+    // it) the gradients of the current image are kept and only the window and eigen stages run again.
     void setGradientandWindowSize(GRADIENT_METHOD GradientMethod, int WindowSize = 2);
 
-    // Getter functions for gradient, energy, orientation, and coherency matrices
-    cv::Mat getGradX() const { return gradX; }
-    cv::Mat getGradY() const { return gradY; }
-    cv::Mat getEnegry() const { return Energy; }
-    cv::Mat getOrientation() const { return Orientation; } 
-    cv::Mat getCoherency() const { return Coherency; }
+    // Change only the window size, e.g. to sweep scales over one image
+    void setWindowSize(int WindowSize) { setGradientandWindowSize(gradientMethod, WindowSize); }
+
+    // Select the window backend. RECURSIVE is used for window sizes of at least
+    // RecursiveGaussian::minSigma and replicates the image borders instead of reflecting them;
+    // it works on whole frames, so it needs three full-size tensor images instead of a row ring.
+    void setWindowMethod(WINDOW_METHOD WindowMethod);
+    WINDOW_METHOD getWindowMethod() const { return windowMethod; }
+
+    // Run the following computations on a private pool of the given number of threads (1 = serial),
+    // optionally pinned to CPUs node by node (see ThreadPool). The image is split into overlapping
+    // row bands and the results are bit-identical to the serial path.
+    void setThreadCount(int Threads, bool Pinned = false);
+
+    // Share an existing thread pool between several analyses (nullptr = serial)
+    void setThreadPool(std::shared_ptr<ThreadPool> Pool) { threadPool = Pool; }
+
+    // Pool the computations run on, null when serial; its statistics() tell how busy the workers were
+    std::shared_ptr<ThreadPool> getThreadPool() const { return threadPool; }
+
+    // Allocate the intermediates (window rings, row and chunk buffers, gradient scratch, whole-frame
+    // tensors and the nested analyses of regions and tiles) from an arena, which several analyses
+    // and threads may share, or from the default allocator when null. The outputs and the gradients
+    // the getters return keep the default allocator, so they outlive the arena. The intermediates
+    // are reallocated by the next computation.
+    void setArena(std::shared_ptr<ArenaAllocator> Arena);
+    std::shared_ptr<ArenaAllocator> getArena() const { return arena; }
+
+    // Precision of the stored intermediates: the gradients kept between passes and the ring of the
+    // window stage. FLOAT16 and INT16 halve their memory and bandwidth (in float) while every
+    // computation stays in T; the error bounds are in ReducedPrecision.h and comparePrecision()
+    // measures the effect on the outputs. The recursive window keeps full-precision tensor images.
+    void setStorage(ReducedPrecision::STORAGE Storage);
+    ReducedPrecision::STORAGE getStorage() const { return storage; }
+
+    // Restrict the following computations to the tiles of TileSize x TileSize pixels that contain
+    // foreground: nonzero pixels of a CV_8UC1 mask, or pixels of a list of rectangles. The mask may
+    // be smaller than the frames (e.g. a threshold of a downsampled image) and is stretched over
+    // each frame. Foreground tiles are merged into runs, and every run is analyzed on its own with
+    // a halo wide enough for the gradient stencil and the window, so its pixels get the values of
+    // the full-frame analysis; with the recursive window they do up to the Gaussian tail beyond
+    // the halo. Outputs are 0 outside the runs, except the gradients of the whole-image methods
+    // (CUBIC_SPLINE, FOURIER, RIESZ), which are computed everywhere.
+    void setMask(const cv::Mat& Mask, int TileSize = 256);
+    void setRegions(const std::vector<cv::Rect>& Regions, int TileSize = 256);
+
+    // Analyze every pixel again
+    void clearRegions();
+
+    // Rectangles analyzed for frames of the given size: the runs of foreground tiles, or the whole
+    // frame when no mask or regions are set
+    std::vector<cv::Rect> activeRegions(cv::Size size) const;
+
+    // Process frames in tiles of at most TileSize x TileSize pixels (0 = whole frames, the default).
+    // Each tile is analyzed on its own with its halo, as a run of setMask(), by one of a pool of
+    // nested analyses, so the working memory grows with the tile size and the worker count instead
+    // of the frame size, and tiles are spread over the workers. The whole-image methods compute
+    // their gradients tile by tile as well: each tile's spline or FFT covers the tile plus
+    // tileMargin() pixels, and adjacent tiles are cross-faded with raised-cosine weights over
+    // tileBlend() pixels. Their results then differ from the whole-frame ones near the seams by the
+    // truncation of their infinite support; the other methods give the same results.
+    void setTileSize(int TileSize);
+    int getTileSize() const { return tileSize; }
+
+    // Getter functions for gradient, energy, orientation, and coherency matrices; each computes its
+    // output on first use. With reduced storage the gradients are returned as decoded copies. Bound
+    // output buffers are returned as they are.
+    cv::Mat getGradX() { ensureOutputs(OUTPUT_GRADIENTS); return decodeGradients(gradX, gradientScaleX); }
+    cv::Mat getGradY() { ensureOutputs(OUTPUT_GRADIENTS); return decodeGradients(gradY, gradientScaleY); }
+    cv::Mat getEnegry() { ensureOutputs(OUTPUT_ENERGY); return Energy; }
+    cv::Mat getOrientation() { ensureOutputs(OUTPUT_ORIENTATION); return Orientation; }
+    cv::Mat getCoherency() { ensureOutputs(OUTPUT_COHERENCY); return Coherency; }
+    cv::Mat getTensorXX() { ensureOutputs(OUTPUT_TENSOR); return Ixx; }
+    cv::Mat getTensorYY() { ensureOutputs(OUTPUT_TENSOR); return Iyy; }
+    cv::Mat getTensorXY() { ensureOutputs(OUTPUT_TENSOR); return Ixy; }
+
+    // Compute image gradients of depth Precision<T>::depth based on the selected method
+    static void computeGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY,
+        GRADIENT_METHOD gradientMethod, int windowSize, Workspace& workspace, ThreadPool* pool = nullptr);
+
+    // Per-stage timings ("frame", "prepare", "gradient", "window", "eigen") of every computation
+    // so far, per gradient method. Only filled when built with CELL_INSPECTION_PROFILING; see Profiler.
+    // The stencil methods have no "gradient" stage: their gradients are part of the "window" one.
+    Profiler& getProfiler() { return profiler; }
+    const Profiler& getProfiler() const { return profiler; }
+
+    // Bytes currently held by intermediates: stored gradients, window rings and whole-frame tensors
+    size_t intermediateBytes() const;
+
+    // Errors of a reduced-precision analysis against the FULL one, for every output
+    struct PrecisionReport
+    {
+        ReducedPrecision::STORAGE storage = ReducedPrecision::STORAGE::FULL;
+        double energyMaxError = 0;          // Relative to the largest reference energy
+        double energyMeanError = 0;
+        double orientationMaxError = 0;     // Radians, modulo pi, where the reference coherency is at least 0.1
+        double orientationMeanError = 0;
+        double coherencyMaxError = 0;       // Absolute
+        double coherencyMeanError = 0;
+        size_t referenceBytes = 0;          // intermediateBytes() of the FULL analysis
+        size_t reducedBytes = 0;            // intermediateBytes() of the reduced one
+    };
+
+    // Analyze an image with FULL and with the given storage, keeping the gradients, and compare
+    static PrecisionReport comparePrecision(const cv::Mat& Image, GRADIENT_METHOD GradientMethod, int WindowSize,
+        ReducedPrecision::STORAGE Storage, int Threads = 1);
 
 private:
+    std::shared_ptr<ArenaAllocator> arena; // Allocator of the intermediates, declared first so it is destroyed last
     cv::Mat image; // Input image
 
     // Matrices for gradient and structure tensor components
@@ -51,13 +276,59 @@ private:
     cv::Mat Energy;
     cv::Mat Orientation;
     cv::Mat Coherency;
+    cv::Mat Ixx, Iyy, Ixy; // Smoothed tensor components, only kept when OUTPUT_TENSOR is requested
+    OutputBuffers outputBuffers; // Caller-owned destinations of the outputs above, empty when not bound
+
+    GRADIENT_METHOD gradientMethod = GRADIENT_METHOD::CUBIC_SPLINE; // Selected gradient computation method
+    int windowSize = 2; // Window size for tensor computation
+    WINDOW_METHOD windowMethod = WINDOW_METHOD::GAUSSIAN; // Backend of the window
+    std::shared_ptr<ThreadPool> threadPool; // Workers for band-parallel execution, null when serial
+    int requestedOutputs = OUTPUT_ALL; // Outputs computed together by one pass
+    int computedOutputs = 0; // Outputs that are up to date for the current image and configuration
+    bool retainGradients = false; // Keep the gradients after a window-only change, for the next ones
+    Profiler profiler; // Stage statistics of the instrumented hot path
+    ReducedPrecision::STORAGE storage = ReducedPrecision::STORAGE::FULL; // Precision of stored intermediates
+    std::vector<T> gradientScaleX, gradientScaleY; // Row scales of reduced-precision gradients
+
+    // Reusable state of one band of output rows
+    struct BandWorkspace
+    {
+        int rowBegin = 0;
+        int rowEnd = 0;
+        Kernel kernel;
+        cv::Mat chunkX, chunkY;     // Gradients of one halo'd chunk
+        cv::Mat rowX, rowY;         // Decoded gradient row
+        Workspace gradient;
+        FiniteDifferenceStencil<T> finiteDifference;
+        GaussianStencil<T> gaussian;
+    };
+
+    std::vector<BandWorkspace> bands;
+    Workspace frameWorkspace; // Scratch of the whole-image gradient methods
+
+    // Outputs that need the windowed tensor
+    static constexpr int windowedOutputs = OUTPUT_ENERGY | OUTPUT_ORIENTATION | OUTPUT_COHERENCY | OUTPUT_TENSOR;
 
-    cv::Mat Ixx;
-    cv::Mat Iyy;
-    cv::Mat Ixy;
+    // Whole-frame buffers of the recursive window
+    cv::Mat tensorXX, tensorYY, tensorXY;
+    cv::Mat decodedGradX, decodedGradY;
+    RecursiveGaussian recursiveGaussian;
 
-    GRADIENT_METHOD gradientMethod; // Selected gradient computation method
-    int windowSize; // Window size for tensor computation
+    // Configuration the bands were prepared for
+    cv::Size preparedSize;
+    GRADIENT_METHOD preparedMethod;
+    int preparedWindowSize = 0;
+    int preparedThreads = 0;
+    WINDOW_METHOD preparedWindowMethod = WINDOW_METHOD::GAUSSIAN;
+    ReducedPrecision::STORAGE preparedStorage = ReducedPrecision::STORAGE::FULL;
+
+    // Foreground of setMask() or setRegions(); regionTileSize is 0 when every pixel is analyzed
+    cv::Mat regionMask;
+    std::vector<cv::Rect> regionRects;
+    int regionTileSize = 0;
+    int tileSize = 0; // Processing tile size, 0 for whole frames
+    ObjectPool<BasicStructureTensorAnalysis> regionAnalyses; // Nested analyses of the runs, one per concurrent run
+    ObjectPool<Workspace> tileWorkspaces; // Scratch of the tiled whole-image gradients
 
     // Helper function to check if a file exists
     bool checkExistence(const std::string& filename)
@@ -67,32 +338,76 @@ private:
         return f.is_open();
     }
 
-    // Compute image gradients based on the selected method
-    void computeGradients(const cv::Mat& grayImage, cv::Mat& gradX, cv::Mat& gradY,
-        GRADIENT_METHOD gradientMethod, int windowSize = 2);
 
-    // Compute structure tensor components from gradients
-    std::tuple<cv::Mat, cv::Mat, cv::Mat> computeStructuralTensor(const cv::Mat& gradX,
-        const cv::Mat& gradY, int windowSize);
+    // Split the rows into bands and allocate kernels and requested outputs, unless the configuration is unchanged
+    void prepare(cv::Size size);
+
+    // Allocate the buffers of the given outputs
+    void allocateOutputs(cv::Size size, int outputs);
+
+    // Stream the output rows of a band through its kernel, computing gradients in halo'd chunks
+    void computeBand(BandWorkspace& band, int halo, int outputs, const typename Kernel::RowTarget& target);
+
+    // Run the gradient rows [first, last) of a stencil method through a window (RingWindow for the
+    // band's kernel, FrameWindow for the recursive one, null when only gradients are wanted),
+    // storing the band's own gradient rows when OUTPUT_GRADIENTS is set. Dispatches on the method
+    // to streamStencil, which is instantiated per stencil, precision and window.
+    template <class Window>
+    void streamFused(BandWorkspace& band, Window* window, int first, int last, int outputs);
+
+    template <class Stencil, class Window>
+    void streamStencil(BandWorkspace& band, Stencil& stencil, Window* window, int first, int last, int outputs);
+
+    // Push gradient rows [first, last) into the fused structure tensor kernel of a band; stored
+    // tells that they are gradX/gradY in the storage precision rather than freshly computed rows
+    void pushGradientRows(BandWorkspace& band, const cv::Mat& gradX, const cv::Mat& gradY,
+        int first, int last, const typename Kernel::RowTarget& target, bool stored = false);
+
+#ifdef CELL_INSPECTION_PROFILING
+    // Record a pass of a band through its kernel as window and eigen stages
+    void recordWindow(BandWorkspace& band, Profiler::Clock::time_point start, size_t bytes, int64_t pixels);
+#endif
+
+    // Store gradient rows, computed in any depth, as rows [first, first + x.rows) of gradX/gradY
+    void storeGradientRows(const cv::Mat& x, const cv::Mat& y, int first, ThreadPool* pool);
+
+    // Full-precision version of stored gradients
+    cv::Mat decodeGradients(const cv::Mat& stored, const std::vector<T>& scales) const;
+    void decodeGradients(const cv::Mat& stored, const std::vector<T>& scales, cv::Mat& values) const;
+
+    // True when the window is applied by the recursive filter
+    bool usesRecursiveWindow() const
+    {
+        return windowMethod == WINDOW_METHOD::RECURSIVE && windowSize >= RecursiveGaussian::minSigma;
+    }
+
+    // Form the tensor of the whole frame, smooth it with the recursive filter and run the eigen-analysis.
+    // With fused, the products are formed band by band from the stencil instead of from gradX/gradY.
+    void computeRecursive(int outputs, bool fused, const typename Kernel::RowTarget& target);
+
+    // Form the products of the whole frame into tensorXX/YY/XY from gradX/gradY
+    void formTensor();
 
-    // Compute energy matrix from structure tensor components
-    cv::Mat computeEnergy(const cv::Mat& Ixx, const cv::Mat& Iyy);
+    // Rows and columns of context a run of tiles needs around itself
+    int regionHalo() const { return std::max(gradientHalo(gradientMethod, windowSize), 0) + Kernel::gaussianRadius(windowSize); }
 
-    // Compute orientation matrix from structure tensor components
-    cv::Mat computeOrientation(const cv::Mat& Ixx,
-        const cv::Mat& Iyy, const cv::Mat Ixy);
+    // The runs of activeRegions() cut into tiles of at most tileSize x tileSize
+    std::vector<cv::Rect> processingTiles(cv::Size size) const;
 
-    // Compute coherency matrix from structure tensor components
-    cv::Mat computeCoherency(const cv::Mat& Ixx,
-        const cv::Mat& Iyy, const cv::Mat Ixy);
+    // Analyze each run on its own and assemble the outputs; runs are split among the workers
+    void computeRegions(const std::vector<cv::Rect>& runs, int outputs);
+
+    // Gradients of a whole-image method, computed tile by tile and cross-faded
+    void computeTiledGradients(cv::Mat& x, cv::Mat& y);
+
+    // Compute the given outputs, plus the requested ones, unless they are already up to date
+    void ensureOutputs(int outputs);
 
     // Compute color survey visualization of the image
     cv::Mat computeColorSurvay(const cv::Mat& Image, int windowSize = 2);
 
-    // Alternative function to compute structure tensor components
-    void computeStructuralTensor(const cv::Mat& gradX, const cv::Mat& gradY, int windowSize,
-        cv::Mat& Ixx, cv::Mat& Iyy, cv::Mat& Ixy);
-
-    // Compute all relevant parameters for analysis
-    void computeParameters();
+    // Compute the given outputs in a single fused pass over row bands
+    void computeParameters(int outputs);
 };
+
+using StructureTensorAnalysis = BasicStructureTensorAnalysis<float>;
@@ -0,0 +1,496 @@
+#include "StructureTensorKernel.h"
+#include "GradientStencil.h"
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+	// Odd minimax polynomial of atan on [0, 1], x * (c0 + c1 x^2 + ... + c5 x^10); its error is
+	// below 1.7e-6 rad
+	const float atanC0 = 0.99997726f;
+	const float atanC1 = -0.33262347f;
+	const float atanC2 = 0.19354346f;
+	const float atanC3 = -0.11643287f;
+	const float atanC4 = 0.05265332f;
+	const float atanC5 = -0.01172120f;
+	const float halfPi = static_cast<float>(CV_PI / 2);
+	const float pi = static_cast<float>(CV_PI);
+	const float twoPi = static_cast<float>(2 * CV_PI);
+
+	// atan2(y, x) in [0, 2 pi): the polynomial on min(|x|, |y|) / max(|x|, |y|), folded into the
+	// octant of (x, y). FLT_MIN keeps 0 / 0 at 0, as std::atan2(0, 0).
+	inline float fastAtan2(float y, float x)
+	{
+		const float ax = std::abs(x);
+		const float ay = std::abs(y);
+		const float a = std::min(ax, ay) / (std::max(ax, ay) + FLT_MIN);
+		const float s = a * a;
+		float r = (((((atanC5 * s + atanC4) * s + atanC3) * s + atanC2) * s + atanC1) * s + atanC0) * a;
+		if (ay > ax)
+			r = halfPi - r;
+		if (x < 0)
+			r = pi - r;
+		if (y < 0)
+			r = twoPi - r;
+		return r;
+	}
+
+#if CV_SIMD || CV_SIMD_SCALABLE
+	// fastAtan2 on every lane
+	inline cv::v_float32 v_fastAtan2(const cv::v_float32& y, const cv::v_float32& x)
+	{
+		const cv::v_float32 zero = cv::vx_setzero_f32();
+		const cv::v_float32 ax = cv::v_abs(x);
+		const cv::v_float32 ay = cv::v_abs(y);
+		const cv::v_float32 a = cv::v_div(cv::v_min(ax, ay), cv::v_add(cv::v_max(ax, ay), cv::vx_setall_f32(FLT_MIN)));
+		const cv::v_float32 s = cv::v_mul(a, a);
+		cv::v_float32 r = cv::v_fma(s, cv::vx_setall_f32(atanC5), cv::vx_setall_f32(atanC4));
+		r = cv::v_fma(r, s, cv::vx_setall_f32(atanC3));
+		r = cv::v_fma(r, s, cv::vx_setall_f32(atanC2));
+		r = cv::v_fma(r, s, cv::vx_setall_f32(atanC1));
+		r = cv::v_mul(cv::v_fma(r, s, cv::vx_setall_f32(atanC0)), a);
+		r = cv::v_select(cv::v_gt(ay, ax), cv::v_sub(cv::vx_setall_f32(halfPi), r), r);
+		r = cv::v_select(cv::v_lt(x, zero), cv::v_sub(cv::vx_setall_f32(pi), r), r);
+		r = cv::v_select(cv::v_lt(y, zero), cv::v_sub(cv::vx_setall_f32(twoPi), r), r);
+		return r;
+	}
+#endif
+}
+
+/**
+ * @brief Builds the half Gaussian window, the border tables and the ring buffer.
+ *
+ * @param rows Number of image rows.
+ * @param cols Number of image columns.
+ * @param sigma Standard deviation of the Gaussian window.
+ * @param storage Precision of the ring.
+ * @param allocator Allocator of the ring and row buffers, null for the default one.
+ */
+template <typename T>
+BasicStructureTensorKernel<T>::BasicStructureTensorKernel(int rows, int cols, double sigma, ReducedPrecision::STORAGE storage,
+	cv::MatAllocator* allocator) :
+	rows{ rows }, cols{ cols }, storage{ storage }
+{
+	if (rows <= 0 || cols <= 0)
+		throw std::invalid_argument("StructureTensorKernel: image must not be empty.");
+	if (sigma <= 0)
+		throw std::invalid_argument("StructureTensorKernel: window size must be positive.");
+
+	windowRadius = gaussianRadius(sigma);
+	ringSize = 2 * windowRadius + 1;
+
+	cv::Mat kernel = cv::getGaussianKernel(ringSize, sigma, Precision<T>::depth);
+	weights.resize(windowRadius + 1);
+	for (int k = 0; k <= windowRadius; k++)
+	{
+		weights[k] = kernel.at<T>(windowRadius + k, 0);
+	}
+
+	leftBorder.resize(windowRadius);
+	rightBorder.resize(windowRadius);
+	for (int k = 0; k < windowRadius; k++)
+	{
+		leftBorder[k] = cv::borderInterpolate(k - windowRadius, cols, cv::BORDER_REFLECT_101);
+		rightBorder[k] = cv::borderInterpolate(cols + k, cols, cv::BORDER_REFLECT_101);
+	}
+
+	for (cv::Mat* m : { &padded, &ring, &tensor, &smoothed, &decoded })
+	{
+		m->allocator = allocator;
+	}
+	padded.create(3, cols + 2 * windowRadius, Precision<T>::depth);
+	ring.create(ringSize, 3 * cols, ReducedPrecision::depth<T>(storage));
+	tensor.create(1, 3 * cols, Precision<T>::depth);
+	if (storage != ReducedPrecision::STORAGE::FULL)
+	{
+		ringScales.assign(3 * ringSize, T(1));
+		smoothed.create(1, 3 * cols, Precision<T>::depth);
+		decoded.create(1, std::min(cols, reducedBlock), Precision<T>::depth);
+	}
+
+	begin(0, rows);
+}
+
+/**
+ * @brief Radius of the window cv::GaussianBlur derives from sigma when called with Size(0, 0).
+ *
+ * @param sigma Standard deviation of the Gaussian window.
+ * @return Half the kernel width.
+ */
+template <typename T>
+int BasicStructureTensorKernel<T>::gaussianRadius(double sigma)
+{
+	int ksize = cvRound(sigma * 4 * 2 + 1) | 1;
+	return ksize / 2;
+}
+
+/**
+ * @brief Restarts streaming for a band of output rows.
+ *
+ * The band needs gradient rows from radius rows above to radius rows below itself,
+ * clipped to the image.
+ *
+ * @param rowBegin First output row.
+ * @param rowEnd One past the last output row.
+ */
+template <typename T>
+void BasicStructureTensorKernel<T>::begin(int rowBegin, int rowEnd)
+{
+	CV_Assert(0 <= rowBegin && rowBegin <= rowEnd && rowEnd <= rows);
+
+	firstInput = std::max(0, rowBegin - windowRadius);
+	lastInput = std::min(rows, rowEnd + windowRadius);
+	nextInput = firstInput;
+	nextOutput = rowBegin;
+	outputEnd = rowEnd;
+}
+
+/**
+ * @brief Pushes the next gradient row of the band.
+ *
+ * @param gx Gradient row in the X direction.
+ * @param gy Gradient row in the Y direction.
+ * @param target Provides the destination of each emitted row.
+ * @return Number of output rows emitted by this call.
+ */
+template <typename T>
+int BasicStructureTensorKernel<T>::pushRow(const T* gx, const T* gy, const RowTarget& target)
+{
+	return pushRow(GradientRows<T>(gx, gy), target);
+}
+
+/**
+ * @brief Pushes the next gradient row of the band, evaluated by a stencil.
+ *
+ * The stencil is inlined into the loop that forms the products into a padded scratch row, so
+ * the gradients exist only in registers unless they are wanted in gx/gy. The products are then
+ * smoothed horizontally into the ring slot of that row, and every output row whose vertical
+ * window is now complete is emitted.
+ *
+ * @param stencil Prepared for the gradient row to push.
+ * @param target Provides the destination of each emitted row.
+ * @param gx Optional destination of the gradient row in the X direction.
+ * @param gy Optional destination of the gradient row in the Y direction.
+ * @return Number of output rows emitted by this call.
+ */
+template <typename T>
+template <class Stencil>
+int BasicStructureTensorKernel<T>::pushRow(const Stencil& stencil, const RowTarget& target, T* gx, T* gy)
+{
+	CV_Assert(nextInput < lastInput);
+
+	const int r = windowRadius;
+	T* pxx = padded.ptr<T>(0) + r;
+	T* pyy = padded.ptr<T>(1) + r;
+	T* pxy = padded.ptr<T>(2) + r;
+
+	if (gx && gy)
+	{
+		for (int j = 0; j < cols; j++)
+		{
+			T x, y;
+			stencil(j, x, y);
+			gx[j] = x;
+			gy[j] = y;
+			pxx[j] = x * x;
+			pyy[j] = y * y;
+			pxy[j] = x * y;
+		}
+	}
+	else
+	{
+		for (int j = 0; j < cols; j++)
+		{
+			T x, y;
+			stencil(j, x, y);
+			pxx[j] = x * x;
+			pyy[j] = y * y;
+			pxy[j] = x * y;
+		}
+	}
+
+	for (int p = 0; p < 3; p++)
+	{
+		T* src = padded.ptr<T>(p);
+		for (int k = 0; k < r; k++)
+		{
+			src[k] = src[r + leftBorder[k]];
+			src[r + cols + k] = src[r + rightBorder[k]];
+		}
+
+		// Symmetric window: accumulate one tap pair at a time so the inner loop vectorizes
+		const bool reduced = storage != ReducedPrecision::STORAGE::FULL;
+		T* dst = (reduced ? smoothed.ptr<T>() : ring.ptr<T>(nextInput % ringSize)) + p * cols;
+		const T* centre = src + r;
+		for (int j = 0; j < cols; j++)
+		{
+			dst[j] = weights[0] * centre[j];
+		}
+		for (int k = 1; k <= r; k++)
+		{
+			const T w = weights[k];
+			const T* left = centre - k;
+			const T* right = centre + k;
+			for (int j = 0; j < cols; j++)
+			{
+				dst[j] += w * (left[j] + right[j]);
+			}
+		}
+
+		if (reduced)
+		{
+			int slot = nextInput % ringSize;
+			ringScales[3 * slot + p] = ReducedPrecision::encodeRow(dst, cols, storage,
+				ring.ptr(slot) + p * cols * ring.elemSize());
+		}
+	}
+
+	nextInput++;
+
+	// Row y is complete once rows up to y + radius (or the last image row) have been pushed
+	int emitted = 0;
+	int ready = (nextInput == rows) ? outputEnd : std::min(outputEnd, nextInput - r);
+	while (nextOutput < ready)
+	{
+		emitRow(nextOutput, target);
+		nextOutput++;
+		emitted++;
+	}
+	return emitted;
+}
+
+/**
+ * @brief Applies the vertical window to the ring, copies out the tensor components that are wanted
+ * and runs the eigen-analysis for one row.
+ *
+ * @param row Image row to emit.
+ * @param target Provides the destination of the row.
+ */
+template <typename T>
+void BasicStructureTensorKernel<T>::emitRow(int row, const RowTarget& target)
+{
+	const int r = windowRadius;
+	const int n = 3 * cols;
+	T* acc = tensor.ptr<T>(0);
+
+	if (storage != ReducedPrecision::STORAGE::FULL)
+	{
+		accumulateReduced(row);
+	}
+	else
+	{
+		const T* centre = ring.ptr<T>(row % ringSize);
+		for (int j = 0; j < n; j++)
+		{
+			acc[j] = weights[0] * centre[j];
+		}
+		for (int k = 1; k <= r; k++)
+		{
+			const T w = weights[k];
+			const T* above = ring.ptr<T>(cv::borderInterpolate(row - k, rows, cv::BORDER_REFLECT_101) % ringSize);
+			const T* below = ring.ptr<T>(cv::borderInterpolate(row + k, rows, cv::BORDER_REFLECT_101) % ringSize);
+			for (int j = 0; j < n; j++)
+			{
+				acc[j] += w * (above[j] + below[j]);
+			}
+		}
+	}
+
+	const RowOutput out = target(row);
+	if (out.ixx)
+		std::copy(acc, acc + cols, out.ixx);
+	if (out.iyy)
+		std::copy(acc + cols, acc + 2 * cols, out.iyy);
+	if (out.ixy)
+		std::copy(acc + 2 * cols, acc + 3 * cols, out.ixy);
+	if (!out.energy && !out.orientation && !out.coherency)
+		return;
+
+#ifdef CELL_INSPECTION_PROFILING
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	eigenRow(acc, acc + cols, acc + 2 * cols, cols, out);
+	eigenTime += std::chrono::steady_clock::now() - start;
+#else
+	eigenRow(acc, acc + cols, acc + 2 * cols, cols, out);
+#endif
+}
+
+/**
+ * @brief Vertical window over a reduced-precision ring.
+ *
+ * Each component of each tap row is decoded in blocks small enough to stay in L1 and
+ * accumulated into the tensor row; the row scales are applied by the decoder.
+ *
+ * @param row Image row to emit.
+ */
+template <typename T>
+void BasicStructureTensorKernel<T>::accumulateReduced(int row)
+{
+	const int r = windowRadius;
+	const size_t elementSize = ring.elemSize();
+	T* block = decoded.ptr<T>();
+
+	for (int p = 0; p < 3; p++)
+	{
+		T* acc = tensor.ptr<T>(0) + p * cols;
+		for (int j0 = 0; j0 < cols; j0 += reducedBlock)
+		{
+			const int m = std::min(reducedBlock, cols - j0);
+			auto decode = [&](int source)
+			{
+				int slot = source % ringSize;
+				ReducedPrecision::decodeRow<T>(ring.ptr(slot) + (p * cols + j0) * elementSize, m, storage,
+					ringScales[3 * slot + p], block);
+			};
+
+			decode(row);
+			for (int j = 0; j < m; j++)
+			{
+				acc[j0 + j] = weights[0] * block[j];
+			}
+			for (int k = 1; k <= r; k++)
+			{
+				const T w = weights[k];
+				decode(cv::borderInterpolate(row - k, rows, cv::BORDER_REFLECT_101));
+				for (int j = 0; j < m; j++)
+				{
+					acc[j0 + j] += w * block[j];
+				}
+				decode(cv::borderInterpolate(row + k, rows, cv::BORDER_REFLECT_101));
+				for (int j = 0; j < m; j++)
+				{
+					acc[j0 + j] += w * block[j];
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @brief Eigen-analysis of one row of tensor components.
+ *
+ * With d = Ixx - Iyy and root = sqrt(d^2 + 4 Ixy^2) the eigenvalues are
+ * (Ixx + Iyy +/- root) / 2, which gives
+ * - Energy = Ixx + Iyy
+ * - Orientation = 0.5 * phase(2 Ixy, Ixx - Iyy), in [0, pi)
+ * - Coherency = (lambda1 - lambda2) / (lambda1 + lambda2 + 1e-5)
+ *
+ * @param ixx Smoothed gradX * gradX.
+ * @param iyy Smoothed gradY * gradY.
+ * @param ixy Smoothed gradX * gradY.
+ * @param n Number of pixels.
+ * @param out Destination row; null outputs are skipped.
+ */
+template <typename T>
+void BasicStructureTensorKernel<T>::eigenRow(const T* ixx, const T* iyy, const T* ixy, int n, const RowOutput& out)
+{
+	const T twoPi = static_cast<T>(2 * CV_PI);
+
+	for (int j = 0; j < n; j++)
+	{
+		T trace = ixx[j] + iyy[j];
+		T diff = ixx[j] - iyy[j];
+		T twoXY = 2 * ixy[j];
+
+		if (out.energy)
+			out.energy[j] = trace;
+
+		if (out.orientation)
+		{
+			T theta = std::atan2(diff, twoXY);
+			if (theta < 0)
+				theta += twoPi;
+			out.orientation[j] = T(0.5) * theta;
+		}
+
+		if (out.coherency)
+		{
+			T root = std::sqrt(diff * diff + twoXY * twoXY);
+			out.coherency[j] = (2 * root) / (2 * trace + T(1e-5));
+		}
+	}
+}
+
+/**
+ * @brief Eigen-analysis of one row of float tensor components.
+ *
+ * Same formulas as the generic version, one SIMD vector of pixels at a time: the components are
+ * read once and the three outputs written in the same pass. The orientation comes from
+ * fastAtan2, within 1e-6 rad of 0.5 * std::atan2 (plus float rounding); energy and coherency use
+ * the correctly rounded sqrt and division and match the scalar formulas.
+ *
+ * @param ixx Smoothed gradX * gradX.
+ * @param iyy Smoothed gradY * gradY.
+ * @param ixy Smoothed gradX * gradY.
+ * @param n Number of pixels.
+ * @param out Destination row; null outputs are skipped.
+ */
+template <>
+void BasicStructureTensorKernel<float>::eigenRow(const float* ixx, const float* iyy, const float* ixy, int n,
+	const RowOutput& out)
+{
+	int j = 0;
+#if CV_SIMD || CV_SIMD_SCALABLE
+	const int lanes = cv::VTraits<cv::v_float32>::vlanes();
+	const cv::v_float32 two = cv::vx_setall_f32(2.f);
+	const cv::v_float32 half = cv::vx_setall_f32(0.5f);
+	const cv::v_float32 epsilon = cv::vx_setall_f32(1e-5f);
+	for (; j <= n - lanes; j += lanes)
+	{
+		const cv::v_float32 xx = cv::vx_load(ixx + j);
+		const cv::v_float32 yy = cv::vx_load(iyy + j);
+		const cv::v_float32 trace = cv::v_add(xx, yy);
+		const cv::v_float32 diff = cv::v_sub(xx, yy);
+		const cv::v_float32 twoXY = cv::v_mul(two, cv::vx_load(ixy + j));
+
+		if (out.energy)
+			cv::v_store(out.energy + j, trace);
+
+		if (out.orientation)
+			cv::v_store(out.orientation + j, cv::v_mul(half, v_fastAtan2(diff, twoXY)));
+
+		if (out.coherency)
+		{
+			const cv::v_float32 root = cv::v_sqrt(cv::v_add(cv::v_mul(diff, diff), cv::v_mul(twoXY, twoXY)));
+			const cv::v_float32 denominator = cv::v_add(cv::v_mul(two, trace), epsilon);
+			cv::v_store(out.coherency + j, cv::v_div(cv::v_mul(two, root), denominator));
+		}
+	}
+	cv::vx_cleanup();
+#endif
+
+	for (; j < n; j++)
+	{
+		float trace = ixx[j] + iyy[j];
+		float diff = ixx[j] - iyy[j];
+		float twoXY = 2 * ixy[j];
+
+		if (out.energy)
+			out.energy[j] = trace;
+
+		if (out.orientation)
+			out.orientation[j] = 0.5f * fastAtan2(diff, twoXY);
+
+		if (out.coherency)
+		{
+			float root = std::sqrt(diff * diff + twoXY * twoXY);
+			out.coherency[j] = (2 * root) / (2 * trace + 1e-5f);
+		}
+	}
+}
+
+template class BasicStructureTensorKernel<float>;
+template class BasicStructureTensorKernel<double>;
+
+#define CELL_INSPECTION_KERNEL_STENCIL(T, STENCIL) \
+	template int BasicStructureTensorKernel<T>::pushRow<STENCIL<T>>(const STENCIL<T>&, const RowTarget&, T*, T*);
+
+CELL_INSPECTION_KERNEL_STENCIL(float, GradientRows)
+CELL_INSPECTION_KERNEL_STENCIL(double, GradientRows)
+CELL_INSPECTION_KERNEL_STENCIL(float, FiniteDifferenceStencil)
+CELL_INSPECTION_KERNEL_STENCIL(double, FiniteDifferenceStencil)
+CELL_INSPECTION_KERNEL_STENCIL(float, GaussianStencil)
+CELL_INSPECTION_KERNEL_STENCIL(double, GaussianStencil)
@@ -0,0 +1,182 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include "Precision.h"
+#include "ReducedPrecision.h"
+
+/**
+ * @class BasicStructureTensorKernel
+ * @brief Fused, row-streaming structure tensor engine, in precision T (see Precision).
+ *
+ * Gradient rows are pushed from top to bottom. Every pushed row is turned into the three
+ * gradient products and smoothed horizontally with the Gaussian window right away; the result
+ * is kept in a ring buffer of 2 * radius + 1 rows. As soon as all rows needed by the vertical
+ * window of an output row have arrived, the tensor components of that row are formed and the
+ * eigen-analysis writes Energy, Orientation and Coherency while the data is still in cache.
+ *
+ * The Gaussian window matches cv::GaussianBlur with Size(0, 0) on data of depth T and
+ * BORDER_REFLECT_101 borders. Only the ring and a few row buffers are allocated, so the
+ * working set is O(cols * window) whatever the image height.
+ *
+ * The ring can be stored in reduced precision (see ReducedPrecision): rows are encoded once
+ * when they enter the ring and decoded block by block into a T scratch for the vertical
+ * window, so the accumulation stays in T while the ring, which every output row reads
+ * 2 * radius + 1 times, takes half the memory or less.
+ *
+ * StructureTensorKernel is the float instance.
+ */
+template <typename T>
+class BasicStructureTensorKernel
+{
+public:
+
+    /**
+     * @brief Destination of one output row. Null pointers skip the corresponding output.
+     */
+    struct RowOutput
+    {
+        T* energy = nullptr;
+        T* orientation = nullptr;
+        T* coherency = nullptr;
+        T* ixx = nullptr;               // Smoothed tensor components, as fed to the eigen-analysis
+        T* iyy = nullptr;
+        T* ixy = nullptr;
+    };
+
+    /**
+     * @brief Returns the destination pointers of an output row given its image row index.
+     */
+    using RowTarget = std::function<RowOutput(int row)>;
+
+    BasicStructureTensorKernel() {};
+
+    /**
+     * @brief Prepares the kernel for an image of the given size.
+     * @param rows Number of image rows.
+     * @param cols Number of image columns.
+     * @param sigma Standard deviation of the Gaussian window.
+     * @param storage Precision of the ring.
+     * @param allocator Allocator of the ring and row buffers, null for the default one.
+     */
+    BasicStructureTensorKernel(int rows, int cols, double sigma,
+        ReducedPrecision::STORAGE storage = ReducedPrecision::STORAGE::FULL, cv::MatAllocator* allocator = nullptr);
+
+    /**
+     * @brief Restarts streaming for the output rows [rowBegin, rowEnd).
+     */
+    void begin(int rowBegin, int rowEnd);
+
+    /**
+     * @brief First gradient row the current band needs.
+     */
+    int inputBegin() const { return firstInput; }
+
+    /**
+     * @brief One past the last gradient row the current band needs.
+     */
+    int inputEnd() const { return lastInput; }
+
+    /**
+     * @brief Pushes the next gradient row of the band and emits every output row it completes.
+     * @param gx Gradient row in the X direction (cols values).
+     * @param gy Gradient row in the Y direction (cols values).
+     * @param target Provides the destination of each emitted row.
+     * @return Number of output rows emitted by this call.
+     */
+    int pushRow(const T* gx, const T* gy, const RowTarget& target);
+
+    /**
+     * @brief Pushes the next gradient row of the band, computed by a stencil inside the product loop.
+     * @param stencil Gradient functor prepared for the row (see GradientStencil.h); instantiated
+     *        for GradientRows, FiniteDifferenceStencil and GaussianStencil.
+     * @param target Provides the destination of each emitted row.
+     * @param gx Optional destination of the gradient row in the X direction (cols values).
+     * @param gy Optional destination of the gradient row in the Y direction (cols values).
+     * @return Number of output rows emitted by this call.
+     */
+    template <class Stencil>
+    int pushRow(const Stencil& stencil, const RowTarget& target, T* gx = nullptr, T* gy = nullptr);
+
+    /**
+     * @brief Radius of the Gaussian window in pixels.
+     */
+    int radius() const { return windowRadius; }
+
+    /**
+     * @brief Bytes of the ring buffer.
+     */
+    size_t ringBytes() const { return ring.total() * ring.elemSize(); }
+
+    /**
+     * @brief Radius of the window cv::GaussianBlur uses for a floating-point image and the given sigma.
+     */
+    static int gaussianRadius(double sigma);
+
+    /**
+     * @brief Eigen-analysis of one row of tensor components.
+     * @param ixx Smoothed gradX * gradX.
+     * @param iyy Smoothed gradY * gradY.
+     * @param ixy Smoothed gradX * gradY.
+     * @param n Number of pixels.
+     * @param out Destination row; null outputs are skipped.
+     *
+     * The float instance is vectorized with OpenCV's universal intrinsics and evaluates the
+     * orientation with a polynomial atan2, to within about 1e-6 rad; the double instance uses
+     * std::atan2.
+     */
+    static void eigenRow(const T* ixx, const T* iyy, const T* ixy, int n, const RowOutput& out);
+
+#ifdef CELL_INSPECTION_PROFILING
+    /**
+     * @brief Wall time spent in the eigen-analysis since the previous call.
+     */
+    std::chrono::steady_clock::duration takeEigenTime()
+    {
+        std::chrono::steady_clock::duration time = eigenTime;
+        eigenTime = std::chrono::steady_clock::duration::zero();
+        return time;
+    }
+#endif
+
+private:
+    // Values per decoded block of a reduced-precision ring row
+    static constexpr int reducedBlock = 1024;
+
+    int rows = 0;
+    int cols = 0;
+    int windowRadius = 0;
+    int ringSize = 1;
+    ReducedPrecision::STORAGE storage = ReducedPrecision::STORAGE::FULL;
+
+    int firstInput = 0;
+    int lastInput = 0;
+    int nextInput = 0;
+    int nextOutput = 0;
+    int outputEnd = 0;
+
+    std::vector<T> weights;         // Half window, weights[0] is the centre tap
+    std::vector<int> leftBorder;    // Reflected source columns of the left padding
+    std::vector<int> rightBorder;   // Reflected source columns of the right padding
+
+    cv::Mat padded;   // 3 x (cols + 2 * radius) products with reflected borders
+    cv::Mat ring;     // ringSize x (3 * cols) horizontally smoothed products, in the storage precision
+    std::vector<T> ringScales;      // INT16 scale of each ring row and component
+    cv::Mat smoothed; // 1 x (3 * cols) T row before it is encoded into the ring
+    cv::Mat decoded;  // T scratch of one block of a ring row
+    cv::Mat tensor;   // 1 x (3 * cols) Ixx | Iyy | Ixy of the current output row
+
+#ifdef CELL_INSPECTION_PROFILING
+    std::chrono::steady_clock::duration eigenTime = std::chrono::steady_clock::duration::zero();
+#endif
+
+    void emitRow(int row, const RowTarget& target);
+    void accumulateReduced(int row);
+};
+
+template <>
+void BasicStructureTensorKernel<float>::eigenRow(const float* ixx, const float* iyy, const float* ixy, int n,
+    const RowOutput& out);
+
+using StructureTensorKernel = BasicStructureTensorKernel<float>;
@@ -0,0 +1,224 @@
+#include "StructureTensorPyramid.h"
+#include "StructureTensorKernel.h"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+/**
+ * @brief Validates the scales and sorts them for the cascade.
+ *
+ * @param sigmas Window sizes, in any order.
+ * @param gradientMethod Gradient method.
+ * @param threads Number of threads for the eigen-analysis.
+ */
+StructureTensorPyramid::StructureTensorPyramid(const std::vector<double>& sigmas, GRADIENT_METHOD gradientMethod, int threads) :
+	gradientMethod{ gradientMethod }
+{
+	if (sigmas.empty() || sigmas.size() > 255)
+		throw std::invalid_argument("StructureTensorPyramid: between 1 and 255 scales are supported.");
+	if (gradientMethod == GRADIENT_METHOD::HESSIAN)
+		throw std::invalid_argument("StructureTensorPyramid: HESSIAN gradients depend on the window size.");
+
+	scaleMaps.resize(sigmas.size());
+	order.resize(sigmas.size());
+	for (size_t i = 0; i < sigmas.size(); i++)
+	{
+		if (sigmas[i] <= 0)
+			throw std::invalid_argument("StructureTensorPyramid: window sizes must be positive.");
+		scaleMaps[i].sigma = sigmas[i];
+		order[i] = static_cast<int>(i);
+	}
+	std::stable_sort(order.begin(), order.end(), [this](int a, int b) { return scaleMaps[a].sigma < scaleMaps[b].sigma; });
+
+	threadPool = (threads > 1) ? std::make_shared<ThreadPool>(threads) : nullptr;
+}
+
+/**
+ * @brief Computes every scale of an image.
+ *
+ * Before a window is applied, levels are dropped as long as it still spans minLevelSigma pixels
+ * of the next level. A level is first smoothed to one of its pixels, and pyrDown adds another
+ * one, so the products are band-limited before they are decimated.
+ *
+ * @param image Input grayscale image.
+ */
+void StructureTensorPyramid::compute(const cv::Mat& image)
+{
+	if (image.empty())
+		throw std::invalid_argument("StructureTensorPyramid: image must not be empty.");
+
+	StructureTensorAnalysis::computeGradients(image, gradX, gradY, gradientMethod, 2, workspace, threadPool.get());
+	computeProducts();
+
+	double sigma = 0;   // Blur of the current level, in full-resolution pixels
+	size_t current = 0;
+	for (int index : order)
+	{
+		Scale& out = scaleMaps[index];
+		for (;;)
+		{
+			int scale = 1 << current;
+			const cv::Mat& products = levels[current];
+			if (out.sigma < minLevelSigma * 2 * scale || std::min(products.rows, products.cols) < 16)
+				break;
+
+			blurTo(levels[current], sigma, scale, scale);
+			if (levels.size() <= current + 1)
+				levels.resize(current + 2);
+			cv::pyrDown(levels[current], levels[current + 1]);
+			sigma = std::sqrt(sigma * sigma + double(scale) * scale);
+			current++;
+		}
+
+		blurTo(levels[current], sigma, out.sigma, 1 << current);
+		out.level = static_cast<int>(current);
+		emitScale(levels[current], 1 << current, out);
+	}
+}
+
+/**
+ * @brief Fills level 0 with the interleaved gradient products.
+ */
+void StructureTensorPyramid::computeProducts()
+{
+	const cv::Mat* gx = &gradX;
+	const cv::Mat* gy = &gradY;
+	if (gradX.depth() != CV_32F || gradY.depth() != CV_32F)
+	{
+		gradX.convertTo(floatX, CV_32F);
+		gradY.convertTo(floatY, CV_32F);
+		gx = &floatX;
+		gy = &floatY;
+	}
+
+	if (levels.empty())
+		levels.resize(1);
+	cv::Mat& products = levels[0];
+	products.create(gx->size(), CV_32FC3);
+
+	const int cols = gx->cols;
+	ThreadPool::forEach(threadPool.get(), 0, gx->rows, [&](int row)
+	{
+		const float* x = gx->ptr<float>(row);
+		const float* y = gy->ptr<float>(row);
+		float* dst = products.ptr<float>(row);
+		for (int j = 0; j < cols; j++)
+		{
+			dst[3 * j] = x[j] * x[j];
+			dst[3 * j + 1] = y[j] * y[j];
+			dst[3 * j + 2] = x[j] * y[j];
+		}
+	});
+}
+
+/**
+ * @brief Adds the Gaussian blur that takes a level from sigma to target.
+ *
+ * @param products Level to smooth in place.
+ * @param sigma Current blur in full-resolution pixels, updated to target.
+ * @param target Wanted blur in full-resolution pixels.
+ * @param scale Size of a level pixel in full-resolution pixels.
+ */
+void StructureTensorPyramid::blurTo(cv::Mat& products, double& sigma, double target, int scale)
+{
+	if (target <= sigma)
+		return;
+
+	double delta = std::sqrt(target * target - sigma * sigma) / scale;
+	cv::GaussianBlur(products, products, cv::Size(0, 0), delta);
+	sigma = target;
+}
+
+/**
+ * @brief Stores a level as the tensor of a scale and runs the eigen-analysis.
+ *
+ * Pixel j of a level sits on pixel j * scale of the image (pyrDown keeps the even pixels), so
+ * coarse levels are interpolated with that exact mapping rather than cv::resize, whose pixel
+ * centres are shifted by a fraction of a pixel.
+ *
+ * @param products Smoothed products of the level.
+ * @param scale Size of a level pixel in full-resolution pixels.
+ * @param out Scale to fill.
+ */
+void StructureTensorPyramid::emitScale(const cv::Mat& products, int scale, Scale& out)
+{
+	const cv::Size size = gradX.size();
+	const cv::Mat* tensor = &products;
+	if (scale > 1)
+	{
+		cv::Matx23d map(scale, 0, 0, 0, scale, 0);
+		cv::warpAffine(products, upsampled, map, size, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+		tensor = &upsampled;
+	}
+
+	out.ixx.create(size, CV_32F);
+	out.iyy.create(size, CV_32F);
+	out.ixy.create(size, CV_32F);
+	planes.assign({ out.ixx, out.iyy, out.ixy });
+	cv::split(*tensor, planes);
+
+	out.energy.create(size, CV_32F);
+	out.orientation.create(size, CV_32F);
+	out.coherency.create(size, CV_32F);
+
+	ThreadPool::forEach(threadPool.get(), 0, size.height, [&](int row)
+	{
+		StructureTensorKernel::RowOutput dst;
+		dst.energy = out.energy.ptr<float>(row);
+		dst.orientation = out.orientation.ptr<float>(row);
+		dst.coherency = out.coherency.ptr<float>(row);
+		StructureTensorKernel::eigenRow(out.ixx.ptr<float>(row), out.iyy.ptr<float>(row), out.ixy.ptr<float>(row),
+			size.width, dst);
+	});
+}
+
+/**
+ * @brief Picks, per pixel, the scale with the highest coherency.
+ *
+ * @param energy Energy of the selected scale.
+ * @param orientation Orientation of the selected scale.
+ * @param coherency Highest coherency.
+ * @param scaleIndex Index of the selected scale (CV_8U).
+ */
+void StructureTensorPyramid::selectScale(cv::Mat& energy, cv::Mat& orientation, cv::Mat& coherency, cv::Mat& scaleIndex) const
+{
+	if (scaleMaps[0].coherency.empty())
+		throw std::logic_error("StructureTensorPyramid: compute() must be called before selectScale().");
+
+	const cv::Size size = scaleMaps[0].coherency.size();
+	energy.create(size, CV_32F);
+	orientation.create(size, CV_32F);
+	coherency.create(size, CV_32F);
+	scaleIndex.create(size, CV_8U);
+
+	const int scales = static_cast<int>(scaleMaps.size());
+	ThreadPool::forEach(threadPool.get(), 0, size.height, [&](int row)
+	{
+		float* bestEnergy = energy.ptr<float>(row);
+		float* bestOrientation = orientation.ptr<float>(row);
+		float* bestCoherency = coherency.ptr<float>(row);
+		uchar* best = scaleIndex.ptr<uchar>(row);
+
+		std::copy_n(scaleMaps[0].coherency.ptr<float>(row), size.width, bestCoherency);
+		std::fill_n(best, size.width, uchar(0));
+		for (int s = 1; s < scales; s++)
+		{
+			const float* c = scaleMaps[s].coherency.ptr<float>(row);
+			for (int j = 0; j < size.width; j++)
+			{
+				if (c[j] > bestCoherency[j])
+				{
+					bestCoherency[j] = c[j];
+					best[j] = static_cast<uchar>(s);
+				}
+			}
+		}
+
+		for (int j = 0; j < size.width; j++)
+		{
+			bestEnergy[j] = scaleMaps[best[j]].energy.at<float>(row, j);
+			bestOrientation[j] = scaleMaps[best[j]].orientation.at<float>(row, j);
+		}
+	});
+}
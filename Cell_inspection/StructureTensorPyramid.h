@@ -0,0 +1,110 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <vector>
+#include "GradientCalculator.h"
+#include "StructureTensorAnalysis.h"
+#include "ThreadPool.h"
+
+/**
+ * @class StructureTensorPyramid
+ * @brief Structure tensor at several window sizes in one call.
+ *
+ * The gradients and their products are computed once. The Gaussian windows are then applied in
+ * increasing order as a cascade: each scale only adds the blur sqrt(sigma_i^2 - sigma_{i-1}^2)
+ * to the previous one. Once a window is large enough the products are reduced with cv::pyrDown
+ * and the remaining blur is applied at the coarser level, where it is 2^level times smaller and
+ * the image 4^level times smaller, so the cost of a scale no longer grows with sigma. Coarse
+ * tensors are brought back to full resolution with bilinear interpolation before the
+ * eigen-analysis.
+ *
+ * The finest scale is computed at full resolution and matches StructureTensorAnalysis. The
+ * coarser ones differ by the truncation of the cascaded kernels and the interpolation, which is
+ * small against the tensor itself since it is smooth at those scales.
+ */
+class StructureTensorPyramid
+{
+public:
+    using GRADIENT_METHOD = StructureTensorAnalysis::GRADIENT_METHOD;
+
+    /**
+     * @brief Tensor and derived maps of one window size, all at full resolution (CV_32F).
+     */
+    struct Scale
+    {
+        double sigma = 0;
+        int level = 0;      // Pyramid level the window was applied at
+        cv::Mat ixx, iyy, ixy;
+        cv::Mat energy, orientation, coherency;
+    };
+
+    /**
+     * @brief Configures the scales.
+     * @param sigmas Window sizes (standard deviations of the Gaussian window), in any order.
+     * @param gradientMethod Gradient method; HESSIAN is not supported since its gradients depend
+     * on the window size.
+     * @param threads Number of threads for the eigen-analysis (1 = serial).
+     */
+    StructureTensorPyramid(const std::vector<double>& sigmas, GRADIENT_METHOD gradientMethod, int threads = 1);
+
+    /**
+     * @brief Computes every scale of an image. Buffers are reused when the size does not change.
+     */
+    void compute(const cv::Mat& image);
+
+    /**
+     * @brief Number of scales.
+     */
+    int size() const { return static_cast<int>(scaleMaps.size()); }
+
+    /**
+     * @brief Maps of a scale, in the order the sigmas were given.
+     */
+    const Scale& scale(int index) const { return scaleMaps[index]; }
+
+    /**
+     * @brief Picks, per pixel, the scale with the highest coherency.
+     * @param energy Energy of the selected scale.
+     * @param orientation Orientation of the selected scale.
+     * @param coherency Highest coherency.
+     * @param scaleIndex Index of the selected scale (CV_8U).
+     */
+    void selectScale(cv::Mat& energy, cv::Mat& orientation, cv::Mat& coherency, cv::Mat& scaleIndex) const;
+
+private:
+    GRADIENT_METHOD gradientMethod;
+    std::shared_ptr<ThreadPool> threadPool;
+
+    std::vector<Scale> scaleMaps;
+    std::vector<int> order;     // Scale indices by increasing sigma
+
+    cv::Mat gradX, gradY;
+    cv::Mat floatX, floatY;     // Float conversion of gradients of another depth
+    GradientCalculator::Workspace workspace;
+    std::vector<cv::Mat> levels;    // Smoothed products per pyramid level, 3 channels Ixx | Iyy | Ixy
+    cv::Mat upsampled;          // Products of a coarse level at full resolution
+    std::vector<cv::Mat> planes;    // Headers of the tensor of the scale being emitted
+
+    /**
+     * @brief Smallest window, in pixels of the coarser level, for which a level is dropped.
+     */
+    static constexpr double minLevelSigma = 2.0;
+
+    /**
+     * @brief Fills level 0 with Ixx | Iyy | Ixy of the gradients.
+     */
+    void computeProducts();
+
+    /**
+     * @brief Adds blur to a level.
+     * @param products Level to smooth in place.
+     * @param sigma Current blur in full-resolution pixels, updated to target.
+     * @param target Wanted blur in full-resolution pixels.
+     * @param scale Size of a level pixel in full-resolution pixels.
+     */
+    static void blurTo(cv::Mat& products, double& sigma, double target, int scale);
+
+    /**
+     * @brief Brings a level to full resolution as the tensor of a scale and runs the eigen-analysis.
+     */
+    void emitScale(const cv::Mat& products, int scale, Scale& out);
+};
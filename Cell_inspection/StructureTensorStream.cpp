@@ -0,0 +1,180 @@
+#include "StructureTensorStream.h"
+#include <stdexcept>
+
+/**
+ * @brief Allocates the rolling input window, the kernel ring and the output row slots.
+ *
+ * @param imageSize Size of the whole image.
+ * @param imageType Type of the pushed rows (single channel).
+ * @param gradientMethod Gradient method; must be a stencil method.
+ * @param windowSize Window size for tensor computation.
+ * @param sink Receives the output rows.
+ */
+StructureTensorStream::StructureTensorStream(cv::Size imageSize, int imageType, GRADIENT_METHOD gradientMethod,
+	int windowSize, RowSink sink) :
+	size{ imageSize }, type{ imageType }, gradientMethod{ gradientMethod }, windowSize{ windowSize }, sink{ sink }
+{
+	halo = StructureTensorAnalysis::gradientHalo(gradientMethod, windowSize);
+	if (halo < 0)
+		throw std::invalid_argument("StructureTensorStream: the gradient method needs the whole image.");
+
+	chunkRows = StructureTensorAnalysis::gradientChunkRows(halo);
+	windowRows = std::min(size.height, chunkRows + 2 * halo);
+
+	input.create(windowRows, size.width, type);
+	kernel = StructureTensorKernel(size.height, size.width, windowSize);
+
+	// A single push emits at most radius + 1 rows (when the last input row arrives)
+	const int slots = kernel.radius() + 1;
+	energy.create(slots, size.width, CV_32F);
+	orientation.create(slots, size.width, CV_32F);
+	coherency.create(slots, size.width, CV_32F);
+
+	target = [this, slots](int row)
+	{
+		StructureTensorKernel::RowOutput out;
+		out.energy = energy.ptr<float>(row % slots);
+		out.orientation = orientation.ptr<float>(row % slots);
+		out.coherency = coherency.ptr<float>(row % slots);
+		return out;
+	};
+}
+
+/**
+ * @brief First input row of the window of a chunk.
+ *
+ * The window is shifted inside the image instead of being clipped, exactly as in
+ * StructureTensorAnalysis, so its rows hold the same gradients as the whole-image path.
+ *
+ * @param chunkBegin First gradient row of the chunk.
+ * @return First input row of its window.
+ */
+int StructureTensorStream::windowBegin(int chunkBegin) const
+{
+	return std::min(std::max(0, chunkBegin - halo), size.height - windowRows);
+}
+
+/**
+ * @brief Pushes the next input row.
+ *
+ * @param row 1 x cols row of the image type.
+ */
+void StructureTensorStream::pushRow(const cv::Mat& row)
+{
+	if (pushed >= size.height)
+		throw std::logic_error("StructureTensorStream: more rows pushed than the image has.");
+	if (row.rows != 1 || row.cols != size.width || row.type() != type)
+		throw std::invalid_argument("StructureTensorStream: row does not match the image width and type.");
+
+	row.copyTo(input.row(pushed - inputBegin));
+	pushed++;
+	processChunks();
+}
+
+/**
+ * @brief Pushes a block of consecutive input rows.
+ *
+ * @param rows Block of rows of the image width and type.
+ */
+void StructureTensorStream::pushRows(const cv::Mat& rows)
+{
+	for (int i = 0; i < rows.rows; i++)
+	{
+		pushRow(rows.row(i));
+	}
+}
+
+/**
+ * @brief Pulls rows from a source until the image is complete or the source runs dry.
+ *
+ * @param source Row source.
+ * @return True when the whole image has been processed.
+ */
+bool StructureTensorStream::pullRows(const RowSource& source)
+{
+	cv::Mat row;
+	while (pushed < size.height && source(row))
+	{
+		pushRow(row);
+	}
+	return finished();
+}
+
+/**
+ * @brief Computes and streams every chunk whose input window is complete.
+ *
+ * After a chunk the input window is moved up to the window of the next chunk, keeping the rows
+ * both windows share.
+ */
+void StructureTensorStream::processChunks()
+{
+	while (nextChunk < size.height && pushed >= windowBegin(nextChunk) + windowRows)
+	{
+		int chunkEnd = std::min(size.height, nextChunk + chunkRows);
+		switch (gradientMethod)
+		{
+		case GRADIENT_METHOD::FINITE_DIFFERENCE:
+			streamChunk(finiteDifference, chunkEnd);
+			break;
+
+		case GRADIENT_METHOD::GAUSSIAN:
+			streamChunk(gaussian, chunkEnd);
+			break;
+
+		default:
+			StructureTensorAnalysis::computeGradients(input, gradX, gradY, gradientMethod, windowSize, workspace);
+			for (int i = nextChunk; i < chunkEnd; i++)
+			{
+				emitRows(kernel.pushRow(gradX.ptr<float>(i - inputBegin), gradY.ptr<float>(i - inputBegin), target));
+			}
+			break;
+		}
+
+		nextChunk = chunkEnd;
+		if (nextChunk < size.height)
+		{
+			int shift = windowBegin(nextChunk) - inputBegin;
+			for (int i = 0; i + shift < pushed - inputBegin; i++)
+			{
+				input.row(i + shift).copyTo(input.row(i));
+			}
+			inputBegin += shift;
+		}
+	}
+}
+
+/**
+ * @brief Streams the rows of a chunk with gradients evaluated by a stencil.
+ *
+ * The stencil reads the input window, whose rows it reflects only where the window reaches an
+ * image border, so it evaluates the same gradients, with the same rounding, as the fused pass of
+ * StructureTensorAnalysis over the whole image.
+ *
+ * @param stencil Stencil of the gradient method.
+ * @param chunkEnd One past the last gradient row of the chunk.
+ */
+template <class Stencil>
+void StructureTensorStream::streamChunk(Stencil& stencil, int chunkEnd)
+{
+	stencil.reset(input);
+	for (int i = nextChunk; i < chunkEnd; i++)
+	{
+		stencil.prepare(i - inputBegin);
+		emitRows(kernel.pushRow(stencil, target));
+	}
+}
+
+/**
+ * @brief Hands the rows completed by one kernel push to the sink.
+ *
+ * @param count Number of rows the push emitted, the next count rows after those already emitted.
+ */
+void StructureTensorStream::emitRows(int count)
+{
+	for (int r = emitted; r < emitted + count; r++)
+	{
+		int slot = r % energy.rows;
+		sink(r, energy.row(slot), orientation.row(slot), coherency.row(slot));
+	}
+	emitted += count;
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <functional>
+#include "StructureTensorAnalysis.h"
+#include "StructureTensorKernel.h"
+
+/**
+ * @class StructureTensorStream
+ * @brief Row-by-row structure tensor analysis for images that do not fit in memory.
+ *
+ * Input rows are pushed from top to bottom (or pulled from a row source). The stream keeps only
+ * the rolling window of input rows the gradient stencil needs and the ring of smoothed products
+ * the Gaussian window needs, and hands every output row to a sink as soon as it is final. Peak
+ * memory is O(cols * window) instead of O(cols * rows), and the results are identical to
+ * StructureTensorAnalysis on the whole image.
+ *
+ * Only the stencil methods (FINITE_DIFFERENCE, GAUSSIAN, HESSIAN) can be streamed; the spline
+ * and spectral methods need the whole image.
+ */
+class StructureTensorStream
+{
+public:
+    using GRADIENT_METHOD = StructureTensorAnalysis::GRADIENT_METHOD;
+
+    /**
+     * @brief Receives one final output row. The row headers are 1 x cols CV_32F views that are
+     * only valid during the call.
+     */
+    using RowSink = std::function<void(int row, const cv::Mat& energy, const cv::Mat& orientation,
+        const cv::Mat& coherency)>;
+
+    /**
+     * @brief Returns the next input row in its argument, or false when there are no more rows.
+     */
+    using RowSource = std::function<bool(cv::Mat& row)>;
+
+    /**
+     * @brief Prepares the stream for an image of known size.
+     * @param imageSize Size of the whole image.
+     * @param imageType Type of the pushed rows (single channel).
+     * @param gradientMethod Gradient method; must be a stencil method.
+     * @param windowSize Window size for tensor computation.
+     * @param sink Receives the output rows.
+     */
+    StructureTensorStream(cv::Size imageSize, int imageType, GRADIENT_METHOD gradientMethod, int windowSize, RowSink sink);
+
+    /**
+     * @brief Pushes the next input row (1 x cols).
+     */
+    void pushRow(const cv::Mat& row);
+
+    /**
+     * @brief Pushes a block of consecutive input rows.
+     */
+    void pushRows(const cv::Mat& rows);
+
+    /**
+     * @brief Pulls rows from a source until the image is complete or the source runs dry.
+     * @return True when the whole image has been processed.
+     */
+    bool pullRows(const RowSource& source);
+
+    /**
+     * @brief Number of input rows pushed so far.
+     */
+    int rowsPushed() const { return pushed; }
+
+    /**
+     * @brief Number of output rows handed to the sink so far.
+     */
+    int rowsEmitted() const { return emitted; }
+
+    /**
+     * @brief True once every output row has been emitted.
+     */
+    bool finished() const { return emitted == size.height; }
+
+private:
+    cv::Size size;
+    int type;
+    GRADIENT_METHOD gradientMethod;
+    int windowSize;
+    RowSink sink;
+
+    int halo;           // Stencil halo of the gradient method
+    int chunkRows;      // Gradient rows produced per chunk
+    int windowRows;     // Input rows a chunk needs, halo included
+
+    cv::Mat input;      // Rolling window of input rows [inputBegin, inputBegin + windowRows)
+    int inputBegin = 0;
+    int pushed = 0;
+    int nextChunk = 0;
+    int emitted = 0;
+
+    cv::Mat gradX, gradY;                       // Gradients of a chunk of the methods without a stencil
+    GradientCalculator::Workspace workspace;
+    FiniteDifferenceStencil<float> finiteDifference;    // Stencils of the other methods, evaluated inside
+    GaussianStencil<float> gaussian;                    // the kernel's product loop as the analysis does
+    StructureTensorKernel kernel;
+    StructureTensorKernel::RowTarget target;
+    cv::Mat energy, orientation, coherency;     // Slots for the rows emitted by one kernel push
+
+    /**
+     * @brief First input row of the window of a chunk, shifted inside the image.
+     */
+    int windowBegin(int chunkBegin) const;
+
+    /**
+     * @brief Computes and streams every chunk whose input window is complete.
+     */
+    void processChunks();
+
+    /**
+     * @brief Streams the rows [nextChunk, chunkEnd) with gradients evaluated by a stencil.
+     */
+    template <class Stencil>
+    void streamChunk(Stencil& stencil, int chunkEnd);
+
+    /**
+     * @brief Hands the rows completed by one kernel push to the sink.
+     */
+    void emitRows(int count);
+};
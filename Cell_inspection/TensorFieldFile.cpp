@@ -0,0 +1,404 @@
+#include "TensorFieldFile.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+namespace
+{
+	const char magic[8] = { 'S', 'T', 'F', 'I', 'E', 'L', 'D', '\0' };
+	const uint32_t version = 1;
+	const uint64_t alignment = 64;
+
+	// On-disk records; every field is naturally aligned, so the structs have no padding
+	struct FileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t headerBytes;
+		int32_t cols;
+		int32_t rows;
+		int32_t stripRows;
+		uint32_t channelCount;
+		uint64_t channelTableOffset;
+		uint64_t fileBytes;
+		uint8_t reserved[16];
+	};
+
+	struct ChannelRecord
+	{
+		char name[32];
+		uint32_t encoding;
+		uint32_t elementBytes;
+		float scale;
+		float offset;
+		uint64_t dataOffset;
+		uint64_t dataBytes;
+	};
+
+	struct StripRecord
+	{
+		uint64_t offset;
+		uint64_t bytes;
+	};
+
+	static_assert(sizeof(FileHeader) == 64, "FileHeader must match the file layout");
+	static_assert(sizeof(ChannelRecord) == 64, "ChannelRecord must match the file layout");
+	static_assert(sizeof(StripRecord) == 16, "StripRecord must match the file layout");
+
+	bool littleEndian()
+	{
+		const uint16_t probe = 1;
+		unsigned char first;
+		std::memcpy(&first, &probe, 1);
+		return first == 1;
+	}
+
+	// True when bytes starting at offset lie inside a file of the given size, without overflowing
+	bool fits(uint64_t offset, uint64_t bytes, uint64_t size)
+	{
+		return offset <= size && bytes <= size - offset;
+	}
+
+	uint64_t alignUp(uint64_t value)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	int storedDepth(TensorFieldFile::ENCODING encoding)
+	{
+		switch (encoding)
+		{
+		case TensorFieldFile::ENCODING::FLOAT16: return CV_16F;
+		case TensorFieldFile::ENCODING::QUANT16: return CV_16U;
+		default: return CV_32F;
+		}
+	}
+
+	// Converts a map to its stored encoding; scale and offset are set for QUANT16 only
+	cv::Mat encodeMap(const cv::Mat& map, TensorFieldFile::ENCODING encoding, float& scale, float& offset)
+	{
+		cv::Mat values;
+		map.convertTo(values, CV_32F);
+		scale = 1;
+		offset = 0;
+
+		cv::Mat stored;
+		switch (encoding)
+		{
+		case TensorFieldFile::ENCODING::FLOAT32:
+			stored = values;
+			break;
+
+		case TensorFieldFile::ENCODING::FLOAT16:
+			values.convertTo(stored, CV_16F);
+			break;
+
+		case TensorFieldFile::ENCODING::QUANT16:
+		{
+			double minimum = 0, maximum = 0;
+			cv::minMaxLoc(values, &minimum, &maximum);
+			offset = static_cast<float>(minimum);
+			scale = static_cast<float>((maximum - minimum) / 65535.0);
+			if (scale > 0)
+				values.convertTo(stored, CV_16U, 1.0 / scale, -offset / static_cast<double>(scale));
+			else
+				stored = cv::Mat::zeros(values.size(), CV_16U);
+			break;
+		}
+		}
+
+		// Strips are written row by row from a continuous buffer
+		return stored.isContinuous() ? stored : stored.clone();
+	}
+}
+
+/**
+ * @brief Writes maps of one size into a new file.
+ *
+ * The file is written to a temporary name and renamed over the path at the end, so readers
+ * never map a partially written file, and an existing file stays in place until it is replaced.
+ *
+ * @param path Output file.
+ * @param channels Maps to store.
+ * @param encoding Encoding of every channel.
+ * @param stripRows Rows per strip of the index.
+ */
+void TensorFieldFile::write(const std::string& path, const std::vector<Channel>& channels, ENCODING encoding,
+	int stripRows)
+{
+	if (!littleEndian())
+		throw std::runtime_error("TensorFieldFile: only little-endian hosts are supported.");
+	if (channels.empty())
+		throw std::invalid_argument("TensorFieldFile::write: no channel given.");
+	if (stripRows < 1)
+		throw std::invalid_argument("TensorFieldFile::write: stripRows must be positive.");
+
+	const cv::Size size = channels.front().map.size();
+	for (const Channel& channel : channels)
+	{
+		if (channel.map.empty() || channel.map.channels() != 1 || channel.map.size() != size)
+			throw std::invalid_argument("TensorFieldFile::write: channel '" + channel.name +
+				"' is not a single-channel map of the size of the first one.");
+		if (channel.name.empty() || channel.name.size() > static_cast<size_t>(maxNameLength))
+			throw std::invalid_argument("TensorFieldFile::write: channel names need 1 to 31 characters, got '" +
+				channel.name + "'.");
+	}
+
+	const int strips = (size.height + stripRows - 1) / stripRows;
+	const size_t elementBytes = CV_ELEM_SIZE(storedDepth(encoding));
+	const uint64_t rowBytes = static_cast<uint64_t>(size.width) * elementBytes;
+	const uint64_t channelBytes = rowBytes * size.height;
+
+	FileHeader header = {};
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.headerBytes = sizeof(FileHeader);
+	header.cols = size.width;
+	header.rows = size.height;
+	header.stripRows = stripRows;
+	header.channelCount = static_cast<uint32_t>(channels.size());
+	header.channelTableOffset = sizeof(FileHeader);
+
+	const uint64_t stripIndexOffset = header.channelTableOffset + sizeof(ChannelRecord) * channels.size();
+	uint64_t dataOffset = alignUp(stripIndexOffset + sizeof(StripRecord) * channels.size() * strips);
+
+	std::vector<cv::Mat> stored(channels.size());
+	std::vector<ChannelRecord> records(channels.size());
+	std::vector<StripRecord> stripRecords;
+	stripRecords.reserve(channels.size() * strips);
+
+	for (size_t c = 0; c < channels.size(); c++)
+	{
+		ChannelRecord& record = records[c];
+		std::memset(&record, 0, sizeof(record));
+		std::memcpy(record.name, channels[c].name.data(), channels[c].name.size());
+		record.encoding = static_cast<uint32_t>(encoding);
+		record.elementBytes = static_cast<uint32_t>(elementBytes);
+		stored[c] = encodeMap(channels[c].map, encoding, record.scale, record.offset);
+		record.dataOffset = dataOffset;
+		record.dataBytes = channelBytes;
+
+		for (int s = 0; s < strips; s++)
+		{
+			int rows = std::min(stripRows, size.height - s * stripRows);
+			StripRecord strip;
+			strip.offset = dataOffset + rowBytes * s * stripRows;
+			strip.bytes = rowBytes * rows;
+			stripRecords.push_back(strip);
+		}
+		dataOffset = alignUp(dataOffset + channelBytes);
+	}
+	header.fileBytes = dataOffset;
+
+	const std::string temporary = path + ".partial";
+	{
+		std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+		if (!out.is_open())
+			throw std::runtime_error("TensorFieldFile::write: cannot create " + temporary);
+
+		auto padTo = [&](uint64_t offset)
+		{
+			static const char zeros[alignment] = {};
+			uint64_t position = static_cast<uint64_t>(out.tellp());
+			out.write(zeros, static_cast<std::streamsize>(offset - position));
+		};
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(records.data()), sizeof(ChannelRecord) * records.size());
+		out.write(reinterpret_cast<const char*>(stripRecords.data()), sizeof(StripRecord) * stripRecords.size());
+		for (size_t c = 0; c < channels.size(); c++)
+		{
+			padTo(records[c].dataOffset);
+			out.write(reinterpret_cast<const char*>(stored[c].data), static_cast<std::streamsize>(channelBytes));
+		}
+		padTo(header.fileBytes);
+
+		if (!out)
+			throw std::runtime_error("TensorFieldFile::write: cannot write " + temporary);
+	}
+
+	// Replace an existing file in one step, so that it is never missing in between
+#ifdef _WIN32
+	const bool renamed = MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	const bool renamed = std::rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+	if (!renamed)
+		throw std::runtime_error("TensorFieldFile::write: cannot rename " + temporary + " to " + path);
+}
+
+/**
+ * @brief Maps a file and validates its header, channel table and strip index against its size.
+ *
+ * @param path File written by write().
+ */
+TensorFieldFile::TensorFieldFile(const std::string& path) :
+	file{ std::make_shared<MappedFile>(path) }
+{
+	if (!littleEndian())
+		throw std::runtime_error("TensorFieldFile: only little-endian hosts are supported.");
+
+	const uint8_t* bytes = file->data();
+	const uint64_t size = file->size();
+	auto invalid = [&](const std::string& reason)
+	{
+		return std::runtime_error("TensorFieldFile: " + path + " is not a valid tensor field file (" + reason + ").");
+	};
+
+	FileHeader header;
+	if (size < sizeof(header))
+		throw invalid("truncated header");
+	std::memcpy(&header, bytes, sizeof(header));
+	if (std::memcmp(header.magic, magic, sizeof(magic)) != 0)
+		throw invalid("bad magic");
+	if (header.version != version)
+		throw invalid("unsupported version " + std::to_string(header.version));
+	if (header.cols <= 0 || header.rows <= 0 || header.stripRows <= 0 || header.fileBytes > size)
+		throw invalid("bad header");
+
+	mapSize = cv::Size(header.cols, header.rows);
+	rowsPerStrip = header.stripRows;
+	const int strips = stripCount();
+
+	const uint64_t channelTableBytes = sizeof(ChannelRecord) * static_cast<uint64_t>(header.channelCount);
+	if (header.channelTableOffset < sizeof(FileHeader) || !fits(header.channelTableOffset, channelTableBytes, size))
+		throw invalid("truncated tables");
+	const uint64_t stripIndexOffset = header.channelTableOffset + channelTableBytes;
+	const uint64_t stripRecordCount = static_cast<uint64_t>(header.channelCount) * strips;
+	if (stripRecordCount > (size - stripIndexOffset) / sizeof(StripRecord))
+		throw invalid("truncated tables");
+
+	channels.resize(header.channelCount);
+	for (uint32_t c = 0; c < header.channelCount; c++)
+	{
+		ChannelRecord record;
+		std::memcpy(&record, bytes + header.channelTableOffset + sizeof(ChannelRecord) * c, sizeof(record));
+		if (record.encoding > static_cast<uint32_t>(ENCODING::QUANT16))
+			throw invalid("unknown encoding");
+
+		ChannelInfo& channel = channels[c];
+		channel.name.assign(record.name, strnlen(record.name, sizeof(record.name)));
+		channel.encoding = static_cast<ENCODING>(record.encoding);
+		channel.scale = record.scale;
+		channel.offset = record.offset;
+		channel.dataOffset = record.dataOffset;
+
+		const uint64_t elementBytes = CV_ELEM_SIZE(storedDepth(channel.encoding));
+		const uint64_t rowBytes = static_cast<uint64_t>(header.cols) * elementBytes;
+		if (record.elementBytes != elementBytes || record.dataBytes != rowBytes * header.rows ||
+			!fits(record.dataOffset, record.dataBytes, size) || record.dataOffset % alignment != 0)
+			throw invalid("bad channel '" + channel.name + "'");
+
+		channel.stripOffsets.resize(strips);
+		for (int s = 0; s < strips; s++)
+		{
+			StripRecord strip;
+			std::memcpy(&strip, bytes + stripIndexOffset + sizeof(StripRecord) * (static_cast<uint64_t>(c) * strips + s),
+				sizeof(strip));
+			int rows = std::min(rowsPerStrip, header.rows - s * rowsPerStrip);
+			if (strip.bytes != rowBytes * rows || !fits(strip.offset, strip.bytes, size) ||
+				strip.offset % elementBytes != 0)
+				throw invalid("bad strip index");
+			channel.stripOffsets[s] = strip.offset;
+		}
+	}
+}
+
+/**
+ * @brief Index of the channel with the given name.
+ *
+ * @param name Channel name.
+ * @return Index, -1 when there is none.
+ */
+int TensorFieldFile::channelIndex(const std::string& name) const
+{
+	for (size_t c = 0; c < channels.size(); c++)
+	{
+		if (channels[c].name == name)
+			return static_cast<int>(c);
+	}
+	return -1;
+}
+
+/**
+ * @brief Header over rows of mapped data that keeps the mapping alive; the data is never written through it.
+ */
+cv::Mat TensorFieldFile::view(const ChannelInfo& channel, uint64_t offset, int rows) const
+{
+	return MappedFile::view(file, offset, rows, mapSize.width, storedDepth(channel.encoding));
+}
+
+/**
+ * @brief Zero-copy view of a whole channel in its stored encoding.
+ *
+ * @param channel Channel index.
+ * @return Read-only view that keeps the mapping alive.
+ */
+cv::Mat TensorFieldFile::raw(int channel) const
+{
+	const ChannelInfo& info = channels.at(channel);
+	return view(info, info.dataOffset, mapSize.height);
+}
+
+/**
+ * @brief Zero-copy view of one strip of a channel in its stored encoding.
+ *
+ * @param channel Channel index.
+ * @param strip Strip index; rows [strip * stripRows(), (strip + 1) * stripRows()).
+ * @return Read-only view that keeps the mapping alive.
+ */
+cv::Mat TensorFieldFile::strip(int channel, int strip) const
+{
+	const ChannelInfo& info = channels.at(channel);
+	int rows = std::min(rowsPerStrip, mapSize.height - strip * rowsPerStrip);
+	return view(info, info.stripOffsets.at(strip), rows);
+}
+
+/**
+ * @brief Decodes stored values of a channel to float32.
+ *
+ * @param channel Channel index.
+ * @param stored View returned by raw() or strip() for that channel.
+ * @return Float values; stored itself for FLOAT32.
+ */
+cv::Mat TensorFieldFile::decode(int channel, const cv::Mat& stored) const
+{
+	const ChannelInfo& info = channels.at(channel);
+	cv::Mat values;
+	switch (info.encoding)
+	{
+	case ENCODING::FLOAT32:
+		return stored;
+
+	case ENCODING::FLOAT16:
+		stored.convertTo(values, CV_32F);
+		break;
+
+	case ENCODING::QUANT16:
+		stored.convertTo(values, CV_32F, info.scale, info.offset);
+		break;
+	}
+	return values;
+}
+
+cv::Mat TensorFieldFile::decode(int channel) const
+{
+	return decode(channel, raw(channel));
+}
+
+cv::Mat TensorFieldFile::decode(const std::string& name) const
+{
+	int channel = channelIndex(name);
+	if (channel < 0)
+		throw std::out_of_range("TensorFieldFile: no channel named '" + name + "'.");
+	return decode(channel);
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "MappedFile.h"
+
+/**
+ * @class TensorFieldFile
+ * @brief Chunked binary container for the output maps of an analysis, read back by memory mapping.
+ *
+ * A file holds any number of named single-channel maps of one size (Energy, Orientation,
+ * Coherency, the tensor components...), each stored with one of three encodings:
+ * - FLOAT32: the exact values.
+ * - FLOAT16: IEEE half floats, relative error below 2^-11 over the normal range.
+ * - QUANT16: 16-bit codes q with value = offset + scale * q, where offset and scale span the
+ *   minimum and maximum of the map, so the absolute error is at most (max - min) / 131070.
+ *
+ * Layout, little-endian, every section starting on a 64-byte boundary:
+ * - Header (64 bytes): magic "STFIELD", version, size, rows per strip, channel count.
+ * - Channel table (64 bytes per channel): name, encoding, scale, offset, data range.
+ * - Strip index (16 bytes per channel and strip): offset and size of every strip of rows.
+ * - Channel data: the strips of each channel, back to back, rows without padding.
+ *
+ * Reading maps the file and hands out cv::Mat headers that point into the mapping, so opening
+ * a file and reading a channel in its stored encoding copies nothing; pages are loaded on
+ * first access. Those headers are read-only and share ownership of the mapping, so they stay
+ * valid after the TensorFieldFile is gone. The strip index allows reading a band of rows without
+ * touching the rest of the file.
+ */
+class TensorFieldFile
+{
+public:
+    // Storage encoding of a channel
+    enum class ENCODING {
+        FLOAT32 = 0,
+        FLOAT16 = 1,
+        QUANT16 = 2
+    };
+
+    /**
+     * @brief A map to write.
+     */
+    struct Channel
+    {
+        std::string name;   // At most maxNameLength characters
+        cv::Mat map;        // Single channel, any depth; stored from its float32 conversion
+    };
+
+    static const int maxNameLength = 31;
+
+    /**
+     * @brief Writes maps of one size into a new file.
+     * @param path Output file, replaced when it exists.
+     * @param channels Maps to store, in order.
+     * @param encoding Encoding of every channel.
+     * @param stripRows Rows per strip of the index.
+     * @throws std::invalid_argument when the maps are empty, differ in size or have more than one
+     *         channel, or a name is too long; std::runtime_error when the file cannot be written.
+     */
+    static void write(const std::string& path, const std::vector<Channel>& channels, ENCODING encoding,
+        int stripRows = 64);
+
+    /**
+     * @brief Opens and maps a file written by write().
+     * @throws std::runtime_error when it is not a valid tensor field file.
+     */
+    explicit TensorFieldFile(const std::string& path);
+
+    cv::Size size() const { return mapSize; }
+    int stripRows() const { return rowsPerStrip; }
+    int stripCount() const { return (mapSize.height + rowsPerStrip - 1) / rowsPerStrip; }
+    int channelCount() const { return static_cast<int>(channels.size()); }
+
+    const std::string& channelName(int channel) const { return channels.at(channel).name; }
+    ENCODING encoding(int channel) const { return channels.at(channel).encoding; }
+
+    /**
+     * @brief Index of the channel with the given name, -1 when there is none.
+     */
+    int channelIndex(const std::string& name) const;
+
+    /**
+     * @brief Zero-copy view of a channel in its stored encoding: CV_32F, CV_16F or CV_16U codes.
+     */
+    cv::Mat raw(int channel) const;
+
+    /**
+     * @brief Zero-copy view of one strip of rows of a channel in its stored encoding.
+     */
+    cv::Mat strip(int channel, int strip) const;
+
+    /**
+     * @brief Channel as float32 values: the mapped data itself for FLOAT32, a decoded copy otherwise.
+     */
+    cv::Mat decode(int channel) const;
+
+    /**
+     * @brief Decodes the channel with the given name.
+     * @throws std::out_of_range when there is none.
+     */
+    cv::Mat decode(const std::string& name) const;
+
+    /**
+     * @brief Decodes stored values (a view returned by raw() or strip()) of a channel to float32.
+     */
+    cv::Mat decode(int channel, const cv::Mat& stored) const;
+
+private:
+    struct ChannelInfo
+    {
+        std::string name;
+        ENCODING encoding = ENCODING::FLOAT32;
+        float scale = 1;
+        float offset = 0;
+        uint64_t dataOffset = 0;
+        std::vector<uint64_t> stripOffsets;
+    };
+
+    std::shared_ptr<const MappedFile> file;
+    cv::Size mapSize;
+    int rowsPerStrip = 0;
+    std::vector<ChannelInfo> channels;
+
+    cv::Mat view(const ChannelInfo& channel, uint64_t offset, int rows) const;
+};
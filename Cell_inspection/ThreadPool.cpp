@@ -0,0 +1,490 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+namespace
+{
+	// Pool and index of the worker running on this thread
+	thread_local const ThreadPool* workerPool = nullptr;
+	thread_local int workerIndex = -1;
+
+	// Block of parallelFor indices, relative to the start of the loop, packed as begin << 32 | end
+	// so that the owner taking an index and a thief splitting the block are each one compare-and-swap
+	struct LoopBlock
+	{
+		std::atomic<uint64_t> bounds{ 0 };
+
+		static uint64_t pack(uint32_t begin, uint32_t end) { return (static_cast<uint64_t>(begin) << 32) | end; }
+
+		void set(uint32_t begin, uint32_t end) { bounds.store(pack(begin, end)); }
+
+		// Takes the first index of the block
+		bool take(uint32_t& index)
+		{
+			uint64_t value = bounds.load();
+			for (;;)
+			{
+				uint32_t begin = static_cast<uint32_t>(value >> 32);
+				uint32_t end = static_cast<uint32_t>(value);
+				if (begin >= end)
+					return false;
+				if (bounds.compare_exchange_weak(value, pack(begin + 1, end)))
+				{
+					index = begin;
+					return true;
+				}
+			}
+		}
+
+		// Takes the second half of the block, or its last index
+		bool split(uint32_t& first, uint32_t& last)
+		{
+			uint64_t value = bounds.load();
+			for (;;)
+			{
+				uint32_t begin = static_cast<uint32_t>(value >> 32);
+				uint32_t end = static_cast<uint32_t>(value);
+				if (begin >= end)
+					return false;
+				uint32_t middle = begin + (end - begin) / 2;
+				if (bounds.compare_exchange_weak(value, pack(begin, middle)))
+				{
+					first = middle;
+					last = end;
+					return true;
+				}
+			}
+		}
+	};
+
+	// Parses a Linux CPU list such as "0-15,32-47"
+	std::vector<int> parseCpuList(const std::string& text)
+	{
+		std::vector<int> cpus;
+		std::stringstream stream(text);
+		std::string item;
+		while (std::getline(stream, item, ','))
+		{
+			size_t dash = item.find('-');
+			try
+			{
+				int first = std::stoi(item.substr(0, dash));
+				int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+				for (int cpu = first; cpu <= last; cpu++)
+				{
+					cpus.push_back(cpu);
+				}
+			}
+			catch (const std::exception&)
+			{
+			}
+		}
+		return cpus;
+	}
+
+	void pinThread(std::thread& thread, int cpu)
+	{
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#elif defined(_WIN32)
+		if (cpu < 64)
+			SetThreadAffinityMask(static_cast<HANDLE>(thread.native_handle()), DWORD_PTR(1) << cpu);
+#else
+		(void)thread;
+		(void)cpu;
+#endif
+	}
+}
+
+/**
+ * @brief Starts the worker threads.
+ *
+ * Workers are laid over the CPUs in NUMA node order. Each one steals from the workers of its
+ * own node first, nearest index first, then from the others; without pinning the OS decides
+ * where workers run, so every worker is treated as being on node 0.
+ *
+ * @param threads Number of workers; values below 1 use the hardware concurrency.
+ * @param pinned Pin every worker to its CPU.
+ */
+ThreadPool::ThreadPool(int threads, bool pinned)
+{
+	if (threads < 1)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector<std::pair<int, int>> cpus; // CPU and node, node by node
+	const std::vector<std::vector<int>> nodes = numaNodes();
+	for (size_t node = 0; node < nodes.size(); node++)
+	{
+		for (int cpu : nodes[node])
+		{
+			cpus.emplace_back(cpu, static_cast<int>(node));
+		}
+	}
+
+	workers.reserve(threads);
+	for (int i = 0; i < threads; i++)
+	{
+		workers.emplace_back(new Worker());
+		if (pinned && !cpus.empty())
+		{
+			workers[i]->cpu = cpus[i % cpus.size()].first;
+			workers[i]->node = cpus[i % cpus.size()].second;
+		}
+	}
+
+	for (int i = 0; i < threads; i++)
+	{
+		std::vector<int>& victims = workers[i]->victims;
+		for (int k = 1; k < threads; k++)
+		{
+			int other = (i + k) % threads;
+			if (workers[other]->node == workers[i]->node)
+				victims.push_back(other);
+		}
+		for (int k = 1; k < threads; k++)
+		{
+			int other = (i + k) % threads;
+			if (workers[other]->node != workers[i]->node)
+				victims.push_back(other);
+		}
+	}
+
+	for (int i = 0; i < threads; i++)
+	{
+		workers[i]->thread = std::thread([this, i] { workerLoop(i); });
+		if (workers[i]->cpu >= 0)
+			pinThread(workers[i]->thread, workers[i]->cpu);
+	}
+}
+
+/**
+ * @brief Lets the workers drain the queues, then joins them.
+ */
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	available.notify_all();
+	for (std::unique_ptr<Worker>& worker : workers)
+	{
+		worker->thread.join();
+	}
+}
+
+/**
+ * @brief Queues a task: on the deque of the calling worker, or round-robin from other threads.
+ *
+ * @param task Callable to run.
+ */
+void ThreadPool::enqueue(std::function<void()> task)
+{
+	int self = currentWorker();
+	int target = self >= 0 ? self : static_cast<int>(nextDeque++ % workers.size());
+	{
+		std::lock_guard<std::mutex> lock(workers[target]->mutex);
+		workers[target]->tasks.push_back(std::move(task));
+	}
+	queued++;
+
+	// A worker going to sleep checks queued under sleepMutex, so it cannot miss this notification
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	available.notify_one();
+}
+
+int ThreadPool::currentWorker() const
+{
+	return workerPool == this ? workerIndex : -1;
+}
+
+/**
+ * @brief Takes the newest task of the worker's deque, or else the oldest task of a victim.
+ *
+ * @param worker Index of the worker.
+ * @param task Receives the task.
+ * @return False when every deque is empty.
+ */
+bool ThreadPool::takeTask(int worker, std::function<void()>& task)
+{
+	Worker& self = *workers[worker];
+	{
+		std::lock_guard<std::mutex> lock(self.mutex);
+		if (!self.tasks.empty())
+		{
+			task = std::move(self.tasks.back());
+			self.tasks.pop_back();
+			queued--;
+			return true;
+		}
+	}
+
+	for (int index : self.victims)
+	{
+		Worker& victim = *workers[index];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			queued--;
+			self.stealCount++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::run(int worker, std::function<void()>& task)
+{
+	auto start = std::chrono::steady_clock::now();
+	task();
+	task = nullptr;
+	auto busy = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+	workers[worker]->busyNanoseconds += busy.count();
+	workers[worker]->taskCount++;
+}
+
+/**
+ * @brief Runs tasks, its own or stolen ones, until the pool is destroyed and every deque is empty.
+ */
+void ThreadPool::workerLoop(int worker)
+{
+	workerPool = this;
+	workerIndex = worker;
+
+	std::function<void()> task;
+	for (;;)
+	{
+		if (takeTask(worker, task))
+		{
+			run(worker, task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		available.wait(lock, [this] { return stopping || queued > 0; });
+		if (stopping && queued <= 0)
+			return;
+	}
+}
+
+void ThreadPool::countSteal()
+{
+	int self = currentWorker();
+	if (self >= 0)
+		workers[self]->stealCount++;
+}
+
+/**
+ * @brief Calls body(i) for every i in [begin, end) on the workers and the calling thread.
+ *
+ * Every participant starts on its own contiguous block of the range and, once it is done,
+ * splits the block of another participant, so a participant whose indices turn out expensive
+ * hands the rest of its block over instead of holding up the loop. The loop state is shared
+ * through a shared_ptr so that helpers which only get scheduled after the loop has finished
+ * find no work left and return without touching the caller's stack.
+ *
+ * @param begin First index.
+ * @param end One past the last index.
+ * @param body Loop body.
+ */
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int)>& body)
+{
+	if (end <= begin)
+		return;
+
+	struct LoopState
+	{
+		std::unique_ptr<LoopBlock[]> blocks;
+		int participants;
+		int begin;
+		std::atomic<int> pending;
+		std::exception_ptr error;
+		std::mutex mutex;
+		std::condition_variable done;
+		const std::function<void(int)>* body;
+	};
+
+	const int count = end - begin;
+	auto state = std::make_shared<LoopState>();
+	state->participants = std::min(size() + 1, count);
+	state->blocks.reset(new LoopBlock[state->participants]);
+	for (int p = 0; p < state->participants; p++)
+	{
+		state->blocks[p].set(static_cast<uint32_t>(static_cast<int64_t>(count) * p / state->participants),
+			static_cast<uint32_t>(static_cast<int64_t>(count) * (p + 1) / state->participants));
+	}
+	state->begin = begin;
+	state->pending = count;
+	state->body = &body;
+
+	auto run = [this](const std::shared_ptr<LoopState>& state, int slot)
+	{
+		LoopBlock& own = state->blocks[slot];
+		for (;;)
+		{
+			uint32_t i;
+			if (!own.take(i))
+			{
+				bool stolen = false;
+				for (int k = 1; k < state->participants && !stolen; k++)
+				{
+					uint32_t first, last;
+					if (state->blocks[(slot + k) % state->participants].split(first, last))
+					{
+						own.set(first, last);
+						stolen = true;
+					}
+				}
+				if (!stolen)
+					return;
+				countSteal();
+				continue;
+			}
+
+			try
+			{
+				(*state->body)(state->begin + static_cast<int>(i));
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				if (!state->error)
+					state->error = std::current_exception();
+			}
+
+			if (--state->pending == 0)
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->done.notify_all();
+			}
+		}
+	};
+
+	for (int p = 1; p < state->participants; p++)
+	{
+		enqueue([state, run, p] { run(state, p); });
+	}
+	run(state, 0);
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->done.wait(lock, [&state] { return state->pending == 0; });
+	if (state->error)
+		std::rethrow_exception(state->error);
+}
+
+/**
+ * @brief Runs a loop body over an index range, on the pool when one is given.
+ *
+ * @param pool Optional thread pool; the loop runs serially when null.
+ * @param begin First index.
+ * @param end One past the last index.
+ * @param body Loop body.
+ */
+void ThreadPool::forEach(ThreadPool* pool, int begin, int end, const std::function<void(int)>& body)
+{
+	if (pool)
+	{
+		pool->parallelFor(begin, end, body);
+		return;
+	}
+	for (int i = begin; i < end; i++)
+	{
+		body(i);
+	}
+}
+
+std::vector<ThreadPool::WorkerStatistics> ThreadPool::statistics() const
+{
+	std::vector<WorkerStatistics> result;
+	result.reserve(workers.size());
+	for (const std::unique_ptr<Worker>& worker : workers)
+	{
+		WorkerStatistics statistics;
+		statistics.cpu = worker->cpu;
+		statistics.node = worker->node;
+		statistics.tasks = worker->taskCount.load();
+		statistics.steals = worker->stealCount.load();
+		statistics.busySeconds = worker->busyNanoseconds.load() * 1e-9;
+		result.push_back(statistics);
+	}
+	return result;
+}
+
+void ThreadPool::resetStatistics()
+{
+	for (std::unique_ptr<Worker>& worker : workers)
+	{
+		worker->taskCount = 0;
+		worker->stealCount = 0;
+		worker->busyNanoseconds = 0;
+	}
+}
+
+/**
+ * @brief CPUs of every NUMA node.
+ *
+ * On Linux the nodes are read from /sys/devices/system/node/node<N>/cpulist, in node order;
+ * elsewhere, or when that fails, all CPUs form node 0.
+ */
+std::vector<std::vector<int>> ThreadPool::numaNodes()
+{
+	std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+	std::error_code error;
+	std::vector<std::pair<int, std::vector<int>>> found;
+	for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error))
+	{
+		const std::string name = entry.path().filename().string();
+		if (name.size() <= 4 || name.compare(0, 4, "node") != 0 ||
+			!std::all_of(name.begin() + 4, name.end(), [](char c) { return c >= '0' && c <= '9'; }))
+			continue;
+
+		std::ifstream file(entry.path() / "cpulist");
+		std::string list;
+		if (std::getline(file, list))
+		{
+			std::vector<int> cpus = parseCpuList(list);
+			if (!cpus.empty())
+				found.emplace_back(std::stoi(name.substr(4)), cpus);
+		}
+	}
+	std::sort(found.begin(), found.end());
+	for (auto& node : found)
+	{
+		nodes.push_back(std::move(node.second));
+	}
+#endif
+
+	if (nodes.empty())
+	{
+		nodes.emplace_back();
+		int cpus = std::max(1u, std::thread::hardware_concurrency());
+		for (int cpu = 0; cpu < cpus; cpu++)
+		{
+			nodes[0].push_back(cpu);
+		}
+	}
+	return nodes;
+}
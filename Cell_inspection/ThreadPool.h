@@ -0,0 +1,132 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class ThreadPool
+ * @brief Work-stealing pool of worker threads executing queued tasks.
+ *
+ * Every worker owns a deque of tasks behind its own lock. A worker pushes the tasks it creates at
+ * the back of its deque and runs them from the back, newest first, which keeps nested work on
+ * warm caches; tasks queued by other threads are dealt round-robin over the deques. A worker with
+ * an empty deque steals the oldest task of another one, trying the workers of its own NUMA node
+ * first, so no single lock is shared by all workers.
+ *
+ * parallelFor() splits its range into one contiguous block per participant, and participants
+ * that run out steal half of the remainder of another's block. Blocks of very different cost,
+ * such as dense and empty tiles of a slide, are balanced without the caller choosing a grain.
+ * The calling thread takes part in the loop, so it can be used from inside a task of the same
+ * pool without dead-locking even when every worker is busy.
+ */
+class ThreadPool
+{
+public:
+
+    /**
+     * @brief Utilization of one worker since the pool was created or the statistics were reset.
+     */
+    struct WorkerStatistics
+    {
+        int cpu = -1;               // CPU the worker is pinned to, -1 when not pinned
+        int node = 0;               // NUMA node of that CPU
+        int64_t tasks = 0;          // Tasks run
+        int64_t steals = 0;         // Tasks and loop blocks taken from other workers
+        double busySeconds = 0;     // Time spent running tasks
+    };
+
+    /**
+     * @brief Starts the worker threads.
+     * @param threads Number of workers; values below 1 use the hardware concurrency.
+     * @param pinned Pin worker i to the i-th CPU, filling one NUMA node after the other, so that
+     * the workers of a node share its memory and steal from each other first. Ignored where
+     * affinity is not supported.
+     */
+    explicit ThreadPool(int threads = 0, bool pinned = false);
+
+    /**
+     * @brief Finishes the queued tasks and joins the workers.
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Number of worker threads.
+     */
+    int size() const { return static_cast<int>(workers.size()); }
+
+    /**
+     * @brief Queues a task for execution on a worker.
+     */
+    void enqueue(std::function<void()> task);
+
+    /**
+     * @brief Calls body(i) for every i in [begin, end) and waits for all of them.
+     *
+     * The range is split into contiguous blocks for the workers and the calling thread, which
+     * steal from each other's blocks when theirs is done.
+     * The first exception thrown by body is rethrown once every started call has returned.
+     */
+    void parallelFor(int begin, int end, const std::function<void(int)>& body);
+
+    /**
+     * @brief Calls body(i) for i in [begin, end), on the pool when one is given and serially otherwise.
+     */
+    static void forEach(ThreadPool* pool, int begin, int end, const std::function<void(int)>& body);
+
+    /**
+     * @brief Utilization counters of every worker. The calling threads of parallelFor() are not
+     * counted unless they are workers themselves.
+     */
+    std::vector<WorkerStatistics> statistics() const;
+
+    /**
+     * @brief Restarts the utilization counters.
+     */
+    void resetStatistics();
+
+    /**
+     * @brief CPUs of every NUMA node, from /sys/devices/system/node on Linux; a single node of
+     * every CPU elsewhere.
+     */
+    static std::vector<std::vector<int>> numaNodes();
+
+private:
+    struct alignas(64) Worker
+    {
+        std::thread thread;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::vector<int> victims;   // Other workers, those of the same node first
+        int cpu = -1;
+        int node = 0;
+        std::atomic<int64_t> taskCount{ 0 };
+        std::atomic<int64_t> stealCount{ 0 };
+        std::atomic<int64_t> busyNanoseconds{ 0 };
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<int> queued{ 0 };           // Tasks in all deques
+    std::atomic<unsigned> nextDeque{ 0 };   // Round-robin target of tasks queued from outside
+    std::mutex sleepMutex;
+    std::condition_variable available;
+    bool stopping = false;
+
+    // Index of the calling thread among the workers of this pool, -1 for other threads
+    int currentWorker() const;
+
+    // Takes the newest task of a worker's own deque, or steals the oldest of another one
+    bool takeTask(int worker, std::function<void()>& task);
+
+    void run(int worker, std::function<void()>& task);
+    void workerLoop(int worker);
+    void countSteal();
+};
@@ -0,0 +1,456 @@
+#include <benchmark/benchmark.h>
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ArenaAllocator.h"
+#include "CountingAllocator.h"
+#include "Precision.h"
+#include "RecursiveGaussian.h"
+#include "ReducedPrecision.h"
+#include "StructureTensorAnalysis.h"
+#include "StructureTensorKernel.h"
+#include "ThreadPool.h"
+
+// Benchmarks of every gradient method and pipeline stage on synthetic images.
+//
+// Every benchmark reports the throughput in megapixels per second (MP/s) and the bytes and
+// number of cv::Mat buffers allocated per iteration in steady state (alloc_bytes, allocs).
+// Run with --benchmark_filter to select a subset, e.g. --benchmark_filter=Pipeline/.*/1024/
+
+namespace
+{
+	using GRADIENT_METHOD = StructureTensorAnalysis::GRADIENT_METHOD;
+
+	// Counts the buffers of OpenCV's worker threads too
+	CountingAllocator allocator(true);
+
+	const std::vector<int64_t> imageSizes = { 256, 1024, 4096, 8192 };
+	const std::vector<int64_t> methods = { 0, 1, 2, 3, 4, 5 };
+
+	std::vector<int64_t> threadCounts()
+	{
+		int64_t hardware = std::max(1u, std::thread::hardware_concurrency());
+		return hardware > 1 ? std::vector<int64_t>{ 1, hardware } : std::vector<int64_t>{ 1 };
+	}
+
+	// Square 8-bit image of fibres whose orientation and period drift across the image, with noise.
+	// Generated once per size.
+	const cv::Mat& syntheticImage(int size)
+	{
+		static std::map<int, cv::Mat> images;
+		cv::Mat& image = images[size];
+		if (!image.empty())
+			return image;
+
+		image.create(size, size, CV_8U);
+		cv::RNG rng(12345);
+		for (int i = 0; i < size; i++)
+		{
+			uchar* row = image.ptr<uchar>(i);
+			for (int j = 0; j < size; j++)
+			{
+				double angle = CV_PI * (i + j) / (2.0 * size);
+				double u = j * std::cos(angle) + i * std::sin(angle);
+				double value = 128 + 80 * std::sin(u / (3 + 5.0 * i / size));
+				row[j] = cv::saturate_cast<uchar>(value + rng.gaussian(10));
+			}
+		}
+		return image;
+	}
+
+	// Snapshot of the allocation counters, turned into per-iteration counters at the end of a run
+	class AllocationCounters
+	{
+	public:
+		AllocationCounters() : bytes{ allocator.allocatedBytes() }, count{ allocator.allocations() } {}
+
+		void report(benchmark::State& state, int64_t pixels) const
+		{
+			state.counters["MP/s"] = benchmark::Counter(pixels / 1e6, benchmark::Counter::kIsIterationInvariantRate);
+			state.counters["alloc_bytes"] = benchmark::Counter(double(allocator.allocatedBytes() - bytes),
+				benchmark::Counter::kAvgIterations);
+			state.counters["allocs"] = benchmark::Counter(double(allocator.allocations() - count),
+				benchmark::Counter::kAvgIterations);
+		}
+
+	private:
+		size_t bytes;
+		size_t count;
+	};
+
+	std::unique_ptr<ThreadPool> makePool(int threads)
+	{
+		return threads > 1 ? std::unique_ptr<ThreadPool>(new ThreadPool(threads)) : nullptr;
+	}
+
+	// Mean share of the wall time the workers of a pool spent running tasks, and steals per iteration
+	void reportUtilization(benchmark::State& state, const ThreadPool* pool, double seconds)
+	{
+		if (!pool || seconds <= 0)
+			return;
+		double busy = 0;
+		int64_t steals = 0;
+		for (const ThreadPool::WorkerStatistics& worker : pool->statistics())
+		{
+			busy += worker.busySeconds;
+			steals += worker.steals;
+		}
+		state.counters["utilization"] = busy / (seconds * pool->size());
+		state.counters["steals"] = benchmark::Counter(double(steals), benchmark::Counter::kAvgIterations);
+	}
+}
+
+// Gradient stage alone: args are method, size, threads
+static void BM_Gradients(benchmark::State& state)
+{
+	const GRADIENT_METHOD method = static_cast<GRADIENT_METHOD>(state.range(0));
+	const cv::Mat& image = syntheticImage(static_cast<int>(state.range(1)));
+	std::unique_ptr<ThreadPool> pool = makePool(static_cast<int>(state.range(2)));
+	state.SetLabel(StructureTensorAnalysis::methodName(method));
+
+	cv::Mat gradX, gradY;
+	GradientCalculator::Workspace workspace;
+	StructureTensorAnalysis::computeGradients(image, gradX, gradY, method, 2, workspace, pool.get());
+
+	AllocationCounters counters;
+	for (auto _ : state)
+	{
+		StructureTensorAnalysis::computeGradients(image, gradX, gradY, method, 2, workspace, pool.get());
+		benchmark::DoNotOptimize(gradX.data);
+	}
+	counters.report(state, image.total());
+}
+BENCHMARK(BM_Gradients)->ArgNames({ "method", "size", "threads" })
+	->ArgsProduct({ methods, imageSizes, threadCounts() })
+	->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Products and Gaussian window of the fused kernel, without the eigen-analysis: args are size, window
+static void BM_Window(benchmark::State& state)
+{
+	const cv::Mat& image = syntheticImage(static_cast<int>(state.range(0)));
+	const int windowSize = static_cast<int>(state.range(1));
+
+	cv::Mat gradX, gradY;
+	GradientCalculator::Workspace workspace;
+	StructureTensorAnalysis::computeGradients(image, gradX, gradY, GRADIENT_METHOD::FINITE_DIFFERENCE, windowSize, workspace);
+
+	StructureTensorKernel kernel(image.rows, image.cols, windowSize);
+	StructureTensorKernel::RowTarget target = [](int) { return StructureTensorKernel::RowOutput(); };
+
+	AllocationCounters counters;
+	for (auto _ : state)
+	{
+		kernel.begin(0, image.rows);
+		for (int i = 0; i < image.rows; i++)
+		{
+			kernel.pushRow(gradX.ptr<float>(i), gradY.ptr<float>(i), target);
+		}
+	}
+	counters.report(state, image.total());
+}
+BENCHMARK(BM_Window)->ArgNames({ "size", "window" })
+	->ArgsProduct({ imageSizes, { 2, 8, 32 } })
+	->Unit(benchmark::kMillisecond);
+
+// Recursive window on the three tensor images: args are size, window
+static void BM_RecursiveWindow(benchmark::State& state)
+{
+	const int size = static_cast<int>(state.range(0));
+	const double sigma = static_cast<double>(state.range(1));
+
+	cv::Mat tensor(size, size, CV_32F);
+	cv::randu(tensor, 0.0f, 1.0f);
+	cv::Mat smoothed;
+	RecursiveGaussian engine;
+	RecursiveGaussian::blur(tensor, smoothed, sigma, engine);
+
+	AllocationCounters counters;
+	for (auto _ : state)
+	{
+		for (int component = 0; component < 3; component++)
+		{
+			RecursiveGaussian::blur(tensor, smoothed, sigma, engine);
+		}
+		benchmark::DoNotOptimize(smoothed.data);
+	}
+	counters.report(state, tensor.total());
+}
+BENCHMARK(BM_RecursiveWindow)->ArgNames({ "size", "window" })
+	->ArgsProduct({ imageSizes, { 2, 8, 32 } })
+	->Unit(benchmark::kMillisecond);
+
+// Eigen-analysis alone on precomputed tensor components: args are size
+static void BM_Eigen(benchmark::State& state)
+{
+	const int size = static_cast<int>(state.range(0));
+
+	cv::Mat ixx(size, size, CV_32F), iyy(size, size, CV_32F), ixy(size, size, CV_32F);
+	cv::randu(ixx, 0.0f, 1000.0f);
+	cv::randu(iyy, 0.0f, 1000.0f);
+	cv::randu(ixy, -500.0f, 500.0f);
+	cv::Mat energy(size, size, CV_32F), orientation(size, size, CV_32F), coherency(size, size, CV_32F);
+
+	AllocationCounters counters;
+	for (auto _ : state)
+	{
+		for (int i = 0; i < size; i++)
+		{
+			StructureTensorKernel::RowOutput out;
+			out.energy = energy.ptr<float>(i);
+			out.orientation = orientation.ptr<float>(i);
+			out.coherency = coherency.ptr<float>(i);
+			StructureTensorKernel::eigenRow(ixx.ptr<float>(i), iyy.ptr<float>(i), ixy.ptr<float>(i), size, out);
+		}
+		benchmark::DoNotOptimize(coherency.data);
+	}
+	counters.report(state, ixx.total());
+}
+BENCHMARK(BM_Eigen)->ArgNames({ "size" })
+	->ArgsProduct({ imageSizes })
+	->Unit(benchmark::kMillisecond);
+
+// Whole analysis of a frame in a session: args are method, size, window, threads
+static void BM_Pipeline(benchmark::State& state)
+{
+	const GRADIENT_METHOD method = static_cast<GRADIENT_METHOD>(state.range(0));
+	const cv::Mat& image = syntheticImage(static_cast<int>(state.range(1)));
+	state.SetLabel(StructureTensorAnalysis::methodName(method));
+
+	StructureTensorAnalysis analysis(image.size(), method, static_cast<int>(state.range(2)),
+		static_cast<int>(state.range(3)));
+	analysis.process(image);
+
+	AllocationCounters counters;
+	for (auto _ : state)
+	{
+		analysis.process(image);
+	}
+	counters.report(state, image.total());
+}
+BENCHMARK(BM_Pipeline)->ArgNames({ "method", "size", "window", "threads" })
+	->ArgsProduct({ methods, imageSizes, { 2, 16 }, threadCounts() })
+	->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Whole analysis restricted by a mask, 8 times smaller than the image, whose foreground is a
+// centred square of the given percentage of the area: args are size, foreground, threads.
+// Reports the utilization of the workers, which shows how well the runs are balanced.
+static void BM_PipelineRegions(benchmark::State& state)
+{
+	const cv::Mat& image = syntheticImage(static_cast<int>(state.range(0)));
+	cv::Mat mask = cv::Mat::zeros(image.rows / 8, image.cols / 8, CV_8U);
+	const int side = static_cast<int>(mask.cols * std::sqrt(state.range(1) / 100.0));
+	mask(cv::Rect((mask.cols - side) / 2, (mask.rows - side) / 2, side, side)).setTo(255);
+
+	const int threads = static_cast<int>(state.range(2));
+	std::shared_ptr<ThreadPool> pool = threads > 1 ? std::make_shared<ThreadPool>(threads) : nullptr;
+	StructureTensorAnalysis analysis(image.size(), GRADIENT_METHOD::FINITE_DIFFERENCE, 2);
+	analysis.setThreadPool(pool);
+	analysis.setMask(mask);
+	analysis.process(image);
+	if (pool)
+		pool->resetStatistics();
+
+	AllocationCounters counters;
+	auto start = std::chrono::steady_clock::now();
+	for (auto _ : state)
+	{
+		analysis.process(image);
+	}
+	counters.report(state, image.total());
+	reportUtilization(state, pool.get(), std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
+BENCHMARK(BM_PipelineRegions)->ArgNames({ "size", "foreground", "threads" })
+	->ArgsProduct({ { 1024, 4096, 8192 }, { 100, 40, 20 }, threadCounts() })
+	->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Whole analysis in tiles (0 = whole frames): args are method, tile, size, threads
+static void BM_PipelineTiled(benchmark::State& state)
+{
+	const GRADIENT_METHOD method = static_cast<GRADIENT_METHOD>(state.range(0));
+	const cv::Mat& image = syntheticImage(static_cast<int>(state.range(2)));
+	state.SetLabel(StructureTensorAnalysis::methodName(method));
+
+	StructureTensorAnalysis analysis(image.size(), method, 2, static_cast<int>(state.range(3)));
+	analysis.setTileSize(static_cast<int>(state.range(1)));
+	analysis.process(image);
+
+	AllocationCounters counters;
+	for (auto _ : state)
+	{
+		analysis.process(image);
+	}
+	counters.report(state, image.total());
+	state.counters["intermediate_MB"] = analysis.intermediateBytes() / 1e6;
+}
+BENCHMARK(BM_PipelineTiled)->ArgNames({ "method", "tile", "size", "threads" })
+	->ArgsProduct({ { 0, 1, 2 }, { 0, 512, 1024 }, { 4096, 8192 }, threadCounts() })
+	->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Concurrent analyses, each built for its frame as a batch does, with or without a per-thread
+// arena for the intermediates: args are arena, analyses, size. alloc_bytes counts the default
+// allocator only, so it drops to the outputs when the arena is used.
+static void BM_PipelineArena(benchmark::State& state)
+{
+	const bool useArena = state.range(0) != 0;
+	const int analyses = static_cast<int>(state.range(1));
+	const cv::Mat& image = syntheticImage(static_cast<int>(state.range(2)));
+
+	std::vector<std::shared_ptr<ArenaAllocator>> arenas(analyses);
+	for (std::shared_ptr<ArenaAllocator>& arena : arenas)
+	{
+		if (useArena)
+			arena = std::make_shared<ArenaAllocator>();
+	}
+
+	auto run = [&](int a)
+	{
+		StructureTensorAnalysis analysis(image, GRADIENT_METHOD::CUBIC_SPLINE);
+		analysis.setOutputs(StructureTensorAnalysis::OUTPUT_COHERENCY);
+		analysis.setArena(arenas[a]);
+		analysis.setTileSize(512);
+		benchmark::DoNotOptimize(analysis.getCoherency().data);
+	};
+
+	AllocationCounters counters;
+	for (auto _ : state)
+	{
+		std::vector<std::thread> threads;
+		for (int a = 0; a < analyses; a++)
+		{
+			threads.emplace_back(run, a);
+		}
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+	}
+	counters.report(state, static_cast<int64_t>(image.total()) * analyses);
+	if (useArena)
+		state.counters["arena_MB"] = arenas[0]->reservedBytes() / 1e6;
+}
+BENCHMARK(BM_PipelineArena)->ArgNames({ "arena", "analyses", "size" })
+	->ArgsProduct({ { 0, 1 }, { 1, 8, 32 }, { 1024, 4096 } })
+	->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Whole analysis with the recursive window: args are size, window, threads
+static void BM_PipelineRecursive(benchmark::State& state)
+{
+	const cv::Mat& image = syntheticImage(static_cast<int>(state.range(0)));
+
+	StructureTensorAnalysis analysis(image.size(), GRADIENT_METHOD::FINITE_DIFFERENCE, static_cast<int>(state.range(1)),
+		static_cast<int>(state.range(2)));
+	analysis.setWindowMethod(StructureTensorAnalysis::WINDOW_METHOD::RECURSIVE);
+	analysis.process(image);
+
+	AllocationCounters counters;
+	for (auto _ : state)
+	{
+		analysis.process(image);
+	}
+	counters.report(state, image.total());
+}
+BENCHMARK(BM_PipelineRecursive)->ArgNames({ "size", "window", "threads" })
+	->ArgsProduct({ imageSizes, { 2, 16 }, threadCounts() })
+	->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Whole analysis with reduced-precision intermediates, gradients kept: args are storage, method, size, window.
+// Besides the throughput it reports the intermediate bytes and the output errors against FULL.
+static void BM_PipelineStorage(benchmark::State& state)
+{
+	const ReducedPrecision::STORAGE storage = static_cast<ReducedPrecision::STORAGE>(state.range(0));
+	const GRADIENT_METHOD method = static_cast<GRADIENT_METHOD>(state.range(1));
+	const cv::Mat& image = syntheticImage(static_cast<int>(state.range(2)));
+	const int window = static_cast<int>(state.range(3));
+	state.SetLabel(std::string(StructureTensorAnalysis::methodName(method)) + "/" + ReducedPrecision::name(storage));
+
+	StructureTensorAnalysis analysis(image.size(), method, window, 1, StructureTensorAnalysis::OUTPUT_ALL);
+	analysis.setStorage(storage);
+	analysis.process(image);
+
+	AllocationCounters counters;
+	for (auto _ : state)
+	{
+		analysis.process(image);
+	}
+	counters.report(state, image.total());
+
+	StructureTensorAnalysis::PrecisionReport report =
+		StructureTensorAnalysis::comparePrecision(image, method, window, storage);
+	state.counters["intermediate_bytes"] = double(analysis.intermediateBytes());
+	state.counters["energy_err"] = report.energyMaxError;
+	state.counters["orientation_err"] = report.orientationMaxError;
+	state.counters["coherency_err"] = report.coherencyMaxError;
+}
+BENCHMARK(BM_PipelineStorage)->ArgNames({ "storage", "method", "size", "window" })
+	->ArgsProduct({ { 0, 1, 2 }, { 1, 2 }, { 1024, 4096 }, { 2, 16 } })
+	->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Whole analysis in float or double precision: args are precision (0 = float, 1 = double), method, size.
+// The float run also reports its largest coherency and orientation differences from the double one.
+template <typename T>
+static void runPrecision(benchmark::State& state, GRADIENT_METHOD method, const cv::Mat& image)
+{
+	BasicStructureTensorAnalysis<T> analysis(image.size(), method, 2, 1, StructureTensorAnalysis::OUTPUT_ALL);
+	analysis.process(image);
+
+	AllocationCounters counters;
+	for (auto _ : state)
+	{
+		analysis.process(image);
+	}
+	counters.report(state, image.total());
+	state.counters["intermediate_bytes"] = double(analysis.intermediateBytes());
+}
+
+static void BM_PipelinePrecision(benchmark::State& state)
+{
+	const bool reference = state.range(0) != 0;
+	const GRADIENT_METHOD method = static_cast<GRADIENT_METHOD>(state.range(1));
+	const cv::Mat& image = syntheticImage(static_cast<int>(state.range(2)));
+	state.SetLabel(std::string(StructureTensorAnalysis::methodName(method)) + "/" +
+		(reference ? Precision<double>::name() : Precision<float>::name()));
+
+	if (reference)
+	{
+		runPrecision<double>(state, method, image);
+		return;
+	}
+	runPrecision<float>(state, method, image);
+
+	StructureTensorAnalysis single(image, method, 2);
+	BasicStructureTensorAnalysis<double> full(image, method, 2);
+	cv::Mat coherency, orientation, difference;
+	single.getCoherency().convertTo(coherency, CV_64F);
+	single.getOrientation().convertTo(orientation, CV_64F);
+
+	double coherencyError = 0, orientationError = 0;
+	cv::absdiff(coherency, full.getCoherency(), difference);
+	cv::minMaxLoc(difference, nullptr, &coherencyError);
+	cv::absdiff(orientation, full.getOrientation(), difference);
+	cv::min(difference, CV_PI - difference, difference);
+	cv::minMaxLoc(difference, nullptr, &orientationError, nullptr, nullptr, full.getCoherency() >= 0.1);
+	state.counters["coherency_err"] = coherencyError;
+	state.counters["orientation_err"] = orientationError;
+}
+BENCHMARK(BM_PipelinePrecision)->ArgNames({ "double", "method", "size" })
+	->ArgsProduct({ { 0, 1 }, methods, { 1024, 4096 } })
+	->Unit(benchmark::kMillisecond)->UseRealTime();
+
+int main(int argc, char** argv)
+{
+	cv::Mat::setDefaultAllocator(&allocator);
+
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+	benchmark::RunSpecifiedBenchmarks();
+
+	cv::Mat::setDefaultAllocator(nullptr);
+	return 0;
+}
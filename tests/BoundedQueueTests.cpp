@@ -0,0 +1,174 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "BoundedQueue.h"
+
+TEST(BoundedQueue, CapacityIsAPowerOfTwo)
+{
+	EXPECT_EQ(2u, BoundedQueue<int>(0).capacity());
+	EXPECT_EQ(2u, BoundedQueue<int>(2).capacity());
+	EXPECT_EQ(8u, BoundedQueue<int>(5).capacity());
+	EXPECT_EQ(8u, BoundedQueue<int>(8).capacity());
+}
+
+TEST(BoundedQueue, TryPushAndTryPopAreFifoAndBounded)
+{
+	BoundedQueue<std::unique_ptr<int>> queue(4);
+	std::unique_ptr<int> value;
+	EXPECT_FALSE(queue.tryPop(value));
+
+	// Several laps around the ring
+	for (int lap = 0; lap < 3; lap++)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			value.reset(new int(lap * 4 + i));
+			ASSERT_TRUE(queue.tryPush(value));
+			EXPECT_EQ(nullptr, value);
+		}
+		value.reset(new int(-1));
+		EXPECT_FALSE(queue.tryPush(value));
+		ASSERT_NE(nullptr, value);
+		EXPECT_EQ(-1, *value);
+
+		for (int i = 0; i < 4; i++)
+		{
+			ASSERT_TRUE(queue.tryPop(value));
+			EXPECT_EQ(lap * 4 + i, *value);
+		}
+		EXPECT_FALSE(queue.tryPop(value));
+	}
+}
+
+TEST(BoundedQueue, CloseLetsConsumersDrainThenStop)
+{
+	BoundedQueue<int> queue(4);
+	for (int i = 0; i < 3; i++)
+	{
+		queue.push(i);
+	}
+	queue.close();
+	EXPECT_TRUE(queue.isClosed());
+
+	int value = -1;
+	for (int i = 0; i < 3; i++)
+	{
+		ASSERT_TRUE(queue.pop(value));
+		EXPECT_EQ(i, value);
+	}
+	EXPECT_FALSE(queue.pop(value));
+	EXPECT_FALSE(queue.pop(value));
+}
+
+TEST(BoundedQueue, PushIntoAFullClosedQueueThrows)
+{
+	BoundedQueue<int> queue(2);
+	for (int i = 0; i < 2; i++)
+	{
+		queue.push(i);
+	}
+	queue.close();
+	int value = 2;
+	EXPECT_THROW(queue.push(value), std::logic_error);
+}
+
+TEST(BoundedQueue, CloseWakesWaitingConsumers)
+{
+	BoundedQueue<int> queue(4);
+	std::atomic<int> stopped{ 0 };
+	std::vector<std::thread> consumers;
+	for (int c = 0; c < 4; c++)
+	{
+		consumers.emplace_back([&]
+		{
+			int value;
+			while (queue.pop(value))
+			{
+			}
+			stopped++;
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT_EQ(0, stopped.load());
+	queue.close();
+	for (std::thread& consumer : consumers)
+	{
+		consumer.join();
+	}
+	EXPECT_EQ(4, stopped.load());
+}
+
+TEST(BoundedQueue, ManyProducersAndConsumersDeliverEveryValueOnce)
+{
+	const int valuesPerProducer = 20000;
+	for (int producers : { 1, 2, 4 })
+	{
+		for (int consumers : { 1, 3 })
+		{
+			SCOPED_TRACE(std::to_string(producers) + " producers, " + std::to_string(consumers) + " consumers");
+
+			// A small queue, so that producers keep waiting on consumers and the ring wraps often
+			BoundedQueue<std::unique_ptr<int>> queue(8);
+			std::vector<std::vector<int>> received(consumers);
+			std::vector<std::thread> threads;
+			for (int c = 0; c < consumers; c++)
+			{
+				threads.emplace_back([&, c]
+				{
+					std::unique_ptr<int> value;
+					while (queue.pop(value))
+					{
+						received[c].push_back(*value);
+					}
+				});
+			}
+
+			std::vector<std::thread> producerThreads;
+			for (int p = 0; p < producers; p++)
+			{
+				producerThreads.emplace_back([&, p]
+				{
+					for (int i = 0; i < valuesPerProducer; i++)
+					{
+						std::unique_ptr<int> value(new int(p * valuesPerProducer + i));
+						queue.push(value);
+					}
+				});
+			}
+			for (std::thread& producer : producerThreads)
+			{
+				producer.join();
+			}
+			queue.close();
+			for (std::thread& consumer : threads)
+			{
+				consumer.join();
+			}
+
+			// Every value once, and each consumer sees the values of a producer in the order pushed
+			std::vector<int> seen(static_cast<size_t>(producers) * valuesPerProducer, 0);
+			for (const std::vector<int>& values : received)
+			{
+				std::vector<int> last(producers, -1);
+				for (int value : values)
+				{
+					ASSERT_GE(value, 0);
+					ASSERT_LT(value, producers * valuesPerProducer);
+					seen[value]++;
+					const int producer = value / valuesPerProducer;
+					ASSERT_GT(value, last[producer]);
+					last[producer] = value;
+				}
+			}
+			EXPECT_TRUE(std::all_of(seen.begin(), seen.end(), [](int count) { return count == 1; }));
+
+			std::unique_ptr<int> value;
+			EXPECT_FALSE(queue.tryPop(value));
+		}
+	}
+}
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include <opencv2/core.hpp>
+#include <boost/math/interpolators/cardinal_cubic_b_spline.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "GradientCalculator.h"
+#include "SyntheticImage.h"
+
+namespace
+{
+	// Boost estimates the end derivatives of its splines while the prefilter mirrors the signal;
+	// the difference decays as (2 - sqrt(3))^d with the distance d to the border and is far below
+	// the tolerance from here on
+	const int borderMargin = 32;
+
+	// Derivative at the knots of the cardinal cubic B-spline through values, as computed before the
+	// recursive prefilter
+	std::vector<double> boostDerivative(const std::vector<double>& values)
+	{
+		boost::math::interpolators::cardinal_cubic_b_spline<double> spline(values.begin(), values.end(), 0.0, 1.0);
+		std::vector<double> derivative(values.size());
+		for (size_t k = 0; k < values.size(); k++)
+		{
+			derivative[k] = spline.prime(static_cast<double>(k));
+		}
+		return derivative;
+	}
+}
+
+TEST(GradientCalculator, SplineFilterMatchesTheBoostSplineAwayFromTheBorders)
+{
+	const cv::Mat image = syntheticImage(cv::Size(150, 97));
+	cv::Mat gradX, gradY;
+	BasicGradientCalculator<double>::cubicSplineInterpolation(image, gradX, gradY);
+	ASSERT_EQ(CV_64FC1, gradX.type());
+	ASSERT_EQ(CV_64FC1, gradY.type());
+	ASSERT_EQ(image.size(), gradX.size());
+	ASSERT_EQ(image.size(), gradY.size());
+
+	double errorX = 0;
+	for (int i = 0; i < image.rows; i++)
+	{
+		std::vector<double> values(image.cols);
+		for (int j = 0; j < image.cols; j++)
+		{
+			values[j] = image.at<uchar>(i, j);
+		}
+		const std::vector<double> expected = boostDerivative(values);
+		for (int j = borderMargin; j < image.cols - borderMargin; j++)
+		{
+			errorX = std::max(errorX, std::abs(gradX.at<double>(i, j) - expected[j]));
+		}
+	}
+
+	double errorY = 0;
+	for (int j = 0; j < image.cols; j++)
+	{
+		std::vector<double> values(image.rows);
+		for (int i = 0; i < image.rows; i++)
+		{
+			values[i] = image.at<uchar>(i, j);
+		}
+		const std::vector<double> expected = boostDerivative(values);
+		for (int i = borderMargin; i < image.rows - borderMargin; i++)
+		{
+			errorY = std::max(errorY, std::abs(gradY.at<double>(i, j) - expected[i]));
+		}
+	}
+
+	EXPECT_LE(errorX, 1e-9);
+	EXPECT_LE(errorY, 1e-9);
+}
+
+TEST(GradientCalculator, SplineDerivativeVanishesOnTheMirroredBorders)
+{
+	const cv::Mat image = syntheticImage(cv::Size(150, 97));
+	cv::Mat gradX, gradY;
+	BasicGradientCalculator<double>::cubicSplineInterpolation(image, gradX, gradY);
+	EXPECT_LE(cv::norm(gradX.col(0), cv::NORM_INF), 1e-9);
+	EXPECT_LE(cv::norm(gradX.col(image.cols - 1), cv::NORM_INF), 1e-9);
+	EXPECT_LE(cv::norm(gradY.row(0), cv::NORM_INF), 1e-9);
+	EXPECT_LE(cv::norm(gradY.row(image.rows - 1), cv::NORM_INF), 1e-9);
+}
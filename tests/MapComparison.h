@@ -0,0 +1,24 @@
+#pragma once
+#include <opencv2/core.hpp>
+
+/**
+ * @brief Largest difference of two maps relative to the largest magnitude of the expected one.
+ */
+inline double relativeError(const cv::Mat& expected, const cv::Mat& actual)
+{
+    return cv::norm(expected, actual, cv::NORM_INF) / cv::norm(expected, cv::NORM_INF);
+}
+
+/**
+ * @brief Largest orientation difference, modulo pi, where the expected coherency is at least 0.1.
+ */
+inline double orientationError(const cv::Mat& expected, const cv::Mat& actual, const cv::Mat& coherency)
+{
+    cv::Mat difference;
+    cv::absdiff(expected, actual, difference);
+    cv::Mat wrapped = CV_PI - difference;
+    cv::min(difference, wrapped, difference);
+    double error = 0;
+    cv::minMaxLoc(difference, nullptr, &error, nullptr, nullptr, coherency >= 0.1);
+    return error;
+}
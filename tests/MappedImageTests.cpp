@@ -0,0 +1,492 @@
+#include <gtest/gtest.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "MappedImage.h"
+
+namespace
+{
+	// Temporary file removed at the end of the test
+	struct TemporaryFile
+	{
+		std::string path;
+
+		explicit TemporaryFile(const char* suffix) : path{ cv::tempfile(suffix) } {}
+		~TemporaryFile() { std::remove(path.c_str()); }
+	};
+
+	bool bigEndianMachine()
+	{
+		const uint16_t probe = 1;
+		uint8_t first;
+		std::memcpy(&first, &probe, 1);
+		return first == 0;
+	}
+
+	// Noise with constant bands, so that PackBits gets both literal and repeated runs
+	cv::Mat testImage(int depth, cv::Size size = cv::Size(61, 47))
+	{
+		cv::Mat image(size, depth);
+		cv::RNG rng(12345);
+		rng.fill(image, cv::RNG::UNIFORM, 0, depth == CV_8U ? 256 : 65536);
+		image.rowRange(10, 14).setTo(depth == CV_8U ? 200 : 51234);
+		image.colRange(30, 40).setTo(7);
+		return image;
+	}
+
+	void expectEqual(const cv::Mat& expected, const cv::Mat& actual)
+	{
+		ASSERT_EQ(expected.size(), actual.size());
+		ASSERT_EQ(expected.type(), actual.type());
+		EXPECT_EQ(0, cv::norm(expected, actual, cv::NORM_INF));
+	}
+
+	// Rectangles inside one block, across blocks, at the corners and the whole image
+	std::vector<cv::Rect> testRects(cv::Size size)
+	{
+		return {
+			cv::Rect(0, 0, size.width, size.height),
+			cv::Rect(0, 0, 1, 1),
+			cv::Rect(size.width - 1, size.height - 1, 1, 1),
+			cv::Rect(2, 1, 5, 3),
+			cv::Rect(3, 5, size.width - 7, size.height - 9),
+			cv::Rect(17, 0, 20, size.height)
+		};
+	}
+
+	// Compares load(), the blocks and read() of a mapped TIFF with the page decoded by cv::imread
+	void expectMatchesImread(const std::string& path)
+	{
+		const cv::Mat expected = cv::imread(path, cv::IMREAD_UNCHANGED);
+		ASSERT_FALSE(expected.empty());
+
+		expectEqual(expected, MappedImage::load(path));
+
+		const MappedImage image = MappedImage::tiff(path);
+		ASSERT_EQ(expected.size(), image.size());
+		const std::vector<cv::Rect> blocks = image.blocks();
+		for (size_t b = 0; b < blocks.size(); b++)
+		{
+			SCOPED_TRACE("block " + std::to_string(b));
+			expectEqual(expected(blocks[b]), image.block(static_cast<int>(b)));
+		}
+		for (const cv::Rect& rect : testRects(expected.size()))
+		{
+			SCOPED_TRACE("rect " + std::to_string(rect.x) + "," + std::to_string(rect.y) + " " +
+				std::to_string(rect.width) + "x" + std::to_string(rect.height));
+			expectEqual(expected(rect), image.read(rect));
+		}
+	}
+
+	/**
+	 * @brief Minimal TIFF writer covering what cv::imwrite cannot choose: the byte order, the
+	 * predictor, PackBits and LZW together with tiles.
+	 */
+	class TiffWriter
+	{
+	public:
+		bool bigEndian = false;
+		int compression = 1;        // 1, 5 (LZW) or 32773 (PackBits)
+		bool predictor = false;     // Horizontal differencing
+		int blockRows = 16;         // Rows per strip, or tile height
+		int tileCols = 0;           // Tile width, 0 for strips
+		int padding = 0;            // Bytes between the header and the first block, to misalign them
+
+		void write(const std::string& path, const cv::Mat& image)
+		{
+			CV_Assert(image.type() == CV_8UC1 || image.type() == CV_16UC1);
+			bytes.clear();
+			put8(bigEndian ? 'M' : 'I');
+			put8(bigEndian ? 'M' : 'I');
+			put16(42);
+			put32(0);   // IFD offset, patched below
+			for (int k = 0; k < padding; k++)
+			{
+				put8(0);
+			}
+
+			const int cols = tileCols > 0 ? tileCols : image.cols;
+			std::vector<uint32_t> offsets;
+			std::vector<uint32_t> counts;
+			for (int y = 0; y < image.rows; y += blockRows)
+			{
+				for (int x = 0; x < image.cols; x += cols)
+				{
+					const int rows = tileCols > 0 ? blockRows : std::min(blockRows, image.rows - y);
+					std::vector<uint8_t> block = compress(storedBlock(image, x, y, cols, rows));
+					offsets.push_back(static_cast<uint32_t>(bytes.size()));
+					counts.push_back(static_cast<uint32_t>(block.size()));
+					bytes.insert(bytes.end(), block.begin(), block.end());
+				}
+			}
+			if (bytes.size() % 2)
+				put8(0);
+
+			struct Entry { uint16_t tag; uint16_t type; std::vector<uint32_t> values; };
+			const uint16_t shortType = 3;
+			const uint16_t longType = 4;
+			std::vector<Entry> entries = {
+				{ 256, longType, { uint32_t(image.cols) } },
+				{ 257, longType, { uint32_t(image.rows) } },
+				{ 258, shortType, { uint32_t(image.elemSize() * 8) } },
+				{ 259, shortType, { uint32_t(compression) } },
+				{ 262, shortType, { 1 } },
+				{ 277, shortType, { 1 } },
+				{ 284, shortType, { 1 } }
+			};
+			if (predictor)
+				entries.push_back({ 317, shortType, { 2 } });
+			if (tileCols > 0)
+			{
+				entries.push_back({ 322, longType, { uint32_t(tileCols) } });
+				entries.push_back({ 323, longType, { uint32_t(blockRows) } });
+				entries.push_back({ 324, longType, offsets });
+				entries.push_back({ 325, longType, counts });
+			}
+			else
+			{
+				entries.push_back({ 273, longType, offsets });
+				entries.push_back({ 278, longType, { uint32_t(blockRows) } });
+				entries.push_back({ 279, longType, counts });
+			}
+			std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.tag < b.tag; });
+
+			// Arrays that do not fit in an entry follow the IFD
+			const size_t ifd = bytes.size();
+			size_t overflow = ifd + 2 + 12 * entries.size() + 4;
+			patch32(4, static_cast<uint32_t>(ifd));
+			put16(static_cast<uint16_t>(entries.size()));
+			for (const Entry& entry : entries)
+			{
+				put16(entry.tag);
+				put16(entry.type);
+				put32(static_cast<uint32_t>(entry.values.size()));
+				const size_t size = entry.type == shortType ? 2 : 4;
+				if (entry.values.size() * size <= 4)
+				{
+					// Left-justified in the value field
+					if (size == 2)
+					{
+						put16(static_cast<uint16_t>(entry.values[0]));
+						put16(entry.values.size() > 1 ? static_cast<uint16_t>(entry.values[1]) : 0);
+					}
+					else
+					{
+						put32(entry.values[0]);
+					}
+				}
+				else
+				{
+					put32(static_cast<uint32_t>(overflow));
+					overflow += entry.values.size() * size;
+				}
+			}
+			put32(0);
+			for (const Entry& entry : entries)
+			{
+				if (entry.type == longType && entry.values.size() > 1)
+				{
+					for (uint32_t value : entry.values)
+					{
+						put32(value);
+					}
+				}
+			}
+
+			std::ofstream out(path, std::ios::binary);
+			out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+			ASSERT_TRUE(out.good());
+		}
+
+	private:
+		std::vector<uint8_t> bytes;
+
+		void put8(int value) { bytes.push_back(static_cast<uint8_t>(value)); }
+
+		void put16(uint16_t value)
+		{
+			put8(bigEndian ? value >> 8 : value & 0xFF);
+			put8(bigEndian ? value & 0xFF : value >> 8);
+		}
+
+		void put32(uint32_t value)
+		{
+			bytes.resize(bytes.size() + 4);
+			patch32(bytes.size() - 4, value);
+		}
+
+		void patch32(size_t at, uint32_t value)
+		{
+			for (int k = 0; k < 4; k++)
+			{
+				bytes[at + k] = static_cast<uint8_t>(value >> (bigEndian ? 24 - 8 * k : 8 * k));
+			}
+		}
+
+		// Samples of a block in the file byte order, padded with zeros outside the image and
+		// differenced along each row when the predictor is on
+		std::vector<uint8_t> storedBlock(const cv::Mat& image, int x0, int y0, int cols, int rows) const
+		{
+			const bool wide = image.depth() == CV_16U;
+			std::vector<uint8_t> stored;
+			for (int y = y0; y < y0 + rows; y++)
+			{
+				uint32_t previous = 0;
+				for (int x = x0; x < x0 + cols; x++)
+				{
+					uint32_t sample = 0;
+					if (y < image.rows && x < image.cols)
+						sample = wide ? image.at<uint16_t>(y, x) : image.at<uint8_t>(y, x);
+					uint32_t value = predictor ? sample - previous : sample;
+					previous = sample;
+					if (!wide)
+					{
+						stored.push_back(static_cast<uint8_t>(value));
+						continue;
+					}
+					stored.push_back(static_cast<uint8_t>(bigEndian ? value >> 8 : value));
+					stored.push_back(static_cast<uint8_t>(bigEndian ? value : value >> 8));
+				}
+			}
+			return stored;
+		}
+
+		std::vector<uint8_t> compress(const std::vector<uint8_t>& data) const
+		{
+			return compression == 5 ? lzw(data) : compression == 32773 ? packBits(data) : data;
+		}
+
+		// Repeated runs of three bytes or more, literal runs otherwise, at most 128 bytes each
+		static std::vector<uint8_t> packBits(const std::vector<uint8_t>& data)
+		{
+			std::vector<uint8_t> packed;
+			size_t at = 0;
+			while (at < data.size())
+			{
+				size_t run = 1;
+				while (at + run < data.size() && run < 128 && data[at + run] == data[at])
+				{
+					run++;
+				}
+				if (run >= 3)
+				{
+					packed.push_back(static_cast<uint8_t>(1 - int(run)));
+					packed.push_back(data[at]);
+					at += run;
+					continue;
+				}
+
+				size_t literal = 0;
+				while (at + literal < data.size() && literal < 128 &&
+					!(at + literal + 2 < data.size() && data[at + literal] == data[at + literal + 1] &&
+						data[at + literal] == data[at + literal + 2]))
+				{
+					literal++;
+				}
+				literal = std::max<size_t>(literal, 1);
+				packed.push_back(static_cast<uint8_t>(literal - 1));
+				packed.insert(packed.end(), data.begin() + at, data.begin() + at + literal);
+				at += literal;
+			}
+			return packed;
+		}
+
+		// Valid TIFF LZW made of single-byte codes: a clear code before the table would grow the
+		// code width keeps every code at 9 bits
+		static std::vector<uint8_t> lzw(const std::vector<uint8_t>& data)
+		{
+			std::vector<uint8_t> packed;
+			uint32_t buffer = 0;
+			int bits = 0;
+			auto code = [&](int value)
+			{
+				buffer = buffer << 9 | static_cast<uint32_t>(value);
+				bits += 9;
+				while (bits >= 8)
+				{
+					packed.push_back(static_cast<uint8_t>(buffer >> (bits - 8)));
+					bits -= 8;
+				}
+			};
+
+			for (size_t at = 0; at < data.size(); at++)
+			{
+				if (at % 250 == 0)
+					code(256);
+				code(data[at]);
+			}
+			code(257);
+			if (bits > 0)
+				packed.push_back(static_cast<uint8_t>(buffer << (8 - bits)));
+			return packed;
+		}
+	};
+
+	struct Layout
+	{
+		bool bigEndian;
+		int compression;
+		bool predictor;
+		int tileCols;
+	};
+
+	std::string name(const Layout& layout, int depth)
+	{
+		return std::string(layout.bigEndian ? "MM" : "II") + " compression " + std::to_string(layout.compression) +
+			(layout.predictor ? " predictor" : "") + (layout.tileCols ? " tiled" : "") +
+			(depth == CV_8U ? " 8-bit" : " 16-bit");
+	}
+
+	const std::vector<Layout> layouts = {
+		{ false, 1, false, 0 }, { true, 1, false, 0 },
+		{ false, 32773, false, 0 }, { true, 32773, false, 0 },
+		{ false, 5, false, 0 }, { true, 5, false, 0 },
+		{ false, 5, true, 0 }, { true, 5, true, 0 },
+		{ false, 1, false, 16 }, { true, 1, false, 16 },
+		{ false, 5, true, 16 }, { true, 32773, false, 16 }
+	};
+}
+
+TEST(MappedImage, MatchesImreadForImwriteCompressions)
+{
+	for (int depth : { CV_8U, CV_16U })
+	{
+		for (int compression : { 1, 5, 32773 })
+		{
+			SCOPED_TRACE("compression " + std::to_string(compression) + (depth == CV_8U ? " 8-bit" : " 16-bit"));
+			TemporaryFile file(".tif");
+			const cv::Mat image = testImage(depth);
+			ASSERT_TRUE(cv::imwrite(file.path, image, { cv::IMWRITE_TIFF_COMPRESSION, compression }));
+			expectEqual(image, cv::imread(file.path, cv::IMREAD_UNCHANGED));
+			expectMatchesImread(file.path);
+		}
+	}
+}
+
+TEST(MappedImage, MatchesImreadForByteOrdersPredictorAndTiles)
+{
+	for (int depth : { CV_8U, CV_16U })
+	{
+		for (const Layout& layout : layouts)
+		{
+			SCOPED_TRACE(name(layout, depth));
+			TemporaryFile file(".tif");
+			TiffWriter writer;
+			writer.bigEndian = layout.bigEndian;
+			writer.compression = layout.compression;
+			writer.predictor = layout.predictor;
+			writer.tileCols = layout.tileCols;
+			const cv::Mat image = testImage(depth);
+			writer.write(file.path, image);
+			expectEqual(image, cv::imread(file.path, cv::IMREAD_UNCHANGED));
+			expectMatchesImread(file.path);
+		}
+	}
+}
+
+TEST(MappedImage, UncompressedNativeStripsAreOneView)
+{
+	for (int depth : { CV_8U, CV_16U })
+	{
+		TemporaryFile file(".tif");
+		TiffWriter writer;
+		writer.bigEndian = bigEndianMachine();
+		const cv::Mat image = testImage(depth);
+		writer.write(file.path, image);
+
+		cv::Mat view;
+		{
+			const MappedImage mapped = MappedImage::tiff(file.path);
+			EXPECT_TRUE(mapped.isContiguous());
+			view = mapped.image();
+		}
+		// The view keeps the mapping alive after the MappedImage is gone
+		expectEqual(image, view);
+	}
+}
+
+TEST(MappedImage, RawFrames)
+{
+	for (int depth : { CV_8U, CV_16U })
+	{
+		TemporaryFile file(".raw");
+		const cv::Mat image = testImage(depth);
+		const std::string header(100, 'h');
+		{
+			std::ofstream out(file.path, std::ios::binary);
+			out.write(header.data(), static_cast<std::streamsize>(header.size()));
+			out.write(reinterpret_cast<const char*>(image.data), static_cast<std::streamsize>(image.total() * image.elemSize()));
+		}
+
+		const MappedImage mapped = MappedImage::raw(file.path, image.size(), depth, header.size());
+		EXPECT_TRUE(mapped.isContiguous());
+		expectEqual(image, mapped.image());
+		for (const cv::Rect& rect : testRects(image.size()))
+		{
+			expectEqual(image(rect), mapped.read(rect));
+		}
+		EXPECT_THROW(MappedImage::raw(file.path, image.size() + cv::Size(0, 1), depth, header.size()), std::runtime_error);
+	}
+}
+
+TEST(MappedImage, MisalignedSamplesAreDecoded)
+{
+	const cv::Mat image = testImage(CV_16U);
+
+	// A raw frame behind an odd header
+	{
+		TemporaryFile file(".raw");
+		const std::string header(101, 'h');
+		{
+			std::ofstream out(file.path, std::ios::binary);
+			out.write(header.data(), static_cast<std::streamsize>(header.size()));
+			out.write(reinterpret_cast<const char*>(image.data), static_cast<std::streamsize>(image.total() * image.elemSize()));
+		}
+		const MappedImage mapped = MappedImage::raw(file.path, image.size(), CV_16U, header.size());
+		EXPECT_FALSE(mapped.isMapped(0));
+		EXPECT_FALSE(mapped.isContiguous());
+		expectEqual(image, mapped.image());
+		for (const cv::Rect& rect : testRects(image.size()))
+		{
+			expectEqual(image(rect), mapped.read(rect));
+		}
+	}
+
+	// Uncompressed native strips and tiles at odd offsets
+	for (int tileCols : { 0, 16 })
+	{
+		SCOPED_TRACE(tileCols ? "tiles" : "strips");
+		TemporaryFile file(".tif");
+		TiffWriter writer;
+		writer.bigEndian = bigEndianMachine();
+		writer.tileCols = tileCols;
+		writer.padding = 1;
+		writer.write(file.path, image);
+
+		const MappedImage mapped = MappedImage::tiff(file.path);
+		for (int k = 0; k < static_cast<int>(mapped.blocks().size()); k++)
+		{
+			EXPECT_FALSE(mapped.isMapped(k));
+		}
+		expectEqual(image, mapped.image());
+		for (const cv::Rect& rect : testRects(image.size()))
+		{
+			expectEqual(image(rect), mapped.read(rect));
+		}
+	}
+}
+
+TEST(MappedImage, RejectsRectanglesOutsideTheImage)
+{
+	TemporaryFile file(".tif");
+	ASSERT_TRUE(cv::imwrite(file.path, testImage(CV_8U)));
+	const MappedImage mapped = MappedImage::tiff(file.path);
+	EXPECT_THROW(mapped.read(cv::Rect(-1, 0, 4, 4)), std::invalid_argument);
+	EXPECT_THROW(mapped.read(cv::Rect(0, 0, mapped.size().width + 1, 1)), std::invalid_argument);
+}
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include "RecursiveGaussian.h"
+
+namespace
+{
+	// Bounds documented in RecursiveGaussian.h
+	struct Bound
+	{
+		double sigma;
+		double sumError;
+		double maxError;    // Fraction of the peak of the sampled Gaussian
+	};
+
+	const Bound bounds[] = {
+		{ 2, 0.029, 0.021 },
+		{ 4, 0.022, 0.012 },
+		{ 8, 0.021, 0.011 }
+	};
+
+	const int length = 401;
+
+	// Impulse response along the rows, read from a few identical rows so that the vertical
+	// passes see a constant column
+	cv::Mat impulseResponse(RecursiveGaussian& filter, bool alongColumns)
+	{
+		cv::Mat image(5, length, CV_64F, cv::Scalar(0));
+		image.col(length / 2).setTo(1);
+		if (alongColumns)
+			image = image.t();
+
+		cv::Mat smoothed;
+		filter.apply(image, smoothed);
+		if (alongColumns)
+			smoothed = smoothed.t();
+		return smoothed;
+	}
+}
+
+TEST(RecursiveGaussian, ImpulseResponseStaysWithinTheDocumentedBounds)
+{
+	for (const Bound& bound : bounds)
+	{
+		// Kernel cv::GaussianBlur samples for floating-point images
+		const int ksize = cvRound(bound.sigma * 8 + 1) | 1;
+		const cv::Mat kernel = cv::getGaussianKernel(ksize, bound.sigma, CV_64F);
+		double peak = 0;
+		cv::minMaxLoc(kernel, nullptr, &peak);
+
+		cv::Mat sampled(1, length, CV_64F, cv::Scalar(0));
+		kernel.reshape(1, 1).copyTo(sampled.colRange(length / 2 - ksize / 2, length / 2 + ksize / 2 + 1));
+
+		RecursiveGaussian filter(bound.sigma);
+		for (bool alongColumns : { false, true })
+		{
+			SCOPED_TRACE("sigma " + std::to_string(bound.sigma) + (alongColumns ? " along columns" : " along rows"));
+			const cv::Mat response = impulseResponse(filter, alongColumns);
+			for (int row = 0; row < response.rows; row++)
+			{
+				EXPECT_LE(cv::norm(response.row(row), sampled, cv::NORM_L1), bound.sumError);
+				EXPECT_LE(cv::norm(response.row(row), sampled, cv::NORM_INF), bound.maxError * peak);
+			}
+		}
+	}
+}
+
+TEST(RecursiveGaussian, ConstantImagesKeepTheirValue)
+{
+	// The replicated borders and the Triggs-Sdika initialisation leave a constant unchanged, up to
+	// the edges of the image
+	for (int depth : { CV_32F, CV_64F })
+	{
+		for (double sigma : { 2.0, 5.5, 30.0 })
+		{
+			SCOPED_TRACE(std::string(depth == CV_32F ? "float" : "double") + " sigma " + std::to_string(sigma));
+			const cv::Mat image(37, 53, depth, cv::Scalar(3.5));
+			RecursiveGaussian filter(sigma);
+			cv::Mat smoothed;
+			filter.apply(image, smoothed);
+			ASSERT_EQ(image.type(), smoothed.type());
+			EXPECT_LE(cv::norm(smoothed, image, cv::NORM_INF), 3.5 * (depth == CV_32F ? 1e-5 : 1e-12));
+		}
+	}
+}
+
+TEST(RecursiveGaussian, RejectsSigmasBelowItsRange)
+{
+	EXPECT_THROW(RecursiveGaussian(1.5), std::invalid_argument);
+}
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+#include <opencv2/core.hpp>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ReducedPrecision.h"
+#include "StructureTensorAnalysis.h"
+
+namespace
+{
+	using STORAGE = ReducedPrecision::STORAGE;
+	using GRADIENT_METHOD = StructureTensorAnalysis::GRADIENT_METHOD;
+
+	// Vertical step edge from 0 to the full range of the depth
+	cv::Mat stepImage(int depth)
+	{
+		cv::Mat image(48, 64, depth, cv::Scalar(0));
+		image.colRange(32, 64).setTo(depth == CV_8U ? 255 : 65535);
+		return image;
+	}
+
+	// Values from 1e-3 to 1e9 with both signs, far beyond the half float range
+	std::vector<float> wideRow()
+	{
+		std::vector<float> row;
+		for (int k = 0; k < 97; k++)
+		{
+			const float magnitude = std::pow(10.0f, -3.0f + 12.0f * k / 96);
+			row.push_back(k % 2 ? -magnitude : magnitude);
+		}
+		return row;
+	}
+}
+
+TEST(ReducedPrecision, Float16RowsDoNotOverflow)
+{
+	const std::vector<float> row = wideRow();
+	const int n = static_cast<int>(row.size());
+	std::vector<uint16_t> stored(n);
+	std::vector<float> decoded(n);
+	const float scale = ReducedPrecision::encodeRow(row.data(), n, STORAGE::FLOAT16, stored.data());
+	ReducedPrecision::decodeRow(stored.data(), n, STORAGE::FLOAT16, scale, decoded.data());
+
+	// Relative error of 2^-11 down to 2^-28 of the row peak, absolute error of 2^-39 of it below
+	const double peak = 1e9;
+	for (int j = 0; j < n; j++)
+	{
+		ASSERT_TRUE(std::isfinite(decoded[j]));
+		const double bound = std::max(std::abs(row[j]) * std::ldexp(1.0, -11), peak * std::ldexp(1.0, -39));
+		EXPECT_LE(std::abs(decoded[j] - row[j]), bound * (1 + 1e-6)) << "value " << row[j];
+	}
+}
+
+TEST(ReducedPrecision, Int16RowsStayWithinTheRowBound)
+{
+	const std::vector<float> row = wideRow();
+	const int n = static_cast<int>(row.size());
+	std::vector<int16_t> stored(n);
+	std::vector<float> decoded(n);
+	const float scale = ReducedPrecision::encodeRow(row.data(), n, STORAGE::INT16, stored.data());
+	ReducedPrecision::decodeRow(stored.data(), n, STORAGE::INT16, scale, decoded.data());
+	for (int j = 0; j < n; j++)
+	{
+		// Plus the float rounding of the scale
+		EXPECT_LE(std::abs(decoded[j] - row[j]), 1e9 / 65534 * (1 + 1e-3)) << "value " << row[j];
+	}
+}
+
+TEST(ReducedPrecision, ZeroRowsDecodeToZero)
+{
+	const std::vector<float> row(16, 0.0f);
+	std::vector<uint16_t> stored(16, 0xFFFF);
+	std::vector<float> decoded(16, 1.0f);
+	for (STORAGE storage : { STORAGE::FLOAT16, STORAGE::INT16 })
+	{
+		const float scale = ReducedPrecision::encodeRow(row.data(), 16, storage, stored.data());
+		ReducedPrecision::decodeRow(stored.data(), 16, storage, scale, decoded.data());
+		for (float value : decoded)
+		{
+			EXPECT_EQ(0.0f, value);
+		}
+	}
+}
+
+TEST(ReducedPrecision, FullContrastStepsStayFinite)
+{
+	for (int depth : { CV_8U, CV_16U })
+	{
+		const cv::Mat image = stepImage(depth);
+		for (GRADIENT_METHOD method : { GRADIENT_METHOD::GAUSSIAN, GRADIENT_METHOD::FINITE_DIFFERENCE })
+		{
+			for (STORAGE storage : { STORAGE::FLOAT16, STORAGE::INT16 })
+			{
+				SCOPED_TRACE(std::string(depth == CV_8U ? "8-bit " : "16-bit ") + StructureTensorAnalysis::methodName(method) +
+					" " + ReducedPrecision::name(storage));
+
+				StructureTensorAnalysis analysis(image, method);
+				analysis.setStorage(storage);
+				EXPECT_TRUE(cv::checkRange(analysis.getEnegry()));
+				EXPECT_TRUE(cv::checkRange(analysis.getOrientation()));
+				EXPECT_TRUE(cv::checkRange(analysis.getCoherency()));
+
+				const StructureTensorAnalysis::PrecisionReport report =
+					StructureTensorAnalysis::comparePrecision(image, method, 2, storage);
+				for (double error : { report.energyMaxError, report.energyMeanError, report.orientationMaxError,
+					report.orientationMeanError, report.coherencyMaxError, report.coherencyMeanError })
+				{
+					EXPECT_TRUE(std::isfinite(error));
+				}
+
+				// Every tensor component is a sum of products of stored values, each within 2^-11
+				// of its own magnitude for FLOAT16 and within 2^-15 of its row peak for INT16
+				EXPECT_LE(report.energyMaxError, 4 * std::ldexp(1.0, -11));
+				// The edge is vertical, so the gradients along y and the orientation are exactly 0
+				EXPECT_LE(report.orientationMaxError, 1e-3);
+			}
+		}
+	}
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "SpectralGradient.h"
+
+namespace
+{
+	using KIND = SpectralGradient::KIND;
+
+	// Sizes of the image and whole periods of its sinusoids along x and y
+	struct Case
+	{
+		int cols;
+		int rows;
+		int periodsX;
+		int periodsY;
+	};
+
+	const double offset = 128;
+	const double amplitudeX = 60;
+	const double amplitudeY = 40;
+
+	// offset + ax sin(2 pi px x / cols) + ay cos(2 pi py y / rows), exactly periodic over the image
+	// along y, and along x when the sinusoid along x is present
+	cv::Mat sinusoid(const Case& c)
+	{
+		cv::Mat image(c.rows, c.cols, CV_32F);
+		for (int y = 0; y < c.rows; y++)
+		{
+			for (int x = 0; x < c.cols; x++)
+			{
+				image.at<float>(y, x) = static_cast<float>(offset +
+					amplitudeX * std::sin(2 * CV_PI * c.periodsX * x / c.cols) +
+					amplitudeY * std::cos(2 * CV_PI * c.periodsY * y / c.rows));
+			}
+		}
+		return image;
+	}
+
+	// Factor of the analytic derivative: 2 pi f for FOURIER, f / |f| (with the regularization of
+	// the plan) for RIESZ
+	double gain(KIND kind, int periods, int size)
+	{
+		const double f = static_cast<double>(periods) / size;
+		return kind == KIND::FOURIER ? 2 * CV_PI * f : f / std::sqrt(f * f + 1e-5);
+	}
+}
+
+TEST(SpectralGradient, SinusoidsMatchTheAnalyticDerivative)
+{
+	// Even and odd padded sizes; 1100 columns are padded to 1125 by reflection, which keeps the
+	// image periodic as long as it is constant along x
+	const std::vector<Case> cases = {
+		{ 1000, 64, 40, 5 },
+		{ 1125, 75, 40, 7 },
+		{ 1100, 75, 0, 7 },
+		{ 1100, 64, 0, 5 }
+	};
+	ASSERT_EQ(1125, cv::getOptimalDFTSize(1100));
+
+	for (const Case& c : cases)
+	{
+		const cv::Mat image = sinusoid(c);
+		for (KIND kind : { KIND::FOURIER, KIND::RIESZ })
+		{
+			SCOPED_TRACE(std::to_string(c.cols) + "x" + std::to_string(c.rows) +
+				(kind == KIND::FOURIER ? " FOURIER" : " RIESZ"));
+
+			SpectralGradient engine;
+			cv::Mat gradX, gradY;
+			engine.compute(image, kind, gradX, gradY);
+			ASSERT_EQ(image.size(), gradX.size());
+			ASSERT_EQ(image.size(), gradY.size());
+
+			const double gainX = gain(kind, c.periodsX, c.cols);
+			const double gainY = gain(kind, c.periodsY, c.rows);
+			// Float rounding of the transforms, far below the amplitude of either derivative
+			const double tolerance = 1e-3 * std::max(amplitudeX * gainX, amplitudeY * gainY);
+			double errorX = 0, errorY = 0;
+			for (int y = 0; y < c.rows; y++)
+			{
+				for (int x = 0; x < c.cols; x++)
+				{
+					const double expectedX = amplitudeX * gainX * std::cos(2 * CV_PI * c.periodsX * x / c.cols);
+					const double expectedY = -amplitudeY * gainY * std::sin(2 * CV_PI * c.periodsY * y / c.rows);
+					errorX = std::max(errorX, std::abs(gradX.at<float>(y, x) - expectedX));
+					errorY = std::max(errorY, std::abs(gradY.at<float>(y, x) - expectedY));
+				}
+			}
+			EXPECT_LE(errorX, tolerance);
+			EXPECT_LE(errorY, tolerance);
+		}
+	}
+}
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <string>
+#include "MapComparison.h"
+#include "StructureTensorAnalysis.h"
+#include "SyntheticImage.h"
+
+namespace
+{
+	using GRADIENT_METHOD = StructureTensorAnalysis::GRADIENT_METHOD;
+
+	const cv::Size imageSize(150, 97);
+
+	const GRADIENT_METHOD allMethods[] = {
+		GRADIENT_METHOD::CUBIC_SPLINE,
+		GRADIENT_METHOD::FINITE_DIFFERENCE,
+		GRADIENT_METHOD::FOURIER,
+		GRADIENT_METHOD::RIESZ,
+		GRADIENT_METHOD::GAUSSIAN,
+		GRADIENT_METHOD::HESSIAN
+	};
+
+	// Outputs of the chain the fused kernel replaced: products, cv::GaussianBlur and whole-image
+	// eigen-analysis
+	struct Baseline
+	{
+		cv::Mat ixx, iyy, ixy;
+		cv::Mat energy, orientation, coherency;
+
+		Baseline(const cv::Mat& gradX, const cv::Mat& gradY, int windowSize)
+		{
+			cv::Mat xx, yy, xy;
+			cv::multiply(gradX, gradX, xx);
+			cv::multiply(gradY, gradY, yy);
+			cv::multiply(gradX, gradY, xy);
+			cv::GaussianBlur(xx, ixx, cv::Size(0, 0), windowSize, windowSize);
+			cv::GaussianBlur(yy, iyy, cv::Size(0, 0), windowSize, windowSize);
+			cv::GaussianBlur(xy, ixy, cv::Size(0, 0), windowSize, windowSize);
+
+			energy = ixx + iyy;
+			cv::phase(2 * ixy, ixx - iyy, orientation);
+			orientation *= 0.5;
+
+			cv::Mat difference = ixx - iyy;
+			cv::Mat root;
+			cv::sqrt(difference.mul(difference) + 4 * ixy.mul(ixy), root);
+			cv::divide(2 * root, 2 * energy + 1e-5, coherency);
+		}
+	};
+
+	void expectIdentical(const cv::Mat& expected, const cv::Mat& actual)
+	{
+		ASSERT_EQ(expected.size(), actual.size());
+		ASSERT_EQ(expected.type(), actual.type());
+		EXPECT_EQ(0, cv::norm(expected, actual, cv::NORM_INF));
+	}
+}
+
+TEST(StructureTensorAnalysis, FusedKernelMatchesTheSeparateChain)
+{
+	const cv::Mat image = syntheticImage(imageSize);
+	for (GRADIENT_METHOD method : { GRADIENT_METHOD::FINITE_DIFFERENCE, GRADIENT_METHOD::GAUSSIAN,
+		GRADIENT_METHOD::HESSIAN, GRADIENT_METHOD::CUBIC_SPLINE })
+	{
+		for (int windowSize : { 2, 5 })
+		{
+			SCOPED_TRACE(std::string(StructureTensorAnalysis::methodName(method)) + " window " + std::to_string(windowSize));
+			StructureTensorAnalysis analysis(image, method, windowSize, 1,
+				StructureTensorAnalysis::OUTPUT_ALL | StructureTensorAnalysis::OUTPUT_TENSOR);
+			const Baseline baseline(analysis.getGradX(), analysis.getGradY(), windowSize);
+
+			// Only the order of the float sums differs
+			EXPECT_LE(relativeError(baseline.ixx, analysis.getTensorXX()), 1e-5);
+			EXPECT_LE(relativeError(baseline.iyy, analysis.getTensorYY()), 1e-5);
+			EXPECT_LE(relativeError(baseline.ixy, analysis.getTensorXY()), 1e-5);
+			EXPECT_LE(relativeError(baseline.energy, analysis.getEnegry()), 1e-5);
+			EXPECT_LE(cv::norm(baseline.coherency, analysis.getCoherency(), cv::NORM_INF), 1e-4);
+			EXPECT_LE(orientationError(baseline.orientation, analysis.getOrientation(), baseline.coherency), 1e-3);
+		}
+	}
+}
+
+TEST(StructureTensorAnalysis, BandsMatchTheSerialPathBitForBit)
+{
+	// Tall enough for several bands of the largest window below
+	const cv::Mat image = syntheticImage(cv::Size(203, 331));
+	const int outputs = StructureTensorAnalysis::OUTPUT_ALL | StructureTensorAnalysis::OUTPUT_TENSOR;
+	for (GRADIENT_METHOD method : allMethods)
+	{
+		for (StructureTensorAnalysis::WINDOW_METHOD window : { StructureTensorAnalysis::WINDOW_METHOD::GAUSSIAN,
+			StructureTensorAnalysis::WINDOW_METHOD::RECURSIVE })
+		{
+			for (int windowSize : { 2, 5 })
+			{
+				StructureTensorAnalysis serial(image, method, windowSize, 1, outputs);
+				serial.setWindowMethod(window);
+				for (int threads : { 2, 3, 8 })
+				{
+					SCOPED_TRACE(std::string(StructureTensorAnalysis::methodName(method)) +
+						(window == StructureTensorAnalysis::WINDOW_METHOD::GAUSSIAN ? " gaussian" : " recursive") +
+						" window " + std::to_string(windowSize) + ", " + std::to_string(threads) + " threads");
+					StructureTensorAnalysis parallel(image, method, windowSize, threads, outputs);
+					parallel.setWindowMethod(window);
+					expectIdentical(serial.getGradX(), parallel.getGradX());
+					expectIdentical(serial.getGradY(), parallel.getGradY());
+					expectIdentical(serial.getTensorXX(), parallel.getTensorXX());
+					expectIdentical(serial.getTensorYY(), parallel.getTensorYY());
+					expectIdentical(serial.getTensorXY(), parallel.getTensorXY());
+					expectIdentical(serial.getEnegry(), parallel.getEnegry());
+					expectIdentical(serial.getOrientation(), parallel.getOrientation());
+					expectIdentical(serial.getCoherency(), parallel.getCoherency());
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+#include <opencv2/core.hpp>
+#include <stdexcept>
+#include <string>
+#include "MapComparison.h"
+#include "StructureTensorPyramid.h"
+#include "SyntheticImage.h"
+
+namespace
+{
+	using GRADIENT_METHOD = StructureTensorPyramid::GRADIENT_METHOD;
+}
+
+TEST(StructureTensorPyramid, FinestScaleMatchesTheAnalysis)
+{
+	const cv::Mat image = syntheticImage(cv::Size(150, 97));
+	const int outputs = StructureTensorAnalysis::OUTPUT_ALL | StructureTensorAnalysis::OUTPUT_TENSOR;
+	for (GRADIENT_METHOD method : { GRADIENT_METHOD::CUBIC_SPLINE, GRADIENT_METHOD::FINITE_DIFFERENCE,
+		GRADIENT_METHOD::FOURIER, GRADIENT_METHOD::RIESZ, GRADIENT_METHOD::GAUSSIAN })
+	{
+		SCOPED_TRACE(StructureTensorAnalysis::methodName(method));
+
+		// Out of order, so that the finest scale is not the first one
+		StructureTensorPyramid pyramid({ 8, 2, 4 }, method);
+		pyramid.compute(image);
+		ASSERT_EQ(3, pyramid.size());
+		const StructureTensorPyramid::Scale& finest = pyramid.scale(1);
+		EXPECT_EQ(2, finest.sigma);
+		EXPECT_EQ(0, finest.level);
+
+		// The stencil methods evaluate their gradients inside the analysis' kernel, which agrees
+		// with the gradient images of the pyramid up to rounding
+		StructureTensorAnalysis analysis(image, method, 2, 1, outputs);
+		EXPECT_LE(relativeError(analysis.getTensorXX(), finest.ixx), 1e-5);
+		EXPECT_LE(relativeError(analysis.getTensorYY(), finest.iyy), 1e-5);
+		EXPECT_LE(relativeError(analysis.getTensorXY(), finest.ixy), 1e-5);
+		EXPECT_LE(relativeError(analysis.getEnegry(), finest.energy), 1e-5);
+		EXPECT_LE(cv::norm(analysis.getCoherency(), finest.coherency, cv::NORM_INF), 1e-3);
+		EXPECT_LE(orientationError(analysis.getOrientation(), finest.orientation, analysis.getCoherency()), 1e-3);
+	}
+}
+
+TEST(StructureTensorPyramid, SelectsTheMostCoherentScale)
+{
+	const cv::Mat image = syntheticImage(cv::Size(150, 97));
+	StructureTensorPyramid pyramid({ 2, 6, 12 }, GRADIENT_METHOD::GAUSSIAN);
+	cv::Mat energy, orientation, coherency, scaleIndex;
+	EXPECT_THROW(pyramid.selectScale(energy, orientation, coherency, scaleIndex), std::logic_error);
+
+	pyramid.compute(image);
+	pyramid.selectScale(energy, orientation, coherency, scaleIndex);
+	for (int y = 0; y < image.rows; y++)
+	{
+		for (int x = 0; x < image.cols; x++)
+		{
+			const int s = scaleIndex.at<uchar>(y, x);
+			ASSERT_LT(s, pyramid.size());
+			const StructureTensorPyramid::Scale& selected = pyramid.scale(s);
+			ASSERT_EQ(selected.coherency.at<float>(y, x), coherency.at<float>(y, x));
+			ASSERT_EQ(selected.energy.at<float>(y, x), energy.at<float>(y, x));
+			ASSERT_EQ(selected.orientation.at<float>(y, x), orientation.at<float>(y, x));
+			for (int other = 0; other < pyramid.size(); other++)
+			{
+				ASSERT_LE(pyramid.scale(other).coherency.at<float>(y, x), coherency.at<float>(y, x));
+			}
+		}
+	}
+}
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "StructureTensorStream.h"
+#include "SyntheticImage.h"
+
+namespace
+{
+	using GRADIENT_METHOD = StructureTensorStream::GRADIENT_METHOD;
+
+	// Ways of feeding the image to the stream
+	enum class FEED {
+		ROWS,       // pushRow() one row at a time
+		BLOCKS,     // pushRows() with blocks of uneven height
+		SOURCE      // pullRows() from a row source
+	};
+
+	// Output maps assembled from the rows the sink receives
+	struct Collected
+	{
+		cv::Mat energy, orientation, coherency;
+		int nextRow = 0;
+		bool inOrder = true;
+
+		explicit Collected(cv::Size size) :
+			energy{ size, CV_32F, cv::Scalar(-1) },
+			orientation{ size, CV_32F, cv::Scalar(-1) },
+			coherency{ size, CV_32F, cv::Scalar(-1) }
+		{
+		}
+
+		StructureTensorStream::RowSink sink()
+		{
+			return [this](int row, const cv::Mat& e, const cv::Mat& o, const cv::Mat& c)
+			{
+				inOrder = inOrder && row == nextRow;
+				nextRow = row + 1;
+				e.copyTo(energy.row(row));
+				o.copyTo(orientation.row(row));
+				c.copyTo(coherency.row(row));
+			};
+		}
+	};
+
+	void feed(StructureTensorStream& stream, const cv::Mat& image, FEED how)
+	{
+		switch (how)
+		{
+		case FEED::ROWS:
+			for (int i = 0; i < image.rows; i++)
+			{
+				stream.pushRow(image.row(i));
+			}
+			break;
+
+		case FEED::BLOCKS:
+			for (int i = 0, block = 1; i < image.rows; i += block, block = block % 13 + 4)
+			{
+				stream.pushRows(image.rowRange(i, std::min(image.rows, i + block)));
+			}
+			break;
+
+		case FEED::SOURCE:
+		{
+			int next = 0;
+			EXPECT_TRUE(stream.pullRows([&](cv::Mat& row)
+			{
+				if (next == image.rows)
+					return false;
+				row = image.row(next++);
+				return true;
+			}));
+			break;
+		}
+		}
+	}
+
+	void expectIdentical(const cv::Mat& expected, const cv::Mat& actual)
+	{
+		ASSERT_EQ(expected.size(), actual.size());
+		ASSERT_EQ(expected.type(), actual.type());
+		EXPECT_EQ(0, cv::norm(expected, actual, cv::NORM_INF));
+	}
+}
+
+TEST(StructureTensorStream, MatchesTheWholeImageAnalysis)
+{
+	const cv::Mat image = syntheticImage(cv::Size(150, 97));
+	for (GRADIENT_METHOD method : { GRADIENT_METHOD::FINITE_DIFFERENCE, GRADIENT_METHOD::GAUSSIAN,
+		GRADIENT_METHOD::HESSIAN })
+	{
+		for (int windowSize : { 2, 5 })
+		{
+			StructureTensorAnalysis analysis(image, method, windowSize);
+			for (FEED how : { FEED::ROWS, FEED::BLOCKS, FEED::SOURCE })
+			{
+				SCOPED_TRACE(std::string(StructureTensorAnalysis::methodName(method)) + " window " +
+					std::to_string(windowSize) + " feed " + std::to_string(static_cast<int>(how)));
+
+				Collected collected(image.size());
+				StructureTensorStream stream(image.size(), image.type(), method, windowSize, collected.sink());
+				feed(stream, image, how);
+
+				EXPECT_TRUE(stream.finished());
+				EXPECT_EQ(image.rows, stream.rowsPushed());
+				EXPECT_EQ(image.rows, stream.rowsEmitted());
+				EXPECT_TRUE(collected.inOrder);
+				EXPECT_EQ(image.rows, collected.nextRow);
+
+				expectIdentical(analysis.getEnegry(), collected.energy);
+				expectIdentical(analysis.getOrientation(), collected.orientation);
+				expectIdentical(analysis.getCoherency(), collected.coherency);
+			}
+		}
+	}
+}
+
+TEST(StructureTensorStream, RejectsWholeImageMethodsAndExtraRows)
+{
+	const StructureTensorStream::RowSink ignore = [](int, const cv::Mat&, const cv::Mat&, const cv::Mat&) {};
+	for (GRADIENT_METHOD method : { GRADIENT_METHOD::CUBIC_SPLINE, GRADIENT_METHOD::FOURIER, GRADIENT_METHOD::RIESZ })
+	{
+		EXPECT_THROW(StructureTensorStream(cv::Size(64, 64), CV_8UC1, method, 2, ignore), std::invalid_argument);
+	}
+
+	const cv::Mat image = syntheticImage(cv::Size(64, 40));
+	StructureTensorStream stream(image.size(), image.type(), GRADIENT_METHOD::GAUSSIAN, 2, ignore);
+	EXPECT_THROW(stream.pushRow(image.row(0).colRange(0, 63)), std::invalid_argument);
+	stream.pushRows(image);
+	EXPECT_TRUE(stream.finished());
+	EXPECT_THROW(stream.pushRow(image.row(0)), std::logic_error);
+}
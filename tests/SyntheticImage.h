@@ -0,0 +1,29 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cmath>
+
+/**
+ * @brief 8-bit image of fibres whose orientation and period drift across the image, with noise.
+ *
+ * Every pixel has some texture, so the coherency and the orientation are well defined everywhere,
+ * and the size need not be a multiple of anything the analysis splits the image by.
+ */
+inline cv::Mat syntheticImage(cv::Size size, uint64 seed = 12345)
+{
+    cv::Mat image(size, CV_8U);
+    cv::RNG rng(seed);
+    const double scale = std::max(size.width, size.height);
+    for (int i = 0; i < size.height; i++)
+    {
+        uchar* row = image.ptr<uchar>(i);
+        for (int j = 0; j < size.width; j++)
+        {
+            double angle = CV_PI * (i + j) / (2.0 * scale);
+            double u = j * std::cos(angle) + i * std::sin(angle);
+            double value = 128 + 80 * std::sin(u / (3 + 5.0 * i / scale));
+            row[j] = cv::saturate_cast<uchar>(value + rng.gaussian(10));
+        }
+    }
+    return image;
+}
@@ -0,0 +1,234 @@
+#include <gtest/gtest.h>
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "TensorFieldFile.h"
+
+namespace
+{
+	// Temporary file removed at the end of the test
+	struct TemporaryFile
+	{
+		std::string path;
+
+		explicit TemporaryFile(const char* suffix) : path{ cv::tempfile(suffix) } {}
+		~TemporaryFile() { std::remove(path.c_str()); }
+	};
+
+	const cv::Size mapSize(53, 37);
+	const int stripRows = 16;
+
+	// Maps spanning several orders of magnitude and both signs, one of them in double
+	std::vector<TensorFieldFile::Channel> testChannels()
+	{
+		cv::RNG rng(2024);
+		cv::Mat energy(mapSize, CV_32F);
+		rng.fill(energy, cv::RNG::UNIFORM, 0.5, 1000.0);
+		cv::Mat orientation(mapSize, CV_64F);
+		rng.fill(orientation, cv::RNG::UNIFORM, -CV_PI / 2, CV_PI / 2);
+		cv::Mat coherency(mapSize, CV_32F);
+		rng.fill(coherency, cv::RNG::UNIFORM, 0.0, 1.0);
+		coherency.rowRange(0, 3).setTo(0.25);
+		return { { "Energy", energy }, { "Orientation", orientation }, { "Coherency", coherency } };
+	}
+
+	std::vector<uint8_t> readBytes(const std::string& path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	void writeBytes(const std::string& path, const std::vector<uint8_t>& bytes)
+	{
+		std::ofstream out(path, std::ios::binary);
+		out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	}
+
+	// Largest difference between a decoded channel and the map it was written from, and the
+	// bound promised by its encoding
+	void expectWithinBound(const cv::Mat& map, const cv::Mat& decoded, TensorFieldFile::ENCODING encoding)
+	{
+		cv::Mat expected;
+		map.convertTo(expected, CV_32F);
+		ASSERT_EQ(expected.size(), decoded.size());
+		ASSERT_EQ(CV_32FC1, decoded.type());
+
+		double minimum = 0, maximum = 0;
+		cv::minMaxLoc(expected, &minimum, &maximum);
+		for (int y = 0; y < expected.rows; y++)
+		{
+			for (int x = 0; x < expected.cols; x++)
+			{
+				const double value = expected.at<float>(y, x);
+				const double error = std::abs(decoded.at<float>(y, x) - value);
+				switch (encoding)
+				{
+				case TensorFieldFile::ENCODING::FLOAT32:
+					ASSERT_EQ(0, error);
+					break;
+				case TensorFieldFile::ENCODING::FLOAT16:
+					// Relative over the normal range, whose smallest value is 2^-14
+					ASSERT_LE(error, std::max(std::abs(value), std::ldexp(1.0, -14)) * std::ldexp(1.0, -11));
+					break;
+				case TensorFieldFile::ENCODING::QUANT16:
+					// The bound of the encoding, plus the float rounding of scale and offset
+					ASSERT_LE(error, (maximum - minimum) / 131070 * (1 + 1e-3) +
+						1e-6 * std::max(std::abs(minimum), std::abs(maximum)));
+					break;
+				}
+			}
+		}
+	}
+
+	const std::vector<TensorFieldFile::ENCODING> encodings = {
+		TensorFieldFile::ENCODING::FLOAT32,
+		TensorFieldFile::ENCODING::FLOAT16,
+		TensorFieldFile::ENCODING::QUANT16
+	};
+
+	int storedDepth(TensorFieldFile::ENCODING encoding)
+	{
+		return encoding == TensorFieldFile::ENCODING::FLOAT32 ? CV_32F
+			: encoding == TensorFieldFile::ENCODING::FLOAT16 ? CV_16F : CV_16U;
+	}
+}
+
+TEST(TensorFieldFile, RoundTripsEveryEncoding)
+{
+	const std::vector<TensorFieldFile::Channel> channels = testChannels();
+	for (TensorFieldFile::ENCODING encoding : encodings)
+	{
+		SCOPED_TRACE("encoding " + std::to_string(static_cast<int>(encoding)));
+		TemporaryFile file(".stf");
+		TensorFieldFile::write(file.path, channels, encoding, stripRows);
+
+		const TensorFieldFile field(file.path);
+		EXPECT_EQ(mapSize, field.size());
+		EXPECT_EQ(stripRows, field.stripRows());
+		EXPECT_EQ(3, field.stripCount());
+		ASSERT_EQ(static_cast<int>(channels.size()), field.channelCount());
+		EXPECT_EQ(-1, field.channelIndex("Missing"));
+
+		for (int c = 0; c < field.channelCount(); c++)
+		{
+			SCOPED_TRACE(channels[c].name);
+			EXPECT_EQ(channels[c].name, field.channelName(c));
+			EXPECT_EQ(c, field.channelIndex(channels[c].name));
+			EXPECT_EQ(encoding, field.encoding(c));
+
+			const cv::Mat raw = field.raw(c);
+			EXPECT_EQ(storedDepth(encoding), raw.type());
+			EXPECT_EQ(mapSize, raw.size());
+
+			const cv::Mat decoded = field.decode(channels[c].name);
+			expectWithinBound(channels[c].map, decoded, encoding);
+
+			// Strips are bands of the whole channel and decode to the same values
+			for (int s = 0; s < field.stripCount(); s++)
+			{
+				const cv::Mat strip = field.strip(c, s);
+				const cv::Range rows(s * stripRows, std::min((s + 1) * stripRows, mapSize.height));
+				ASSERT_EQ(rows.size(), strip.rows);
+				EXPECT_EQ(0, cv::norm(decoded.rowRange(rows), field.decode(c, strip), cv::NORM_INF));
+			}
+		}
+	}
+}
+
+TEST(TensorFieldFile, QuantizesConstantMapsExactly)
+{
+	TemporaryFile file(".stf");
+	const cv::Mat constant(mapSize, CV_32F, cv::Scalar(-2.5));
+	TensorFieldFile::write(file.path, { { "Constant", constant } }, TensorFieldFile::ENCODING::QUANT16);
+	EXPECT_EQ(0, cv::norm(constant, TensorFieldFile(file.path).decode(0), cv::NORM_INF));
+}
+
+TEST(TensorFieldFile, ViewsOutliveTheFileObject)
+{
+	TemporaryFile file(".stf");
+	const std::vector<TensorFieldFile::Channel> channels = testChannels();
+	TensorFieldFile::write(file.path, channels, TensorFieldFile::ENCODING::FLOAT32, stripRows);
+
+	cv::Mat decoded;
+	cv::Mat strip;
+	{
+		const TensorFieldFile field(file.path);
+		decoded = field.decode(0);
+		strip = field.strip(0, 1);
+	}
+	EXPECT_EQ(0, cv::norm(channels[0].map, decoded, cv::NORM_INF));
+	EXPECT_EQ(0, cv::norm(channels[0].map.rowRange(stripRows, 2 * stripRows), strip, cv::NORM_INF));
+}
+
+TEST(TensorFieldFile, ReplacesExistingFiles)
+{
+	TemporaryFile file(".stf");
+	const cv::Mat first(mapSize, CV_32F, cv::Scalar(1));
+	const cv::Mat second(mapSize, CV_32F, cv::Scalar(2));
+	TensorFieldFile::write(file.path, { { "First", first } }, TensorFieldFile::ENCODING::FLOAT32);
+	TensorFieldFile::write(file.path, { { "Second", second }, { "Third", second } }, TensorFieldFile::ENCODING::FLOAT32);
+
+	const TensorFieldFile field(file.path);
+	ASSERT_EQ(2, field.channelCount());
+	EXPECT_EQ(-1, field.channelIndex("First"));
+	EXPECT_EQ(0, cv::norm(second, field.decode("Second"), cv::NORM_INF));
+	EXPECT_FALSE(std::ifstream(file.path + ".partial").good());
+}
+
+TEST(TensorFieldFile, RejectsInvalidChannels)
+{
+	TemporaryFile file(".stf");
+	const cv::Mat map(mapSize, CV_32F, cv::Scalar(1));
+	const TensorFieldFile::ENCODING encoding = TensorFieldFile::ENCODING::FLOAT32;
+	EXPECT_THROW(TensorFieldFile::write(file.path, {}, encoding), std::invalid_argument);
+	EXPECT_THROW(TensorFieldFile::write(file.path, { { "A", map }, { "B", map.rowRange(1, 5) } }, encoding),
+		std::invalid_argument);
+	EXPECT_THROW(TensorFieldFile::write(file.path, { { std::string(32, 'n'), map } }, encoding), std::invalid_argument);
+	EXPECT_THROW(TensorFieldFile::write(file.path, { { "A", map } }, encoding, 0), std::invalid_argument);
+
+	TensorFieldFile::write(file.path, { { "A", map } }, encoding);
+	EXPECT_THROW(TensorFieldFile(file.path).decode("B"), std::out_of_range);
+}
+
+TEST(TensorFieldFile, RejectsCorruptFiles)
+{
+	TemporaryFile file(".stf");
+	TensorFieldFile::write(file.path, testChannels(), TensorFieldFile::ENCODING::FLOAT16, stripRows);
+	const std::vector<uint8_t> bytes = readBytes(file.path);
+
+	// The channel table offset is the 64-bit field at byte 32 of the header; the strip index
+	// follows the 64-byte channel records
+	uint64_t channelTableOffset = 0;
+	std::memcpy(&channelTableOffset, bytes.data() + 32, sizeof(channelTableOffset));
+	const size_t firstStrip = static_cast<size_t>(channelTableOffset) + 64 * 3;
+	uint64_t stripOffset = 0;
+	std::memcpy(&stripOffset, bytes.data() + firstStrip, sizeof(stripOffset));
+
+	auto corrupted = [&](size_t at, uint64_t value)
+	{
+		std::vector<uint8_t> copy = bytes;
+		std::memcpy(copy.data() + at, &value, sizeof(value));
+		writeBytes(file.path, copy);
+		return file.path;
+	};
+
+	// Offsets that wrap around when their size is added
+	EXPECT_THROW(TensorFieldFile(corrupted(firstStrip, ~uint64_t(0) - 15)), std::runtime_error);
+	EXPECT_THROW(TensorFieldFile(corrupted(32, ~uint64_t(0) - 63)), std::runtime_error);
+	// A strip inside the file but not aligned to its elements
+	EXPECT_THROW(TensorFieldFile(corrupted(firstStrip, stripOffset + 1)), std::runtime_error);
+
+	std::vector<uint8_t> truncated(bytes.begin(), bytes.end() - 1);
+	writeBytes(file.path, truncated);
+	EXPECT_THROW(TensorFieldFile(file.path), std::runtime_error);
+
+	writeBytes(file.path, bytes);
+	EXPECT_NO_THROW(TensorFieldFile(file.path));
+}
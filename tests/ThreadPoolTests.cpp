@@ -0,0 +1,232 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "ThreadPool.h"
+
+namespace
+{
+	// 1 to N workers, N covering the machine without making the suite slow on large hosts
+	std::vector<int> workerCounts()
+	{
+		const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+		const int most = std::max(2, std::min(8, hardware));
+		std::vector<int> counts;
+		for (int threads = 1; threads <= most; threads++)
+		{
+			counts.push_back(threads);
+		}
+		return counts;
+	}
+
+	// Busy work of very uneven cost, so that participants finish their blocks at different times
+	void spin(int i)
+	{
+		volatile double sum = 0;
+		const int steps = i % 97 == 0 ? 20000 : 10;
+		for (int k = 0; k < steps; k++)
+		{
+			sum = sum + k;
+		}
+	}
+}
+
+TEST(ThreadPool, ParallelForVisitsEveryIndexOnce)
+{
+	for (int threads : workerCounts())
+	{
+		for (bool pinned : { false, true })
+		{
+			SCOPED_TRACE(std::to_string(threads) + (pinned ? " pinned workers" : " workers"));
+			ThreadPool pool(threads, pinned);
+			ASSERT_EQ(threads, pool.size());
+			for (int repeat = 0; repeat < 50; repeat++)
+			{
+				std::vector<std::atomic<int>> hits(1000);
+				pool.parallelFor(-5, 995, [&](int i)
+				{
+					hits[i + 5]++;
+					spin(i);
+				});
+				for (const std::atomic<int>& hit : hits)
+				{
+					ASSERT_EQ(1, hit.load());
+				}
+			}
+		}
+	}
+}
+
+TEST(ThreadPool, RangesSmallerThanThePool)
+{
+	ThreadPool pool(4);
+	int calls = 0;
+	pool.parallelFor(3, 3, [&](int) { calls++; });
+	pool.parallelFor(5, 2, [&](int) { calls++; });
+	EXPECT_EQ(0, calls);
+
+	std::atomic<int> sum{ 0 };
+	pool.parallelFor(7, 9, [&](int i) { sum += i; });
+	EXPECT_EQ(15, sum.load());
+}
+
+TEST(ThreadPool, NestedLoopsDoNotDeadlock)
+{
+	for (int threads : workerCounts())
+	{
+		SCOPED_TRACE(std::to_string(threads) + " workers");
+		ThreadPool pool(threads);
+
+		// Every outer iteration runs a loop of its own while all the workers are busy
+		std::vector<std::atomic<int64_t>> sums(64);
+		pool.parallelFor(0, 64, [&](int outer)
+		{
+			pool.parallelFor(0, 100, [&](int inner)
+			{
+				sums[outer] += inner;
+				spin(inner);
+			});
+		});
+		for (const std::atomic<int64_t>& sum : sums)
+		{
+			EXPECT_EQ(4950, sum.load());
+		}
+
+		// Three levels, started from queued tasks as well as from the calling thread
+		std::atomic<int> leaves{ 0 };
+		std::atomic<int> finished{ 0 };
+		for (int task = 0; task < 8; task++)
+		{
+			pool.enqueue([&]
+			{
+				pool.parallelFor(0, 4, [&](int)
+				{
+					pool.parallelFor(0, 4, [&](int) { pool.parallelFor(0, 4, [&](int) { leaves++; }); });
+				});
+				finished++;
+			});
+		}
+		pool.parallelFor(0, 4, [&](int) { pool.parallelFor(0, 16, [&](int) { leaves++; }); });
+		while (finished < 8)
+		{
+			std::this_thread::yield();
+		}
+		EXPECT_EQ(8 * 64 + 64, leaves.load());
+	}
+}
+
+TEST(ThreadPool, ParallelForRethrowsAfterEveryCallReturned)
+{
+	for (int threads : workerCounts())
+	{
+		SCOPED_TRACE(std::to_string(threads) + " workers");
+		ThreadPool pool(threads);
+
+		std::atomic<int> running{ 0 };
+		EXPECT_THROW(pool.parallelFor(0, 1000, [&](int i)
+		{
+			running++;
+			spin(i);
+			if (i % 100 == 42)
+				throw std::runtime_error("body failed");
+			running--;
+		}), std::runtime_error);
+		// Only the calls that threw are still counted: every other one has returned
+		EXPECT_GE(running.load(), 1);
+		EXPECT_LE(running.load(), 10);
+
+		// Exceptions of inner loops reach the outer caller
+		EXPECT_THROW(pool.parallelFor(0, 16, [&](int outer)
+		{
+			pool.parallelFor(0, 16, [&](int inner)
+			{
+				if (outer == 5 && inner == 7)
+					throw std::logic_error("inner failed");
+			});
+		}), std::logic_error);
+
+		// The pool stays usable
+		std::atomic<int> count{ 0 };
+		pool.parallelFor(0, 500, [&](int) { count++; });
+		EXPECT_EQ(500, count.load());
+	}
+}
+
+TEST(ThreadPool, DestructorFinishesQueuedTasks)
+{
+	for (int threads : workerCounts())
+	{
+		std::atomic<int> done{ 0 };
+		{
+			ThreadPool pool(threads);
+			for (int task = 0; task < 1000; task++)
+			{
+				pool.enqueue([&, task] { spin(task); done++; });
+			}
+		}
+		EXPECT_EQ(1000, done.load());
+	}
+}
+
+TEST(ThreadPool, StatisticsCountTasks)
+{
+	ThreadPool pool(3);
+	std::atomic<int> done{ 0 };
+	for (int task = 0; task < 300; task++)
+	{
+		pool.enqueue([&] { done++; });
+	}
+	while (done < 300)
+	{
+		std::this_thread::yield();
+	}
+
+	// A worker counts a task after it has returned, so the last ones may show up a little later
+	auto countedTasks = [&]
+	{
+		int64_t tasks = 0;
+		for (const ThreadPool::WorkerStatistics& worker : pool.statistics())
+		{
+			EXPECT_GE(worker.busySeconds, 0);
+			tasks += worker.tasks;
+		}
+		return tasks;
+	};
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (countedTasks() < 300 && std::chrono::steady_clock::now() < deadline)
+	{
+		std::this_thread::yield();
+	}
+	EXPECT_EQ(3u, pool.statistics().size());
+	EXPECT_EQ(300, countedTasks());
+
+	pool.resetStatistics();
+	for (const ThreadPool::WorkerStatistics& worker : pool.statistics())
+	{
+		EXPECT_EQ(0, worker.tasks);
+		EXPECT_EQ(0, worker.steals);
+	}
+}
+
+TEST(ThreadPool, ForEachWithoutPoolIsSerial)
+{
+	std::vector<int> order;
+	ThreadPool::forEach(nullptr, 2, 6, [&](int i) { order.push_back(i); });
+	EXPECT_EQ((std::vector<int>{ 2, 3, 4, 5 }), order);
+}
+
+TEST(ThreadPool, NumaNodesCoverTheCpus)
+{
+	const std::vector<std::vector<int>> nodes = ThreadPool::numaNodes();
+	ASSERT_FALSE(nodes.empty());
+	size_t cpus = 0;
+	for (const std::vector<int>& node : nodes)
+	{
+		cpus += node.size();
+	}
+	EXPECT_GE(cpus, 1u);
+}